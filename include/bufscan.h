@@ -0,0 +1,28 @@
+/** \file bufscan.h
+ \brief classify message data for 8bit characters and line lengths
+ */
+#ifndef BUFSCAN_H
+#define BUFSCAN_H
+
+#include <sys/types.h>
+
+#define BUFSCAN_8BIT	1	/**< buffer contains bytes with the high bit set */
+#define BUFSCAN_NUL	2	/**< buffer contains NUL bytes */
+
+/**
+ * @brief result of scan_buffer()
+ *
+ * CR, LF, and CRLF are all accepted as line ends. Line lengths never include
+ * the line end. A line at the end of the buffer without line end is counted.
+ */
+struct bufscan {
+	unsigned int flags;	/**< logical or of BUFSCAN_8BIT and BUFSCAN_NUL */
+	size_t hdrmaxline;	/**< length of the longest line in the header */
+	size_t maxline;		/**< length of the longest line in the body */
+	size_t headerend;	/**< offset of the line end of the empty line terminating the header, length of buffer if none */
+};
+
+extern void scan_buffer(const char *buf, const size_t len, struct bufscan *res) __attribute__ ((nonnull (3)));
+extern int has_8bit(const char *buf, const size_t len);
+
+#endif
@@ -1,11 +1,76 @@
 /** \file cdb.h
- \brief headers of function to read from CDB database
+ \brief headers of functions to read from and write to CDB databases
  */
 #ifndef CDB_H
 #define CDB_H
 
+#include <stdint.h>
 #include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
 
+#define CDB_HEADER	2048		/**< size of the table of hash tables at the start of the file */
+
+/**
+ * @brief a CDB database mapped into memory
+ *
+ * The object keeps the file mapped between lookups. cdb_open() only checks
+ * if the file has been replaced since it was mapped, so it is cheap to call
+ * it before every lookup.
+ *
+ * The members are private to cdb.c, initialize the object with CDB_INIT.
+ */
+struct cdb {
+	const char *map;		/**< the mapped file, NULL if no file or an empty file is open */
+	uint32_t size;			/**< size of the mapping */
+	int opened;			/**< if a file is open */
+	dev_t dev;			/**< device of the open file */
+	ino_t ino;			/**< inode of the open file */
+	struct timespec mtime;		/**< modification time of the open file */
+	/* state of the last search */
+	const char *key;		/**< the key searched for */
+	unsigned int klen;		/**< length of key */
+	uint32_t khash;			/**< hash of key */
+	uint32_t hpos;			/**< position of the hash table for key */
+	uint32_t hslots;		/**< number of slots in that hash table */
+	uint32_t kslot;			/**< next slot to check */
+	uint32_t loop;			/**< number of slots already checked */
+};
+
+#define CDB_INIT { .map = NULL, .size = 0, .opened = 0 }
+
+extern int cdb_open(struct cdb *c, int dirfd, const char *fname) __attribute__ ((nonnull (1, 3)));
+extern int cdb_find(struct cdb *c, const char *key, unsigned int klen, const char **data, uint32_t *dlen)
+		__attribute__ ((nonnull (1, 2, 4, 5)));
+extern int cdb_findnext(struct cdb *c, const char **data, uint32_t *dlen) __attribute__ ((nonnull (1, 2, 3)));
+extern void cdb_close(struct cdb *c) __attribute__ ((nonnull (1)));
+
+extern uint32_t cdb_hash(const char *buf, unsigned int len) __attribute__ ((pure));
 extern const char *cdb_seekmm(int, const char *, unsigned int, char **, const struct stat *);
 
+/** @brief hash table entry of a record written by cdb_make_add() */
+struct cdb_hp {
+	uint32_t h;			/**< hash of the key */
+	uint32_t pos;			/**< position of the record in the file */
+};
+
+/**
+ * @brief state of a CDB database being written
+ */
+struct cdb_make {
+	int fd;				/**< descriptor of the output file */
+	uint32_t pos;			/**< position of the next record */
+	struct cdb_hp *hp;		/**< hash and position of all records */
+	uint32_t num;			/**< number of records */
+	uint32_t alloc;			/**< number of entries allocated in hp */
+	size_t buflen;			/**< amount of data in buf */
+	char buf[4096];			/**< output buffer */
+};
+
+extern int cdb_make_start(struct cdb_make *cm, int fd) __attribute__ ((nonnull (1)));
+extern int cdb_make_add(struct cdb_make *cm, const char *key, unsigned int klen, const char *data, unsigned int dlen)
+		__attribute__ ((nonnull (1, 2)));
+extern int cdb_make_finish(struct cdb_make *cm) __attribute__ ((nonnull (1)));
+extern int cdb_make_abort(struct cdb_make *cm) __attribute__ ((nonnull (1)));
+
 #endif
@@ -17,6 +17,8 @@ extern size_t loadonelinerfd(int fd, char **buf) __attribute__ ((nonnull (2)));
 extern int loadlistfd(int, char ***, checkfunc) __attribute__ ((nonnull (2)));
 extern int finddomainfd(int, const char *, const int) __attribute__ ((nonnull (2)));
 extern int finddomain(const char *buf, const off_t size, const char *domain) __attribute__ ((nonnull (3)));
+extern int makedomainidx(const char *buf, const off_t size, int fd);
+extern int loaddomainidx(const char *buf, int dirfd, const char *fname) __attribute__ ((nonnull (3)));
 
 extern char **data_array(unsigned int entries, size_t datalen, void *oldbuf, size_t oldlen);
 
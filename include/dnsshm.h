@@ -0,0 +1,68 @@
+/** \file dnsshm.h
+ \brief headers of the DNS cache shared between processes
+
+ The shared cache is a file that is mapped into memory by every process using
+ it. It starts with a struct dnsshm_header followed by a fixed number of
+ slots of DNSSHM_SLOTSIZE bytes. A slot is selected by the hash of the record
+ type and the name, collisions are resolved by checking the following
+ DNSSHM_PROBES slots.
+
+ Every slot is protected by a sequence counter: a writer atomically changes
+ the counter from an even to an odd value before modifying the slot and
+ increments it again afterwards. A reader copies the slot contents and checks
+ that the counter was even and did not change in between, otherwise the entry
+ is treated as not cached. Readers never wait. A writer that finds a slot
+ locked waits at most DNSSHM_LOCKWAIT milliseconds for the lock to change. If
+ it does not the previous writer is assumed to have died and the lock is taken
+ over.
+
+ The cached answers are used without further validation, so every user has a
+ cache file of its own: Qsmtpd, which handles data from the network, must not
+ be able to modify the MX and TLSA records Qremote uses for delivery. A cache
+ file is only used if it is owned by the user of the process and is not
+ writable by anyone else.
+ */
+#ifndef DNSSHM_H
+#define DNSSHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DNSSHM_MAGIC	"QSdnsc"	/**< magic string at the start of the cache file */
+#define DNSSHM_VERSION	1		/**< current version of the cache file format */
+#define DNSSHM_SLOTS	2048		/**< number of slots in a newly created cache file */
+#define DNSSHM_SLOTSIZE	2048		/**< size of one slot in bytes */
+#define DNSSHM_PROBES	4		/**< number of slots checked for a name */
+#define DNSSHM_LOCKWAIT	100		/**< milliseconds to wait for a locked slot before taking it over */
+#define DNSSHM_FILE	"dnscache"	/**< name of the cache file of Qsmtpd in the qmail directory */
+#define DNSSHM_REMOTE_FILE	"dnscache-remote"	/**< name of the cache file of Qremote in the qmail directory */
+
+/** @enum dnscache_type
+ * @brief the record type of a cached lookup
+ */
+enum dnscache_type {
+	DNSCACHE_A = 1,		/**< result of dnsip4() */
+	DNSCACHE_AAAA = 2,	/**< result of dnsip6() */
+	DNSCACHE_MX = 3,	/**< result of dnsmx() */
+	DNSCACHE_TXT = 4,	/**< result of dnstxt() */
+	DNSCACHE_PTR = 5,	/**< result of dnsname() */
+	DNSCACHE_TLSA = 6	/**< answer packet of a TLSA query */
+};
+
+/**
+ * @brief header of the cache file
+ */
+struct dnsshm_header {
+	char magic[8];		/**< DNSSHM_MAGIC, padded with 0 bytes */
+	uint32_t version;	/**< DNSSHM_VERSION */
+	uint32_t slots;		/**< number of slots in the file */
+	uint32_t slotsize;	/**< DNSSHM_SLOTSIZE */
+	uint32_t reserved;	/**< unused, always 0 */
+};
+
+extern int dnsshm_open(int dirfd, const char *fname) __attribute__ ((nonnull (2)));
+extern void dnsshm_close(void);
+extern int dnsshm_get(const enum dnscache_type type, const char *name, char **out, size_t *len, int *negative) __attribute__ ((nonnull (2,3,4,5)));
+extern void dnsshm_put(const enum dnscache_type type, const char *name, const int negative, const char *data, const size_t len, const unsigned int ttl) __attribute__ ((nonnull (2)));
+
+#endif
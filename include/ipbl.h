@@ -0,0 +1,22 @@
+/** \file ipbl.h
+ \brief definitions of the sorted IP match file format
+
+ A sorted IP match file starts with a header of IPBL_HEADERLEN bytes: the
+ magic string IPBL_MAGIC, the format version and the length of an address in
+ bytes (4 or 16). It is followed by address ranges, each consisting of the
+ first and the last address of the range in network byte order. The ranges are
+ sorted in ascending order and do not overlap, so lookups can be done using a
+ binary search.
+
+ Files not starting with the magic string are lists of address and netmask
+ length records as written by older versions of addipbl.
+ */
+#ifndef IPBL_H
+#define IPBL_H
+
+#define IPBL_MAGIC	"QSipbl"	/**< magic string at the start of a sorted file */
+#define IPBL_MAGICLEN	6		/**< length of IPBL_MAGIC */
+#define IPBL_VERSION	1		/**< current version of the sorted file format */
+#define IPBL_HEADERLEN	8		/**< length of the header of a sorted file */
+
+#endif
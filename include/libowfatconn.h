@@ -8,10 +8,21 @@
 
 struct in6_addr;
 
-extern int dnsip4(char **out, size_t *len, const char *host) __attribute__ ((nonnull (1,2,3)));
-extern int dnsip6(char **out, size_t *len, const char *host) __attribute__ ((nonnull (1,2,3)));
-extern int dnstxt(char **, const char *) __attribute__ ((nonnull (1,2)));
-extern int dnsmx(char **out, size_t *len, const char *host) __attribute__ ((nonnull (1,2,3)));
-extern int dnsname(char **, const struct in6_addr *) __attribute__ ((nonnull (1,2)));
+/**
+ * @brief result of a single lookup done by dnsip4_parallel()
+ */
+struct dnsip4_result {
+	int status;		/**< number of addresses found or negative error code */
+	char *out;		/**< the addresses found, memory is malloced */
+	size_t len;		/**< length of out */
+	unsigned int ttl;	/**< lifetime of the result in seconds */
+};
+
+extern int dnsip4(char **out, size_t *len, const char *host, unsigned int *ttl) __attribute__ ((nonnull (1,2,3,4)));
+extern int dnsip6(char **out, size_t *len, const char *host, unsigned int *ttl) __attribute__ ((nonnull (1,2,3,4)));
+extern int dnstxt(char **, const char *, unsigned int *ttl) __attribute__ ((nonnull (1,2,3)));
+extern int dnsmx(char **out, size_t *len, const char *host, unsigned int *ttl) __attribute__ ((nonnull (1,2,3,4)));
+extern int dnsname(char **, const struct in6_addr *, unsigned int *ttl) __attribute__ ((nonnull (1,2,3)));
+extern int dnsip4_parallel(const char *const *hosts, const unsigned int count, struct dnsip4_result *results, const unsigned int timeout) __attribute__ ((nonnull (1,3)));
 
 #endif
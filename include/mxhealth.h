@@ -0,0 +1,59 @@
+/** \file mxhealth.h
+ \brief headers of the persistent MX host health database
+
+ The database is a directory with one small file per remote IP address, the
+ file name is the textual form of the address. Every file contains a single
+ struct mxhealth_record. Writers hold an exclusive flock() on the file while
+ they read, modify and write the record, readers hold a shared one. Records
+ that were not updated for MXHEALTH_EXPIRE seconds are removed by the writer
+ that first notices that the file MXHEALTH_STAMP is older than
+ MXHEALTH_CLEANUP seconds.
+ */
+#ifndef MXHEALTH_H
+#define MXHEALTH_H
+
+#include <qdns.h>
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <time.h>
+
+#define MXHEALTH_DIR		"mxhealth"	/**< name of the database directory in the qmail directory */
+#define MXHEALTH_VERSION	1		/**< current version of the record format */
+#define MXHEALTH_BACKOFF	60		/**< backoff time in seconds after the first failure */
+#define MXHEALTH_MAXBACKOFF	(4 * 3600)	/**< maximum backoff time in seconds */
+#define MXHEALTH_EXPIRE		(24 * 3600)	/**< failures older than this many seconds are forgotten */
+#define MXHEALTH_CLEANUP	3600		/**< interval in seconds in which expired records are removed */
+#define MXHEALTH_STAMP		".cleanup"	/**< file in the database directory with the time of the last cleanup */
+
+/** @enum mxhealth_reason
+ * @brief the result of a delivery attempt to a host
+ */
+enum mxhealth_reason {
+	MXHEALTH_OK = 0,	/**< the connection was established and the greeting was accepted */
+	MXHEALTH_CONNECT,	/**< the connection was refused or the host is unreachable */
+	MXHEALTH_TIMEOUT,	/**< the connection was not established in time */
+	MXHEALTH_RESET,		/**< the connection was reset before the greeting was complete */
+	MXHEALTH_GREETING	/**< the greeting was invalid or not a 220 reply */
+};
+
+/**
+ * @brief the state of one remote host as stored on disk
+ */
+struct mxhealth_record {
+	uint32_t version;	/**< MXHEALTH_VERSION */
+	uint32_t reason;	/**< enum mxhealth_reason of the last failure */
+	uint32_t failures;	/**< number of failures since the last success */
+	uint32_t rtt;		/**< time in milliseconds it took to connect on the last success */
+	int64_t lastfailure;	/**< time of the last failure */
+	int64_t lastsuccess;	/**< time of the last success */
+};
+
+extern int mxhealth_open(int dirfd, const char *dirname) __attribute__ ((nonnull (2)));
+extern void mxhealth_close(void);
+extern int mxhealth_get(const struct in6_addr *addr, struct mxhealth_record *rec) __attribute__ ((nonnull (1,2)));
+extern time_t mxhealth_backoff(const struct mxhealth_record *rec, const time_t now) __attribute__ ((nonnull (1)));
+extern void mxhealth_report(const struct in6_addr *addr, const enum mxhealth_reason reason, const unsigned int rtt) __attribute__ ((nonnull (1)));
+extern void mxhealth_sort(struct ips **p) __attribute__ ((nonnull (1)));
+
+#endif
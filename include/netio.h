@@ -13,16 +13,21 @@
 extern struct string linein;
 
 extern int net_read(const int fatal);
+extern int net_readview(cstring *line, const int fatal) __attribute__ ((nonnull (1)));
 extern int net_writen(const char *const *) __attribute__ ((nonnull (1)));
 extern int net_write_multiline(const char *const *) __attribute__ ((nonnull (1)));
 static inline int netwrite(const char *) __attribute__ ((nonnull (1)));
 extern int netnwrite(const char *, const size_t) __attribute__ ((nonnull (1)));
 extern size_t net_readbin(size_t, char *) __attribute__ ((nonnull (2)));
 extern size_t net_readline(size_t, char *) __attribute__ ((nonnull (2)));
+extern size_t net_readbody(const char **, size_t *) __attribute__ ((nonnull (1, 2)));
 extern int data_pending(void);
+extern size_t net_buffered(const char **buf) __attribute__ ((nonnull (1)));
+extern int net_flush(void);
 
 extern time_t timeout;
 extern int socketd;
+extern int net_batching;
 
 enum conn_shutdown_type {
 	shutdown_clean,		/**< do a normal shutdown and notify the partner about the shutdown */
@@ -47,7 +47,11 @@ struct ips {
 extern int ask_dnsmx(const char *, struct ips **) __attribute__ ((nonnull (1,2)));
 extern int ask_dnsaaaa(const char *, struct in6_addr **) __attribute__ ((nonnull (1,2)));
 extern int ask_dnsa(const char *, struct in6_addr **) __attribute__ ((nonnull (1)));
+extern int ask_dnsa_parallel(const char *const *names, const unsigned int count, int *results) __attribute__ ((nonnull (1,3)));
 extern int ask_dnsname(const struct in6_addr *, char **) __attribute__ ((nonnull (1,2)));
+extern int ask_dnstxt(char **out, const char *name) __attribute__ ((nonnull (1,2)));
+extern void dnscache_stats(unsigned long *hits, unsigned long *misses) __attribute__ ((nonnull (1,2)));
+extern void dnscache_clear(void);
 
 /* lib/dnshelpers.c */
 
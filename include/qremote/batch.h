@@ -0,0 +1,54 @@
+/** \file batch.h
+ \brief job lists for sending several messages over one connection with Qremote
+ */
+#ifndef QREMOTE_BATCH_H
+#define QREMOTE_BATCH_H
+
+#include <stddef.h>
+
+/**
+ * @brief one message of a job list
+ */
+struct batch_job {
+	const char *msgfile;	/**< name of the file containing the message */
+	const char *sender;	/**< envelope sender address */
+	char **rcpts;		/**< envelope recipient addresses */
+	int rcptcount;		/**< number of entries in rcpts */
+};
+
+/**
+ * @brief split a job list into jobs
+ * @param buf the job list, will be referenced by the jobs
+ * @param len length of buf
+ * @param jobs the jobs are returned here, free() it when done
+ * @return number of jobs in the list
+ * @retval -EINVAL the job list is malformed
+ * @retval -ENOMEM out of memory
+ *
+ * Every job consists of the name of the message file, the envelope sender,
+ * and one or more envelope recipients, each terminated by a 0 byte. The
+ * recipient list of a job is terminated by an additional 0 byte. The sender
+ * is empty for bounces.
+ */
+extern int batch_parse(char *buf, const size_t len, struct batch_job **jobs) __attribute__ ((nonnull (1, 3)));
+
+/**
+ * @brief read and parse a job list
+ * @param fd the descriptor to read the list from
+ * @param buf the list is read into this buffer, free() it when done
+ * @param jobs the jobs are returned here, free() it when done
+ * @return number of jobs in the list or negative error code
+ */
+extern int batch_read(int fd, char **buf, struct batch_job **jobs) __attribute__ ((nonnull (2, 3)));
+
+/**
+ * @brief report the jobs that were not attempted as temporary failures
+ * @param first index of the first job that was not attempted
+ * @param count number of jobs in the list
+ *
+ * One message report is written for every job from first to count - 1, so
+ * the caller gets a complete report for every job of the list.
+ */
+extern void batch_report_skipped(const int first, const int count);
+
+#endif
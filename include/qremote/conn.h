@@ -4,13 +4,17 @@
 #ifndef CONN_H
 #define CONN_H
 
+#include <mxhealth.h>
 #include <qdns.h>
 
 #include <netinet/in.h>
 
 extern unsigned int targetport;	/**< the port on the destination host to connect to */
+extern unsigned int connect_timeout;	/**< seconds to wait until a connection is established */
+extern unsigned int connect_delay;	/**< milliseconds to wait before the next address is tried in parallel */
 
 extern int tryconn(struct ips *mx, const struct in6_addr *outip4, const struct in6_addr *outip6);
+extern void tryconn_report(const enum mxhealth_reason reason);
 
 /**
  * @brief establish a connection to a MX
@@ -0,0 +1,76 @@
+/** \file pool.h
+ \brief headers of the connection pool daemon and its protocol
+
+ Qpoold keeps SMTP connections that Qremote has finished with, so the next
+ Qremote process sending to the same host can skip connection setup and the
+ greeting of the remote server. Only unencrypted connections can be pooled,
+ the state of a TLS session can't be passed to another process. As nearly all
+ public servers offer STARTTLS this is only done for routes that explicitly
+ allow it, i.e. relays that do not offer STARTTLS.
+
+ Every request is a single message on a new connection to the unix socket
+ POOL_SOCKET. It consists of a struct pool_request, directly followed by
+ count addresses of the remote host.
+
+ To return a connection Qremote sends a POOL_PUT request with the address of
+ the remote host and passes the connection as SCM_RIGHTS ancillary data of
+ the same message. There is no reply. Qpoold only keeps the connection if it
+ is a TCP connection to the given address and port.
+
+ To get a connection Qremote sends a POOL_GET request with the addresses it
+ would connect to, most preferred first. Qpoold replies with a struct
+ pool_reply, the connection is passed as SCM_RIGHTS ancillary data of the
+ reply if one was found.
+
+ The outgoing addresses and the port are part of the key of a connection, a
+ connection is only handed out for a request where they match.
+ */
+#ifndef QREMOTE_POOL_H
+#define QREMOTE_POOL_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <time.h>
+
+#define POOL_SOCKET		"pool/socket"	/**< socket of Qpoold, relative to the qmail directory */
+#define POOL_VERSION		1		/**< current version of the messages */
+#define POOL_MAXADDRS		16		/**< maximum number of addresses in a request */
+#define POOL_MAXCONNS		1024		/**< maximum number of connections kept by Qpoold */
+
+/** @brief type of a request */
+enum pool_op {
+	POOL_GET = 1,	/**< ask for a connection */
+	POOL_PUT = 2	/**< return a connection */
+};
+
+/**
+ * @brief header of a request message
+ */
+struct pool_request {
+	uint32_t version;		/**< POOL_VERSION */
+	uint32_t op;			/**< one of enum pool_op */
+	uint32_t port;			/**< the port on the remote host */
+	uint32_t count;			/**< number of addresses following, 1 for POOL_PUT */
+	struct in6_addr outip4;		/**< local address used for IPv4 connections */
+	struct in6_addr outip6;		/**< local address used for IPv6 connections */
+};
+
+/**
+ * @brief reply to a POOL_GET request
+ */
+struct pool_reply {
+	uint32_t version;		/**< POOL_VERSION */
+	uint32_t index;			/**< index of the address of the connection in the request, count if none was found */
+};
+
+extern int poold_init(const int listenfd, const time_t idle, const unsigned int perhost);
+extern int poold_add(const int ctlfd);
+extern int poold_step(const int maxwait);
+extern unsigned int poold_connections(void);
+
+struct ips;
+
+extern int pool_get(struct ips *mx, const struct in6_addr *outip4, const struct in6_addr *outip6);
+extern void pool_put(void);
+
+#endif
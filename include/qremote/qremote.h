@@ -75,8 +75,10 @@ extern unsigned int smtpext;
 extern string heloname;
 #ifdef CHUNKING
 extern size_t chunksize;
+extern unsigned int chunkwindow;
 #endif
 extern char *clientcertbuf;
+extern int poolroute;
 extern struct in6_addr outgoingip;
 extern struct in6_addr outgoingip6;
 
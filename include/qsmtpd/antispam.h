@@ -10,10 +10,15 @@
 
 extern void dotip6(char *);
 extern int check_rbl(char *const *, char **) __attribute__ ((nonnull (1)));
-extern void tarpit(void);
 extern int domainmatch(const char *fqdn, const size_t len, const char **list);
 extern int lookupipbl(int);
 
+/* qsmtpd/tarpit.c */
+
+extern unsigned long tarpit_handoff_count;
+extern void tarpit(void);
+extern void tarpit_handoff(void);
+
 /* qsmtpd/spf.c */
 
 extern int check_host(const char *);
@@ -0,0 +1,9 @@
+/** \file daemon.h
+ \brief headers of the standalone listener mode of Qsmtpd
+ */
+#ifndef QSMTPD_DAEMON_H
+#define QSMTPD_DAEMON_H
+
+extern int daemon_run(int *argc, char ***argv) __attribute__ ((nonnull (1,2)));
+
+#endif
@@ -0,0 +1,29 @@
+/** \file filtercache.h
+ \brief per-transaction cache of recipient independent filter results
+ */
+#ifndef FILTERCACHE_H
+#define FILTERCACHE_H
+
+#include <stdint.h>
+
+/** @enum filtercache_type
+ * @brief the kind of lookup a cached result belongs to
+ */
+enum filtercache_type {
+	FILTERCACHE_RBL = 1,		/**< result of check_rbl() for a list of RBLs */
+	FILTERCACHE_IPBL = 2,		/**< result of lookupipbl() for a file */
+	FILTERCACHE_NAMEBL = 3,		/**< result of the namebl lookups for a list of blocklists */
+	FILTERCACHE_RSPF = 4		/**< result of check_host() for a rSPF domain */
+};
+
+extern uint64_t filtercache_key_list(char *const *list) __attribute__ ((nonnull (1)));
+extern int filtercache_key_fd(int fd, uint64_t *key) __attribute__ ((nonnull (2)));
+
+extern int filtercache_get(const enum filtercache_type type, const uint64_t key, int *result, char **txt) __attribute__ ((nonnull (3)));
+extern void filtercache_put(const enum filtercache_type type, const uint64_t key, const int result, const char *txt, const int hastxt);
+extern void filtercache_clear(void);
+
+extern int check_rbl_cached(char *const *rbls, char **txt) __attribute__ ((nonnull (1)));
+extern int lookupipbl_cached(int fd);
+
+#endif
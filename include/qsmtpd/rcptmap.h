@@ -0,0 +1,37 @@
+/** \file rcptmap.h
+ \brief format of the compiled recipient map
+
+ The recipient map is a CDB database generated from the vpopmail tree by
+ newrcptmap. It holds everything the vpopmail backend would otherwise find
+ out by looking into the domain and user directories. All keys start with
+ a type character:
+
+ @arg @c "d" domain: the domain is local, the value is the domain flag
+	(one of RCPTMAP_*), the real domain, the domain directory and the
+	file list of the domain directory (each terminated by '\\0'),
+	followed by the lines of the filterconf file of the domain (each
+	terminated by '\\0') and an empty string
+ @arg @c "u" user "@" real domain: a user directory with that name exists,
+	the value is the user directory, the file list and the filterconf
+	lines like for a domain
+ @arg @c "q" suffix "@" real domain: the file .qmail-suffix exists in the
+	domain directory, the value is empty
+
+ The file lists contain the names of all regular files of the directory
+ except the .qmail files, each one followed by '/'. If the directory could
+ not be read the file list is "/" and there are no filterconf lines, the
+ file system has to be asked instead.
+ */
+#ifndef RCPTMAP_H
+#define RCPTMAP_H
+
+#define RCPTMAP_FILE	"users/rcptmap.cdb"	/**< the map, relative to the qmail directory */
+
+#define RCPTMAP_NOCATCHALL	'0'	/**< there is no .qmail-default or it bounces */
+#define RCPTMAP_CATCHALL	'2'	/**< .qmail-default accepts all mail */
+#define RCPTMAP_NODIR		'n'	/**< the domain directory does not exist */
+#define RCPTMAP_NOACCESS	'a'	/**< the domain directory can not be read */
+
+extern int rcptmap_make(int fd, const char *vpopbounce);
+
+#endif
@@ -7,6 +7,7 @@
 
 extern int smtp_starttls(void);
 extern int tls_verify(void);
+extern void tls_load_params(void);
 
 extern char certfilename[];		/**< path to SSL certificate filename */
 
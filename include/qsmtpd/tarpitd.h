@@ -0,0 +1,38 @@
+/** \file tarpitd.h
+ \brief headers of the tarpit daemon and the handoff protocol
+
+ Qsmtpd hands a tarpitted connection to Qtarpitd by connecting to the unix
+ socket TARPIT_SOCKET and sending a single message. The message consists of
+ a struct tarpit_handoff, directly followed by inputlen bytes of input that
+ Qsmtpd has already read from the client but not yet processed. All output is
+ sent by Qsmtpd before. The client connection is passed as
+ SCM_RIGHTS ancillary data of the same message. Only the process owner may
+ hand off connections.
+ */
+#ifndef QSMTPD_TARPITD_H
+#define QSMTPD_TARPITD_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <time.h>
+
+#define TARPIT_SOCKET		"tarpit/socket"	/**< socket of Qtarpitd, relative to the qmail directory */
+#define TARPIT_VERSION		3		/**< current version of the handoff message */
+#define TARPIT_MAXINPUT		1001		/**< maximum length of the unprocessed input */
+
+/**
+ * @brief header of the handoff message
+ */
+struct tarpit_handoff {
+	uint32_t version;			/**< TARPIT_VERSION */
+	uint32_t badcmds;			/**< number of bad commands in a row */
+	uint32_t inputlen;			/**< length of the unprocessed input */
+	char remoteip[INET6_ADDRSTRLEN];	/**< the address of the client for logging */
+};
+
+extern int tarpitd_init(const int listenfd, const char *helo, const time_t idle) __attribute__ ((nonnull (2)));
+extern int tarpitd_add(const int ctlfd);
+extern int tarpitd_step(const int maxwait);
+extern unsigned int tarpitd_connections(void);
+
+#endif
@@ -0,0 +1,44 @@
+/** \file tlstickets.h
+ \brief files used for TLS session resumption of Qsmtpd
+
+ Every connection is handled by a separate process, so a session cache kept
+ in memory would never be used again. Instead clients get stateless session
+ tickets that are encrypted with keys shared by all processes.
+
+ The key file is a sequence of struct tls_ticket_key. New tickets are always
+ encrypted with the first key, the other ones are only used to decrypt the
+ tickets of clients that got them before the keys were rotated. If the file
+ does not exist no tickets are issued.
+
+ If the statistics file exists every Qsmtpd process counts the handshakes
+ there. Both files are maintained by tlsticketkeys.
+ */
+#ifndef QSMTPD_TLSTICKETS_H
+#define QSMTPD_TLSTICKETS_H
+
+#include <stdint.h>
+
+#define TLSTICKET_FILE		"tlsticketkeys"		/**< name of the key file in the control directory */
+#define TLSTICKET_MAXKEYS	3			/**< maximum number of keys in the file */
+#define TLSSTATS_FILE		"tlsstats"		/**< name of the statistics file in the qmail directory */
+#define TLSSTATS_MAGIC		"QStlss"		/**< magic string at the start of the statistics file */
+
+/**
+ * @brief one key of the key file
+ */
+struct tls_ticket_key {
+	unsigned char name[16];		/**< identifies the key, sent to the client in the ticket */
+	unsigned char hmac[32];		/**< HMAC-SHA256 key */
+	unsigned char aes[32];		/**< AES-256 key */
+};
+
+/**
+ * @brief contents of the statistics file
+ */
+struct tls_stats {
+	char magic[8];			/**< TLSSTATS_MAGIC, padded with 0 bytes */
+	uint64_t full;			/**< number of full handshakes */
+	uint64_t resumed;		/**< number of handshakes resuming a session */
+};
+
+#endif
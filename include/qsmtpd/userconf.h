@@ -7,12 +7,47 @@
 #include <control.h>
 #include <sstring.h>
 
+/** @enum config_setting
+ * @brief the settings that can be given in a "filterconf" file
+ */
+enum config_setting {
+	SETTING_BLOCK_SOBERG,		/**< block_SoberG */
+	SETTING_BLOCK_WILDCARDNS,	/**< block_wildcardns */
+	SETTING_CHECK_STRICT_RFC2822,	/**< check_strict_rfc2822 */
+	SETTING_FAIL_HARD_ON_TEMP,	/**< fail_hard_on_temp */
+	SETTING_FORCESTARTTLS,		/**< forcestarttls */
+	SETTING_FROMDOMAIN,		/**< fromdomain */
+	SETTING_HELOVALID,		/**< helovalid */
+	SETTING_NOAPOS,			/**< noapos */
+	SETTING_NOBOUNCE,		/**< nobounce */
+	SETTING_NONEXIST_ON_BLOCK,	/**< nonexist_on_block */
+	SETTING_REJECT_IPV6ONLY,	/**< reject_ipv6only */
+	SETTING_SMTP_SPACE_BUG,		/**< smtp_space_bug */
+	SETTING_SPFPOLICY,		/**< spfpolicy */
+	SETTING_USERSIZE,		/**< usersize */
+	SETTING_WHITELISTAUTH,		/**< whitelistauth */
+	SETTING_COUNT			/**< number of settings, must be the last entry */
+};
+
+/**
+ * @brief the parsed contents of one "filterconf" file
+ */
+struct config_settings {
+	unsigned long present;		/**< bit mask of the settings given in the file */
+	unsigned long invalid;		/**< bit mask of the settings that have no valid number as value */
+	long values[SETTING_COUNT];	/**< the values of the settings given in the file */
+};
+
 struct userconf {
 	string domainpath;		/**< Path of the domain for domain settings */
 	char **userconf;		/**< contents of the "filterconf" file in user directory (or NULL) */
 	char **domainconf;		/**< dito for domain directory */
+	struct config_settings usersettings;	/**< the parsed userconf */
+	struct config_settings domainsettings;	/**< the parsed domainconf */
 	int domaindirfd;		/**< descriptor of the domain settings directory */
 	int userdirfd;			/**< descriptor of the user directory where the user stores it's own settings */
+	const char *userfiles;		/**< names of all files in the user directory, each followed by '/', NULL if unknown */
+	const char *domainfiles;	/**< dito for domain directory */
 };
 
 enum userconf_flags {
@@ -48,6 +83,16 @@ void userconf_free(struct userconf *ds) __attribute__ ((nonnull (1)));
  */
 int userconf_load_configs(struct userconf *ds) __attribute__ ((nonnull (1)));
 
+/**
+ * @brief parse the contents of a "filterconf" file
+ * @param settings the parsed settings are stored here
+ * @param config the lines of the file, may be NULL
+ *
+ * Unknown settings are ignored. If a setting is given more than once the
+ * first entry is used.
+ */
+void config_settings_parse(struct config_settings *settings, const char * const *config) __attribute__ ((nonnull (1)));
+
 /**
  * @brief get a config buffer for a given user or domain
  * @param ds the userconf buffer
@@ -5,13 +5,12 @@
 #define USERFILTERS_H
 
 #include "qsmtpd.h"
+#include <qsmtpd/userconf.h>
 #include <sstring.h>
 
 #include <sys/queue.h>
 #include <sys/types.h>
 
-struct userconf;
-
 /** @enum config_domain
  * @brief describe where the domain a read config value is originating from
  */
@@ -24,6 +23,13 @@ enum config_domain {
 
 extern const char **globalconf;
 
+/**
+ * @brief drop the parsed settings of the global configuration
+ *
+ * This must be called every time globalconf is loaded or freed.
+ */
+extern void globalconf_changed(void);
+
 /**
  * check in user and domain directory if a file with given filename exists
  *
@@ -38,8 +44,8 @@ extern const char **globalconf;
  */
 extern int getfile(const struct userconf *ds, const char *fn, enum config_domain *type, const unsigned int flags);
 
-extern long getsetting(const struct userconf *, const char *, enum config_domain  *);
-extern long getsettingglobal(const struct userconf *, const char *, enum config_domain *);
+extern long getsetting(const struct userconf *, const enum config_setting, enum config_domain *);
+extern long getsettingglobal(const struct userconf *, const enum config_setting, enum config_domain *);
 
 /** @enum filter_result
  * @brief describes the result of a policy filter
@@ -0,0 +1,292 @@
+/** \file bufscan.c
+ \brief classify message data for 8bit characters and line lengths
+
+ The buffers are scanned using SSE2 or AVX2 instructions if the CPU supports
+ them, the best implementation is selected on first use. A portable
+ implementation is used otherwise.
+ */
+
+#include <bufscan.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BUFSCAN_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief the internal state while scanning a buffer
+ */
+struct scanstate {
+	size_t linestart;	/**< offset of the first character of the current line */
+	int in_header;		/**< if the end of the header has not yet been found */
+};
+
+/**
+ * @brief handle a CR or LF found in the buffer
+ * @param buf the buffer being scanned
+ * @param pos offset of the CR or LF
+ * @param st the scanner state
+ * @param res the result is updated here
+ */
+static inline void
+scan_lineend(const char *buf, const size_t pos, struct scanstate *st, struct bufscan *res)
+{
+	size_t llen;
+
+	/* LF of a CRLF pair, the line was already terminated by the CR */
+	if ((buf[pos] == '\n') && (pos > 0) && (buf[pos - 1] == '\r')) {
+		st->linestart = pos + 1;
+		return;
+	}
+
+	llen = pos - st->linestart;
+	st->linestart = pos + 1;
+
+	if (!st->in_header) {
+		if (llen > res->maxline)
+			res->maxline = llen;
+	} else if (llen == 0) {
+		st->in_header = 0;
+		res->headerend = pos;
+	} else if (llen > res->hdrmaxline) {
+		res->hdrmaxline = llen;
+	}
+}
+
+/**
+ * @brief scan the buffer one byte at a time
+ * @param buf the buffer to scan
+ * @param pos offset to start scanning
+ * @param len length of buffer
+ * @param st the scanner state
+ * @param res the result is updated here
+ *
+ * This also accounts for an unterminated last line.
+ */
+static void
+scan_tail(const char *buf, size_t pos, const size_t len, struct scanstate *st, struct bufscan *res)
+{
+	unsigned char acc = 0;
+
+	for (; pos < len; pos++) {
+		const unsigned char c = (unsigned char)buf[pos];
+
+		acc |= c;
+		if (c == 0)
+			res->flags |= BUFSCAN_NUL;
+		else if ((c == '\r') || (c == '\n'))
+			scan_lineend(buf, pos, st, res);
+	}
+
+	if (acc & 0x80)
+		res->flags |= BUFSCAN_8BIT;
+
+	if (st->linestart < len) {
+		const size_t llen = len - st->linestart;
+
+		if (st->in_header) {
+			if (llen > res->hdrmaxline)
+				res->hdrmaxline = llen;
+		} else if (llen > res->maxline) {
+			res->maxline = llen;
+		}
+	}
+
+	if (st->in_header)
+		res->headerend = len;
+}
+
+static void
+scan_generic(const char *buf, const size_t len, struct bufscan *res)
+{
+	struct scanstate st = { 0, 1 };
+
+	scan_tail(buf, 0, len, &st, res);
+}
+
+static int
+has_8bit_generic(const char *buf, const size_t len)
+{
+	const uint64_t mask = 0x8080808080808080ULL;
+	size_t pos = 0;
+
+	for (; pos + sizeof(uint64_t) <= len; pos += sizeof(uint64_t)) {
+		uint64_t w;
+
+		memcpy(&w, buf + pos, sizeof(w));
+		if (w & mask)
+			return 1;
+	}
+
+	for (; pos < len; pos++)
+		if (((signed char)buf[pos]) < 0)
+			return 1;
+
+	return 0;
+}
+
+#ifdef BUFSCAN_X86
+__attribute__ ((target ("sse2")))
+static void
+scan_sse2(const char *buf, const size_t len, struct bufscan *res)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+	__m128i high = zero;
+	__m128i nul = zero;
+	struct scanstate st = { 0, 1 };
+	size_t pos = 0;
+
+	for (; pos + sizeof(__m128i) <= len; pos += sizeof(__m128i)) {
+		const __m128i v = _mm_loadu_si128((const __m128i *)(buf + pos));
+		unsigned int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+
+		high = _mm_or_si128(high, v);
+		nul = _mm_or_si128(nul, _mm_cmpeq_epi8(v, zero));
+
+		while (m != 0) {
+			scan_lineend(buf, pos + __builtin_ctz(m), &st, res);
+			m &= m - 1;
+		}
+	}
+
+	if (_mm_movemask_epi8(high))
+		res->flags |= BUFSCAN_8BIT;
+	if (_mm_movemask_epi8(nul))
+		res->flags |= BUFSCAN_NUL;
+
+	scan_tail(buf, pos, len, &st, res);
+}
+
+__attribute__ ((target ("sse2")))
+static int
+has_8bit_sse2(const char *buf, const size_t len)
+{
+	size_t pos = 0;
+
+	for (; pos + sizeof(__m128i) <= len; pos += sizeof(__m128i))
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(buf + pos))))
+			return 1;
+
+	return has_8bit_generic(buf + pos, len - pos);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+scan_avx2(const char *buf, const size_t len, struct bufscan *res)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i high = zero;
+	__m256i nul = zero;
+	struct scanstate st = { 0, 1 };
+	size_t pos = 0;
+
+	for (; pos + sizeof(__m256i) <= len; pos += sizeof(__m256i)) {
+		const __m256i v = _mm256_loadu_si256((const __m256i *)(buf + pos));
+		uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+
+		high = _mm256_or_si256(high, v);
+		nul = _mm256_or_si256(nul, _mm256_cmpeq_epi8(v, zero));
+
+		while (m != 0) {
+			scan_lineend(buf, pos + __builtin_ctz(m), &st, res);
+			m &= m - 1;
+		}
+	}
+
+	if (_mm256_movemask_epi8(high))
+		res->flags |= BUFSCAN_8BIT;
+	if (_mm256_movemask_epi8(nul))
+		res->flags |= BUFSCAN_NUL;
+
+	scan_tail(buf, pos, len, &st, res);
+}
+
+__attribute__ ((target ("avx2")))
+static int
+has_8bit_avx2(const char *buf, const size_t len)
+{
+	size_t pos = 0;
+
+	for (; pos + sizeof(__m256i) <= len; pos += sizeof(__m256i))
+		if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(buf + pos))))
+			return 1;
+
+	return has_8bit_generic(buf + pos, len - pos);
+}
+#endif /* BUFSCAN_X86 */
+
+static void scan_select(const char *buf, const size_t len, struct bufscan *res);
+static int has_8bit_select(const char *buf, const size_t len);
+
+static void (*scan_impl)(const char *, const size_t, struct bufscan *) = scan_select;
+static int (*has_8bit_impl)(const char *, const size_t) = has_8bit_select;
+
+/**
+ * @brief pick the best implementations for the running CPU
+ */
+static void
+bufscan_init(void)
+{
+	scan_impl = scan_generic;
+	has_8bit_impl = has_8bit_generic;
+
+#ifdef BUFSCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scan_impl = scan_avx2;
+		has_8bit_impl = has_8bit_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		scan_impl = scan_sse2;
+		has_8bit_impl = has_8bit_sse2;
+	}
+#endif
+}
+
+static void
+scan_select(const char *buf, const size_t len, struct bufscan *res)
+{
+	bufscan_init();
+	scan_impl(buf, len, res);
+}
+
+static int
+has_8bit_select(const char *buf, const size_t len)
+{
+	bufscan_init();
+	return has_8bit_impl(buf, len);
+}
+
+/**
+ * @brief classify a buffer in one pass
+ * @param buf the buffer to scan
+ * @param len length of buffer
+ * @param res the result will be stored here
+ *
+ * The header is everything up to the first empty line.
+ */
+void
+scan_buffer(const char *buf, const size_t len, struct bufscan *res)
+{
+	memset(res, 0, sizeof(*res));
+
+	scan_impl(buf, len, res);
+}
+
+/**
+ * @brief check if a buffer contains bytes with the high bit set
+ * @param buf the buffer to scan
+ * @param len length of buffer
+ * @return if 8bit characters were found
+ */
+int
+has_8bit(const char *buf, const size_t len)
+{
+	return has_8bit_impl(buf, len);
+}
@@ -5,6 +5,7 @@
 #include <cdb.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -14,7 +15,13 @@
 
 #define CDB_HASHSTART 5381
 
-static inline uint32_t
+/**
+ * @brief calculate the hash of a key
+ * @param buf the key
+ * @param len length of buf
+ * @return the hash value
+ */
+uint32_t
 cdb_hash(const char *buf, unsigned int len)
 {
 	uint32_t h;
@@ -22,7 +29,7 @@ cdb_hash(const char *buf, unsigned int len)
 	h = CDB_HASHSTART;
 	while (len--) {
 		h += (h << 5);
-		h ^= (uint32_t) *buf++;
+		h ^= (uint32_t)(unsigned char) *buf++;
 	}
 	return h;
 }
@@ -40,6 +47,198 @@ cdb_unpack(const char *buf)
 #endif
 }
 
+/**
+ * @brief release the mapping of a database
+ * @param c the database object
+ */
+void
+cdb_close(struct cdb *c)
+{
+	if (c->map != NULL)
+		munmap((void *)c->map, c->size);
+	c->map = NULL;
+	c->size = 0;
+	c->opened = 0;
+	c->hslots = 0;
+	c->loop = 0;
+}
+
+/**
+ * @brief map a database into memory
+ * @param c the database object
+ * @param dirfd descriptor of the directory fname is relative to
+ * @param fname name of the database file
+ * @return 0 on success, -1 on error (errno is set)
+ *
+ * If c already maps the file with the same inode and modification time the
+ * mapping is kept, otherwise the new file is mapped and the old mapping is
+ * released. All data pointers returned from c before are invalid then.
+ *
+ * If the file does not exist errno is set to ENOENT, an empty file is
+ * accepted and contains no keys. On error c is closed.
+ */
+int
+cdb_open(struct cdb *c, int dirfd, const char *fname)
+{
+	struct stat st;
+	void *map = NULL;
+	int fd;
+	int err;
+
+	if (fstatat(dirfd, fname, &st, 0) != 0)
+		goto err;
+
+	if (c->opened && (c->dev == st.st_dev) && (c->ino == st.st_ino) && (c->size == st.st_size) &&
+			(c->mtime.tv_sec == st.st_mtim.tv_sec) && (c->mtime.tv_nsec == st.st_mtim.tv_nsec))
+		return 0;
+
+	fd = openat(dirfd, fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		goto err;
+
+	/* the file may have been replaced in between */
+	if (fstat(fd, &st) != 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		goto err;
+	}
+
+	if (st.st_size > UINT32_MAX) {
+		close(fd);
+		errno = EFBIG;
+		goto err;
+	}
+
+	if (st.st_size != 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		err = errno;
+		close(fd);
+		if (map == MAP_FAILED) {
+			errno = err;
+			goto err;
+		}
+	} else {
+		close(fd);
+	}
+
+	cdb_close(c);
+	c->map = map;
+	c->size = st.st_size;
+	c->opened = 1;
+	c->dev = st.st_dev;
+	c->ino = st.st_ino;
+	c->mtime = st.st_mtim;
+
+	return 0;
+err:
+	err = errno;
+	cdb_close(c);
+	errno = err;
+	return -1;
+}
+
+/**
+ * @brief find the next record for the key of the last cdb_find()
+ * @param c the database object
+ * @param data a pointer to the value of the record is stored here
+ * @param dlen the length of the value is stored here
+ * @retval 1 a record was found
+ * @retval 0 there are no more records for the key
+ * @retval -1 the database is corrupt (errno is set)
+ *
+ * The records are returned in the order they were added to the database.
+ * data points into the mapped file and is not 0-terminated.
+ */
+int
+cdb_findnext(struct cdb *c, const char **data, uint32_t *dlen)
+{
+	while (c->loop < c->hslots) {
+		const char *slot = c->map + c->hpos + 8 * c->kslot;
+		const uint32_t pos = cdb_unpack(slot + 4);
+		uint32_t klen;
+
+		/* an empty slot ends the search */
+		if (pos == 0)
+			break;
+
+		c->loop++;
+		if (++c->kslot == c->hslots)
+			c->kslot = 0;
+
+		if (cdb_unpack(slot) != c->khash)
+			continue;
+
+		if ((pos < CDB_HEADER) || (pos > c->size - 8)) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		klen = cdb_unpack(c->map + pos);
+		*dlen = cdb_unpack(c->map + pos + 4);
+		if ((klen > c->size - pos - 8) || (*dlen > c->size - pos - 8 - klen)) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		if ((klen == c->klen) && (memcmp(c->map + pos + 8, c->key, klen) == 0)) {
+			*data = c->map + pos + 8 + klen;
+			return 1;
+		}
+	}
+
+	c->loop = c->hslots;
+	return 0;
+}
+
+/**
+ * @brief find the first record for a key
+ * @param c the database object
+ * @param key the key to search for
+ * @param klen length of key
+ * @param data a pointer to the value of the record is stored here
+ * @param dlen the length of the value is stored here
+ * @retval 1 a record was found
+ * @retval 0 no record for the key exists
+ * @retval -1 the database is corrupt (errno is set)
+ *
+ * key must stay valid as long as cdb_findnext() is used to get further
+ * records for the same key.
+ */
+int
+cdb_find(struct cdb *c, const char *key, unsigned int klen, const char **data, uint32_t *dlen)
+{
+	c->key = key;
+	c->klen = klen;
+	c->khash = cdb_hash(key, klen);
+	c->hslots = 0;
+	c->loop = 0;
+
+	if (c->map == NULL)
+		return 0;
+
+	if (c->size < CDB_HEADER) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	c->hpos = cdb_unpack(c->map + 8 * (c->khash & 255));
+	c->hslots = cdb_unpack(c->map + 8 * (c->khash & 255) + 4);
+
+	if (c->hslots == 0)
+		return 0;
+
+	if ((c->hpos < CDB_HEADER) || (c->hpos > c->size) || (c->hslots > (c->size - c->hpos) / 8)) {
+		c->hslots = 0;
+		errno = EINVAL;
+		return -1;
+	}
+
+	c->kslot = (c->khash >> 8) % c->hslots;
+
+	return cdb_findnext(c, data, dlen);
+}
+
 /**
  * perform cdb search on the given file
  *
@@ -57,18 +256,17 @@ cdb_unpack(const char *buf)
  * The file is mmaped into memory, the result pointer will point inside that
  * memory. The caller must munmap() the value returned in mm if the function
  * does not return NULL. fd will be closed before the function returns.
+ *
+ * Use cdb_open() and cdb_find() to do multiple lookups in the same file.
  */
 const char *
 cdb_seekmm(int fd, const char *key, unsigned int len, char **mm, const struct stat *st)
 {
-	uint32_t pos;
-	uint32_t h;
-	uint32_t lenhash;
-	uint32_t h2;
-	uint32_t loop;
-	uint32_t poskd;
-	char *cur;
+	struct cdb c = CDB_INIT;
+	const char *data;
+	uint32_t dlen;
 	int err;
+	int r;
 
 	*mm = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
 	err = errno;
@@ -81,38 +279,14 @@ cdb_seekmm(int fd, const char *key, unsigned int len, char **mm, const struct st
 		return NULL;
 	}
 
-	errno = 0;
-	h = cdb_hash(key, len);
-
-	pos = 8 * (h & 255);
+	c.map = *mm;
+	c.size = st->st_size;
 
-	lenhash = cdb_unpack(*mm + pos + 4);
+	r = cdb_find(&c, key, len, &data, &dlen);
+	if (r > 0)
+		return data;
 
-	if (lenhash != 0) {
-		h2 = (h >> 8) % lenhash;
-
-		pos = cdb_unpack(*mm + pos);
-
-		for (loop = 0; loop < lenhash; ++loop) {
-			cur = *mm + pos + 8 * h2;
-			poskd = cdb_unpack(cur + 4);
-
-			if (!poskd)
-				break;
-
-			if (cdb_unpack(cur) == h) {
-				cur = *mm + poskd;
-
-				if (cdb_unpack(cur) == len)
-					if (!strncmp(cur + 8, key, len))
-						return cur + 8 + len;
-			}
-			if (++h2 == lenhash)
-				h2 = 0;
-		}
-	}
-
-	err = errno;
+	err = (r == 0) ? 0 : errno;
 	munmap(*mm, st->st_size);
 	errno = err;
 	return NULL;
@@ -0,0 +1,248 @@
+/** \file cdb_make.c
+ * \brief functions to write CDB databases
+ *
+ * The files use the format of D. J. Bernstein's cdb package, so they can be
+ * read by cdb_open() as well as by all other cdb readers. The caller writes
+ * to a temporary file and renames it to the final name after
+ * cdb_make_finish() was successful, so readers always see a complete file.
+ */
+
+#include <cdb.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void
+cdb_pack(char *buf, uint32_t num)
+{
+	buf[0] = num & 0xff;
+	buf[1] = (num >> 8) & 0xff;
+	buf[2] = (num >> 16) & 0xff;
+	buf[3] = num >> 24;
+}
+
+static int
+cdb_make_flush(struct cdb_make *cm)
+{
+	size_t off = 0;
+
+	while (off < cm->buflen) {
+		const ssize_t r = write(cm->fd, cm->buf + off, cm->buflen - off);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		off += r;
+	}
+
+	cm->buflen = 0;
+	return 0;
+}
+
+static int
+cdb_make_write(struct cdb_make *cm, const char *buf, size_t len)
+{
+	while (len > 0) {
+		size_t l = sizeof(cm->buf) - cm->buflen;
+
+		if (l == 0) {
+			if (cdb_make_flush(cm) != 0)
+				return -1;
+			l = sizeof(cm->buf);
+		}
+		if (l > len)
+			l = len;
+
+		memcpy(cm->buf + cm->buflen, buf, l);
+		cm->buflen += l;
+		buf += l;
+		len -= l;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief release all resources and preserve errno
+ * @param cm the database
+ * @return -1
+ *
+ * This is used if writing the database is stopped before cdb_make_finish()
+ * is called. The file descriptor is not closed.
+ */
+int
+cdb_make_abort(struct cdb_make *cm)
+{
+	const int err = errno;
+
+	free(cm->hp);
+	cm->hp = NULL;
+	errno = err;
+	return -1;
+}
+
+/**
+ * @brief start writing a database
+ * @param cm the database
+ * @param fd descriptor of the output file, positioned at the beginning of an empty file
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int
+cdb_make_start(struct cdb_make *cm, int fd)
+{
+	char header[CDB_HEADER];
+
+	cm->fd = fd;
+	cm->pos = sizeof(header);
+	cm->hp = NULL;
+	cm->num = 0;
+	cm->alloc = 0;
+	cm->buflen = 0;
+
+	/* reserve space for the header, it is written by cdb_make_finish() */
+	memset(header, 0, sizeof(header));
+	return cdb_make_write(cm, header, sizeof(header));
+}
+
+/**
+ * @brief add a record to the database
+ * @param cm the database
+ * @param key the key of the record
+ * @param klen length of key
+ * @param data the value of the record
+ * @param dlen length of data
+ * @return 0 on success, -1 on error (errno is set)
+ *
+ * The same key may be added multiple times, cdb_findnext() returns the
+ * records in the order they were added. After an error all resources are
+ * released and cm must not be used anymore.
+ */
+int
+cdb_make_add(struct cdb_make *cm, const char *key, unsigned int klen, const char *data, unsigned int dlen)
+{
+	char lens[8];
+
+	/* every record also needs 2 hash table slots of 8 byte each */
+	if ((uint64_t)cm->pos + 8 + klen + dlen + 16 * ((uint64_t)cm->num + 1) > UINT32_MAX) {
+		errno = EFBIG;
+		return cdb_make_abort(cm);
+	}
+
+	if (cm->num == cm->alloc) {
+		const uint32_t n = cm->alloc ? 2 * cm->alloc : 256;
+		struct cdb_hp *tmp = realloc(cm->hp, n * sizeof(*cm->hp));
+
+		if (tmp == NULL)
+			return cdb_make_abort(cm);
+		cm->hp = tmp;
+		cm->alloc = n;
+	}
+
+	cdb_pack(lens, klen);
+	cdb_pack(lens + 4, dlen);
+	if ((cdb_make_write(cm, lens, sizeof(lens)) != 0) ||
+			(cdb_make_write(cm, key, klen) != 0) ||
+			((dlen != 0) && (cdb_make_write(cm, data, dlen) != 0)))
+		return cdb_make_abort(cm);
+
+	cm->hp[cm->num].h = cdb_hash(key, klen);
+	cm->hp[cm->num].pos = cm->pos;
+	cm->num++;
+	cm->pos += sizeof(lens) + klen + dlen;
+
+	return 0;
+}
+
+/**
+ * @brief write the hash tables and the header of the database
+ * @param cm the database
+ * @return 0 on success, -1 on error (errno is set)
+ *
+ * All resources are released, the file descriptor is not closed.
+ */
+int
+cdb_make_finish(struct cdb_make *cm)
+{
+	char header[CDB_HEADER];
+	uint32_t count[256];
+	uint32_t start[256];
+	struct cdb_hp *sorted;
+	struct cdb_hp *table;
+	uint32_t maxslots = 0;
+	uint32_t i;
+	ssize_t r;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < cm->num; i++)
+		count[cm->hp[i].h & 255]++;
+
+	for (i = 0; i < 256; i++) {
+		start[i] = (i == 0) ? 0 : start[i - 1] + count[i - 1];
+		if (2 * count[i] > maxslots)
+			maxslots = 2 * count[i];
+	}
+
+	/* sort the records by hash table, keeping the order inside every
+	 * table so duplicate keys are found in the order they were added */
+	sorted = malloc((cm->num + maxslots + 1) * sizeof(*sorted));
+	if (sorted == NULL)
+		return cdb_make_abort(cm);
+	table = sorted + cm->num;
+
+	for (i = 0; i < cm->num; i++)
+		sorted[start[cm->hp[i].h & 255]++] = cm->hp[i];
+
+	for (i = 0; i < 256; i++) {
+		const uint32_t slots = 2 * count[i];
+		const struct cdb_hp *hp = sorted + start[i] - count[i];
+		uint32_t j;
+
+		cdb_pack(header + 8 * i, cm->pos);
+		cdb_pack(header + 8 * i + 4, slots);
+
+		if (slots == 0)
+			continue;
+
+		memset(table, 0, slots * sizeof(*table));
+		for (j = 0; j < count[i]; j++) {
+			uint32_t k = (hp[j].h >> 8) % slots;
+
+			while (table[k].pos != 0)
+				if (++k == slots)
+					k = 0;
+			table[k] = hp[j];
+		}
+
+		for (j = 0; j < slots; j++) {
+			char slot[8];
+
+			cdb_pack(slot, table[j].h);
+			cdb_pack(slot + 4, table[j].pos);
+			if (cdb_make_write(cm, slot, sizeof(slot)) != 0) {
+				free(sorted);
+				return cdb_make_abort(cm);
+			}
+		}
+		cm->pos += slots * 8;
+	}
+
+	free(sorted);
+
+	if (cdb_make_flush(cm) != 0)
+		return cdb_make_abort(cm);
+
+	r = pwrite(cm->fd, header, sizeof(header), 0);
+	if (r != sizeof(header)) {
+		if (r >= 0)
+			errno = EIO;
+		return cdb_make_abort(cm);
+	}
+
+	free(cm->hp);
+	cm->hp = NULL;
+	return 0;
+}
@@ -4,6 +4,7 @@
 
 #include <control.h>
 
+#include <cdb.h>
 #include <fmt.h>
 #include <log.h>
 #include <mmap.h>
@@ -24,6 +25,11 @@
 
 int controldir_fd = -1;	/**< descriptor of the control directory */
 
+static struct cdb domainidx = CDB_INIT;	/**< compiled index of a domain list */
+static const char *domainidx_buf;	/**< the mapping of the domain list the index belongs to */
+static dev_t domainidx_dev;		/**< device of the domain list the index belongs to */
+static ino_t domainidx_ino;		/**< inode of the domain list the index belongs to */
+
 /**
  * @brief compact a given buffer
  *
@@ -425,6 +431,149 @@ loadlistfd(int fd, char ***bufa, checkfunc cf)
 	return 0;
 }
 
+/**
+ * @brief search a domain in the compiled index
+ * @param domain domain name to find
+ * @retval 1 on match
+ * @retval 0 if none
+ * @retval -1 the index can not be used for this search
+ *
+ * The index contains all entries of the domain list in lower case. A domain
+ * matches if it is found itself, or if one of its subdomains starting at a
+ * '.' is found, which is what finddomain() does for entries beginning with
+ * a '.'.
+ */
+static int
+finddomainidx(const char *domain)
+{
+	char key[256];	/* the same limit is used in makedomainidx() */
+	const size_t dl = strlen(domain);
+	const char *data;
+	uint32_t dlen;
+	size_t i;
+	int r;
+
+	if (dl >= sizeof(key))
+		return -1;
+
+	for (i = 0; i < dl; i++)
+		key[i] = ((domain[i] >= 'A') && (domain[i] <= 'Z')) ? domain[i] - 'A' + 'a' : domain[i];
+
+	/* entries without leading '.' must match the whole domain */
+	if (key[0] != '.') {
+		r = cdb_find(&domainidx, key, dl, &data, &dlen);
+		if (r != 0)
+			return r;
+	}
+
+	/* entries with leading '.' must be shorter than the domain */
+	for (i = 1; i < dl; i++) {
+		if (key[i] != '.')
+			continue;
+
+		r = cdb_find(&domainidx, key + i, dl - i, &data, &dlen);
+		if (r != 0)
+			return r;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief write a compiled index of a domain list
+ * @param buf the contents of the domain list
+ * @param size size of buf
+ * @param fd descriptor of the empty output file
+ * @return 0 on success, -1 on error (errno is set)
+ *
+ * The entries are found in the same way finddomain() parses buf. The file
+ * is not closed.
+ */
+int
+makedomainidx(const char *buf, const off_t size, int fd)
+{
+	struct cdb_make cm;
+	const char *cur = buf;
+	const char *end = buf + size;
+
+	if (cdb_make_start(&cm, fd) != 0)
+		return -1;
+
+	while (cur < end) {
+		const char *cure = memchr(cur, '\n', end - cur);
+		size_t len = (cure != NULL) ? (size_t)(cure - cur) : (size_t)(end - cur);
+
+		if (*cur != '#') {
+			while (len && ((*(cur + len - 1) == ' ') || (*(cur + len - 1) == '\t')))
+				len--;
+			/* finddomainidx() does not use the index for domains
+			 * this long, so they can not match anything in it */
+			if (len && (len < 256)) {
+				char key[256];
+				size_t i;
+
+				for (i = 0; i < len; i++)
+					key[i] = ((cur[i] >= 'A') && (cur[i] <= 'Z')) ? cur[i] - 'A' + 'a' : cur[i];
+
+				if (cdb_make_add(&cm, key, len, "", 0) != 0)
+					return -1;
+			}
+		}
+
+		if (cure == NULL)
+			break;
+		cur = cure + 1;
+	}
+
+	return cdb_make_finish(&cm);
+}
+
+/**
+ * @brief use a compiled index for lookups in a domain list
+ * @param buf the mapping of the domain list as passed to finddomain()
+ * @param dirfd descriptor of the directory of the domain list
+ * @param fname name of the domain list, the index is the same name with ".cdb" appended
+ * @retval 1 the index is used
+ * @retval 0 there is no index or it is not newer than the domain list
+ * @retval -1 error (errno is set)
+ *
+ * Afterwards finddomain() uses the index when called for buf, and
+ * finddomainfd() when called for a descriptor of the same file. Only one
+ * index can be used at a time.
+ */
+int
+loaddomainidx(const char *buf, int dirfd, const char *fname)
+{
+	const size_t fnlen = strlen(fname);
+	char idxname[fnlen + sizeof(".cdb")];
+	struct stat st;
+
+	domainidx_buf = NULL;
+	cdb_close(&domainidx);
+
+	memcpy(idxname, fname, fnlen);
+	memcpy(idxname + fnlen, ".cdb", sizeof(".cdb"));
+
+	if (fstatat(dirfd, fname, &st, 0) != 0)
+		return (errno == ENOENT) ? 0 : -1;
+
+	if (cdb_open(&domainidx, dirfd, idxname) != 0)
+		return (errno == ENOENT) ? 0 : -1;
+
+	/* an index older than the list is missing the latest changes */
+	if ((domainidx.mtime.tv_sec < st.st_mtim.tv_sec) ||
+			((domainidx.mtime.tv_sec == st.st_mtim.tv_sec) && (domainidx.mtime.tv_nsec <= st.st_mtim.tv_nsec))) {
+		cdb_close(&domainidx);
+		return 0;
+	}
+
+	domainidx_buf = buf;
+	domainidx_dev = st.st_dev;
+	domainidx_ino = st.st_ino;
+
+	return 1;
+}
+
 /**
  * mmap a file and search a domain entry in it
  *
@@ -443,6 +592,7 @@ finddomainfd(int fd, const char *domain, const int cl)
 	char *map;
 	int rc = 0, i;
 	off_t len;
+	struct stat st;
 
 	if (fd < 0) {
 		return (errno == ENOENT) ? 0 : fd;
@@ -455,19 +605,28 @@ finddomainfd(int fd, const char *domain, const int cl)
 		return -1;
 	}
 
-	map = mmap_fd(fd, &len);
+	/* the file the index was loaded for */
+	if (domainidx.opened && (fstat(fd, &st) == 0) &&
+			(st.st_dev == domainidx_dev) && (st.st_ino == domainidx_ino))
+		rc = finddomainidx(domain);
+	else
+		rc = -1;
 
-	if (map == NULL) {
-		int e = errno;
+	if (rc < 0) {
+		map = mmap_fd(fd, &len);
 
-		close(fd);
-		errno = e;
-		return -1;
-	}
+		if (map == NULL) {
+			int e = errno;
 
-	rc = finddomain(map, len, domain);
+			close(fd);
+			errno = e;
+			return -1;
+		}
+
+		rc = finddomain(map, len, domain);
 
-	munmap(map, len);
+		munmap(map, len);
+	}
 	if (cl) {
 		i = close(fd);
 	} else {
@@ -502,6 +661,13 @@ finddomain(const char *buf, const off_t size, const char *domain)
 	if (!buf)
 		return 0;
 
+	if ((buf == domainidx_buf) && domainidx.opened) {
+		const int r = finddomainidx(domain);
+
+		if (r >= 0)
+			return r;
+	}
+
 	cur = buf;
 	do {
 		char *cure = memchr(cur, '\n', size - pos);
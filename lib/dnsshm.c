@@ -0,0 +1,330 @@
+/** \file dnsshm.c
+ \brief DNS cache shared between processes using a memory mapped file
+
+ Qsmtpd and Qremote are started for every single connection, so any cache
+ kept in process memory is lost when the connection ends. If the cache file
+ exists all processes share the results of their DNS lookups through it. The
+ file format and the locking scheme are described in dnsshm.h.
+ */
+
+#include <dnsshm.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief one slot of the cache file
+ *
+ * The data of the entry follows directly after this structure in the slot.
+ */
+struct dnsshm_slot {
+	uint32_t seq;		/**< sequence counter, odd while the slot is written */
+	uint32_t type;		/**< enum dnscache_type of the entry, 0 if unused */
+	uint64_t hash;		/**< hash of type and name */
+	int64_t expires;	/**< time when the entry becomes invalid */
+	uint16_t namelen;	/**< length of name */
+	uint16_t datalen;	/**< length of the data */
+	uint32_t negative;	/**< if the name does not exist */
+	char name[256];		/**< the name that was looked up, not 0-terminated */
+};
+
+#define DNSSHM_MAXDATA	(DNSSHM_SLOTSIZE - sizeof(struct dnsshm_slot))	/**< maximum data length of an entry */
+
+static struct dnsshm_header *shm;	/**< the mapped cache file, NULL if no cache is used */
+static size_t shmlen;			/**< length of the mapping */
+
+static struct dnsshm_slot *
+slot_at(const uint32_t idx)
+{
+	return (struct dnsshm_slot *)((char *)(shm + 1) + (size_t)(idx % shm->slots) * DNSSHM_SLOTSIZE);
+}
+
+static uint64_t
+dnsshm_hash(const enum dnscache_type type, const char *name, const size_t namelen)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	h ^= (unsigned char)type;
+	h *= 0x100000001b3ULL;
+
+	for (size_t i = 0; i < namelen; i++) {
+		unsigned char c = name[i];
+
+		/* DNS names are case insensitive */
+		if ((c >= 'A') && (c <= 'Z'))
+			c += 'a' - 'A';
+		h ^= c;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static int
+header_valid(const struct dnsshm_header *h, const off_t len)
+{
+	if (memcmp(h->magic, DNSSHM_MAGIC, sizeof(DNSSHM_MAGIC)) != 0)
+		return 0;
+	if ((h->version != DNSSHM_VERSION) || (h->slotsize != DNSSHM_SLOTSIZE) || (h->slots == 0))
+		return 0;
+	return (len == (off_t)(sizeof(*h) + (size_t)h->slots * DNSSHM_SLOTSIZE));
+}
+
+/**
+ * @brief map the shared DNS cache file
+ * @param dirfd descriptor of the directory the file is in
+ * @param fname name of the cache file
+ * @return 0 on success, -1 on error (errno is set)
+ *
+ * If the file does not exist the shared cache is not used and errno is set
+ * to ENOENT. An empty file is initialized, so an administrator only needs to
+ * create the file. If the file is not owned by the effective user of the
+ * process or if it is writable by group or others it is not used and errno is
+ * set to EPERM, as another user could then inject DNS answers.
+ */
+int
+dnsshm_open(int dirfd, const char *fname)
+{
+	struct stat st;
+	void *m;
+	int fd;
+
+	dnsshm_close();
+
+	fd = openat(dirfd, fname, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) != 0)
+		goto err;
+
+	if ((st.st_uid != geteuid()) || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		errno = EPERM;
+		goto err;
+	}
+
+	if (st.st_size == 0) {
+		struct dnsshm_header h = {
+			.magic = DNSSHM_MAGIC,
+			.version = DNSSHM_VERSION,
+			.slots = DNSSHM_SLOTS,
+			.slotsize = DNSSHM_SLOTSIZE
+		};
+
+		/* only one process may initialize the file */
+		if (flock(fd, LOCK_EX) != 0)
+			goto err;
+		if (fstat(fd, &st) != 0)
+			goto err;
+		if (st.st_size == 0) {
+			st.st_size = sizeof(h) + (size_t)h.slots * DNSSHM_SLOTSIZE;
+			if ((ftruncate(fd, st.st_size) != 0) ||
+					(pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)))
+				goto err;
+		}
+		flock(fd, LOCK_UN);
+	} else if (st.st_size < (off_t)sizeof(struct dnsshm_header)) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (m == MAP_FAILED)
+		goto err;
+	close(fd);
+
+	if (!header_valid(m, st.st_size)) {
+		munmap(m, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	shm = m;
+	shmlen = st.st_size;
+
+	return 0;
+err:
+	{
+		const int e = errno;
+
+		close(fd);
+		errno = e;
+		return -1;
+	}
+}
+
+/**
+ * @brief stop using the shared DNS cache
+ */
+void
+dnsshm_close(void)
+{
+	if (shm != NULL)
+		munmap(shm, shmlen);
+	shm = NULL;
+	shmlen = 0;
+}
+
+/**
+ * @brief look up an entry in the shared cache
+ * @param type record type
+ * @param name the name to look up
+ * @param out a copy of the cached data is stored here, memory is malloced
+ * @param len length of out
+ * @param negative if the entry is a cached nonexistent name
+ * @return if a valid entry was found
+ */
+int
+dnsshm_get(const enum dnscache_type type, const char *name, char **out, size_t *len, int *negative)
+{
+	const size_t namelen = strlen(name);
+	uint64_t hash;
+
+	if ((shm == NULL) || (namelen > sizeof(((struct dnsshm_slot *)NULL)->name)))
+		return 0;
+
+	hash = dnsshm_hash(type, name, namelen);
+
+	for (uint32_t i = 0; i < DNSSHM_PROBES; i++) {
+		struct dnsshm_slot *s = slot_at((uint32_t)hash + i);
+		const uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		struct dnsshm_slot copy;
+		char *d = NULL;
+
+		if (seq & 1)
+			continue;
+
+		memcpy(&copy, s, sizeof(copy));
+		if ((copy.type != (uint32_t)type) || (copy.hash != hash) || (copy.namelen != namelen) ||
+				(copy.datalen > DNSSHM_MAXDATA))
+			continue;
+
+		if (copy.datalen > 0) {
+			d = malloc(copy.datalen);
+			if (d == NULL)
+				return 0;
+			memcpy(d, s + 1, copy.datalen);
+		}
+
+		/* the slot was modified while it was read */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) {
+			free(d);
+			continue;
+		}
+
+		if ((copy.expires <= time(NULL)) || (strncasecmp(copy.name, name, namelen) != 0)) {
+			free(d);
+			continue;
+		}
+
+		*out = d;
+		*len = copy.datalen;
+		*negative = (copy.negative != 0);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief wait for another writer to release a slot
+ * @param s the slot
+ * @param seq the odd sequence counter found in the slot
+ * @return if the counter did not change for DNSSHM_LOCKWAIT milliseconds
+ *
+ * Writing a slot takes only a few microseconds, so if the lock is held much
+ * longer the writer has died between locking and releasing the slot.
+ */
+static int
+slot_stale(struct dnsshm_slot *s, const uint32_t seq)
+{
+	const struct timespec ts = {
+		.tv_sec = 0,
+		.tv_nsec = 1000000
+	};
+
+	for (unsigned int i = 0; i < DNSSHM_LOCKWAIT; i++) {
+		nanosleep(&ts, NULL);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief store an entry in the shared cache
+ * @param type record type
+ * @param name the name that was looked up
+ * @param negative if the name does not exist
+ * @param data the result data
+ * @param len length of data
+ * @param ttl lifetime of the entry in seconds
+ *
+ * Entries too big for a slot are not stored. If another process is writing
+ * the selected slot at the same time the entry is silently dropped. A slot
+ * that stays locked is taken over, see slot_stale().
+ */
+void
+dnsshm_put(const enum dnscache_type type, const char *name, const int negative, const char *data, const size_t len, const unsigned int ttl)
+{
+	const size_t namelen = strlen(name);
+	const time_t now = time(NULL);
+	struct dnsshm_slot *s = NULL;
+	uint64_t hash;
+	uint32_t seq;
+	uint32_t lockseq;
+
+	if ((shm == NULL) || (namelen > sizeof(s->name)) || (len > DNSSHM_MAXDATA) || (ttl == 0))
+		return;
+
+	hash = dnsshm_hash(type, name, namelen);
+
+	/* prefer the slot of the same name, otherwise the one that expires
+	 * first, unused slots have an expiry time of 0 */
+	for (uint32_t i = 0; i < DNSSHM_PROBES; i++) {
+		struct dnsshm_slot *c = slot_at((uint32_t)hash + i);
+
+		if ((c->type == (uint32_t)type) && (c->hash == hash)) {
+			s = c;
+			break;
+		}
+		if ((s == NULL) || (c->expires < s->expires))
+			s = c;
+	}
+
+	seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+	if (seq & 1) {
+		if (!slot_stale(s, seq))
+			return;
+		/* take over the lock, the counter stays odd */
+		lockseq = seq + 2;
+	} else {
+		lockseq = seq + 1;
+	}
+	if (!__atomic_compare_exchange_n(&s->seq, &seq, lockseq, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	s->type = type;
+	s->hash = hash;
+	s->expires = now + ttl;
+	s->namelen = namelen;
+	s->datalen = len;
+	s->negative = (negative != 0);
+	memcpy(s->name, name, namelen);
+	if (len > 0)
+		memcpy(s + 1, data, len);
+
+	/* if the lock was taken over in the meantime the new owner releases it */
+	__atomic_compare_exchange_n(&s->seq, &lockseq, lockseq + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
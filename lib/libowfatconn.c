@@ -4,11 +4,16 @@
 
 #include <libowfatconn.h>
 
+#include <arpa/inet.h>
 #include <dns.h>
+#include <errno.h>
+#include <iopause.h>
 #include <netinet/in.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stralloc.h>
 #include <string.h>
+#include <taia.h>
 
 /**
  * @brief handle the libowfat return codes
@@ -50,30 +55,216 @@ mangle_ip_ret(struct stralloc *sa, char **out, size_t *len, int r)
 		.s = (char *)str \
 	}
 
+/**
+ * @brief get the lifetime of a DNS answer
+ *
+ * @param buf the answer packet
+ * @param len length of buf
+ * @param negative if the answer contains no records of the requested type
+ * @param ttl the lifetime in seconds is stored here
+ *
+ * For positive answers the lowest TTL of all records in the answer section is
+ * used. For negative answers the lifetime is taken from the SOA record in the
+ * authority section as described in RFC 2308, section 5. If the packet does
+ * not contain such records ttl is not modified.
+ */
+static void
+dns_packet_ttl(const char *buf, const unsigned int len, const int negative, unsigned int *ttl)
+{
+	char header[12];
+	unsigned int pos;
+	uint16_t numanswers;
+	uint16_t numauthority;
+	uint32_t minttl = UINT32_MAX;
+
+	if (len < sizeof(header))
+		return;
+	memcpy(header, buf, sizeof(header));
+
+	memcpy(&numanswers, header + 6, sizeof(numanswers));
+	numanswers = ntohs(numanswers);
+	memcpy(&numauthority, header + 8, sizeof(numauthority));
+	numauthority = negative ? ntohs(numauthority) : 0;
+
+	pos = dns_packet_skipname(buf, len, sizeof(header));
+	if (!pos)
+		return;
+	pos += 4;
+
+	for (unsigned int i = 0; i < (unsigned int)numanswers + numauthority; i++) {
+		uint32_t t;
+		uint16_t datalen;
+
+		pos = dns_packet_skipname(buf, len, pos);
+		if (!pos || (len < pos + 10))
+			return;
+		memcpy(header, buf + pos, 10);
+		pos += 10;
+
+		memcpy(&datalen, header + 8, sizeof(datalen));
+		datalen = ntohs(datalen);
+		if (pos + datalen > len)
+			return;
+		memcpy(&t, header + 4, sizeof(t));
+		t = ntohl(t);
+
+		if (i < numanswers) {
+			/* a negative answer may still contain CNAME records */
+			if (!negative && (t < minttl))
+				minttl = t;
+		} else if (memcmp(header, DNS_T_SOA, 2) == 0) {
+			uint32_t soamin;
+
+			/* the MINIMUM field is at the end of the SOA record */
+			if (datalen < 20)
+				return;
+			memcpy(&soamin, buf + pos + datalen - 4, sizeof(soamin));
+			soamin = ntohl(soamin);
+			minttl = (soamin < t) ? soamin : t;
+			break;
+		}
+		pos += datalen;
+	}
+
+	if (minttl != UINT32_MAX)
+		*ttl = minttl;
+}
+
+/**
+ * @brief query DNS and parse the answer
+ *
+ * @param sa the parsed answer is stored here
+ * @param q the name to look up in DNS packet format
+ * @param qtype the query type
+ * @param parse the libowfat function to parse the answer packet
+ * @param ttl the lifetime of the answer is stored here, see dns_packet_ttl()
+ * @retval 0 success
+ * @retval -1 an error occurred, errno is set
+ */
+static int
+dns_resolve_ttl(stralloc *sa, const char *q, const char *qtype,
+		int (*parse)(stralloc *, const char *, unsigned int), unsigned int *ttl)
+{
+	int r;
+
+	if (dns_resolve(q, qtype) == -1)
+		return -1;
+
+	r = parse(sa, dns_resolve_tx.packet, dns_resolve_tx.packetlen);
+	if (r == 0)
+		dns_packet_ttl(dns_resolve_tx.packet, dns_resolve_tx.packetlen, (sa->len == 0), ttl);
+	dns_transmit_free(&dns_resolve_tx);
+
+	return r;
+}
+
+/**
+ * @brief query DNS for a name given as string and parse the answer
+ *
+ * @param sa the parsed answer is stored here
+ * @param host the name to look up
+ * @param qtype the query type
+ * @param parse the libowfat function to parse the answer packet
+ * @param ttl the lifetime of the answer is stored here, see dns_packet_ttl()
+ * @retval 0 success
+ * @retval -1 an error occurred, errno is set
+ */
+static int
+dns_host_ttl(stralloc *sa, const char *host, const char *qtype,
+		int (*parse)(stralloc *, const char *, unsigned int), unsigned int *ttl)
+{
+	char *q = NULL;
+	int r;
+
+	if (!dns_domain_fromdot(&q, host, strlen(host)))
+		return -1;
+
+	r = dns_resolve_ttl(sa, q, qtype, parse, ttl);
+	dns_domain_free(&q);
+
+	return r;
+}
+
 /**
  * @brief query DNS for IPv6 address of host
  *
  * @param out result string will be stored here, memory is malloced
  * @param len length of out
  * @param host host name to look up
+ * @param ttl lifetime of the result in seconds, only modified if the answer contains one
  * @retval 0 success
  * @retval -1 an error occurred, errno is set
+ *
+ * Like dns_ip6() this returns the IPv6 addresses of the host followed by the
+ * IPv4 addresses as v4mapped IPv6 addresses. If only one of both lookups
+ * succeeds its result is returned with a lifetime of 0.
  */
 int
-dnsip6(char **out, size_t *len, const char *host)
+dnsip6(char **out, size_t *len, const char *host, unsigned int *ttl)
 {
-	/* we can't use const_stralloc_from_string() here as dns_ip6()
-	 * modifies it's second argument. */
-	stralloc fqdn = {.a = 0, .len = 0, .s = NULL};
+	static const char v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\xff', '\xff' };
 	stralloc sa = {.a = 0, .len = 0, .s = NULL};
-	int r;
+	stralloc sa4 = {.a = 0, .len = 0, .s = NULL};
+	struct in6_addr literal;
+	unsigned int ttl6 = *ttl;
+	unsigned int ttl4 = *ttl;
+	char *q = NULL;
+	int r6;
+	int r4;
+	int e = 0;
+
+	if ((inet_pton(AF_INET6, host, &literal) == 1) || (inet_pton(AF_INET, host, &literal) == 1)) {
+		/* we can't use const_stralloc_from_string() here as dns_ip6()
+		 * modifies it's second argument. */
+		stralloc fqdn = {.a = 0, .len = 0, .s = NULL};
+		int r;
 
-	if (!stralloc_copys(&fqdn, host))
+		if (!stralloc_copys(&fqdn, host))
+			return -1;
+
+		r = dns_ip6(&sa, &fqdn);
+		free(fqdn.s);
+		return mangle_ip_ret(&sa, out, len, r);
+	}
+
+	if (!dns_domain_fromdot(&q, host, strlen(host)))
 		return -1;
 
-	r = dns_ip6(&sa, &fqdn);
-	free(fqdn.s);
-	return mangle_ip_ret(&sa, out, len, r);
+	r6 = dns_resolve_ttl(&sa, q, DNS_T_AAAA, dns_ip6_packet, &ttl6);
+	if (r6 != 0)
+		e = errno;
+	r4 = dns_resolve_ttl(&sa4, q, DNS_T_A, dns_ip4_packet, &ttl4);
+	if (r4 != 0)
+		e = errno;
+	dns_domain_free(&q);
+
+	if ((r6 != 0) && (r4 != 0)) {
+		free(sa4.s);
+		errno = e;
+		return mangle_ip_ret(&sa, out, len, -1);
+	}
+
+	for (unsigned int i = 0; (r4 == 0) && (i + 4 <= sa4.len); i += 4) {
+		if (!stralloc_catb(&sa, v4mapped, sizeof(v4mapped)) || !stralloc_catb(&sa, sa4.s + i, 4)) {
+			free(sa4.s);
+			errno = ENOMEM;
+			return mangle_ip_ret(&sa, out, len, -1);
+		}
+	}
+	free(sa4.s);
+
+	if ((r6 != 0) || (r4 != 0)) {
+		/* a partial result is only good if it contains addresses */
+		if (sa.len == 0) {
+			errno = e;
+			return mangle_ip_ret(&sa, out, len, -1);
+		}
+		*ttl = 0;
+	} else {
+		*ttl = (ttl6 < ttl4) ? ttl6 : ttl4;
+	}
+
+	return mangle_ip_ret(&sa, out, len, 0);
 }
 
 /**
@@ -82,17 +273,24 @@ dnsip6(char **out, size_t *len, const char *host)
  * @param out result string will be stored here, memory is malloced
  * @param len length of out
  * @param host host name to look up
+ * @param ttl lifetime of the result in seconds, only modified if the answer contains one
  * @retval 0 success
  * @retval -1 an error occurred, errno is set
  */
 int
-dnsip4(char **out, size_t *len, const char *host)
+dnsip4(char **out, size_t *len, const char *host, unsigned int *ttl)
 {
-	const stralloc fqdn = const_stralloc_from_string(host);
 	stralloc sa = {.a = 0, .len = 0, .s = NULL};
+	struct in_addr literal;
 	int r;
 
-	r = dns_ip4(&sa, &fqdn);
+	if (inet_pton(AF_INET, host, &literal) == 1) {
+		const stralloc fqdn = const_stralloc_from_string(host);
+
+		r = dns_ip4(&sa, &fqdn);
+	} else {
+		r = dns_host_ttl(&sa, host, DNS_T_A, dns_ip4_packet, ttl);
+	}
 	return mangle_ip_ret(&sa, out, len, r);
 }
 
@@ -102,17 +300,17 @@ dnsip4(char **out, size_t *len, const char *host)
  * @param out result string will be stored here, memory is malloced
  * @param len length of out
  * @param host host name to look up
+ * @param ttl lifetime of the result in seconds, only modified if the answer contains one
  * @retval 0 success
  * @retval -1 an error occurred, errno is set
  */
 int
-dnsmx(char **out, size_t *len, const char *host)
+dnsmx(char **out, size_t *len, const char *host, unsigned int *ttl)
 {
-	const stralloc fqdn = const_stralloc_from_string(host);
 	stralloc sa = {.a = 0, .len = 0, .s = NULL};
 	int r;
 
-	r = dns_mx(&sa, &fqdn);
+	r = dns_host_ttl(&sa, host, DNS_T_MX, dns_mx_packet, ttl);
 	return mangle_ip_ret(&sa, out, len, r);
 }
 
@@ -121,17 +319,17 @@ dnsmx(char **out, size_t *len, const char *host)
  *
  * @param out TXT record of host will be stored here, memory is malloced
  * @param host name of host to look up
+ * @param ttl lifetime of the result in seconds, only modified if the answer contains one
  * @retval 0 success
  * @retval -1 an error occurred, errno is set
  */
 int
-dnstxt(char **out, const char *host)
+dnstxt(char **out, const char *host, unsigned int *ttl)
 {
 	stralloc sa = {.a = 0, .len = 0, .s = NULL};
-	const stralloc fqdn = const_stralloc_from_string(host);
 	int r;
 
-	r = dns_txt(&sa, &fqdn);
+	r = dns_host_ttl(&sa, host, DNS_T_TXT, dns_txt_packet, ttl);
 	if ((r != 0) || (sa.len == 0)) {
 		free(sa.s);
 		*out = NULL;
@@ -153,16 +351,24 @@ dnstxt(char **out, const char *host)
  *
  * @param out DNS name of host will be stored here, memory is malloced
  * @param ip IPv6 address of host to look up
+ * @param ttl lifetime of the result in seconds, only modified if the answer contains one
  * @retval 0 success
  * @retval -1 an error occurred, errno is set
  */
 int
-dnsname(char **out, const struct in6_addr *ip)
+dnsname(char **out, const struct in6_addr *ip, unsigned int *ttl)
 {
 	stralloc sa = {.a = 0, .len = 0, .s = NULL};
+	char q[DNS_NAME6_DOMAIN];
 	int r;
 
-	r = dns_name6(&sa, (const char *)ip->s6_addr);
+	/* like dns_name6() use the in-addr.arpa name for v4mapped addresses */
+	if (IN6_IS_ADDR_V4MAPPED(ip))
+		dns_name4_domain(q, (const char *)ip->s6_addr + 12);
+	else
+		dns_name6_domain(q, (const char *)ip->s6_addr);
+
+	r = dns_resolve_ttl(&sa, q, DNS_T_PTR, dns_name_packet, ttl);
 	if ((r != 0) || (sa.len == 0)) {
 		free(sa.s);
 		*out = NULL;
@@ -175,3 +381,136 @@ dnsname(char **out, const struct in6_addr *ip)
 	*out = sa.s;
 	return 0;
 }
+
+/**
+ * @brief query DNS for IPv4 addresses of multiple hosts in parallel
+ *
+ * @param hosts host names to look up
+ * @param count number of entries in hosts
+ * @param results the results of the lookups, see below
+ * @param timeout maximum time in seconds to wait for all lookups
+ * @retval 0 lookups were done
+ * @retval -1 an error occurred, errno is set
+ *
+ * All queries are sent at once. The function returns as soon as a host has
+ * been found for which all hosts before it in the list have already been
+ * answered, i.e. the first host in list order with an address is known.
+ *
+ * For every host the status member of results contains the number of addresses
+ * found, or the negative error code if the lookup failed. Lookups that were not
+ * answered before the timeout or that were aborted because an earlier host
+ * already has an address have -ETIMEDOUT set. For successful lookups the other
+ * members are filled like the arguments of dnsip4(), the caller has to free
+ * the out member. The ttl member must be initialized by the caller.
+ */
+int
+dnsip4_parallel(const char *const *hosts, const unsigned int count, struct dnsip4_result *results, const unsigned int timeout)
+{
+	static const char localip[16];
+	char servers[256];
+	struct dns_transmit *tx;
+	char **q;
+	iopause_fd *x;
+	unsigned int *xidx;
+	struct taia limit;
+	struct taia stamp;
+	unsigned int first = 0;		/* the first host without a result */
+	unsigned int i;
+
+	if (count == 0)
+		return 0;
+
+	if (dns_resolvconfip(servers) == -1)
+		return -1;
+
+	tx = calloc(count, sizeof(*tx));
+	q = calloc(count, sizeof(*q));
+	x = calloc(count, sizeof(*x));
+	xidx = calloc(count, sizeof(*xidx));
+	if ((tx == NULL) || (q == NULL) || (x == NULL) || (xidx == NULL)) {
+		free(tx);
+		free(q);
+		free(x);
+		free(xidx);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		results[i].status = -EINPROGRESS;
+		results[i].out = NULL;
+		results[i].len = 0;
+
+		if (!dns_domain_fromdot(&q[i], hosts[i], strlen(hosts[i])))
+			results[i].status = -ENOMEM;
+		else if (dns_transmit_start(tx + i, servers, 1, q[i], DNS_T_A, localip) == -1)
+			results[i].status = errno ? -errno : -EIO;
+	}
+
+	taia_now(&stamp);
+	taia_uint(&limit, timeout);
+	taia_add(&limit, &limit, &stamp);
+
+	for (;;) {
+		struct taia deadline = limit;
+		unsigned int n = 0;
+		unsigned int k;
+
+		/* the result is known once the first host with an address has
+		 * all hosts before it answered */
+		while ((first < count) && (results[first].status != -EINPROGRESS)) {
+			if (results[first].status > 0)
+				break;
+			first++;
+		}
+		if ((first == count) || (results[first].status > 0))
+			break;
+
+		if (!taia_less(&stamp, &limit))
+			break;
+
+		for (i = first; i < count; i++) {
+			if (results[i].status != -EINPROGRESS)
+				continue;
+			dns_transmit_io(tx + i, x + n, &deadline);
+			xidx[n++] = i;
+		}
+
+		iopause(x, n, &deadline, &stamp);
+
+		for (k = 0; k < n; k++) {
+			int r;
+
+			i = xidx[k];
+			r = dns_transmit_get(tx + i, x + k, &stamp);
+			if (r == -1) {
+				results[i].status = errno ? -errno : -EIO;
+			} else if (r == 1) {
+				stralloc sa = {.a = 0, .len = 0, .s = NULL};
+
+				if (dns_ip4_packet(&sa, tx[i].packet, tx[i].packetlen) == -1) {
+					results[i].status = errno ? -errno : -EIO;
+					free(sa.s);
+				} else {
+					dns_packet_ttl(tx[i].packet, tx[i].packetlen, (sa.len == 0), &results[i].ttl);
+					results[i].status = sa.len / 4;
+					mangle_ip_ret(&sa, &results[i].out, &results[i].len, 0);
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (results[i].status == -EINPROGRESS)
+			results[i].status = -ETIMEDOUT;
+		dns_transmit_free(tx + i);
+		dns_domain_free(&q[i]);
+	}
+
+	free(tx);
+	free(q);
+	free(x);
+	free(xidx);
+
+	return 0;
+}
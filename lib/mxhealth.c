@@ -0,0 +1,320 @@
+/** \file mxhealth.c
+ \brief persistent database of the health of remote mail servers
+
+ Qremote is started for every single delivery, so it has no memory of hosts
+ that failed a few seconds ago. If the database directory exists Qremote
+ records the outcome of every connection in it, and hosts that failed
+ recently are tried after the healthy hosts of the same MX priority. The
+ time a host is pushed back doubles with every failure and the state is
+ forgotten after a successful connection or after MXHEALTH_EXPIRE seconds.
+ */
+
+#include <mxhealth.h>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int healthdir = -1;	/**< descriptor of the database directory, -1 if not used */
+
+/**
+ * @brief open the database directory
+ * @param dirfd descriptor of the directory the database directory is in
+ * @param dirname name of the database directory
+ * @return 0 on success, -1 on error (errno is set)
+ *
+ * If the directory does not exist the database is not used and errno is set
+ * to ENOENT.
+ */
+int
+mxhealth_open(int dirfd, const char *dirname)
+{
+	mxhealth_close();
+
+	healthdir = openat(dirfd, dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	return (healthdir < 0) ? -1 : 0;
+}
+
+/**
+ * @brief stop using the database
+ */
+void
+mxhealth_close(void)
+{
+	if (healthdir >= 0)
+		close(healthdir);
+	healthdir = -1;
+}
+
+/**
+ * @brief read the record of a host
+ * @param addr the address of the host
+ * @param rec the record is stored here
+ * @return if a valid record was found
+ */
+int
+mxhealth_get(const struct in6_addr *addr, struct mxhealth_record *rec)
+{
+	char fn[INET6_ADDRSTRLEN];
+	ssize_t r;
+	int fd;
+
+	if ((healthdir < 0) || (inet_ntop(AF_INET6, addr, fn, sizeof(fn)) == NULL))
+		return 0;
+
+	fd = openat(healthdir, fn, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	if (flock(fd, LOCK_SH) != 0) {
+		close(fd);
+		return 0;
+	}
+	r = read(fd, rec, sizeof(*rec));
+	close(fd);
+
+	return (r == (ssize_t)sizeof(*rec)) && (rec->version == MXHEALTH_VERSION);
+}
+
+/**
+ * @brief calculate the remaining backoff time of a host
+ * @param rec the record of the host
+ * @param now the current time
+ * @return how many seconds the host should still be avoided, 0 if it is healthy
+ */
+time_t
+mxhealth_backoff(const struct mxhealth_record *rec, const time_t now)
+{
+	time_t backoff = MXHEALTH_BACKOFF;
+
+	if ((rec->failures == 0) || (rec->lastfailure + MXHEALTH_EXPIRE <= now))
+		return 0;
+
+	for (uint32_t i = 1; (i < rec->failures) && (backoff < MXHEALTH_MAXBACKOFF); i++)
+		backoff *= 2;
+	if (backoff > MXHEALTH_MAXBACKOFF)
+		backoff = MXHEALTH_MAXBACKOFF;
+
+	if (rec->lastfailure + backoff <= now)
+		return 0;
+
+	return rec->lastfailure + backoff - now;
+}
+
+/**
+ * @brief check if a record has not been updated for MXHEALTH_EXPIRE seconds
+ */
+static int
+record_expired(const struct mxhealth_record *rec, const time_t now)
+{
+	const int64_t last = (rec->lastfailure > rec->lastsuccess) ? rec->lastfailure : rec->lastsuccess;
+
+	return (rec->version != MXHEALTH_VERSION) || (last + MXHEALTH_EXPIRE <= now);
+}
+
+/**
+ * @brief remove expired records from the database
+ * @param now the current time
+ *
+ * This is only done if the last cleanup was at least MXHEALTH_CLEANUP seconds
+ * ago, and only by one process at a time.
+ */
+static void
+mxhealth_cleanup(const time_t now)
+{
+	struct stat st;
+	struct dirent *de;
+	DIR *d;
+	int dfd;
+	int fd = openat(healthdir, MXHEALTH_STAMP, O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+
+	if (fd < 0)
+		return;
+
+	if ((fstat(fd, &st) != 0) || (st.st_mtime + MXHEALTH_CLEANUP > now) ||
+			(flock(fd, LOCK_EX | LOCK_NB) != 0)) {
+		close(fd);
+		return;
+	}
+
+	/* another process may have finished a cleanup in the meantime */
+	if ((fstat(fd, &st) != 0) || (st.st_mtime + MXHEALTH_CLEANUP > now) || (futimens(fd, NULL) != 0)) {
+		close(fd);
+		return;
+	}
+
+	dfd = openat(healthdir, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	d = (dfd < 0) ? NULL : fdopendir(dfd);
+	if (d == NULL) {
+		if (dfd >= 0)
+			close(dfd);
+		close(fd);
+		return;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		struct mxhealth_record rec;
+		struct in6_addr a;
+		int rfd;
+
+		/* this also skips ".", ".." and the stamp file */
+		if (inet_pton(AF_INET6, de->d_name, &a) != 1)
+			continue;
+
+		rfd = openat(healthdir, de->d_name, O_RDONLY | O_CLOEXEC);
+		if (rfd < 0)
+			continue;
+
+		/* a writer holding the lock is about to update the record */
+		if ((flock(rfd, LOCK_EX | LOCK_NB) == 0) &&
+				((read(rfd, &rec, sizeof(rec)) != (ssize_t)sizeof(rec)) || record_expired(&rec, now)))
+			unlinkat(healthdir, de->d_name, 0);
+		close(rfd);
+	}
+
+	closedir(d);
+	close(fd);
+}
+
+/**
+ * @brief record the result of a connection to a host
+ * @param addr the address of the host
+ * @param reason the result of the connection
+ * @param rtt the time in milliseconds it took to connect, only used if reason is MXHEALTH_OK
+ *
+ * Errors are silently ignored, the database is only a hint for the order in
+ * which hosts are tried. The record is locked while it is updated, so
+ * concurrent reports for the same host are not lost.
+ */
+void
+mxhealth_report(const struct in6_addr *addr, const enum mxhealth_reason reason, const unsigned int rtt)
+{
+	struct mxhealth_record rec;
+	struct stat st;
+	char fn[INET6_ADDRSTRLEN];
+	const time_t now = time(NULL);
+	int fd;
+
+	if ((healthdir < 0) || (inet_ntop(AF_INET6, addr, fn, sizeof(fn)) == NULL))
+		return;
+
+	for (;;) {
+		fd = openat(healthdir, fn, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return;
+
+		if ((flock(fd, LOCK_EX) != 0) || (fstat(fd, &st) != 0)) {
+			close(fd);
+			return;
+		}
+
+		/* the record was removed by mxhealth_cleanup() while waiting for the lock */
+		if (st.st_nlink > 0)
+			break;
+		close(fd);
+	}
+
+	if ((read(fd, &rec, sizeof(rec)) != (ssize_t)sizeof(rec)) || (rec.version != MXHEALTH_VERSION)) {
+		memset(&rec, 0, sizeof(rec));
+		rec.version = MXHEALTH_VERSION;
+	}
+
+	if (reason == MXHEALTH_OK) {
+		rec.failures = 0;
+		rec.rtt = rtt;
+		rec.lastsuccess = now;
+	} else {
+		/* old failures do not count anymore */
+		if (rec.lastfailure + MXHEALTH_EXPIRE <= now)
+			rec.failures = 0;
+		rec.failures++;
+		rec.reason = reason;
+		rec.lastfailure = now;
+	}
+
+	/* a short write leaves a short file, which is read as an empty record */
+	(void) pwrite(fd, &rec, sizeof(rec), 0);
+	close(fd);
+
+	mxhealth_cleanup(now);
+}
+
+/**
+ * @brief check if an address is currently in backoff
+ */
+static int
+in_backoff(const struct in6_addr *addr, const time_t now)
+{
+	struct mxhealth_record rec;
+
+	return mxhealth_get(addr, &rec) && (mxhealth_backoff(&rec, now) > 0);
+}
+
+/**
+ * @brief push hosts in backoff back in a sorted MX list
+ * @param p the list sorted by sortmx()
+ *
+ * Inside every entry the addresses in backoff are moved behind the others.
+ * If the first address of an entry is still in backoff afterwards, i.e. all
+ * of them are, the entry is moved behind all other entries of the same
+ * priority. The order is otherwise not changed, so hosts are never moved to a
+ * different priority class.
+ */
+void
+mxhealth_sort(struct ips **p)
+{
+	const time_t now = time(NULL);
+	struct ips **link = p;
+
+	if (healthdir < 0)
+		return;
+
+	for (struct ips *m = *p; m != NULL; m = m->next) {
+		if (m->count < 2)
+			continue;
+
+		struct in6_addr tmp[m->count];
+		unsigned short good = 0;
+		unsigned short bad = 0;
+
+		for (unsigned short i = 0; i < m->count; i++) {
+			if (!in_backoff(m->addr + i, now))
+				m->addr[good++] = m->addr[i];
+			else
+				tmp[bad++] = m->addr[i];
+		}
+
+		memcpy(m->addr + good, tmp, bad * sizeof(*tmp));
+	}
+
+	while (*link != NULL) {
+		const unsigned int prio = (*link)->priority;
+		struct ips *badhead = NULL;
+		struct ips **badlink = &badhead;
+		struct ips *m = *link;
+
+		while ((m != NULL) && (m->priority == prio)) {
+			struct ips *next = m->next;
+
+			if ((m->count > 0) && in_backoff(m->addr, now)) {
+				*badlink = m;
+				badlink = &m->next;
+			} else {
+				*link = m;
+				link = &m->next;
+			}
+			m = next;
+		}
+
+		/* append the entries in backoff to those of the same priority */
+		*badlink = m;
+		*link = badhead;
+		if (badlink != &badhead)
+			link = badlink;
+	}
+}
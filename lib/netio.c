@@ -22,35 +22,44 @@
 #define POLL_IN_OR_ERROR POLLIN
 #endif
 
-static char lineinbuf[1002];		/**< buffer for the line to read: max 1000 chars including CRLF,
-					 * leading extra '.', closing '\\0' */
+#ifndef NETIO_INBUF_SIZE
+#define NETIO_INBUF_SIZE	64		/**< size of the input buffer in kiB */
+#endif
+#define INBUF_SIZE	(NETIO_INBUF_SIZE * 1024)	/**< size of the input buffer */
+#define MAXLINELEN	999		/**< maximum length of an input line without CRLF: 1000 chars
+					 * including CRLF, plus a leading extra '.' */
+#define MAXLINE		(MAXLINELEN + 2)	/**< maximum length of an input line including CRLF */
+
+#if INBUF_SIZE < 4 * MAXLINE
+#error NETIO_INBUF_SIZE is too small
+#endif
+
+static char inbuf[INBUF_SIZE + 1];	/**< buffer for all input, the extra byte is for the
+					 * '\0' written by readinput() */
+static size_t inhead;			/**< offset of the first input byte not yet processed */
+static size_t intail;			/**< offset behind the last input byte */
 struct string linein = {
-	.s = lineinbuf
+	.s = inbuf
 };
-static char lineinn[sizeof(lineinbuf)];	/**< if more than one line was in linein the rest is stored here */
-static size_t linenlen;			/**< length of the lineinn */
 time_t timeout;				/**< how long to wait for data */
 
-/**
- * read the first characters of lineinn
- * @param dest destination buffer or NULL to simply drop the data
- * @param len characters to copy
- * @param droplen additional characters to drop (usually 2 to drop CRLF)
- *
- * Move the rest of the buffer content forward (if any).
- */
-static void
-get_from_inbuffer(char *dest, const size_t len, const size_t droplen)
-{
-	assert(len + droplen <= linenlen);
-	if (dest != NULL)
-		memcpy(dest, lineinn, len);
-
-	linenlen -= (len + droplen);
-	/* still data in input buffer */
-	if (linenlen != 0)
-		memmove(lineinn, lineinn + len + droplen, linenlen);
-}
+/** @brief position of net_readbody() in the input stream */
+static enum {
+	body_bol = 0,	/**< at the beginning of a line */
+	body_dot,	/**< a '.' was found at the beginning of a line */
+	body_dotcr,	/**< a '.' followed by CR was found at the beginning of a line */
+	body_line,	/**< inside a line */
+	body_cr,	/**< inside a line, the last character was CR */
+	body_skip,	/**< dropping the rest of a too long line */
+	body_skipcr,	/**< dropping the rest of a too long line, the last character was CR */
+	body_end	/**< the end of data was found, but not yet reported */
+} bodystate;
+static size_t bodylinelen;		/**< number of characters already read of the current line */
+static int bodyerr;			/**< error to report on the next call of net_readbody() */
+
+static char outbuf[4096];		/**< output collected by netnwrite() */
+static size_t outlen;			/**< length of the data in outbuf */
+int net_batching;			/**< if replies to pipelined commands are collected */
 
 #ifdef DEBUG_IO
 #include <syslog.h>
@@ -129,6 +138,10 @@ readinput(char *buffer, const size_t len, const int fatal)
 {
 	size_t retval;
 
+	/* the peer will not send anything before it has seen the replies */
+	if (net_flush() != 0)
+		return -1;
+
 	if (ssl) {
 		int r = ssl_timeoutread(timeout, buffer, len - 1);
 
@@ -188,6 +201,40 @@ readinput(char *buffer, const size_t len, const int fatal)
 	return retval;
 }
 
+/**
+ * @brief read more data into the input buffer
+ * @param fatal if connection errors should lead to program termination
+ * @return number of bytes read
+ * @retval -1 on error (errno is set)
+ *
+ * If the buffer is empty reading starts again at its beginning. If there is
+ * not enough space left for a complete line behind the unprocessed data this
+ * data is moved to the front of the buffer. Both may overwrite the line
+ * returned by the last call to net_read().
+ */
+static size_t
+fill_input(const int fatal)
+{
+	size_t r;
+
+	if (inhead == intail) {
+		inhead = 0;
+		intail = 0;
+	} else if (intail + MAXLINE > INBUF_SIZE) {
+		/* callers only ask for more data if there is no complete line in buffer */
+		assert(intail - inhead < MAXLINE);
+		memmove(inbuf, inbuf + inhead, intail - inhead);
+		intail -= inhead;
+		inhead = 0;
+	}
+
+	r = readinput(inbuf + intail, sizeof(inbuf) - intail, fatal);
+	if (r != (size_t) -1)
+		intail += r;
+
+	return r;
+}
+
 /**
  * detect the end of the first line in the given buffer
  *
@@ -247,171 +294,144 @@ find_eol(const char *buffer, const size_t buflen, int *valid)
 }
 
 /**
- * read input until a line with a valid length is in buffer
- * @param has_cr if the previous buffer ended with CR
+ * @brief drop input until the end of a too long line
+ * @param has_cr if the part already dropped ended with CR
+ *
+ * The idea here is to read input until we find a valid line end (CRLF),
+ * drop everything until this point (i.e. the too long line) and keep
+ * the rest in the buffer, but still return with an error code.
  *
  * This function will set errno to the proper error code before
  * returning.
  */
 static void
-loop_long(int has_cr)
+skip_long(int has_cr)
 {
 	const char *p;
+
 	do {
+		const char *start;
 		int valid;
-		/* The idea here is to read input until we find a valid line end (CRLF),
-		 * drop everything until this point (i.e. the too long line) and keep
-		 * the rest in the buffer, but still return with an error code. */
-		linenlen = readinput(lineinbuf, sizeof(lineinbuf), 1);
-
-		if (linenlen == (size_t) -1) {
-			/* reset that to 0, otherwise it will confuse net_read() */
-			linenlen = 0;
+
+		if ((inhead == intail) && (fill_input(1) == (size_t) -1))
 			return;
-		}
+
+		start = inbuf + inhead;
 		/* detect if the linebreak is interrupted by buffer end */
-		if (has_cr && (lineinbuf[0] == '\n')) {
-			p = lineinbuf + 1;
-			linenlen--;
+		if (has_cr && (*start == '\n')) {
+			inhead++;
 			break;
 		}
 		has_cr = 0;
 
-		p = find_eol(lineinbuf, linenlen, &valid);
+		p = find_eol(start, intail - inhead, &valid);
 
-		if (!valid && (p == lineinbuf + linenlen) && (*(p - 1) == '\r')) {
+		if (!valid && (p == inbuf + intail) && (*(p - 1) == '\r')) {
 			/* we need to read more data */
 			has_cr = 1;
+			inhead = intail;
 		} else if (p != NULL) {
 			/* skip the broken part */
-			linenlen -= (p - lineinbuf);
+			inhead = p - inbuf;
+		} else {
+			inhead = intail;
 		}
 	} while ((p == NULL) || has_cr);
 
-	memcpy(lineinn, p, linenlen);
 	errno = E2BIG;
 }
 
 /**
- * @brief read one line from the network
+ * @brief read one line from the network without copying it
+ * @param line the line is stored here, without the trailing CRLF
  * @param fatal if connection errors should lead to program termination
  * @retval 0 on success
  * @retval -1 on error (errno is set)
  *
+ * The returned line points into the input buffer and is terminated by '\0'.
+ * It stays valid until the next call to net_read(), net_readview(),
+ * net_readline(), or net_readbody(). net_readbin() does not touch it.
+ * linein is set to the same line, so callers using it keep working.
+ *
  * does not return on timeout, program will be cancelled
  */
 int
-net_read(const int fatal)
+net_readview(cstring *line, const int fatal)
 {
-	size_t readoffset = 0;
-	const char *p;
-	int valid;
+	for (;;) {
+		char *start = inbuf + inhead;
+		const size_t avail = intail - inhead;
+		const size_t window = (avail < MAXLINE) ? avail : MAXLINE;
+		int valid;
+		const char *p = find_eol(start, window, &valid);
 
-	if (linenlen) {
-		p = find_eol(lineinn, linenlen, &valid);
+		/* RfC 2821, section 2.3.7:
+		 * "Conforming implementations MUST NOT recognize or generate any other
+		 * character or character sequence [than <CRLF>] as a line terminator" */
 
 		if (valid) {
-			linein.len = p - lineinn - 2;
-			get_from_inbuffer(lineinbuf, linein.len, 2);
-			lineinbuf[linein.len] = '\0';
+			linein.s = start;
+			linein.len = p - start - 2;
+			linein.s[linein.len] = '\0';
+			inhead += p - start;
+
+			line->s = linein.s;
+			line->len = linein.len;
 
 			DEBUG_IN(linein.len);
 			return 0;
-		/* neither is found, so everything currently in the
-		 * buffer is read, and more must be read from network */
-		} else if ((p == NULL) ||
-		/* only CR is found and it is at the end of the input buffer */
-				((*(p - 1) == '\r') && (p == lineinn + linenlen))) {
-			readoffset = linenlen;
-			memcpy(lineinbuf, lineinn, linenlen);
-			linenlen = 0;
-		/* something went wrong */
-		} else {
-			get_from_inbuffer(NULL, 0, p - lineinn);
+		} else if ((p != NULL) && ((p != start + window) || (*(p - 1) != '\r'))) {
+			/* something went wrong, drop the broken part */
+			inhead += p - start;
 			errno = EINVAL;
 			return -1;
-		}
-	}
-
-	do {
-		size_t datain = readinput(lineinbuf + readoffset, sizeof(lineinbuf) - readoffset, fatal);
-		/* now the first readoffset characters of linein are filled with the stuff from the last buffer (if any),
-		 * the next datain characters are filled with the data just read, then there is a '\0' */
-
-		if (datain == (size_t) -1)
+		} else if (window == MAXLINE) {
+			/* Either neither CR nor LF is found in a whole line, or a CR was
+			 * found just at the end. Drop the too long line, find out if an
+			 * LF follows in the latter case. */
+			inhead += window;
+			skip_long(p != NULL);
 			return -1;
-
-		/* RfC 2821, section 2.3.7:
-		 * "Conforming implementations MUST NOT recognize or generate any other
-		 * character or character sequence [than <CRLF>] as a line terminator" */
-
-		readoffset += datain;
-
-		p = find_eol(lineinbuf, readoffset, &valid);
-
-		/* a CR was found at the current end of the input, but there is more
-		 * space to read more data (i.e. the line is not yet too long). Try again
-		 * to see if the next byte would be just the missing LF */
-		if (!valid && (p == lineinbuf + readoffset) && (readoffset < sizeof(lineinbuf) - 1) &&
-				(*(p - 1) == '\r')) {
-			p = NULL;
-			continue;
-		}
-	} while ((p == NULL) && (readoffset < sizeof(lineinbuf) - 1));
-
-	if (valid) {
-		linein.len = p - lineinbuf - 2;
-		lineinbuf[linein.len] = '\0';
-		/* if there is more data put it back into the buffer */
-		if (p != lineinbuf + readoffset) {
-			linenlen = readoffset - (p - lineinbuf);
-			if (linenlen != 0)
-				memcpy(lineinn, p, linenlen);
 		}
 
-		/* do this again here: if there is a broken client that
-		 * handles '.' duplication in data phase wrong this allows
-		 * smtp_data to get his '\n.\n' and throw him out. If he
-		 * is broken once why not twice? */
+		/* neither CR nor LF is found, or only the CR at the end of input,
+		 * but the line is not yet too long: read more data */
+		if (fill_input(fatal) == (size_t) -1)
+			return -1;
+	}
+}
 
-		DEBUG_IN(linein.len);
+/**
+ * @brief read one line from the network
+ * @param fatal if connection errors should lead to program termination
+ * @retval 0 on success
+ * @retval -1 on error (errno is set)
+ *
+ * The line is returned in linein, see net_readview().
+ *
+ * does not return on timeout, program will be cancelled
+ */
+int
+net_read(const int fatal)
+{
+	cstring line;
 
-		return 0;
-	} else if (p == NULL) {
-		/* the whole buffer is filled, but neither CR nor LF is found */
-		loop_long(0);
-		return -1;
-	} else if ((p == lineinbuf + sizeof(lineinbuf) - 1) && (*(p - 1) == '\r')) {
-		/* We found a CR, but a too long line. Let's find out if an LF will follow. */
-		loop_long(1);
-		return -1;
-	} else {
-		/* copy the rest of the input buffer back to lineinn, then return error */
-		if (p != lineinbuf + readoffset) {
-			linenlen = readoffset - (p - lineinbuf);
-			if (linenlen != 0)
-				memcpy(lineinn, p, linenlen);
-		}
-		errno = EINVAL;
-		return -1;
-	}
+	return net_readview(&line, fatal);
 }
 
 /**
- * write one line to the network
+ * write data to the network
  *
- * @param s line to be written (nothing else it written so it should contain CRLF)
+ * @param s data to be written
  * @param l length of s
  * @retval 0 on success
  * @retval -1 on error (errno is set)
  *
  * does not return on timeout, program will be cancelled
  */
-int
-netnwrite(const char *s, const size_t l)
+static int
+write_out(const char *s, const size_t l)
 {
-	DEBUG_OUT(s, l);
-
 	if (ssl) {
 		int r = ssl_timeoutwrite(timeout, s, l);
 		switch (r) {
@@ -455,6 +475,85 @@ netnwrite(const char *s, const size_t l)
 	}
 }
 
+/**
+ * @brief check if the client has already sent another complete command
+ */
+static int
+command_pending(void)
+{
+	return memchr(inbuf + inhead, '\n', intail - inhead) != NULL;
+}
+
+/**
+ * @brief send out all collected output
+ * @retval 0 on success
+ * @retval -1 on error (errno is set)
+ */
+int
+net_flush(void)
+{
+	const size_t len = outlen;
+
+	if (len == 0)
+		return 0;
+
+	/* reset first, a write error may end in dieerror() which flushes again */
+	outlen = 0;
+	return write_out(outbuf, len);
+}
+
+/**
+ * @brief get the input already received but not yet processed
+ * @param buf a pointer to the data is stored here
+ * @return length of the data
+ *
+ * This does not look for data that is pending on the connection itself, use
+ * data_pending() for that.
+ */
+size_t
+net_buffered(const char **buf)
+{
+	*buf = inbuf + inhead;
+	return intail - inhead;
+}
+
+/**
+ * write one line to the network
+ *
+ * @param s line to be written (nothing else it written so it should contain CRLF)
+ * @param l length of s
+ * @retval 0 on success
+ * @retval -1 on error (errno is set)
+ *
+ * does not return on timeout, program will be cancelled
+ *
+ * If net_batching is set and the client has already sent the next command
+ * the data is only collected. It is sent together with the reply to the last
+ * command of the pipelined group, or before the next blocking read, so a
+ * whole group is answered with one write or one TLS record.
+ */
+int
+netnwrite(const char *s, const size_t l)
+{
+	DEBUG_OUT(s, l);
+
+	if ((net_batching && command_pending()) || (outlen != 0)) {
+		if (outlen + l <= sizeof(outbuf)) {
+			memcpy(outbuf + outlen, s, l);
+			outlen += l;
+			if (net_batching && command_pending())
+				return 0;
+			return net_flush();
+		}
+
+		/* too much data, send what was collected to keep the order */
+		if (net_flush() != 0)
+			return -1;
+	}
+
+	return write_out(s, l);
+}
+
 /**
  * write one line to the network, fold if needed
  *
@@ -597,19 +696,15 @@ net_write_multiline(const char *const *s)
 size_t
 net_readbin(size_t num, char *buf)
 {
-	size_t offs = 0;
+	const size_t avail = intail - inhead;
+	size_t offs = (avail < num) ? avail : num;
 
-	if (linenlen) {
-		if (linenlen > num) {
-			get_from_inbuffer(buf, num, 0);
-			return num;
-		} else {
-			memcpy(buf, lineinn, linenlen);
-			num -= linenlen;
-			offs = linenlen;
-			linenlen = 0;
-		}
-	}
+	memcpy(buf, inbuf + inhead, offs);
+	inhead += offs;
+	num -= offs;
+
+	/* read the rest directly into the output buffer, this does not read
+	 * more than requested so nothing has to be put back into the buffer */
 	while (num) {
 		size_t r;
 
@@ -625,7 +720,7 @@ net_readbin(size_t num, char *buf)
 /**
  * read up to a given number of bytes from network but stop at the first CRLF
  *
- * @param num number of bytes to read, must be < 1002 so everything behind the CRLF can be copied back to lineinn
+ * @param num number of bytes to read
  * @param buf buffer to store data (must have enough space)
  * @return number of bytes read
  * @retval -1 on error
@@ -640,114 +735,236 @@ size_t
 net_readline(size_t num, char *buf)
 {
 	size_t offs = 0;
-	const char *n;
-	int valid;
 
-	if (linenlen) {
-		int done;	/* if function must return after copying */
+	while (num) {
+		const char *start;
+		const char *n;
+		size_t avail;
+		size_t cp;
+		int valid;
 
-		/* LF found at start of buffer (user needs to check for CRLF wrap himself) */
-		if (lineinn[0] == '\n') {
-			get_from_inbuffer(buf, 1, 0);
-			return 1;
+		if ((inhead == intail) && (fill_input(1) == (size_t) -1))
+			return -1;
+
+		start = inbuf + inhead;
+		avail = intail - inhead;
+
+		/* First check for an LF at the start of the buffer: it either
+		 * completes a CRLF wrap or the user needs to check for the wrap
+		 * himself. This makes the other code simpler. */
+		if (*start == '\n') {
+			buf[offs] = *start;
+			inhead++;
+			return offs + 1;
+		} else if ((offs > 0) && (buf[offs - 1] == '\r')) {
+			/* crap detected */
+			errno = EINVAL;
+			return -1;
 		}
 
-		n = find_eol(lineinn, linenlen, &valid);
-		/* copy data to the user if:
-		 * -everything is fine, i.e. valid EOL found
-		 * -no EOL found
-		 * -CR is found at end of buffer
-		 */
-		if (valid || ((n == lineinn + linenlen) && (*(n - 1) == '\r'))) {
-			/* Found a valid linebreak or part of it.
-			 * If the input buffer has more data than the user
-			 * requested copy part of it, otherwise drain the buffer
-			 * and return. */
-			if (n >= lineinn + num) {
-				offs = num;
-				done = 1;
-			} else {
-				offs = n - lineinn;
-				/* if the last we have in buffer is CR, but
-				 * we are asked to read more: read more. */
-				done = valid;
-			}
-		} else if (n == NULL) {
-			/* no linebreak found */
-			if (linenlen >= num) {
-				offs = num;
-				done = 1;
-			} else {
-				offs = linenlen;
-				done = 0;
-			}
+		/* Now we know that there is neither CR nor LF in buf as we would
+		 * have detected that before. All further CRLF detection can be
+		 * limited to the input buffer. */
+		n = find_eol(start, avail, &valid);
+
+		if (n == NULL) {
+			/* neither CR nor LF in buffer: copy as much as requested */
+			cp = (avail < num) ? avail : num;
+		} else if (valid || ((n == start + avail) && (*(n - 1) == '\r'))) {
+			/* Found a valid linebreak or part of it. If the last we
+			 * have in buffer is CR, but we are asked to read more:
+			 * read more. */
+			cp = n - start;
+			if (cp >= num)
+				cp = num;
+			else if (valid)
+				num = cp;
 		} else {
 			/* invalid CRLF detected */
-			get_from_inbuffer(NULL, 0, n - lineinn);
+			inhead += n - start;
 			errno = EINVAL;
 			return -1;
 		}
 
-		get_from_inbuffer(buf, offs, 0);
-
-		if (done)
-			return offs;
-		num -= offs;
+		memcpy(buf + offs, start, cp);
+		inhead += cp;
+		offs += cp;
+		num -= cp;
 	}
-	while (num) {
-		/* do not directly read into the output buffer here. readinput()
-		 * needs to be able to write the trailing '\0', so use the other
-		 * buffer to make sure we can fill the entire caller buffer */
-		linenlen = readinput(lineinn, sizeof(lineinn), 1);
-		if (linenlen == (size_t) -1)
-			return -1;
+	return offs;
+}
 
-		/* First check if we need to care for a CRLF wrap, this makes
-		 * the other code simpler. */
-		if ((offs > 0) && (buf[offs - 1] == '\r')) {
-			if (lineinn[0] == '\n') {
-				get_from_inbuffer(buf + offs, 1, 0);
-				return offs + 1;
+/**
+ * @brief convert the data in the input buffer to message data
+ * @param out the converted data is stored here, must not be behind the input data
+ * @param lines the number of complete lines is added here
+ * @return the first character behind the converted data
+ *
+ * This converts as much data as possible, until either the input data is
+ * exhausted, the end of data is found, or an error is detected. In the last
+ * case bodyerr is set and the input is positioned where processing can
+ * continue.
+ */
+static char *
+body_convert(char *out, size_t *lines)
+{
+	const char *in = inbuf + inhead;
+	const char *end = inbuf + intail;
+
+	while ((in < end) && (bodystate != body_end) && (bodyerr == 0)) {
+		switch (bodystate) {
+		case body_bol:
+			if (*in == '.') {
+				bodystate = body_dot;
+				bodylinelen = 1;
+				in++;
 			} else {
-				/* crap detected */
-				errno = EINVAL;
-				return -1;
+				bodystate = body_line;
+				bodylinelen = 0;
+			}
+			break;
+		case body_dot:
+			if (*in == '\r') {
+				bodystate = body_dotcr;
+				in++;
+			} else {
+				/* drop the leading dot, RfC 5321, section 4.5.2 */
+				bodystate = body_line;
+			}
+			break;
+		case body_dotcr:
+		case body_cr:
+			if (*in == '\n') {
+				in++;
+				if (bodystate == body_dotcr) {
+					bodystate = body_end;
+				} else {
+					*out++ = '\n';
+					(*lines)++;
+					bodystate = body_bol;
+				}
+			} else {
+				/* bare CR, continue behind it */
+				bodystate = body_bol;
+				bodyerr = EINVAL;
+			}
+			break;
+		case body_line: {
+			const char *cr = memchr(in, '\r', end - in);
+			const char *stop = (cr == NULL) ? end : cr;
+			const char *lf = memchr(in, '\n', stop - in);
+			size_t len;
+
+			if (lf != NULL) {
+				/* bare LF, continue behind it */
+				in = lf + 1;
+				bodystate = body_bol;
+				bodyerr = EINVAL;
+				break;
 			}
-		}
-		/* Now we know that there is neither CR nor LF in buf as we would
-		 * have detected that before. All further CRLF detection can be
-		 * limited to lineinn. */
-		n = find_eol(lineinn, linenlen, &valid);
 
-		if (n) {
-			size_t rest = lineinn + linenlen - n;
+			len = stop - in;
+			if (bodylinelen + len > MAXLINELEN) {
+				bodystate = body_skip;
+				bodyerr = E2BIG;
+				break;
+			}
 
-			if (valid || (lineinn[0] == '\n') || ((rest == 0) && (*(n - 1) == '\r'))) {
-				const size_t cp = (linenlen - rest) > num ? num : linenlen - rest;
-				get_from_inbuffer(buf + offs, cp, 0);
+			memmove(out, in, len);
+			out += len;
+			bodylinelen += len;
+			in = stop;
+			if (cr != NULL) {
+				bodystate = body_cr;
+				in++;
+			}
+			break;
+		}
+		case body_skip: {
+			const char *cr = memchr(in, '\r', end - in);
 
-				return offs + cp;
+			if (cr == NULL) {
+				in = end;
 			} else {
-				get_from_inbuffer(NULL, 0, linenlen - rest);
-				errno = EINVAL;
-				return -1;
+				bodystate = body_skipcr;
+				in = cr + 1;
 			}
-		} else {
-			/* neither CR nor LF in buffer */
-			if (linenlen >= num) {
-				/* enough to satisfy the request */
-				get_from_inbuffer(buf + offs, num, 0);
-				offs += num;
-				num = 0;
+			break;
+		}
+		case body_skipcr:
+			if (*in == '\n') {
+				bodystate = body_bol;
+				in++;
 			} else {
-				/* we still need data: copy everything we have and try again */
-				memcpy(buf + offs, lineinn, linenlen);
-				offs += linenlen;
-				num -= linenlen;
+				bodystate = body_skip;
 			}
+			break;
+		case body_end:
+			/* excluded by the loop condition */
+			break;
 		}
 	}
-	return offs;
+
+	inhead = in - inbuf;
+
+	return out;
+}
+
+/**
+ * @brief read message data in bulk
+ * @param data a pointer to the message data is stored here
+ * @param lines the number of line ends in the returned data is stored here
+ * @return number of bytes in data
+ * @retval 0 the end of data (a line containing only a '.') was reached
+ * @retval -1 on error (errno is set)
+ *
+ * This must be called at the beginning of a line. It reads as much input as
+ * is available at once and returns it with the leading dots removed and CRLF
+ * replaced by LF. The returned buffer is valid until the next call to any of
+ * the input functions.
+ *
+ * Errors are reported like net_read() does: EINVAL is returned for bare CR
+ * or LF, E2BIG for lines exceeding the SMTP line length limit. After an error
+ * the function has to be called again until the end of data is reached.
+ *
+ * Does not return on timeout, program will be cancelled.
+ */
+size_t
+net_readbody(const char **data, size_t *lines)
+{
+	char *out;
+
+	*lines = 0;
+
+	if (bodystate == body_end) {
+		bodystate = body_bol;
+		return 0;
+	} else if (bodyerr != 0) {
+		errno = bodyerr;
+		bodyerr = 0;
+		return -1;
+	}
+
+	/* the data is converted in place, the output is never longer than the input */
+	do {
+		if ((inhead == intail) && (fill_input(1) == (size_t) -1))
+			return -1;
+
+		*data = inbuf + inhead;
+		out = body_convert(inbuf + inhead, lines);
+	} while ((out == *data) && (bodystate != body_end) && (bodyerr == 0));
+
+	if (out != *data)
+		return out - *data;
+
+	if (bodystate == body_end) {
+		bodystate = body_bol;
+		return 0;
+	}
+
+	errno = bodyerr;
+	bodyerr = 0;
+	return -1;
 }
 
 /**
@@ -762,7 +979,7 @@ net_readline(size_t num, char *buf)
 int
 data_pending(void)
 {
-	if (linenlen) {
+	if (inhead != intail) {
 		return 1;
 	} else if (ssl) {
 		int i = SSL_pending(ssl);
@@ -785,11 +1002,14 @@ data_pending(void)
 
 		/* verify that there is really data available and that the
 		 * connection was not simply closed. */
-		i = read(rfd.fd, lineinn, 1);
+		/* the buffer is empty here, so there is always space at its start */
+		inhead = 0;
+		intail = 0;
+		i = read(rfd.fd, inbuf + intail, 1);
 		if (i < 0)
 			return -errno;
 		if (i > 0) {
-			linenlen = i;
+			intail += i;
 			return 1;
 		}
 		return -ECONNRESET;
@@ -4,12 +4,259 @@
 
 #include <qdns.h>
 
+#include <dnsshm.h>
 #include <libowfatconn.h>
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define DNSCACHE_SIZE	64	/**< maximum number of cached lookups */
+#define DNSCACHE_MAXTTL	3600	/**< upper limit for the lifetime of a positive result in seconds */
+#define DNSCACHE_MAXNEGTTL	900	/**< upper limit for the lifetime of a negative result in seconds */
+#define DNSCACHE_DEFTTL	30	/**< lifetime of a result if the answer has no TTL, e.g. no SOA record */
+
+/**
+ * @brief one cached lookup result
+ */
+struct dnscache_entry {
+	char *name;			/**< the name that was looked up, NULL if entry is unused */
+	char *data;			/**< the raw result as returned by the libowfatconn functions */
+	size_t len;			/**< length of data */
+	time_t expires;			/**< time when the entry becomes invalid */
+	enum dnscache_type type;	/**< record type */
+	int negative;			/**< if the name does not exist (ENOENT) */
+};
+
+static struct dnscache_entry dnscache[DNSCACHE_SIZE];
+static unsigned int dnscache_next;	/**< index of the entry to replace next */
+static unsigned long dnscache_hits;
+static unsigned long dnscache_misses;
+
+/**
+ * @brief store a result in the process local cache
+ * @param type record type
+ * @param name the name that was looked up
+ * @param negative if the name does not exist
+ * @param data the result data
+ * @param len length of data
+ * @param ttl lifetime of the entry in seconds
+ */
+static void
+dnscache_store(const enum dnscache_type type, const char *name, const int negative, const char *data,
+		const size_t len, const unsigned int ttl)
+{
+	const time_t now = time(NULL);
+	struct dnscache_entry *e = NULL;
+	char *n;
+	char *d = NULL;
+
+	n = strdup(name);
+	if ((n != NULL) && (len > 0)) {
+		d = malloc(len);
+		if (d != NULL)
+			memcpy(d, data, len);
+	}
+	if ((n == NULL) || ((len > 0) && (d == NULL))) {
+		free(n);
+		free(d);
+		return;
+	}
+
+	/* replace an entry for the same lookup */
+	for (unsigned int i = 0; i < DNSCACHE_SIZE; i++) {
+		struct dnscache_entry *c = dnscache + i;
+
+		if ((c->name != NULL) && (c->type == type) && (strcasecmp(c->name, name) == 0)) {
+			e = c;
+			break;
+		}
+	}
+
+	/* otherwise use an unused or expired one */
+	for (unsigned int i = 0; (i < DNSCACHE_SIZE) && (e == NULL); i++) {
+		struct dnscache_entry *c = dnscache + i;
+
+		if ((c->name == NULL) || (c->expires <= now))
+			e = c;
+	}
+
+	if (e == NULL) {
+		e = dnscache + dnscache_next;
+		dnscache_next = (dnscache_next + 1) % DNSCACHE_SIZE;
+	}
+
+	free(e->name);
+	free(e->data);
+	e->name = n;
+	e->data = d;
+	e->len = len;
+	e->type = type;
+	e->negative = negative;
+	e->expires = now + ttl;
+}
+
+/**
+ * @brief look up a result in the cache
+ * @param type record type
+ * @param name the name to look up
+ * @param out a copy of the cached data is stored here
+ * @param len length of out
+ * @param ret the return value of the original lookup is stored here
+ * @return if a valid cached result was found
+ *
+ * If the result is not in the process local cache the shared cache is asked.
+ * Results from the shared cache are not copied to the process local cache as
+ * their remaining lifetime is not known. If a negative result is returned
+ * errno is set to ENOENT.
+ */
+static int
+dnscache_get(const enum dnscache_type type, const char *name, char **out, size_t *len, int *ret)
+{
+	const time_t now = time(NULL);
+	int negative;
+
+	for (unsigned int i = 0; i < DNSCACHE_SIZE; i++) {
+		struct dnscache_entry *e = dnscache + i;
+
+		if ((e->name == NULL) || (e->type != type) || (strcasecmp(e->name, name) != 0))
+			continue;
+
+		if (e->expires <= now)
+			break;
+
+		*out = NULL;
+		*len = e->len;
+		if (e->len > 0) {
+			*out = malloc(e->len);
+			/* just do a real lookup instead */
+			if (*out == NULL)
+				break;
+			memcpy(*out, e->data, e->len);
+		}
+
+		negative = e->negative;
+		goto hit;
+	}
+
+	if (dnsshm_get(type, name, out, len, &negative))
+		goto hit;
+
+	dnscache_misses++;
+	return 0;
+
+hit:
+	dnscache_hits++;
+	if (negative) {
+		*ret = -1;
+		errno = ENOENT;
+	} else {
+		*ret = 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief store a lookup result in the cache
+ * @param type record type
+ * @param name the name that was looked up
+ * @param ret return value of the lookup function
+ * @param data the result data
+ * @param len length of data
+ * @param ttl the lifetime of the DNS answer in seconds
+ *
+ * Only successful lookups and lookups of names that do not exist are cached,
+ * errors are not. The entry is kept for the TTL of the answer, but at most for
+ * DNSCACHE_MAXTTL or DNSCACHE_MAXNEGTTL seconds. The result is also stored in
+ * the shared cache. errno is preserved.
+ */
+static void
+dnscache_put(const enum dnscache_type type, const char *name, const int ret, const char *data, const size_t len,
+		unsigned int ttl)
+{
+	const int olderrno = errno;
+	const unsigned int maxttl = ((ret != 0) || (len == 0)) ? DNSCACHE_MAXNEGTTL : DNSCACHE_MAXTTL;
+
+	if (((ret != 0) && (errno != ENOENT)) || (ttl == 0))
+		return;
+
+	if (ttl > maxttl)
+		ttl = maxttl;
+
+	dnscache_store(type, name, ret != 0, data, len, ttl);
+	dnsshm_put(type, name, ret != 0, data, len, ttl);
+
+	errno = olderrno;
+}
+
+/**
+ * @brief get the statistics of the DNS cache
+ * @param hits number of lookups answered from the cache
+ * @param misses number of lookups that needed a DNS query
+ */
+void
+dnscache_stats(unsigned long *hits, unsigned long *misses)
+{
+	*hits = dnscache_hits;
+	*misses = dnscache_misses;
+}
+
+/**
+ * @brief remove all entries from the DNS cache
+ *
+ * The statistics are reset, too.
+ */
+void
+dnscache_clear(void)
+{
+	for (unsigned int i = 0; i < DNSCACHE_SIZE; i++) {
+		free(dnscache[i].name);
+		free(dnscache[i].data);
+		dnscache[i].name = NULL;
+		dnscache[i].data = NULL;
+	}
+	dnscache_next = 0;
+	dnscache_hits = 0;
+	dnscache_misses = 0;
+}
+
+/**
+ * @brief dnsip4(), dnsip6() or dnsmx() with cached results
+ * @param type record type
+ * @param out result string will be stored here, memory is malloced
+ * @param len length of out
+ * @param name host name to look up
+ * @return the same values as the libowfatconn functions
+ */
+static int
+cached_lookup(const enum dnscache_type type, char **out, size_t *len, const char *name)
+{
+	unsigned int ttl = DNSCACHE_DEFTTL;
+	int r;
+
+	if (dnscache_get(type, name, out, len, &r))
+		return r;
+
+	switch (type) {
+	case DNSCACHE_A:
+		r = dnsip4(out, len, name, &ttl);
+		break;
+	case DNSCACHE_AAAA:
+		r = dnsip6(out, len, name, &ttl);
+		break;
+	default:
+		r = dnsmx(out, len, name, &ttl);
+		break;
+	}
+
+	dnscache_put(type, name, r, *out, *len, ttl);
+
+	return r;
+}
 
 /**
  * \brief get info out of the DNS
@@ -31,7 +278,7 @@ ask_dnsmx(const char *name, struct ips **result)
 	char *s;
 	int errtype = 0;
 
-	i = dnsmx(&r, &l, name);
+	i = cached_lookup(DNSCACHE_MX, &r, &l, name);
 
 	if ((i != 0) && (errno != ENOENT)) {
 		switch (errno) {
@@ -159,7 +406,7 @@ ask_dnsaaaa(const char *name, struct in6_addr **result)
 
 	*result = NULL;
 
-	i = dnsip6(&r, &l, name);
+	i = cached_lookup(DNSCACHE_AAAA, &r, &l, name);
 	if (i < 0) {
 		free(r);
 		switch (errno) {
@@ -217,7 +464,7 @@ ask_dnsa(const char *name, struct in6_addr **result)
 	size_t l;
 	unsigned int idx = 0;
 
-	i = dnsip4(&r, &l, name);
+	i = cached_lookup(DNSCACHE_A, &r, &l, name);
 	if (i < 0) {
 		switch (errno) {
 		case ETIMEDOUT:
@@ -264,6 +511,117 @@ ask_dnsa(const char *name, struct in6_addr **result)
 	return idx;
 }
 
+#define DNS_PARALLEL_TIMEOUT	30	/**< maximum time in seconds for all parallel queries together */
+
+/**
+ * \brief look up the IPv4 addresses of multiple hosts in parallel
+ *
+ * \param names the names to look up
+ * \param count number of entries in names
+ * \param results the result for every name is stored here
+ * \retval 0 the lookups were done
+ * \retval DNS_ERROR_LOCAL on error (errno is set)
+ *
+ * Every entry in results gets the value ask_dnsa() would return for the name.
+ * All queries are sent at once and the function returns as soon as the first
+ * name in list order that has an address is known. Queries that are still
+ * pending at this point or when the timeout expires are set to DNS_ERROR_TEMP.
+ * If a local error happens for a single name DNS_ERROR_LOCAL is set for it and
+ * errno is set accordingly.
+ *
+ * The results are taken from and stored in the cache like for ask_dnsa(). If
+ * a cached name has addresses the names following it are not looked up.
+ */
+int
+ask_dnsa_parallel(const char *const *names, const unsigned int count, int *results)
+{
+	if (count == 0)
+		return 0;
+
+	const char *queries[count];
+	unsigned int qidx[count];
+	struct dnsip4_result answers[count];
+	unsigned int n = 0;
+	int localerr = 0;	/* errno of the first local error */
+
+	for (unsigned int i = 0; i < count; i++) {
+		char *out;
+		size_t l;
+		int r;
+
+		if (!dnscache_get(DNSCACHE_A, names[i], &out, &l, &r)) {
+			queries[n] = names[i];
+			answers[n].ttl = DNSCACHE_DEFTTL;
+			qidx[n++] = i;
+			continue;
+		}
+
+		free(out);
+		results[i] = (r == 0) ? (int)(l / 4) : 0;
+		if (results[i] > 0) {
+			/* the same as if the queries had been aborted */
+			for (unsigned int k = i + 1; k < count; k++)
+				results[k] = DNS_ERROR_TEMP;
+			break;
+		}
+	}
+
+	if (n == 0)
+		return 0;
+
+	if (dnsip4_parallel(queries, n, answers, DNS_PARALLEL_TIMEOUT) != 0) {
+		switch (errno) {
+		case ENFILE:
+		case EMFILE:
+		case ENOBUFS:
+			errno = ENOMEM;
+			break;
+		default:
+			break;
+		}
+		return DNS_ERROR_LOCAL;
+	}
+
+	for (unsigned int k = 0; k < n; k++) {
+		int *res = results + qidx[k];
+
+		*res = answers[k].status;
+		if (*res >= 0) {
+			dnscache_put(DNSCACHE_A, queries[k], 0, answers[k].out, answers[k].len, answers[k].ttl);
+			free(answers[k].out);
+			continue;
+		}
+
+		switch (-*res) {
+		case ETIMEDOUT:
+		case EAGAIN:
+			*res = DNS_ERROR_TEMP;
+			break;
+		case ENFILE:
+		case EMFILE:
+		case ENOBUFS:
+		case ENOMEM:
+			if (localerr == 0)
+				localerr = ENOMEM;
+			*res = DNS_ERROR_LOCAL;
+			break;
+		case ENOENT:
+			errno = ENOENT;
+			dnscache_put(DNSCACHE_A, queries[k], -1, NULL, 0, answers[k].ttl);
+			*res = 0;
+			break;
+		default:
+			*res = DNS_ERROR_PERM;
+		}
+	}
+
+	/* later entries must not hide the error of an entry set to DNS_ERROR_LOCAL */
+	if (localerr != 0)
+		errno = localerr;
+
+	return 0;
+}
+
 /**
  * \brief get host name for IP address
  *
@@ -278,9 +636,17 @@ ask_dnsa(const char *name, struct in6_addr **result)
 int
 ask_dnsname(const struct in6_addr *ip, char **result)
 {
+	char ipname[INET6_ADDRSTRLEN];
+	size_t l;
 	int r;
 
-	r = dnsname(result, ip);
+	inet_ntop(AF_INET6, ip, ipname, sizeof(ipname));
+	if (!dnscache_get(DNSCACHE_PTR, ipname, result, &l, &r)) {
+		unsigned int ttl = DNSCACHE_DEFTTL;
+
+		r = dnsname(result, ip, &ttl);
+		dnscache_put(DNSCACHE_PTR, ipname, r, *result, ((r == 0) && (*result != NULL)) ? strlen(*result) + 1 : 0, ttl);
+	}
 
 	if (!r)
 		return *result ? 1 : 0;
@@ -302,3 +668,29 @@ ask_dnsname(const struct in6_addr *ip, char **result)
 		return DNS_ERROR_PERM;
 	}
 }
+
+/**
+ * \brief get TXT record from the DNS
+ *
+ * @param out TXT record of host will be stored here, memory is malloced
+ * @param name name of host to look up
+ * @retval 0 success
+ * @retval -1 an error occurred, errno is set
+ *
+ * This is dnstxt() with cached results.
+ */
+int
+ask_dnstxt(char **out, const char *name)
+{
+	unsigned int ttl = DNSCACHE_DEFTTL;
+	size_t l;
+	int r;
+
+	if (dnscache_get(DNSCACHE_TXT, name, out, &l, &r))
+		return r;
+
+	r = dnstxt(out, name, &ttl);
+	dnscache_put(DNSCACHE_TXT, name, r, *out, ((r == 0) && (*out != NULL)) ? strlen(*out) + 1 : 0, ttl);
+
+	return r;
+}
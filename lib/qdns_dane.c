@@ -1,5 +1,6 @@
 #include <qdns_dane.h>
 
+#include <dnsshm.h>
 #include <fmt.h>
 #include <qdns.h>
 
@@ -12,6 +13,8 @@
 #define TLSA_DATA_LEN_SHA256 (256 / 8)
 #define TLSA_DATA_LEN_SHA512 (512 / 8)
 #define TLSA_MIN_RECORD_LEN 3
+#define TLSA_NEGTTL 30		/**< lifetime of a cached answer without TLSA records in seconds */
+#define TLSA_MAXTTL 86400	/**< maximum lifetime of a cached answer in seconds */
 
 static int
 free_tlsa_data(struct daneinfo **out, const int cnt)
@@ -30,7 +33,7 @@ free_tlsa_data(struct daneinfo **out, const int cnt)
 
 /* taken from dns_txt_packet() of libowfat */
 static int
-dns_tlsa_packet(struct daneinfo **out, const char *buf, unsigned int len)
+dns_tlsa_packet(struct daneinfo **out, const char *buf, unsigned int len, uint32_t *ttl)
 {
 	unsigned int pos;
 	char header[12];
@@ -105,6 +108,15 @@ dns_tlsa_packet(struct daneinfo **out, const char *buf, unsigned int len)
 					return free_tlsa_data(out, ret);
 				}
 
+				if (ttl != NULL) {
+					uint32_t t;
+
+					memcpy(&t, header + 4, sizeof(t));
+					t = ntohl(t);
+					if ((ret == 0) || (t < *ttl))
+						*ttl = t;
+				}
+
 				if (out != NULL) {
 					struct daneinfo *res = *out + ret;
 
@@ -146,6 +158,10 @@ dnstlsa(const char *host, const unsigned short port, struct daneinfo **out)
 {
 	char hostbuf[strlen("_65535._tcp.") + strlen(host) + 1];
 	char *q = NULL;
+	char *pkt;
+	size_t pktlen;
+	int negative;
+	uint32_t ttl = TLSA_NEGTTL;
 	int r;
 
 	hostbuf[0] = '_';
@@ -156,13 +172,25 @@ dnstlsa(const char *host, const unsigned short port, struct daneinfo **out)
 	if (out != NULL)
 		*out = NULL;
 
+	/* the answer packet is cached, negative answers are packets without TLSA records */
+	if (dnsshm_get(DNSCACHE_TLSA, hostbuf, &pkt, &pktlen, &negative)) {
+		r = dns_tlsa_packet(out, pkt, pktlen, NULL);
+		free(pkt);
+		return r;
+	}
+
 	if (!dns_domain_fromdot(&q, hostbuf, strlen(hostbuf)))
 		return -1;
 	if (dns_resolve(q, DNS_T_TLSA) == -1)
 		return -1;
-	r = dns_tlsa_packet(out, dns_resolve_tx.packet, dns_resolve_tx.packetlen);
+	r = dns_tlsa_packet(out, dns_resolve_tx.packet, dns_resolve_tx.packetlen, &ttl);
 	if (r < 0)
 		return r;
+	if (r == 0)
+		ttl = TLSA_NEGTTL;
+	else if (ttl > TLSA_MAXTTL)
+		ttl = TLSA_MAXTTL;
+	dnsshm_put(DNSCACHE_TLSA, hostbuf, 0, dns_resolve_tx.packet, dns_resolve_tx.packetlen, ttl);
 	dns_transmit_free(&dns_resolve_tx);
 	dns_domain_free(&q);
 
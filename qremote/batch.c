@@ -0,0 +1,137 @@
+/** \file batch.c
+ \brief parse the job lists of Qremote's batch mode
+ */
+
+#include <qremote/batch.h>
+
+#include <qremote/qremote.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int
+batch_parse(char *buf, const size_t len, struct batch_job **jobs)
+{
+	unsigned int jobcount = 0;
+	size_t rcptcount = 0;
+	size_t pos = 0;
+	char **rcpts;
+	unsigned int i;
+
+	*jobs = NULL;
+
+	/* this also makes sure every strlen() below stops inside buf */
+	if ((len == 0) || (buf[len - 1] != '\0'))
+		return -EINVAL;
+
+	/* first pass: check the syntax and count jobs and recipients */
+	while (pos < len) {
+		size_t jobrcpts = 0;
+
+		/* message file */
+		if (buf[pos] == '\0')
+			return -EINVAL;
+		pos += strlen(buf + pos) + 1;
+		/* sender */
+		if (pos == len)
+			return -EINVAL;
+		pos += strlen(buf + pos) + 1;
+		/* recipients */
+		while ((pos < len) && (buf[pos] != '\0')) {
+			pos += strlen(buf + pos) + 1;
+			jobrcpts++;
+		}
+		if ((pos == len) || (jobrcpts == 0) || (jobrcpts > INT_MAX))
+			return -EINVAL;
+		pos++;
+
+		rcptcount += jobrcpts;
+		if (++jobcount == INT_MAX)
+			return -EINVAL;
+	}
+
+	/* the recipient pointers are stored behind the jobs */
+	*jobs = malloc(jobcount * sizeof(**jobs) + rcptcount * sizeof(*rcpts));
+	if (*jobs == NULL)
+		return -ENOMEM;
+	rcpts = (char **)(*jobs + jobcount);
+
+	pos = 0;
+	for (i = 0; i < jobcount; i++) {
+		struct batch_job *job = *jobs + i;
+
+		job->msgfile = buf + pos;
+		pos += strlen(buf + pos) + 1;
+		job->sender = buf + pos;
+		pos += strlen(buf + pos) + 1;
+		job->rcpts = rcpts;
+		job->rcptcount = 0;
+		while (buf[pos] != '\0') {
+			*rcpts++ = buf + pos;
+			job->rcptcount++;
+			pos += strlen(buf + pos) + 1;
+		}
+		pos++;
+	}
+
+	return jobcount;
+}
+
+int
+batch_read(int fd, char **buf, struct batch_job **jobs)
+{
+	size_t len = 0;
+	size_t size = 0;
+	int r;
+
+	*buf = NULL;
+	*jobs = NULL;
+
+	for (;;) {
+		ssize_t cnt;
+
+		if (len == size) {
+			char *n;
+
+			size += 4096;
+			n = realloc(*buf, size);
+			if (n == NULL) {
+				free(*buf);
+				*buf = NULL;
+				return -ENOMEM;
+			}
+			*buf = n;
+		}
+
+		cnt = read(fd, *buf + len, size - len);
+		if (cnt < 0) {
+			if (errno == EINTR)
+				continue;
+			r = -errno;
+			free(*buf);
+			*buf = NULL;
+			return r;
+		} else if (cnt == 0) {
+			break;
+		}
+		len += cnt;
+	}
+
+	r = batch_parse(*buf, len, jobs);
+	if (r < 0) {
+		free(*buf);
+		*buf = NULL;
+	}
+
+	return r;
+}
+
+void
+batch_report_skipped(const int first, const int count)
+{
+	for (int i = first; i < count; i++)
+		write_status("Z4.4.2 message not sent because of an earlier error in the batch");
+}
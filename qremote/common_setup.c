@@ -6,11 +6,18 @@
 
 #include <control.h>
 #include <diropen.h>
+#include <dnsshm.h>
+#include <log.h>
+#include <mxhealth.h>
 #include <netio.h>
 #include <qdns.h>
 #include <qmaildir.h>
+#include <qremote/conn.h>
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
 #include <unistd.h>
 
 string heloname;
@@ -31,6 +38,14 @@ remote_common_setup(void)
 	if (controldir_fd < 0)
 		err_conf("cannot get a file descriptor for " AUTOQMAIL "/control");
 
+	/* the shared DNS cache is optional */
+	if ((dnsshm_open(AT_FDCWD, DNSSHM_REMOTE_FILE) != 0) && (errno != ENOENT))
+		log_write(LOG_WARNING, "cannot use shared DNS cache " AUTOQMAIL "/" DNSSHM_REMOTE_FILE);
+
+	/* the MX health database is optional, too */
+	if ((mxhealth_open(AT_FDCWD, MXHEALTH_DIR) != 0) && (errno != ENOENT))
+		log_write(LOG_WARNING, "cannot use MX health database " AUTOQMAIL "/" MXHEALTH_DIR);
+
 	if ( (j = loadoneliner(controldir_fd, "helohost", &heloname.s, 1) ) < 0 ) {
 		if ( ( j = loadoneliner(controldir_fd, "me", &heloname.s, 0) ) < 0 )
 			err_conf("can open neither control/helohost nor control/me");
@@ -47,6 +62,14 @@ remote_common_setup(void)
 
 	timeout = tmp;
 
+	if (loadintfd(openat(controldir_fd, "timeoutconnect", O_RDONLY | O_CLOEXEC), &tmp, 60) < 0)
+		err_conf("parse error in control/timeoutconnect");
+	connect_timeout = tmp;
+
+	if (loadintfd(openat(controldir_fd, "connectdelay", O_RDONLY | O_CLOEXEC), &tmp, 250) < 0)
+		err_conf("parse error in control/connectdelay");
+	connect_delay = tmp;
+
 	if (((ssize_t)loadoneliner(controldir_fd, "outgoingip", &ipbuf, 1)) >= 0) {
 		int r = inet_pton(AF_INET6, ipbuf, &outgoingip);
 
@@ -6,6 +6,7 @@
 
 #include <control.h>
 #include <log.h>
+#include <mxhealth.h>
 #include <netio.h>
 #include <qdns.h>
 #include <qremote/client.h>
@@ -16,25 +17,35 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
 unsigned int targetport = 25;
+unsigned int connect_timeout = 60;
+unsigned int connect_delay = 250;
 
 #ifndef SOCK_CLOEXEC
 #define SOCK_CLOEXEC 0
 #endif /* SOCK_CLOEXEC */
 
+#ifndef SOCK_NONBLOCK
+#define SOCK_NONBLOCK 0
+#endif /* SOCK_NONBLOCK */
+
 /**
- * @brief create a socket and connect to the given ip
+ * @brief create a socket and start connecting to the given ip
  * @param remoteip the target address
  * @param outip the local IP the connection should originate from
- * @return the socket descriptor or a negative error code
+ * @param done set to 1 if the connection was established immediately
+ * @return the nonblocking socket descriptor or a negative error code
  */
 static int
-conn(const struct in6_addr remoteip, const struct in6_addr *outip)
+conn_start(const struct in6_addr remoteip, const struct in6_addr *outip, int *done)
 {
 	int rc;
 	int sd;
@@ -42,7 +53,7 @@ conn(const struct in6_addr remoteip, const struct in6_addr *outip)
 #ifdef IPV4ONLY
 	struct sockaddr_in sock;
 
-	sd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	sd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
 
 	if (sd < 0)
 		return -errno;
@@ -62,7 +73,7 @@ conn(const struct in6_addr remoteip, const struct in6_addr *outip)
 #else
 	struct sockaddr_in6 sock;
 
-	sd = socket(PF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	sd = socket(PF_INET6, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
 
 	if (sd < 0)
 		return -errno;
@@ -85,13 +96,138 @@ conn(const struct in6_addr remoteip, const struct in6_addr *outip)
 
 	rc = connect(sd, (struct sockaddr *) &sock, sizeof(sock));
 
-	if (rc < 0) {
+	if (rc == 0) {
+		*done = 1;
+	} else if (errno == EINPROGRESS) {
+		*done = 0;
+	} else {
 		int err = errno;
 		close(sd);
 		return -err;
 	}
-	
-	return  sd;
+
+	return sd;
+}
+
+#ifndef IPV4ONLY
+/**
+ * @brief alternate the address families in the address list of a MX
+ * @param m the MX entry
+ *
+ * The family of the first address is kept first, as recommended by RFC 8305.
+ * The order of the addresses within a family is not changed.
+ */
+static void
+interleave_families(struct ips *m)
+{
+	struct in6_addr tmp[m->count];
+	const int firstv4 = IN6_IS_ADDR_V4MAPPED(m->addr);
+	unsigned short same = 0;	/* next address of the family of the first address */
+	unsigned short other = 0;	/* next address of the other family */
+
+	for (unsigned short i = 0; i < m->count; i++) {
+		const int wantsame = ((i % 2) == 0);
+		int found = 0;
+
+		/* find the next unused address of the wanted family, fall back
+		 * to the other family if there are none left */
+		for (int pass = 0; (pass < 2) && !found; pass++) {
+			const int usesame = (pass == 0) ? wantsame : !wantsame;
+			unsigned short *pos = usesame ? &same : &other;
+
+			while (*pos < m->count) {
+				const int isv4 = IN6_IS_ADDR_V4MAPPED(m->addr + *pos);
+
+				if ((isv4 == firstv4) == usesame) {
+					tmp[i] = m->addr[(*pos)++];
+					found = 1;
+					break;
+				}
+				(*pos)++;
+			}
+		}
+	}
+
+	memcpy(m->addr, tmp, m->count * sizeof(*tmp));
+}
+#endif
+
+/**
+ * @brief one connection attempt
+ */
+struct conn_attempt {
+	struct ips *mx;			/**< the MX entry */
+	unsigned int oldprio;		/**< priority of the MX before it was touched */
+	unsigned short idx;		/**< index of the address in mx */
+	int sd;				/**< socket descriptor, -1 if the attempt has failed */
+	long start;			/**< time the attempt was started in milliseconds */
+};
+
+static struct in6_addr lastaddr;	/**< address of the last connection returned by tryconn() */
+static unsigned int lastrtt;		/**< time it took to establish that connection */
+
+/**
+ * @brief advance to the next address to try
+ * @param mx list of IP adresses
+ * @param cur_s index of the current address in the current MX entry
+ * @param oldprio the priority of the returned entry before it was marked is stored here
+ * @return the MX entry of the next address, NULL if none is left
+ */
+static struct ips *
+next_address(struct ips *mx, unsigned short *cur_s, unsigned int *oldprio)
+{
+	struct ips *thisip;
+
+	for (thisip = mx; thisip; thisip = thisip->next) {
+		if (thisip->priority == MX_PRIORITY_CURRENT) {
+			if (*cur_s < thisip->count - 1) {
+				(*cur_s)++;
+				*oldprio = MX_PRIORITY_CURRENT;
+				break;
+			} else {
+				thisip->priority = MX_PRIORITY_USED;
+			}
+		} else if (thisip->priority <= 65536) {
+			*cur_s = 0;
+			*oldprio = thisip->priority;
+			/* set priority to MX_PRIORITY_CURRENT so this can be identified */
+			thisip->priority = MX_PRIORITY_CURRENT;
+#ifndef IPV4ONLY
+			interleave_families(thisip);
+#endif
+			break;
+		}
+	}
+
+	return thisip;
+}
+
+/**
+ * @brief check if a connection attempt failed because of the remote host
+ * @param err the negative error code
+ */
+static int
+remote_error(const int err)
+{
+	switch (-err) {
+	case ECONNREFUSED:
+	case ECONNRESET:
+	case EHOSTUNREACH:
+	case ENETUNREACH:
+	case ETIMEDOUT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static long
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 /**
@@ -102,53 +238,203 @@ conn(const struct in6_addr remoteip, const struct in6_addr *outip)
  * @param outip6 local IPv6 to bind
  * @return the socket descriptor of the open connection
  * @retval -ENOENT no IP address left to connect to
+ * @retval -ETIMEDOUT no connection was established within connect_timeout
+ *
+ * The addresses are tried in the order of the list. A new connection attempt
+ * is started every connect_delay milliseconds, or immediately once all
+ * running attempts have failed, while the previous attempts continue. The
+ * first connection that is established is used, all others are closed. No new
+ * attempt is started once connect_timeout has expired.
  *
  * Every entry where a connection attempt was made is marked with a priority of
- * MX_PRIORITY_USED, the last one tried with MX_PRIORITY_CURRENT.
+ * MX_PRIORITY_USED, the one the connection was established to with
+ * MX_PRIORITY_CURRENT. Attempts to addresses after that one in the list that
+ * were aborted are not marked, so they are tried again on the next call.
  */
 int
 tryconn(struct ips *mx, const struct in6_addr *outip4, const struct in6_addr *outip6)
 {
 	static unsigned short cur_s;
+	struct ips *thisip;
+	struct conn_attempt *att;
+	unsigned int total = 0;
+	unsigned int started = 0;
+	unsigned int pending = 0;
+	int winner = -1;
+	int exhausted = 0;
+	int expired = 0;
+	const long deadline = now_ms() + (long)connect_timeout * 1000;
+	long nextstart = 0;
+
+	for (thisip = mx; thisip; thisip = thisip->next)
+		total += thisip->count;
+
+	att = calloc(total ? total : 1, sizeof(*att));
+	if (att == NULL)
+		err_mem(0);
 
-	while (1) {
-		struct ips *thisip;
-		const struct in6_addr *outip;
-		int sd;
+	while (winner < 0) {
+		const long now = now_ms();
 
-		for (thisip = mx; thisip; thisip = thisip->next) {
-			if (thisip->priority == MX_PRIORITY_CURRENT) {
-				if (cur_s < thisip->count - 1) {
-					cur_s++;
-					break;
-				} else {
-					thisip->priority = MX_PRIORITY_USED;
-				}
-			} else if (thisip->priority <= 65536) {
-				cur_s = 0;
-				/* set priority to MX_PRIORITY_CURRENT so this can be identified */
-				thisip->priority = MX_PRIORITY_CURRENT;
-				break;
-			}
+		if (!exhausted && (now >= deadline)) {
+			/* the remaining addresses are left untouched for the next call */
+			exhausted = 1;
+			expired = 1;
 		}
-		if (!thisip)
-			return -ENOENT;
+
+		if (!exhausted && ((pending == 0) || (now >= nextstart))) {
+			const struct in6_addr *outip;
+			struct conn_attempt *a = att + started;
+			int done = 0;
+
+			if (started == total)
+				thisip = NULL;
+			else
+				thisip = next_address(mx, &cur_s, &a->oldprio);
+			if (thisip == NULL) {
+				exhausted = 1;
+				continue;
+			}
 
 #ifdef IPV4ONLY
-		(void) outip6;
+			(void) outip6;
 #else
-		if (!IN6_IS_ADDR_V4MAPPED(thisip->addr + cur_s))
-			outip = outip6;
-		else
+			if (!IN6_IS_ADDR_V4MAPPED(thisip->addr + cur_s))
+				outip = outip6;
+			else
 #endif
-			outip = outip4;
+				outip = outip4;
+
+			a->mx = thisip;
+			a->idx = cur_s;
+			a->start = now;
+			a->sd = conn_start(thisip->addr[cur_s], outip, &done);
+			started++;
+
+			if (remote_error(a->sd))
+				mxhealth_report(thisip->addr + cur_s, MXHEALTH_CONNECT, 0);
+
+			if (a->sd >= 0) {
+				if (done)
+					winner = started - 1;
+				pending++;
+				nextstart = now + connect_delay;
+			}
+			continue;
+		}
+
+		if (pending == 0) {
+			free(att);
+			return expired ? -ETIMEDOUT : -ENOENT;
+		}
 
-		sd = conn(thisip->addr[cur_s], outip);
-		if (sd >= 0) {
-			getrhost(thisip, cur_s);
-			return sd;
+		if (now >= deadline)
+			break;
+
+		{
+			struct pollfd fds[pending];
+			unsigned int idx[pending];
+			unsigned int n = 0;
+			long wait = deadline - now;
+
+			if (!exhausted && (nextstart - now < wait))
+				wait = nextstart - now;
+
+			for (unsigned int i = 0; i < started; i++) {
+				if (att[i].sd < 0)
+					continue;
+				fds[n].fd = att[i].sd;
+				fds[n].events = POLLOUT;
+				fds[n].revents = 0;
+				idx[n++] = i;
+			}
+
+			if (poll(fds, n, wait) < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+
+			for (unsigned int i = 0; i < n; i++) {
+				struct conn_attempt *a = att + idx[i];
+				int err = 0;
+				socklen_t errlen = sizeof(err);
+
+				if (fds[i].revents == 0)
+					continue;
+
+				if ((getsockopt(a->sd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0) && (err == 0)) {
+					/* the attempts are ordered, so the first one in the list wins */
+					if ((winner < 0) || (idx[i] < (unsigned int)winner))
+						winner = idx[i];
+				} else {
+					if (remote_error(-err))
+						mxhealth_report(a->mx->addr + a->idx, (err == ETIMEDOUT) ? MXHEALTH_TIMEOUT : MXHEALTH_CONNECT, 0);
+					close(a->sd);
+					a->sd = -1;
+					pending--;
+				}
+			}
 		}
 	}
+
+	/* close all other connections */
+	for (unsigned int i = 0; i < started; i++) {
+		if ((att[i].sd >= 0) && ((int)i != winner)) {
+			if ((winner < 0) && (now_ms() >= deadline))
+				mxhealth_report(att[i].mx->addr + att[i].idx, MXHEALTH_TIMEOUT, 0);
+			close(att[i].sd);
+		}
+	}
+
+	if (winner < 0) {
+		free(att);
+		return -ETIMEDOUT;
+	}
+
+	lastaddr = att[winner].mx->addr[att[winner].idx];
+	lastrtt = now_ms() - att[winner].start;
+
+	/* addresses behind the winner have not really been tried, restore
+	 * the state so they will be used on the next call */
+	for (unsigned int i = started - 1; i > (unsigned int)winner; i--) {
+		if ((att[i].idx == 0) && (att[i].mx != att[winner].mx))
+			att[i].mx->priority = att[i].oldprio;
+	}
+	thisip = att[winner].mx;
+	thisip->priority = MX_PRIORITY_CURRENT;
+	cur_s = att[winner].idx;
+
+	{
+		const int sd = att[winner].sd;
+		const int flags = fcntl(sd, F_GETFL);
+
+		free(att);
+
+		/* the rest of the program expects a blocking socket */
+		if ((flags < 0) || (fcntl(sd, F_SETFL, flags & ~O_NONBLOCK) < 0)) {
+			const int err = errno;
+
+			close(sd);
+			return -err;
+		}
+
+		getrhost(thisip, cur_s);
+		return sd;
+	}
+}
+
+/**
+ * @brief record the result of the connection returned by the last tryconn() call
+ * @param reason the result of the connection
+ *
+ * The result is stored in the MX health database so hosts that fail are
+ * tried later on the next deliveries, see mxhealth_sort().
+ */
+void
+tryconn_report(const enum mxhealth_reason reason)
+{
+	mxhealth_report(&lastaddr, reason, lastrtt);
 }
 
 /**
@@ -9,6 +9,7 @@
 #include <qdns.h>
 #include <qremote/client.h>
 #include <qremote/greeting.h>
+#include <qremote/pool.h>
 #include <qremote/qremote.h>
 #include <qremote/starttlsr.h>
 #include <qdns_dane.h>
@@ -42,94 +43,154 @@ connection_died(void)
 {
 	const char *logmsg[] = { "connection to ", rhost, " died", NULL };
 
+	tryconn_report(MXHEALTH_RESET);
 	close(socketd);
 	socketd = -1;
 	log_writen(LOG_WARNING, logmsg);
 }
 
-int
-connect_mx(struct ips *mx, const struct in6_addr *outip4, const struct in6_addr *outip6)
+/**
+ * @brief record a failed greeting of the remote host
+ * @param error the negative error code or the reply code of the greeting
+ */
+static void
+greeting_failed(const int error)
 {
-	/* for all MX entries we got: try to enable connection, check if the SMTP server wants us
-	 * (sends 220 response) and EHLO/HELO succeeds. If not, try next. If none left, exit. */
-	do {
-		int flagerr = 0;
-		int s;
-		/* query DNS before opening the socket, otherwise a long DNS timeout could lead to SMTP
-		 * socket timeout */
-		const int tlsa = (mx->name == NULL) ? 0 : dnstlsa(mx->name, targetport, NULL);
-
-		socketd = tryconn(mx, outip4, outip6);
-		if (socketd < 0)
-			return socketd;
-		if (dup2(socketd, 0) < 0)
-			net_conn_shutdown(shutdown_abort);
+	switch (error) {
+	case -ETIMEDOUT:
+		tryconn_report(MXHEALTH_TIMEOUT);
+		break;
+	case -EPIPE:
+	case -ECONNRESET:
+		tryconn_report(MXHEALTH_RESET);
+		break;
+	default:
+		tryconn_report(MXHEALTH_GREETING);
+	}
+}
 
-		s = netget(0);
-		if (s < 0) {
-			switch (-s) {
-			case ECONNRESET:
-				/* try next MX */
-				connection_died();
-				continue;
-			case EINVAL:
-				{
-				const char *dropmsg[] = { "invalid greeting from ", rhost, NULL };
+/**
+ * @brief open a new connection and read the greeting of the remote host
+ * @param mx list of MX entries
+ * @param outip4 address to use when making outgoing IPv4 connections
+ * @param outip6 address to use when making outgoing IPv6 connections
+ * @return if the connection can be used
+ * @retval 0 socketd is a connection, the greeting was 220
+ * @retval 1 the connection was closed, the next host should be tried
+ * @retval <0 error code of tryconn()
+ */
+static int
+open_connection(struct ips *mx, const struct in6_addr *outip4, const struct in6_addr *outip6)
+{
+	int flagerr = 0;
+	int s;
+
+	socketd = tryconn(mx, outip4, outip6);
+	if (socketd < 0)
+		return socketd;
+	if (dup2(socketd, 0) < 0)
+		net_conn_shutdown(shutdown_abort);
+
+	s = netget(0);
+	if (s < 0) {
+		switch (-s) {
+		case ECONNRESET:
+			/* try next MX */
+			connection_died();
+			return 1;
+		case EINVAL:
+			{
+			const char *dropmsg[] = { "invalid greeting from ", rhost, NULL };
 
-				log_writen(LOG_WARNING, dropmsg);
-				quitmsg();
-				continue;
-				}
-			default:
-				/* something unexpected went wrong, assume that this is a local
-				 * problem that will eventually go away. */
-				net_conn_shutdown(shutdown_abort);
+			log_writen(LOG_WARNING, dropmsg);
+			greeting_failed(s);
+			quitmsg();
+			return 1;
 			}
+		default:
+			/* something unexpected went wrong, assume that this is a local
+			 * problem that will eventually go away. */
+			net_conn_shutdown(shutdown_abort);
 		}
+	}
 
-		/* consume the rest of the replies */
-		while (linein.s[3] == '-') {
-			int t = netget(0);
-
-			if (t == -ECONNRESET) {
-				s = t;
-				break;
-			}
-
-			flagerr |= (s != t);
-			if (t > 0)
-				continue;
+	/* consume the rest of the replies */
+	while (linein.s[3] == '-') {
+		int t = netget(0);
 
-			/* save t, it may be an error code */
+		if (t == -ECONNRESET) {
 			s = t;
-			/* if the reply was invalid in itself (i.e. parse error or such)
-			 * we can't know what the remote server will do next, so break out
-			 * and immediately send quit. Since the initial result of netget()
-			 * must have been positive flagerr will always be set here. */
 			break;
 		}
-		if (s == -ECONNRESET) {
-			connection_died();
+
+		flagerr |= (s != t);
+		if (t > 0)
 			continue;
+
+		/* save t, it may be an error code */
+		s = t;
+		/* if the reply was invalid in itself (i.e. parse error or such)
+		 * we can't know what the remote server will do next, so break out
+		 * and immediately send quit. Since the initial result of netget()
+		 * must have been positive flagerr will always be set here. */
+		break;
+	}
+	if (s == -ECONNRESET) {
+		connection_died();
+		return 1;
+	}
+	if ((s != 220) || (flagerr != 0)) {
+		if (flagerr) {
+			const char *dropmsg[] = {"invalid greeting from ", rhost, NULL};
+
+			log_writen(LOG_WARNING, dropmsg);
 		}
-		if ((s != 220) || (flagerr != 0)) {
-			if (flagerr) {
-				const char *dropmsg[] = {"invalid greeting from ", rhost, NULL};
 
-				log_writen(LOG_WARNING, dropmsg);
-			}
+		greeting_failed(s);
+		quitmsg_if_net(s);
 
-			quitmsg_if_net(s);
+		return 1;
+	}
 
-			continue;
+	return 0;
+}
+
+int
+connect_mx(struct ips *mx, const struct in6_addr *outip4, const struct in6_addr *outip6)
+{
+	/* a connection from the pool has already passed the greeting, it is only
+	 * tried once and is not recorded in the health of the host */
+	int pooled = pool_get(mx, outip4, outip6);
+
+	/* for all MX entries we got: try to enable connection, check if the SMTP server wants us
+	 * (sends 220 response) and EHLO/HELO succeeds. If not, try next. If none left, exit. */
+	do {
+		const int frompool = pooled;
+		int flagerr;
+		/* query DNS before opening the socket, otherwise a long DNS timeout could lead to SMTP
+		 * socket timeout */
+		const int tlsa = (mx->name == NULL) ? 0 : dnstlsa(mx->name, targetport, NULL);
+
+		if (pooled) {
+			pooled = 0;
+		} else {
+			flagerr = open_connection(mx, outip4, outip6);
+			if (flagerr < 0)
+				return flagerr;
+			else if (flagerr > 0)
+				continue;
 		}
 
 		flagerr = greeting();
 		if (flagerr < 0) {
+			if (!frompool)
+				greeting_failed(flagerr);
 			quitmsg_if_net(flagerr);
 			continue;
 		}
 
+		if (!frompool)
+			tryconn_report(MXHEALTH_OK);
 		smtpext = flagerr;
 
 		if (smtpext & esmtp_starttls) {
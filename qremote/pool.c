@@ -0,0 +1,283 @@
+/** \file pool.c
+ \brief get connections from Qpoold and return them
+ */
+
+#include <qremote/pool.h>
+
+#include <netio.h>
+#include <qdns.h>
+#include <qremote/client.h>
+#include <qremote/conn.h>
+#include <qremote/qremote.h>
+#include <tls.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define POOL_WAIT	1000	/**< milliseconds to wait for the reply of Qpoold */
+
+/**
+ * @brief connect to Qpoold
+ * @return the socket, -1 on error
+ *
+ * If Qpoold is not running or busy this fails immediately.
+ */
+static int
+pool_connect(void)
+{
+	struct sockaddr_un sa;
+	int sd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, POOL_SOCKET, sizeof(sa.sun_path) - 1);
+
+	sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		return -1;
+
+	if (connect(sd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		close(sd);
+		return -1;
+	}
+
+	return sd;
+}
+
+/**
+ * @brief send a request to Qpoold
+ * @param sd the socket connected to Qpoold
+ * @param req the request
+ * @param addrs the addresses of the request
+ * @param fd the connection to pass, -1 if none
+ * @return 0 on success, -1 on error
+ */
+static int
+pool_send(const int sd, const struct pool_request *req, const struct in6_addr *addrs, const int fd)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+
+	iov[0].iov_base = (void *)req;
+	iov[0].iov_len = sizeof(*req);
+	iov[1].iov_base = (void *)addrs;
+	iov[1].iov_len = req->count * sizeof(*addrs);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	if (fd >= 0) {
+		struct cmsghdr *cmsg;
+
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof(cbuf.buf);
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	if (sendmsg(sd, &msg, MSG_NOSIGNAL) != (ssize_t)(iov[0].iov_len + iov[1].iov_len))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * @brief receive the reply to a POOL_GET request
+ * @param sd the socket to read from
+ * @param count the number of addresses in the request
+ * @param index the index of the address of the connection is returned here
+ * @return the connection, -1 if there is none
+ */
+static int
+pool_receive(const int sd, const uint32_t count, uint32_t *index)
+{
+	struct pool_reply rep;
+	struct iovec iov = {
+		.iov_base = &rep,
+		.iov_len = sizeof(rep)
+	};
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+	struct pollfd pfd = {
+		.fd = sd,
+		.events = POLLIN
+	};
+	ssize_t r;
+	int fd = -1;
+
+	if (poll(&pfd, 1, POOL_WAIT) != 1)
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	r = recvmsg(sd, &msg, MSG_CMSG_CLOEXEC);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if ((r > 0) && (cmsg != NULL) && (cmsg->cmsg_level == SOL_SOCKET) &&
+			(cmsg->cmsg_type == SCM_RIGHTS) && (cmsg->cmsg_len == CMSG_LEN(sizeof(int))))
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+
+	if ((r != sizeof(rep)) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+			(rep.version != POOL_VERSION) || (rep.index >= count)) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	*index = rep.index;
+	return fd;
+}
+
+/**
+ * @brief ask Qpoold for a connection
+ * @param mx list of MX entries
+ * @param outip4 address to use when making outgoing IPv4 connections
+ * @param outip6 address to use when making outgoing IPv6 connections
+ * @return if a connection was found
+ * @retval 1 socketd is a connection, the greeting of the remote host was already read
+ * @retval 0 no connection is available
+ *
+ * Only the addresses of the MX entries with the lowest priority are asked for,
+ * a pooled connection must not be preferred over a host with a higher
+ * preference. Nothing is asked for if the route does not allow pooling.
+ */
+int
+pool_get(struct ips *mx, const struct in6_addr *outip4, const struct in6_addr *outip6)
+{
+	struct pool_request req = {
+		.version = POOL_VERSION,
+		.op = POOL_GET,
+		.port = targetport,
+		.outip4 = *outip4,
+		.outip6 = *outip6
+	};
+	struct in6_addr addrs[POOL_MAXADDRS];
+	struct ips *first = NULL;
+	struct ips *m;
+	uint32_t index;
+	int sd;
+	int fd;
+
+	for (m = mx; m != NULL; m = m->next) {
+		if (m->priority > MX_PRIORITY_IMPLICIT)
+			continue;
+		if (first == NULL)
+			first = m;
+		else if (m->priority != first->priority)
+			break;
+
+		for (unsigned short i = 0; (i < m->count) && (req.count < POOL_MAXADDRS); i++)
+			addrs[req.count++] = m->addr[i];
+	}
+
+	if ((req.count == 0) || !poolroute)
+		return 0;
+
+	sd = pool_connect();
+	if (sd < 0)
+		return 0;
+
+	fd = (pool_send(sd, &req, addrs, -1) == 0) ? pool_receive(sd, req.count, &index) : -1;
+	close(sd);
+	if (fd < 0)
+		return 0;
+
+	if (dup2(fd, 0) < 0) {
+		close(fd);
+		return 0;
+	}
+	socketd = fd;
+
+	/* find the entry again for the name of the host */
+	for (m = first; m != NULL; m = m->next) {
+		for (unsigned short i = 0; i < m->count; i++) {
+			if (IN6_ARE_ADDR_EQUAL(m->addr + i, addrs + index)) {
+				getrhost(m, i);
+				return 1;
+			}
+		}
+	}
+
+	/* not reached, the address was taken from this list */
+	return 1;
+}
+
+/**
+ * @brief return the current connection to Qpoold
+ *
+ * This must only be called when there is no transaction in progress. The
+ * connection is reset and passed to Qpoold, socketd is -1 afterwards. If that
+ * is not possible the connection is left untouched. Connections using TLS
+ * and connections of routes that do not allow pooling are never returned.
+ */
+void
+pool_put(void)
+{
+	struct pool_request req = {
+		.version = POOL_VERSION,
+		.op = POOL_PUT,
+		.port = targetport,
+		.count = 1,
+		.outip4 = outgoingip,
+		.outip6 = outgoingip6
+	};
+	struct sockaddr_storage sa;
+	socklen_t salen = sizeof(sa);
+	struct in6_addr addr;
+	int sd;
+
+	if ((socketd < 0) || (ssl != NULL) || !poolroute)
+		return;
+
+	if (getpeername(socketd, (struct sockaddr *)&sa, &salen) != 0)
+		return;
+
+	if (sa.ss_family == AF_INET6) {
+		addr = ((struct sockaddr_in6 *)&sa)->sin6_addr;
+	} else if (sa.ss_family == AF_INET) {
+		addr.s6_addr32[0] = 0;
+		addr.s6_addr32[1] = 0;
+		addr.s6_addr32[2] = htonl(0xffff);
+		addr.s6_addr32[3] = ((struct sockaddr_in *)&sa)->sin_addr.s_addr;
+	} else {
+		return;
+	}
+
+	/* do not bother the remote host if there is nobody to take the connection */
+	sd = pool_connect();
+	if (sd < 0)
+		return;
+
+	if ((netwrite("RSET\r\n") != 0) || (netget(0) != 250) || (linein.s[3] != ' ') ||
+			(data_pending() != 0) || (pool_send(sd, &req, &addr, socketd) != 0)) {
+		close(sd);
+		return;
+	}
+	close(sd);
+
+	close(socketd);
+	close(0);
+	socketd = -1;
+}
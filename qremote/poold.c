@@ -0,0 +1,525 @@
+/** \file poold.c
+ \brief event loop of the connection pool daemon
+
+ Qpoold keeps the connections returned by Qremote in a single epoll set until
+ another Qremote process asks for a connection to the same host. While a
+ connection is idle nothing is expected from the remote host, any input or
+ the remote end closing the connection drops it. Once a connection has been
+ idle for too long QUIT is sent and it is closed.
+
+ All connections have the same idle timeout, so they expire in the order they
+ were returned and a simple list is enough to find the ones that expired.
+ The same is true for the control sockets the requests are read from.
+
+ Requests are only accepted from processes of the same user. A returned
+ connection must be a TCP connection to the address and port given in the
+ request, otherwise a local process could plant a connection to a host it
+ controls and have the mail of the next Qremote sent there.
+ */
+
+#define _GNU_SOURCE /* for accept4() and struct ucred */
+#include <qremote/pool.h>
+
+#include <log.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#define MAXEVENTS	64		/**< events handled per epoll_wait() call */
+#define CTLTIMEOUT	10		/**< seconds to wait for the request on a control socket */
+
+/**
+ * @brief a connection or control socket owned by the daemon
+ */
+struct pool_conn {
+	TAILQ_ENTRY(pool_conn) list;	/**< entry in conns or ctls */
+	int fd;				/**< the socket */
+	int ctl;			/**< if this is a control socket */
+	time_t expires;			/**< when the connection is dropped */
+	uint32_t port;			/**< port on the remote host */
+	struct in6_addr addr;		/**< address of the remote host */
+	struct in6_addr outip;		/**< local address the connection was made from */
+};
+
+TAILQ_HEAD(pool_list, pool_conn);
+
+static struct pool_list conns = TAILQ_HEAD_INITIALIZER(conns);	/**< idle connections, oldest first */
+static struct pool_list ctls = TAILQ_HEAD_INITIALIZER(ctls);	/**< control sockets, oldest first */
+static struct pool_list dead = TAILQ_HEAD_INITIALIZER(dead);	/**< dropped entries, freed once all events are handled */
+static int epfd = -1;			/**< the epoll instance */
+static int listensd = -1;		/**< the listening socket for requests, -1 if none */
+static time_t idletimeout;		/**< how long a connection is kept */
+static unsigned int maxperhost;		/**< maximum number of connections with the same key */
+static unsigned int conncount;		/**< number of idle connections */
+
+/**
+ * @brief set up the event loop
+ * @param listenfd listening socket for requests, -1 if requests only come in by poold_add()
+ * @param idle how many seconds an idle connection is kept
+ * @param perhost maximum number of connections kept for the same host and port
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int
+poold_init(const int listenfd, const time_t idle, const unsigned int perhost)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = NULL
+	};
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		return -1;
+
+	if ((listenfd >= 0) && (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) != 0)) {
+		const int e = errno;
+
+		close(epfd);
+		epfd = -1;
+		errno = e;
+		return -1;
+	}
+
+	listensd = listenfd;
+	idletimeout = idle;
+	maxperhost = perhost;
+
+	return 0;
+}
+
+static void
+drop_conn(struct pool_conn *c)
+{
+	if (c->ctl) {
+		TAILQ_REMOVE(&ctls, c, list);
+	} else {
+		TAILQ_REMOVE(&conns, c, list);
+		conncount--;
+	}
+	/* a connection handed out is still open in Qremote, closing it here
+	 * would not remove it from the epoll set */
+	(void) epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	/* there may be another event for it in the current batch */
+	TAILQ_INSERT_TAIL(&dead, c, list);
+}
+
+/**
+ * @brief end an SMTP connection
+ * @param fd the connection
+ *
+ * The reply to QUIT is not waited for, the remote host has nothing to tell
+ * that would change anything.
+ */
+static void
+quit_fd(const int fd)
+{
+	(void) send(fd, "QUIT\r\n", 6, MSG_NOSIGNAL | MSG_DONTWAIT);
+	close(fd);
+}
+
+/**
+ * @brief check if an idle connection matches a request
+ */
+static int
+conn_matches(const struct pool_conn *c, const struct in6_addr *addr, const uint32_t port,
+		const struct pool_request *req)
+{
+	const struct in6_addr *outip = IN6_IS_ADDR_V4MAPPED(addr) ? &req->outip4 : &req->outip6;
+
+	return (c->port == port) && IN6_ARE_ADDR_EQUAL(&c->addr, addr) &&
+			IN6_ARE_ADDR_EQUAL(&c->outip, outip);
+}
+
+/**
+ * @brief get the address and port of a socket address
+ * @param sa the socket address
+ * @param addr the address is stored here, IPv4 addresses as v4mapped
+ * @param port the port is stored here
+ * @return if sa is an IPv4 or IPv6 address
+ */
+static int
+sockaddr_get(const struct sockaddr_storage *sa, struct in6_addr *addr, uint32_t *port)
+{
+	if (sa->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sa;
+
+		*addr = sin6->sin6_addr;
+		*port = ntohs(sin6->sin6_port);
+	} else if (sa->ss_family == AF_INET) {
+		const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+
+		addr->s6_addr32[0] = 0;
+		addr->s6_addr32[1] = 0;
+		addr->s6_addr32[2] = htonl(0xffff);
+		addr->s6_addr32[3] = sin->sin_addr.s_addr;
+		*port = ntohs(sin->sin_port);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief check that a returned connection is what the request claims it is
+ * @param req the request
+ * @param addr the address of the remote host
+ * @param fd the connection
+ * @return if fd is a TCP connection to addr and the port of the request
+ *
+ * If an outgoing address is given in the request the connection must also
+ * originate from it.
+ */
+static int
+conn_valid(const struct pool_request *req, const struct in6_addr *addr, const int fd)
+{
+	const struct in6_addr *outip = IN6_IS_ADDR_V4MAPPED(addr) ? &req->outip4 : &req->outip6;
+	struct sockaddr_storage sa;
+	socklen_t len = sizeof(sa);
+	struct in6_addr a;
+	uint32_t port;
+	int type;
+	socklen_t typelen = sizeof(type);
+
+	if ((getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &typelen) != 0) || (type != SOCK_STREAM))
+		return 0;
+
+	if ((getpeername(fd, (struct sockaddr *)&sa, &len) != 0) || !sockaddr_get(&sa, &a, &port) ||
+			!IN6_ARE_ADDR_EQUAL(&a, addr) || (port != req->port))
+		return 0;
+
+	if (IN6_IS_ADDR_UNSPECIFIED(outip))
+		return 1;
+
+	len = sizeof(sa);
+	return (getsockname(fd, (struct sockaddr *)&sa, &len) == 0) && sockaddr_get(&sa, &a, &port) &&
+			IN6_ARE_ADDR_EQUAL(&a, outip);
+}
+
+/**
+ * @brief check that a request comes from a process of the same user
+ * @param sd the accepted control socket
+ * @return if the peer may send requests
+ */
+static int
+peer_allowed(const int sd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(sd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+		return 0;
+
+	return (len == sizeof(cred)) && (cred.uid == geteuid());
+}
+
+/**
+ * @brief store a returned connection
+ * @param req the request
+ * @param addr the address of the remote host
+ * @param fd the connection
+ */
+static void
+put_conn(const struct pool_request *req, const struct in6_addr *addr, const int fd)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLRDHUP
+	};
+	struct pool_conn *c;
+	unsigned int same = 0;
+
+	/* not sending QUIT here, nobody knows where it is connected to */
+	if (!conn_valid(req, addr, fd)) {
+		log_write(LOG_WARNING, "returned connection does not match the pool request");
+		close(fd);
+		return;
+	}
+
+	TAILQ_FOREACH(c, &conns, list) {
+		if (conn_matches(c, addr, req->port, req))
+			same++;
+	}
+
+	if ((same >= maxperhost) || (conncount >= POOL_MAXCONNS)) {
+		quit_fd(fd);
+		return;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL) {
+		quit_fd(fd);
+		return;
+	}
+
+	c->fd = fd;
+	c->port = req->port;
+	c->addr = *addr;
+	c->outip = IN6_IS_ADDR_V4MAPPED(addr) ? req->outip4 : req->outip6;
+	c->expires = time(NULL) + idletimeout;
+	ev.data.ptr = c;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		log_write(LOG_ERR, "cannot add connection to epoll set");
+		free(c);
+		quit_fd(fd);
+		return;
+	}
+
+	TAILQ_INSERT_TAIL(&conns, c, list);
+	conncount++;
+}
+
+/**
+ * @brief answer a request for a connection
+ * @param ctl the control socket
+ * @param req the request
+ * @param addrs the addresses of the request
+ *
+ * The most recently returned connection to the first address that has one is
+ * handed out.
+ */
+static void
+get_conn(struct pool_conn *ctl, const struct pool_request *req, const struct in6_addr *addrs)
+{
+	struct pool_reply rep = {
+		.version = POOL_VERSION,
+		.index = req->count
+	};
+	struct pool_conn *c = NULL;
+	struct iovec iov = {
+		.iov_base = &rep,
+		.iov_len = sizeof(rep)
+	};
+	struct msghdr msg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+
+	for (uint32_t i = 0; (i < req->count) && (c == NULL); i++) {
+		TAILQ_FOREACH_REVERSE(c, &conns, pool_list, list) {
+			if (conn_matches(c, addrs + i, req->port, req)) {
+				rep.index = i;
+				break;
+			}
+		}
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (c != NULL) {
+		struct cmsghdr *cmsg;
+
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof(cbuf.buf);
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &c->fd, sizeof(int));
+	}
+
+	/* if the reply can't be sent the connection stays in the pool */
+	if ((sendmsg(ctl->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)sizeof(rep)) && (c != NULL))
+		drop_conn(c);
+}
+
+/**
+ * @brief receive and handle a request
+ * @param ctl the control socket
+ */
+static void
+receive_request(struct pool_conn *ctl)
+{
+	struct pool_request req;
+	struct in6_addr addrs[POOL_MAXADDRS];
+	struct iovec iov[2];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+	ssize_t r;
+	int fd = -1;
+
+	iov[0].iov_base = &req;
+	iov[0].iov_len = sizeof(req);
+	iov[1].iov_base = addrs;
+	iov[1].iov_len = sizeof(addrs);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	r = recvmsg(ctl->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if ((r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+		return;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if ((r > 0) && (cmsg != NULL) && (cmsg->cmsg_level == SOL_SOCKET) &&
+			(cmsg->cmsg_type == SCM_RIGHTS) && (cmsg->cmsg_len == CMSG_LEN(sizeof(int))))
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+
+	if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || (r < (ssize_t)sizeof(req)) ||
+			(req.version != POOL_VERSION) || (req.count == 0) || (req.count > POOL_MAXADDRS) ||
+			(req.count * sizeof(addrs[0]) != r - sizeof(req)) ||
+			((req.op == POOL_PUT) && ((fd < 0) || (req.count != 1))) ||
+			((req.op == POOL_GET) && (fd >= 0)) ||
+			((req.op != POOL_PUT) && (req.op != POOL_GET))) {
+		log_write(LOG_WARNING, "invalid pool request received");
+		if (fd >= 0)
+			close(fd);
+		drop_conn(ctl);
+		return;
+	}
+
+	if (req.op == POOL_PUT)
+		put_conn(&req, addrs, fd);
+	else
+		get_conn(ctl, &req, addrs);
+
+	drop_conn(ctl);
+}
+
+/**
+ * @brief add a control socket a request will be received from
+ * @param ctlfd the socket, it is owned by the event loop afterwards
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int
+poold_add(const int ctlfd)
+{
+	struct pool_conn *c = calloc(1, sizeof(*c));
+	struct epoll_event ev = {
+		.events = EPOLLIN
+	};
+
+	if (c == NULL) {
+		close(ctlfd);
+		return -1;
+	}
+
+	c->fd = ctlfd;
+	c->ctl = 1;
+	/* Qremote sends the request directly after connecting */
+	c->expires = time(NULL) + CTLTIMEOUT;
+	ev.data.ptr = c;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, ctlfd, &ev) != 0) {
+		const int e = errno;
+
+		close(ctlfd);
+		free(c);
+		errno = e;
+		return -1;
+	}
+
+	TAILQ_INSERT_TAIL(&ctls, c, list);
+
+	return 0;
+}
+
+/**
+ * @brief drop the connections and control sockets whose time is over
+ */
+static void
+expire(void)
+{
+	const time_t now = time(NULL);
+	struct pool_conn *c;
+
+	while (((c = TAILQ_FIRST(&conns)) != NULL) && (c->expires <= now)) {
+		(void) send(c->fd, "QUIT\r\n", 6, MSG_NOSIGNAL | MSG_DONTWAIT);
+		drop_conn(c);
+	}
+
+	while (((c = TAILQ_FIRST(&ctls)) != NULL) && (c->expires <= now))
+		drop_conn(c);
+}
+
+/**
+ * @brief wait for events and handle them
+ * @param maxwait maximum time to wait in milliseconds, -1 to wait until the next connection expires
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int
+poold_step(const int maxwait)
+{
+	struct epoll_event events[MAXEVENTS];
+	struct pool_conn *c;
+	int wait = maxwait;
+	int n;
+
+	/* expiry is checked at least once per second while there is something to expire */
+	if ((!TAILQ_EMPTY(&conns) || !TAILQ_EMPTY(&ctls)) && ((wait < 0) || (wait > 1000)))
+		wait = 1000;
+
+	n = epoll_wait(epfd, events, MAXEVENTS, wait);
+	if (n < 0) {
+		if (errno != EINTR)
+			return -1;
+		n = 0;
+	}
+
+	for (int i = 0; i < n; i++) {
+		c = events[i].data.ptr;
+
+		if (c == NULL) {
+			const int sd = accept4(listensd, NULL, NULL, SOCK_CLOEXEC);
+
+			if (sd < 0) {
+				if ((errno == EMFILE) || (errno == ENFILE))
+					log_write(LOG_ERR, "too many open files, cannot accept request");
+				continue;
+			}
+			if (!peer_allowed(sd)) {
+				log_write(LOG_WARNING, "rejected pool request from a process of another user");
+				close(sd);
+				continue;
+			}
+			(void) poold_add(sd);
+		} else if (c->fd < 0) {
+			continue;
+		} else if (c->ctl) {
+			receive_request(c);
+		} else {
+			/* an idle connection was closed or the remote host
+			 * sent something, e.g. a 421 because of its own timeout */
+			drop_conn(c);
+		}
+	}
+
+	expire();
+
+	while ((c = TAILQ_FIRST(&dead)) != NULL) {
+		TAILQ_REMOVE(&dead, c, list);
+		free(c);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief get the number of idle connections owned by the event loop
+ */
+unsigned int
+poold_connections(void)
+{
+	return conncount;
+}
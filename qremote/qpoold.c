@@ -0,0 +1,113 @@
+/** \file qpoold.c
+ \brief main function of the connection pool daemon
+
+ Qpoold listens on the unix socket POOL_SOCKET in the qmail directory for
+ requests of Qremote. It has to run as the same user as Qremote, the socket
+ is only accessible for this user and requests from other users are
+ rejected.
+ */
+
+#include <qremote/pool.h>
+
+#include <control.h>
+#include <log.h>
+#include <qmaildir.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+void
+dieerror(int error)
+{
+	exit(error);
+}
+
+static int
+listen_socket(void)
+{
+	struct sockaddr_un sa;
+	mode_t oldmask;
+	int sd;
+	int r;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, POOL_SOCKET, sizeof(sa.sun_path) - 1);
+
+	sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		return -1;
+
+	/* a socket left over from a previous instance */
+	if ((unlink(POOL_SOCKET) != 0) && (errno != ENOENT))
+		goto err;
+
+	/* only Qremote, running as the same user, may connect */
+	oldmask = umask(0177);
+	r = bind(sd, (struct sockaddr *)&sa, sizeof(sa));
+	umask(oldmask);
+
+	if ((r != 0) || (chmod(POOL_SOCKET, 0600) != 0) || (listen(sd, SOMAXCONN) != 0))
+		goto err;
+
+	return sd;
+err:
+	close(sd);
+	return -1;
+}
+
+int
+main(void)
+{
+	unsigned long idle;
+	unsigned long perhost;
+	int sd;
+
+#ifdef USESYSLOG
+	openlog("Qpoold", LOG_PID, LOG_MAIL);
+#endif
+
+	if (chdir(AUTOQMAIL)) {
+		log_write(LOG_ERR, "cannot chdir to qmail directory");
+		return EINVAL;
+	}
+
+	/* most servers wait at least 5 minutes for the next command */
+	if (loadintfd(open("control/timeoutpool", O_RDONLY | O_CLOEXEC), &idle, 60)) {
+		log_write(LOG_ERR, "parse error in control/timeoutpool");
+		return errno;
+	}
+
+	if (loadintfd(open("control/poolsize", O_RDONLY | O_CLOEXEC), &perhost, 4)) {
+		log_write(LOG_ERR, "parse error in control/poolsize");
+		return errno;
+	}
+
+	/* writes to connections that went away are detected by their return value */
+	signal(SIGPIPE, SIG_IGN);
+
+	sd = listen_socket();
+	if (sd < 0) {
+		log_write(LOG_ERR, "cannot listen on " AUTOQMAIL "/" POOL_SOCKET);
+		return errno;
+	}
+
+	if (poold_init(sd, idle, perhost) != 0) {
+		log_write(LOG_ERR, "cannot set up event loop");
+		return errno;
+	}
+
+	while (poold_step(-1) == 0)
+		;
+
+	log_write(LOG_ERR, "error waiting for events");
+	return errno;
+}
@@ -4,6 +4,7 @@
 #include <log.h>
 #include <netio.h>
 #include <qremote/client.h>
+#include <qremote/greeting.h>
 #include <qremote/qremote.h>
 
 #include <stdlib.h>
@@ -11,6 +12,56 @@
 #include <syslog.h>
 
 size_t chunksize;	/**< the maximum allowed size for an outgoing send buffer in BDAT mode */
+unsigned int chunkwindow;	/**< how many chunks may be unacknowledged if the server supports PIPELINING */
+
+/**
+ * @brief give up on the message after a chunk was rejected
+ * @param chunkbuf the chunk buffer to free
+ * @param pending number of chunks whose replies were not read yet
+ *
+ * The status of the message was already written when reading the failed reply.
+ * The remaining replies belong to chunks that were already sent and are only
+ * consumed so QUIT is answered in order.
+ */
+static void __attribute__ ((noreturn))
+bdat_failed(char *chunkbuf, unsigned int pending)
+{
+	free(chunkbuf);
+
+	while (pending-- > 0)
+		(void) checkreply(NULL, NULL, 0);
+
+	net_conn_shutdown(shutdown_clean);
+}
+
+/**
+ * @brief read the replies to the chunks sent so far
+ * @param chunkbuf the chunk buffer, freed on error
+ * @param pending number of chunks whose replies were not read yet
+ * @param keep how many replies may stay unread
+ * @param last if the last chunk was already sent, its reply is not counted in pending
+ * @return the number of chunks whose replies are still unread
+ *
+ * More replies than needed are read if they are already available, so the
+ * window stays as open as possible. Does not return if a chunk was rejected.
+ */
+static unsigned int
+bdat_replies(char *chunkbuf, unsigned int pending, const unsigned int keep, const unsigned int last)
+{
+#ifdef DEBUG_IO
+	in_data = 0;
+#endif
+	while ((pending > keep) || ((pending > 0) && (data_pending() > 0))) {
+		pending--;
+		if (checkreply(" ZD", NULL, 0) != 250)
+			bdat_failed(chunkbuf, pending + last);
+	}
+#ifdef DEBUG_IO
+	in_data = 1;
+#endif
+
+	return pending;
+}
 
 /**
  * send the message data as binary chunk
@@ -25,6 +76,9 @@ send_bdat(unsigned int recodeflag)
 	size_t lenlen;			/* "reserved" length for "BDAT <len> (LAST)?" */
 	int i;
 	int bare_cr_warning = 0;
+	/* RfC 3030, section 4.2: BDAT commands may be pipelined */
+	const unsigned int window = (smtpext & esmtp_pipelining) ? chunkwindow : 1;
+	unsigned int pending = 0;	/* chunks sent without reading the reply */
 
 	chunkbuf = malloc(chunksize);
 
@@ -128,19 +182,11 @@ send_bdat(unsigned int recodeflag)
 			chunkbuf[lenlen - 1] = '\n';
 		}
 		netnwrite(chunkbuf + hl, len - hl);
-		if (off != msgsize) {
-#ifdef DEBUG_IO
-			in_data = 0;
-#endif
-			if (checkreply(" ZD", NULL, 0) != 250) {
-				free(chunkbuf);
-				net_conn_shutdown(shutdown_clean);
-			}
-#ifdef DEBUG_IO
-			in_data = 1;
-#endif
-		}
+		if (off != msgsize)
+			pending = bdat_replies(chunkbuf, pending + 1, window - 1, 0);
 	}
+	/* all chunks before the last one must have been accepted */
+	(void) bdat_replies(chunkbuf, pending, 0, 1);
 #ifdef DEBUG_IO
 	in_data = 0;
 #endif
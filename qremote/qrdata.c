@@ -8,6 +8,7 @@
 
 #include <qremote/qrdata.h>
 
+#include <bufscan.h>
 #include <fmt.h>
 #include <log.h>
 #include <netio.h>
@@ -44,35 +45,17 @@ static int lastlf = 1;		/* set if last byte sent was a LF */
 unsigned int
 need_recode(const char *buf, off_t len)
 {
-	int res = 0;
-	int llen = 0;
-	int in_header = 1;
-	off_t pos = 0;
+	struct bufscan bs;
+	unsigned int res = 0;
 
-	while ((pos < len) && (res != 3)) {
-		if (llen > 998) {
-			if (in_header)
-				res |= 4;
-			else
-				res |= 2;
-		}
-		if (((signed char)buf[pos]) <= 0) {
-			res |= 1;
-			llen++;
-		} else if ((buf[pos] == '\r') || (buf[pos] == '\n')) {
-			if ((buf[pos] == '\r') && (pos < len - 1) && (buf[pos + 1] == '\n'))
-				pos++;
-			if (llen == 0)
-				in_header = 0;
-			llen = 0;
-			/* if buffer is too short we don't need to check for long lines */
-			if ((len - pos < 998) && (res & 1))
-				return res;
-		} else {
-			llen++;
-		}
-		pos++;
-	}
+	scan_buffer(buf, len, &bs);
+
+	if (bs.flags != 0)
+		res |= 1;
+	if (bs.maxline > 998)
+		res |= 2;
+	if (bs.hdrmaxline > 998)
+		res |= 4;
 
 	return res;
 }
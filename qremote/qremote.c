@@ -10,11 +10,15 @@
 #include <control.h>
 #include <ipme.h>
 #include <log.h>
+#include <mxhealth.h>
 #include <netio.h>
 #include <qdns.h>
 #include <qmaildir.h>
+#include <qremote/batch.h>
+#include <qremote/client.h>
 #include <qremote/conn.h>
 #include <qremote/greeting.h>
+#include <qremote/pool.h>
 #include <qremote/qrdata.h>
 #include <qremote/starttlsr.h>
 #include <sstring.h>
@@ -25,6 +29,7 @@
 #include <netinet/in.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
@@ -37,6 +42,8 @@ unsigned int smtpext;	/**< the SMTP extensions supported by the remote server */
 char *rhost;		/**< the DNS name (if present) and IP address of the remote server to be used in log messages */
 size_t rhostlen;	/**< valid length of rhost */
 char *partner_fqdn;	/**< the DNS name of the remote server (forward-lookup), or NULL if the connection was done by IP */
+static int batchjobs;	/**< number of jobs in batch mode */
+static int batchnext;	/**< first batch job that has not been attempted yet */
 
 /**
  * @brief send QUIT to the remote server and close the connection
@@ -74,6 +81,15 @@ quitmsg(void)
 void
 net_conn_shutdown(const enum conn_shutdown_type sd_type)
 {
+	/* the caller expects a report for every job of a batch, reset the
+	 * count first as a failing status write comes back here */
+	if (batchjobs > 0) {
+		const int count = batchjobs;
+
+		batchjobs = 0;
+		batch_report_skipped(batchnext, count);
+	}
+
 	if ((sd_type == shutdown_clean) && (socketd >= 0)) {
 		quitmsg();
 	} else if (socketd >= 0) {
@@ -168,6 +184,12 @@ setup(void)
 		}
 		chunksize = chunk & 0xffffffff;
 	}
+
+	if (loadintfd(openat(controldir_fd, "chunkwindowremote", O_RDONLY | O_CLOEXEC), &chunk, 8) < 0)
+		err_conf("parse error in control/chunkwindowremote");
+	else if ((chunk == 0) || (chunk > 1024))
+		err_conf("invalid window size in control/chunkwindowremote");
+	chunkwindow = chunk;
 #endif
 
 #ifdef DEBUG_IO
@@ -175,13 +197,90 @@ setup(void)
 #endif
 }
 
+/**
+ * @brief map the message of a batch job
+ * @param fname name of the message file
+ * @return if the message could be mapped
+ *
+ * The previous message is unmapped. If the new one can't be mapped the
+ * message report for the job has already been written.
+ */
+static int
+map_message(const char *fname)
+{
+	struct stat st;
+	int fd;
+
+	if (msgdata != MAP_FAILED) {
+		munmap((void*)msgdata, msgsize);
+		msgdata = MAP_FAILED;
+	}
+
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		const char *logmsg[] = { "can't open message file ", fname, NULL };
+
+		if (errno == ENOMEM)
+			err_mem(1);
+		log_writen(LOG_ERR, logmsg);
+		write_status("Z4.3.0 internal error: can't open message file");
+		return 0;
+	}
+
+	if (fstat(fd, &st) == 0) {
+		msgsize = st.st_size;
+		msgdata = mmap(NULL, msgsize, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	if (msgdata == MAP_FAILED) {
+		const char *logmsg[] = { "can't mmap() message file ", fname, NULL };
+
+		log_writen(LOG_ERR, logmsg);
+		write_status("Z4.3.0 internal error: can't mmap() message file");
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief send one message over the established connection
+ * @param job the envelope of the message
+ *
+ * The message must already be mapped to msgdata.
+ */
+static void
+send_message(const struct batch_job *job)
+{
+	/* check if message is plain ASCII or not */
+	const unsigned int recodeflag = need_recode(msgdata, msgsize);
+
+	if (send_envelope(recodeflag, job->sender, job->rcptcount, job->rcpts) != 0)
+		return;
+
+	successmsg[0] = rhost;
+#ifdef CHUNKING
+	if (smtpext & esmtp_chunking) {
+		send_bdat(recodeflag);
+	} else {
+#else
+	{
+#endif
+		send_data(recodeflag);
+	}
+}
+
 int
 main(int argc, char *argv[])
 {
 	struct ips *mx = NULL;
-	int rcptcount = argc - 3;
 	struct stat st;
-	unsigned int recodeflag;
+	char *domain = argv[1];
+	struct batch_job single;
+	struct batch_job *jobs = &single;
+	char *joblist = NULL;
+	int jobcount = 1;
 	int i;
 
 	/* do this check before opening any files to catch the case that fd 0 is closed at this point */
@@ -189,7 +288,9 @@ main(int argc, char *argv[])
 
 	setup();
 
-	if (rcptcount <= 0) {
+	if ((argc == 3) && (strcmp(argv[1], "-b") == 0)) {
+		domain = argv[2];
+	} else if (argc < 4) {
 		log_write(LOG_CRIT, "too few arguments");
 		write_status("Z4.3.0 internal error: Qremote called with invalid arguments");
 		net_conn_shutdown(shutdown_abort);
@@ -203,26 +304,49 @@ main(int argc, char *argv[])
 		write_status("Z4.3.0 internal error: can't fstat() input");
 		net_conn_shutdown(shutdown_abort);
 	}
-	msgsize = st.st_size;
-	msgdata = mmap(NULL, msgsize, PROT_READ, MAP_SHARED, 0, 0);
 
-	if (msgdata == MAP_FAILED) {
-		log_write(LOG_CRIT, "can't mmap() input");
-		write_status("Z4.3.0 internal error: can't mmap() input");
-		net_conn_shutdown(shutdown_abort);
+	if (domain == argv[1]) {
+		single.msgfile = NULL;
+		single.sender = argv[2];
+		single.rcpts = argv + 3;
+		single.rcptcount = argc - 3;
+
+		msgsize = st.st_size;
+		msgdata = mmap(NULL, msgsize, PROT_READ, MAP_SHARED, 0, 0);
+
+		if (msgdata == MAP_FAILED) {
+			log_write(LOG_CRIT, "can't mmap() input");
+			write_status("Z4.3.0 internal error: can't mmap() input");
+			net_conn_shutdown(shutdown_abort);
+		}
+	} else {
+		jobcount = batch_read(0, &joblist, &jobs);
+		if (jobcount == -ENOMEM)
+			err_mem(0);
+		if (jobcount < 0) {
+			log_write(LOG_CRIT, "invalid job list");
+			write_status("Z4.3.0 internal error: invalid job list");
+			net_conn_shutdown(shutdown_abort);
+		}
+
+		/* an error before the first job is sent is reported once for the
+		 * first job, all others are reported as not attempted */
+		batchjobs = jobcount;
+		batchnext = 1;
 	}
 
-	getmxlist(argv[1], &mx);
+	getmxlist(domain, &mx);
 	if (targetport == 25) {
 		mx = filter_my_ips(mx);
 		if (mx == NULL) {
 			const char *msg[] = { "Z4.4.3 all mail exchangers for ",
-					argv[1], " point back to me" };
+					domain, " point back to me" };
 			write_status_m(msg, 3);
 			net_conn_shutdown(shutdown_abort);
 		}
 	}
 	sortmx(&mx);
+	mxhealth_sort(&mx);
 
 	i = connect_mx(mx, &outgoingip, &outgoingip6);
 	freeips(mx);
@@ -238,21 +362,35 @@ main(int argc, char *argv[])
 		successmsg[5] = " encrypted";
 	}
 
-/* check if message is plain ASCII or not */
-	recodeflag = need_recode(msgdata, msgsize);
+	for (i = 0; i < jobcount; i++) {
+		batchnext = i + 1;
 
-	if (send_envelope(recodeflag, argv[2], argc - 3, argv + 3) != 0)
-		net_conn_shutdown(shutdown_clean);
+		if (jobs[i].msgfile != NULL) {
+			if (!map_message(jobs[i].msgfile))
+				continue;
 
-	successmsg[0] = rhost;
-#ifdef CHUNKING
-	if (smtpext & esmtp_chunking) {
-		send_bdat(recodeflag);
-	} else {
-#else
-	{
-#endif
-		send_data(recodeflag);
+			/* discard whatever is left of the previous transaction */
+			if (i > 0) {
+				netwrite("RSET\r\n");
+				if (checkreply(NULL, NULL, 0) >= 300) {
+					const char *logmsg[] = { rhost, " rejected RSET", NULL };
+
+					log_writen(LOG_ERR, logmsg);
+					net_conn_shutdown(shutdown_clean);
+				}
+			}
+		}
+
+		send_message(jobs + i);
 	}
+
+	if (jobs != &single) {
+		free(jobs);
+		free(joblist);
+	}
+
+	/* keep the connection for the next Qremote if Qpoold is running */
+	pool_put();
+
 	net_conn_shutdown(shutdown_clean);
 }
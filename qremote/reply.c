@@ -37,7 +37,9 @@ err_network(int error)
 int
 netget(const unsigned int terminate)
 {
-	if (net_read(terminate)) {
+	cstring reply;
+
+	if (net_readview(&reply, terminate)) {
 		switch (errno) {
 		case ENOMEM:
 			err_mem(1);
@@ -60,13 +62,13 @@ netget(const unsigned int terminate)
 			}
 		}
 	} else {
-		if ((linein.len > 3) && ((linein.s[3] == ' ') || (linein.s[3] == '-'))) {
-			int r = linein.s[0] - '0';
-			int q = linein.s[1] - '0';
+		if ((reply.len > 3) && ((reply.s[3] == ' ') || (reply.s[3] == '-'))) {
+			int r = reply.s[0] - '0';
+			int q = reply.s[1] - '0';
 
 			if ((r >= 2) && (r <= 5) && (q >= 0) && (q <= 9)) {
 				r = r * 10 + q;
-				q = linein.s[2] - '0';
+				q = reply.s[2] - '0';
 				if ((q >= 0) && (q <= 9))
 					return r * 10 + q;
 			}
@@ -23,6 +23,7 @@
 #include <unistd.h>
 
 char *clientcertbuf;	/* buffer for a user-defined client certificate location */
+int poolroute;		/* if connections of the current route may be pooled */
 
 static const char *tags[] = {
 	"relay",
@@ -30,6 +31,7 @@ static const char *tags[] = {
 	"clientcert",
 	"outgoingip",
 	"outgoingip6",
+	"pool",
 	NULL
 };
 
@@ -318,6 +320,14 @@ smtproute(const char *remhost, const size_t reml, unsigned int *targetport)
 						err_confn(logmsg, array);
 					}
 
+					break;
+				case 5:
+					if (strcmp(v, "1") != 0) {
+						const char *logmsg[] = { "invalid pool value '", v, "' given for \"",
+								remhost, "\"", NULL };
+						err_confn(logmsg, array);
+					}
+					poolroute = 1;
 					break;
 				default:
 					assert(0);
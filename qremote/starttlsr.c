@@ -5,6 +5,7 @@
 #include <qremote/starttlsr.h>
 
 #include <control.h>
+#include <fmt.h>
 #include <log.h>
 #include <netio.h>
 #include <qdns.h>
@@ -13,17 +14,215 @@
 #include <sstring.h>
 #include <tls.h>
 
+#include <arpa/inet.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <openssl/x509v3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <syslog.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 const char *clientcertname = "control/clientcert.pem";
 
+#define TLSCACHE_DIR		"tlssessions"	/**< name of the session cache directory in the qmail directory */
+#define TLSCACHE_VERSION	1		/**< current version of the cache entry format */
+#define TLSCACHE_MAXLEN		(64 * 1024)	/**< maximum size of a cache entry */
+
+/**
+ * @brief header of a cached TLS session
+ *
+ * The header is followed by the cache key and the DER encoded session.
+ */
+struct tlscache_record {
+	uint32_t version;	/**< TLSCACHE_VERSION */
+	uint32_t keylen;	/**< length of the cache key */
+	int64_t certmtime;	/**< modification time of the certificate used for verification in ns, 0 if none */
+};
+
+static int tlscache_dir = -1;		/**< descriptor of the session cache directory */
+static char tlscache_key[DOMAINNAME_MAX + PATH_MAX + 16];	/**< key of the current connection, empty if not cached */
+static char tlscache_fn[17];		/**< file name of the cache entry of the current connection */
+static int64_t tlscache_certmtime;	/**< the verification policy of the current connection */
+
+/**
+ * @brief set up the session cache for the current connection
+ * @param certmtime modification time of the certificate used for verification in ns, 0 if none
+ * @return if the session cache is used for this connection
+ *
+ * Sessions are cached per MX name, port and client certificate in one file
+ * each in the session cache directory. Qremote is started for every delivery,
+ * so the next delivery to the same host can resume the session with an
+ * abbreviated handshake. The cache is only used if the directory exists.
+ */
+static int
+tlscache_setup(const int64_t certmtime)
+{
+	struct sockaddr_storage sa;
+	socklen_t salen = sizeof(sa);
+	unsigned int port = 0;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int len;
+
+	*tlscache_key = '\0';
+
+	if (partner_fqdn == NULL)
+		return 0;
+
+	if (tlscache_dir < 0) {
+		tlscache_dir = openat(AT_FDCWD, TLSCACHE_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (tlscache_dir < 0)
+			return 0;
+	}
+
+	if (getpeername(socketd, (struct sockaddr *)&sa, &salen) == 0) {
+		if (sa.ss_family == AF_INET6)
+			port = ntohs(((struct sockaddr_in6 *)&sa)->sin6_port);
+		else if (sa.ss_family == AF_INET)
+			port = ntohs(((struct sockaddr_in *)&sa)->sin_port);
+	}
+
+	len = snprintf(tlscache_key, sizeof(tlscache_key), "%s:%u:%s", partner_fqdn, port, clientcertname);
+	if ((len < 0) || ((size_t)len >= sizeof(tlscache_key))) {
+		*tlscache_key = '\0';
+		return 0;
+	}
+
+	for (int i = 0; i < len; i++) {
+		h ^= (unsigned char)tlscache_key[i];
+		h *= 0x100000001b3ULL;
+	}
+	snprintf(tlscache_fn, sizeof(tlscache_fn), "%016llx", (unsigned long long)h);
+	tlscache_certmtime = certmtime;
+
+	return 1;
+}
+
+/**
+ * @brief remove the cache entry of the current connection
+ */
+static void
+tlscache_drop(void)
+{
+	if (*tlscache_key != '\0')
+		unlinkat(tlscache_dir, tlscache_fn, 0);
+}
+
+/**
+ * @brief load the cached session of the current connection
+ * @return the session, NULL if none is cached
+ *
+ * Entries that were stored with a different verification policy or that
+ * have expired are removed.
+ */
+static SSL_SESSION *
+tlscache_load(void)
+{
+	struct tlscache_record rec;
+	SSL_SESSION *sess = NULL;
+	struct stat st;
+	const size_t keylen = strlen(tlscache_key);
+	int fd = openat(tlscache_dir, tlscache_fn, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return NULL;
+
+	if ((fstat(fd, &st) != 0) || (st.st_size <= (off_t)(sizeof(rec) + keylen)) ||
+			(st.st_size > TLSCACHE_MAXLEN)) {
+		close(fd);
+		return NULL;
+	}
+
+	unsigned char buf[st.st_size];
+
+	if (read(fd, buf, st.st_size) != st.st_size) {
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	memcpy(&rec, buf, sizeof(rec));
+	/* a hash collision, keep the entry of the other host */
+	if ((rec.version == TLSCACHE_VERSION) && ((rec.keylen != keylen) ||
+			(memcmp(buf + sizeof(rec), tlscache_key, keylen) != 0)))
+		return NULL;
+
+	if ((rec.version == TLSCACHE_VERSION) && (rec.certmtime == tlscache_certmtime)) {
+		const unsigned char *p = buf + sizeof(rec) + keylen;
+
+		sess = d2i_SSL_SESSION(NULL, &p, st.st_size - sizeof(rec) - keylen);
+		if ((sess != NULL) && (SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess) <= time(NULL))) {
+			SSL_SESSION_free(sess);
+			sess = NULL;
+		}
+	}
+
+	if (sess == NULL)
+		tlscache_drop();
+
+	return sess;
+}
+
+/**
+ * @brief store a new session of the current connection in the cache
+ * @param s the connection
+ * @param sess the new session
+ * @return 0, the session is not referenced afterwards
+ *
+ * Sessions of hosts that could not be verified are not stored.
+ */
+static int
+tlscache_store(SSL *s, SSL_SESSION *sess)
+{
+	struct tlscache_record rec = {
+		.version = TLSCACHE_VERSION,
+		.certmtime = tlscache_certmtime
+	};
+	char tmpfn[sizeof(tlscache_fn) + ULSTRLEN + 1];
+	unsigned char *p;
+	int fd;
+
+	if ((*tlscache_key == '\0') || ((tlscache_certmtime != 0) && (SSL_get_verify_result(s) != X509_V_OK)))
+		return 0;
+
+	const int len = i2d_SSL_SESSION(sess, NULL);
+	rec.keylen = strlen(tlscache_key);
+	if ((len <= 0) || (sizeof(rec) + rec.keylen + len > TLSCACHE_MAXLEN))
+		return 0;
+
+	unsigned char buf[sizeof(rec) + rec.keylen + len];
+
+	memcpy(buf, &rec, sizeof(rec));
+	memcpy(buf + sizeof(rec), tlscache_key, rec.keylen);
+	p = buf + sizeof(rec) + rec.keylen;
+	if (i2d_SSL_SESSION(sess, &p) != len)
+		return 0;
+
+	snprintf(tmpfn, sizeof(tmpfn), "%s.%i", tlscache_fn, getpid());
+	fd = openat(tlscache_dir, tmpfn, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return 0;
+
+	if (write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+		close(fd);
+		unlinkat(tlscache_dir, tmpfn, 0);
+		return 0;
+	}
+	close(fd);
+
+	if (renameat(tlscache_dir, tmpfn, tlscache_dir, tlscache_fn) != 0)
+		unlinkat(tlscache_dir, tmpfn, 0);
+
+	return 0;
+}
+
 /**
  * @brief send STARTTLS and handle the connection setup
  * @return if connection was successfully established
@@ -46,6 +245,7 @@ tls_init(void)
 	const char fnprefix[] = "control/tlshosts/";
 	const char fnsuffix[] = ".pem";
 	char servercert[strlen(fnprefix) + DOMAINNAME_MAX + strlen(fnsuffix) + 1];
+	int64_t certmtime = 0;
 
 	if (partner_fqdn == NULL) {
 		*servercert = '\0';
@@ -60,6 +260,8 @@ tls_init(void)
 		memcpy(servercert + strlen(fnprefix) + fqlen, fnsuffix, strlen(fnsuffix) + 1);
 		if (stat(servercert, &st))
 			*servercert = '\0';
+		else
+			certmtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
 	}
 
 	SSL_library_init();
@@ -89,6 +291,11 @@ tls_init(void)
 	if (SSL_CTX_use_certificate_chain_file(ctx, clientcertname) == 1)
 		SSL_CTX_use_RSAPrivateKey_file(ctx, clientcertname, SSL_FILETYPE_PEM);
 
+	if (tlscache_setup(certmtime)) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx, tlscache_store);
+	}
+
 	myssl = SSL_new(ctx);
 	SSL_CTX_free(ctx);
 	if (!myssl) {
@@ -116,6 +323,15 @@ tls_init(void)
 	}
 	SSL_set_verify(myssl, SSL_VERIFY_NONE, NULL);
 
+	if (*tlscache_key != '\0') {
+		SSL_SESSION *sess = tlscache_load();
+
+		if (sess != NULL) {
+			SSL_set_session(myssl, sess);
+			SSL_SESSION_free(sess);
+		}
+	}
+
 	netwrite("STARTTLS\r\n");
 
 	/* while the server is preparing a response, do something else */
@@ -187,6 +403,7 @@ tls_init(void)
 			const char *msg[] = { "unable to verify ", rhost, " with ", servercert,
 					": ", X509_verify_cert_error_string(r), NULL };
 
+			tlscache_drop();
 			log_writen(LOG_ERR, msg);
 			return EDONE;
 		}
@@ -6,7 +6,7 @@
 
 #include <control.h>
 #include <fmt.h>
-#include <libowfatconn.h>
+#include <ipbl.h>
 #include <log.h>
 #include <match.h>
 #include <mmap.h>
@@ -22,6 +22,7 @@
 #include <openssl/ssl.h>
 #include <poll.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
 #include <sys/mman.h>
@@ -84,6 +85,7 @@ reverseip4(char *buf)
  * @param txt pointer to "char *" where the TXT record of the listing will be stored if existent
  * @return index of first match
  * @retval -1 if not listed or error (if not listed errno is set to 0)
+ * @retval DNS_ERROR_LOCAL on local error (errno is set)
  *
  * If no match was found but temporary DNS errors were encountered errno
  * is set to EAGAIN.
@@ -93,90 +95,108 @@ reverseip4(char *buf)
 int
 check_rbl(char *const *rbls, char **txt)
 {
-	char lookup[DOMAINNAME_MAX + 1];
+	char prefix[DOMAINNAME_MAX + 1];
 	unsigned int l;
-	int i = 0;
+	unsigned int cnt = 0;
+	unsigned int n = 0;
+	char (*lookup)[DOMAINNAME_MAX + 1];
+	const char **names;
+	unsigned int *idx;	/* index in names for every rbl */
+	int *results;
+	int ret = -1;
 	int again = 0;	/* if this is set at least one rbl lookup failed with temp error */
 
 	if (connection_is_ipv4()) {
-		l = reverseip4(lookup);
-		lookup[l++] = '.';
+		l = reverseip4(prefix);
+		prefix[l++] = '.';
 	} else {
-		dotip6(lookup);
+		dotip6(prefix);
 		l = 64;
 	}
-	while (rbls[i]) {
-		if (strlen(rbls[i]) >= sizeof(lookup) - l) {
+
+	while (rbls[cnt])
+		cnt++;
+
+	if (cnt == 0) {
+		errno = 0;
+		return -1;
+	}
+
+	lookup = malloc(cnt * sizeof(*lookup));
+	names = malloc(cnt * sizeof(*names));
+	idx = malloc(cnt * sizeof(*idx));
+	results = malloc(cnt * sizeof(*results));
+	if ((lookup == NULL) || (names == NULL) || (idx == NULL) || (results == NULL)) {
+		free(lookup);
+		free(names);
+		free(idx);
+		free(results);
+		errno = ENOMEM;
+		return DNS_ERROR_LOCAL;
+	}
+
+	for (unsigned int i = 0; i < cnt; i++) {
+		if (strlen(rbls[i]) >= sizeof(*lookup) - l) {
+			/* this is logged when the results are evaluated */
+			idx[i] = cnt;
+			continue;
+		}
+
+		memcpy(lookup[n], prefix, l);
+		strcpy(lookup[n] + l, rbls[i]);
+		names[n] = lookup[n];
+		idx[i] = n++;
+	}
+
+	/* all lists are queried at once, the result is still the first list
+	 * in configuration order that matches */
+	if ((n > 0) && (ask_dnsa_parallel(names, n, results) != 0)) {
+		ret = DNS_ERROR_LOCAL;
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < cnt; i++) {
+		if (idx[i] == cnt) {
 			const char *logmsg[] = {"name of rbl too long: \"", rbls[i], "\"", NULL};
 
 			log_writen(LOG_ERR, logmsg);
-		} else {
-			int j;
-
-			strcpy(lookup + l, rbls[i]);
-			j = ask_dnsa(lookup, NULL);
-			switch (j) {
-			case DNS_ERROR_LOCAL:
-				return j;
-			case DNS_ERROR_TEMP:
-				/* This lookup failed with temporary error. We continue and check the other RBLs first, if
-				 * one matches we can block permanently, only if no other matches we block mail with 4xx */
-				again = 1;
-				break;
-			default:
-				/* if there is any error here we just write the generic message to the client
-				 * so that's no real problem for us */
-				if (j > 0) {
-					if (txt != NULL)
-						(void) dnstxt(txt, lookup);
-					return i;
-				}
+			continue;
+		}
+
+		switch (results[idx[i]]) {
+		case DNS_ERROR_LOCAL:
+			ret = DNS_ERROR_LOCAL;
+			goto out;
+		case DNS_ERROR_TEMP:
+			/* This lookup failed with temporary error. We continue and check the other RBLs first, if
+			 * one matches we can block permanently, only if no other matches we block mail with 4xx */
+			again = 1;
+			break;
+		default:
+			/* if there is any error here we just write the generic message to the client
+			 * so that's no real problem for us */
+			if (results[idx[i]] > 0) {
+				if (txt != NULL)
+					(void) ask_dnstxt(txt, names[idx[i]]);
+				ret = i;
+				errno = 0;
+				goto out;
 			}
 		}
-		i++;
 	}
-	errno = again ? EAGAIN : 0;
-	return -1;
-}
 
-static unsigned int tarpitcount = 0;	/* number of extra seconds from tarpit */
+	errno = again ? EAGAIN : 0;
+out:
+	{
+		const int e = errno;
 
-/**
- * delay the next reply to the client
- *
- * This should be used in all places where the client seems to be a spammer. This will
- * delay him so he can't send so much spams.
- *
- * tarpit does not sleep if there is input pending. If the client is using pipelining or (more likely) a worm or spambot
- * ignoring our replies we kick him earlier and save some traffic.
- */
-void
-tarpit(void)
-{
-	int i = data_pending();
-	if (i > 0)
-		return;
-	if (i < 0)
-		dieerror(-i);
-	if (ssl) {
-		/* SSL encoding is too much overhead for worms and friends, so at the other side we can expect a real
-		 * mail server. We just have to check here if there is data pending (he's using PIPELINING) or not. */
-		sleep(5 + tarpitcount);
-	} else {
-		struct pollfd rfd = {
-			.fd = 0,
-			.events = POLLIN
-		};
-
-		/* don't care about the return value here: if something goes wrong we will only not
-		 * sleep long enough here. If something is really bad (ENOMEM or something) the error
-		 * will happen again and will be caught at another place */
-		(void) poll(&rfd, 1, (5 + tarpitcount) * 1000);
+		free(lookup);
+		free(names);
+		free(idx);
+		free(results);
+		errno = e;
 	}
-
-	/* maximum sleep time is 4 minutes */
-	if (tarpitcount < 235)
-		tarpitcount++;
+	return ret;
 }
 
 typedef int (*ip_matchnet)(const struct in6_addr *ip, const void *ipbuf, const unsigned char netmask);
@@ -206,6 +226,48 @@ check_ipbl_file(const size_t iplen, const off_t flen, const unsigned char *buf,
 	return 0;
 }
 
+/**
+ * check the remote address against a sorted IP match file
+ *
+ * @param buf buffer of the file contents
+ * @param flen length of the buffer
+ * @param iplen length of one address in bytes
+ * @return 1 if match, 0 if not, -1 if data malformed
+ *
+ * The ranges in the file are sorted and do not overlap, so the only range
+ * that may contain the address is the last one starting at or before it.
+ */
+static int
+check_ipbl_sorted(const unsigned char *buf, const off_t flen, const size_t iplen)
+{
+	const size_t recordlen = 2 * iplen;
+	const unsigned char *ip = xmitstat.sremoteip.s6_addr + (sizeof(xmitstat.sremoteip) - iplen);
+	size_t lo = 0;
+	size_t hi;
+
+	if ((buf[IPBL_MAGICLEN] != IPBL_VERSION) || (buf[IPBL_MAGICLEN + 1] != iplen) ||
+			((flen - IPBL_HEADERLEN) % recordlen))
+		return -1;
+
+	buf += IPBL_HEADERLEN;
+	hi = (flen - IPBL_HEADERLEN) / recordlen;
+
+	/* find the first range starting after the address */
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+
+		if (memcmp(buf + mid * recordlen, ip, iplen) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0)
+		return 0;
+
+	return (memcmp(ip, buf + (lo - 1) * recordlen + iplen, iplen) <= 0) ? 1 : 0;
+}
+
 /**
  * check an IPv4 mapped IPv6 address against a local blocklist
  *
@@ -296,7 +358,10 @@ lookupipbl(int fd)
 		return -1;
 	}
 
-	if (connection_is_ipv4()) {
+	if ((flen >= IPBL_HEADERLEN) && (memcmp(map, IPBL_MAGIC, IPBL_MAGICLEN) == 0)) {
+		rc = check_ipbl_sorted(map, flen, connection_is_ipv4() ?
+				sizeof(struct in_addr) : sizeof(struct in6_addr));
+	} else if (connection_is_ipv4()) {
 		rc = check_ip4(map, flen);
 	} else {
 		rc = check_ip6(map, flen);
@@ -0,0 +1,404 @@
+/** \file rcptmap.c
+ * \brief user backend answering all queries from the compiled recipient map
+ *
+ * The map is generated from the vpopmail tree by newrcptmap, see
+ * qsmtpd/rcptmap.h for the format. The results are the same the vpopmail
+ * backend would return for the tree at the time the map was generated, but
+ * the existence checks are answered without any file system access.
+ *
+ * Before every recipient the map is checked for being replaced, so a long
+ * running process like the daemon mode picks up a regenerated map. The
+ * userconf of a recipient points into the map, so it must not be used anymore
+ * once user_exists() was called for the next recipient.
+ */
+
+#include <qsmtpd/rcptmap.h>
+
+#include <cdb.h>
+#include <control.h>
+#include <diropen.h>
+#include <qsmtpd/addrparse.h>
+#include <qsmtpd/qsmtpd.h>
+#include <qsmtpd/userconf.h>
+#include <qsmtpd/userfilters.h>
+#include <sstring.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct userconf uconf;			/**< global userconfig cache */
+static struct cdb rcptmap = CDB_INIT;		/**< the recipient map */
+
+/**
+ * @brief search a record in the map
+ * @param type the type character of the key
+ * @param name the name part of the key
+ * @param nlen length of name
+ * @param domain the domain part of the key, NULL if the key has none
+ * @param data the value is returned here
+ * @param dlen the length of the value is returned here
+ * @retval 1 the record was found
+ * @retval 0 the record was not found
+ * @retval -EDONE the map is broken, the error was already handled
+ */
+static int
+rcptmap_find(const char type, const char *name, const size_t nlen, const char *domain,
+		const char **data, uint32_t *dlen)
+{
+	const size_t domlen = (domain == NULL) ? 0 : strlen(domain) + 1;
+	char key[1 + nlen + domlen];
+	int r;
+
+	key[0] = type;
+	memcpy(key + 1, name, nlen);
+	if (domain != NULL) {
+		key[1 + nlen] = '@';
+		memcpy(key + 2 + nlen, domain, domlen - 1);
+	}
+
+	r = cdb_find(&rcptmap, key, sizeof(key), data, dlen);
+	if (r < 0) {
+		if (err_control(RCPTMAP_FILE) == 0)
+			return -EDONE;
+		return -EINVAL;
+	}
+
+	return r;
+}
+
+/**
+ * @brief check the directory part of a record
+ * @param rec the path of the directory in the record
+ * @param end the end of the record
+ * @param files the file list of the directory is returned here, NULL if it is unknown
+ * @return if the record is valid
+ */
+static int
+parse_dir(const char *rec, const char *end, const char **files)
+{
+	const char *p = memchr(rec, '\0', end - rec);
+
+	if (p == NULL)
+		return 0;
+	*files = ++p;
+
+	/* the file list, then the filterconf lines up to an empty one */
+	p = memchr(p, '\0', end - p);
+	while (p != NULL) {
+		p++;
+		if (p == end)
+			return 0;
+		if (*p == '\0')
+			break;
+		p = memchr(p, '\0', end - p);
+	}
+	if (p == NULL)
+		return 0;
+
+	if (strcmp(*files, "/") == 0)
+		*files = NULL;
+
+	return 1;
+}
+
+/**
+ * @brief open the directories of a recipient
+ * @param ds the userconf to fill
+ * @param user the name of the user directory, NULL if there is none
+ * @return the directory status
+ * @retval 1 the directories were opened or are not accessible
+ * @retval 0 the domain directory does not exist anymore, ds was freed
+ * @retval <0 negative error code
+ *
+ * If the directories are not accessible the recipient is assumed to exist
+ * like the vpopmail backend does.
+ */
+static int
+open_dirs(struct userconf *ds, const char *user)
+{
+	int res;
+
+	ds->domaindirfd = get_dirfd(AT_FDCWD, ds->domainpath.s);
+	if (ds->domaindirfd >= 0) {
+		if (user == NULL)
+			return 1;
+
+		ds->userdirfd = get_dirfd(ds->domaindirfd, user);
+		if (ds->userdirfd >= 0)
+			return 1;
+
+		res = errno;
+		switch (res) {
+		case ENOENT:
+		case ENOTDIR:
+			/* the map is outdated, the user still exists */
+			ds->userfiles = NULL;
+			return 1;
+		case EACCES:
+			return 1;
+		default:
+			if (err_control2(ds->domainpath.s, user) == 0)
+				res = EDONE;
+			userconf_free(ds);
+			return -res;
+		}
+	}
+
+	res = errno;
+	switch (res) {
+	case EMFILE:
+	case ENFILE:
+	case ENOMEM:
+		userconf_free(ds);
+		return -res;
+	case ENOENT:
+	case ENOTDIR:
+		userconf_free(ds);
+		return 0;
+	case EACCES:
+		return 1;
+	default:
+		if (err_control(ds->domainpath.s) == 0)
+			res = EDONE;
+		userconf_free(ds);
+		return -res;
+	}
+}
+
+int
+user_exists(const string *localpart, const char *domain, struct userconf *dsp)
+{
+	struct userconf *ds = (dsp == NULL) ? &uconf : dsp;
+	const char *drec;
+	const char *urec = NULL;
+	const char *data;
+	uint32_t dlen;
+	uint32_t ulen;
+	const char *realdomain;
+	const char *path;
+	const char *domainfiles;
+	const char *userfiles = NULL;
+	char flag;
+	int res;
+
+	/* '/' is a valid character for localparts but we don't want it because
+	 * it could be abused to check the existence of files */
+	if (memchr(localpart->s, '/', localpart->len))
+		return 0;
+
+	/* the map is only mapped again if it was replaced */
+	if (cdb_open(&rcptmap, AT_FDCWD, RCPTMAP_FILE) != 0) {
+		res = errno;
+		switch (res) {
+		case EMFILE:
+		case ENFILE:
+		case ENOMEM:
+			return -ENOMEM;
+		default:
+			if (err_control(RCPTMAP_FILE) == 0)
+				return -EDONE;
+			return -res;
+		}
+	}
+
+	res = rcptmap_find('d', domain, strlen(domain), NULL, &drec, &dlen);
+	if (res < 0)
+		return res;
+	else if (res == 0)
+		/* the domain is not local or at least no vpopmail domain */
+		return 5;
+
+	/* flag, real domain, path, files, filterconf lines */
+	realdomain = drec + 1;
+	path = (dlen > 1) ? memchr(realdomain, '\0', dlen - 1) : NULL;
+	if ((path == NULL) || !parse_dir(++path, drec + dlen, &domainfiles)) {
+		if (err_control(RCPTMAP_FILE) == 0)
+			return -EDONE;
+		return -EINVAL;
+	}
+	flag = *drec;
+
+	userconf_free(ds);
+	ds->domainpath.len = strlen(path);
+	ds->domainpath.s = strdup(path);
+	if (ds->domainpath.s == NULL) {
+		userconf_free(ds);
+		return -ENOMEM;
+	}
+
+	switch (flag) {
+	case RCPTMAP_NODIR:
+		userconf_free(ds);
+		return 0;
+	case RCPTMAP_NOACCESS:
+		/* The directory exists, but we can not look into it. Assume the
+		 * user exists. */
+		return 1;
+	default:
+		break;
+	}
+
+	/* does directory (ds->domainpath.s)+'/'+localpart exist? */
+	res = rcptmap_find('u', localpart->s, localpart->len, realdomain, &data, &ulen);
+	if (res < 0) {
+		userconf_free(ds);
+		return res;
+	} else if (res > 0) {
+		urec = data;
+		if (!parse_dir(urec, urec + ulen, &userfiles)) {
+			userconf_free(ds);
+			if (err_control(RCPTMAP_FILE) == 0)
+				return -EDONE;
+			return -EINVAL;
+		}
+	} else {
+		/* the .qmail files use ':' instead of '.' */
+		char suffix[localpart->len + strlen("-default")];
+		char *p;
+
+		memcpy(suffix, localpart->s, localpart->len);
+		p = suffix;
+		while ((p = memchr(p, '.', localpart->len - (p - suffix))) != NULL)
+			*p = ':';
+		memcpy(suffix + localpart->len, "-default", strlen("-default"));
+
+		/* does USERPATH/DOMAIN/.qmail-LOCALPART exist? */
+		res = rcptmap_find('q', suffix, localpart->len, realdomain, &data, &dlen);
+		/* try .qmail-user-default instead */
+		if (res == 0)
+			res = rcptmap_find('q', suffix, sizeof(suffix), realdomain, &data, &dlen);
+
+		/* if username contains '-' there may be
+		 * .qmail-partofusername-default */
+		p = memchr(suffix, '-', localpart->len);
+		while ((res == 0) && (p != NULL)) {
+			char prefix[p - suffix + strlen("-default")];
+
+			memcpy(prefix, suffix, p - suffix);
+			memcpy(prefix + (p - suffix), "-default", strlen("-default"));
+			res = rcptmap_find('q', prefix, sizeof(prefix), realdomain, &data, &dlen);
+			if (res > 0)
+				res = 4;
+
+			p = memchr(p + 1, '-', localpart->len - (p + 1 - suffix));
+		}
+
+		/* does USERPATH/DOMAIN/.qmail-default exist and accept the mail? */
+		if ((res == 0) && (flag == RCPTMAP_CATCHALL))
+			res = 2;
+
+		if (res <= 0) {
+			/* no local user with that address */
+			userconf_free(ds);
+			return res;
+		}
+	}
+
+	/* the recipient exists, make the configuration files available */
+	ds->domainfiles = domainfiles;
+	ds->userfiles = userfiles;
+	{
+		char user[localpart->len + 1];
+		int r;
+
+		memcpy(user, localpart->s, localpart->len);
+		user[localpart->len] = '\0';
+
+		r = open_dirs(ds, (urec != NULL) ? user : NULL);
+		if (r <= 0)
+			return r;
+	}
+
+	return res;
+}
+
+/**
+ * @brief load the filterconf lines of a user or domain
+ * @param ds the userconf
+ * @param user if the user or the domain settings should be loaded
+ * @param conf the lines are returned here
+ * @return 0 on success, -1 on error
+ */
+static int
+load_conf(const struct userconf *ds, const int user, char ***conf)
+{
+	const char *files = user ? ds->userfiles : ds->domainfiles;
+	const char *lines;
+	const char *p;
+	unsigned int count = 0;
+	size_t len;
+
+	*conf = NULL;
+
+	if ((user ? ds->userdirfd : ds->domaindirfd) < 0)
+		return 0;
+
+	if (files == NULL) {
+		/* the directory could not be read when the map was generated */
+		struct userconf uc = *ds;
+		enum config_domain type;
+
+		if (user)
+			uc.domaindirfd = -1;
+		else
+			uc.userdirfd = -1;
+		return loadlistfd(getfile(&uc, "filterconf", &type, 0), conf, NULL);
+	}
+
+	lines = files + strlen(files) + 1;
+	for (p = lines; *p != '\0'; p += strlen(p) + 1)
+		count++;
+	if (count == 0)
+		return 0;
+
+	len = p - lines;
+	*conf = data_array(count, len - count, NULL, 0);
+	if (*conf == NULL)
+		return -1;
+
+	memcpy(*conf + count + 1, lines, len);
+	p = (const char *)(*conf + count + 1);
+	for (unsigned int i = 0; i < count; i++) {
+		(*conf)[i] = (char *)p;
+		p += strlen(p) + 1;
+	}
+
+	return 0;
+}
+
+int
+userconf_load_configs(struct userconf *ds)
+{
+	/* if the file is empty there is no problem, NULL is a legal value for the buffers */
+	if ((load_conf(ds, 1, &ds->userconf) != 0) || (load_conf(ds, 0, &ds->domainconf) != 0))
+		return errno;
+
+	config_settings_parse(&ds->usersettings, (const char **)ds->userconf);
+	config_settings_parse(&ds->domainsettings, (const char **)ds->domainconf);
+
+	return 0;
+}
+
+int
+userbackend_init(void)
+{
+	if (cdb_open(&rcptmap, AT_FDCWD, RCPTMAP_FILE) != 0) {
+		int e = errno;
+		err_control(RCPTMAP_FILE);
+		return e;
+	}
+
+	userconf_init(&uconf);
+
+	return 0;
+}
+
+void
+userbackend_free(void)
+{
+	userconf_free(&uconf);
+	cdb_close(&rcptmap);
+}
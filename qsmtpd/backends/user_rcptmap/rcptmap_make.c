@@ -0,0 +1,414 @@
+/** \file rcptmap_make.c
+ * \brief generate the recipient map from the vpopmail tree
+ */
+
+#include <qsmtpd/rcptmap.h>
+
+#include <cdb.h>
+#include <control.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** @brief a growing buffer for a database record */
+struct rbuf {
+	char *s;		/**< the data */
+	size_t len;		/**< used length of s */
+	size_t alloc;		/**< allocated length of s */
+};
+
+static int
+rbuf_add(struct rbuf *b, const char *s, const size_t len)
+{
+	if (b->len + len > b->alloc) {
+		size_t n = b->alloc ? 2 * b->alloc : 256;
+		char *tmp;
+
+		while (n < b->len + len)
+			n *= 2;
+		tmp = realloc(b->s, n);
+		if (tmp == NULL)
+			return -1;
+		b->s = tmp;
+		b->alloc = n;
+	}
+
+	memcpy(b->s + b->len, s, len);
+	b->len += len;
+	return 0;
+}
+
+/**
+ * @brief add a 0-terminated string to the buffer
+ */
+static int
+rbuf_addstr(struct rbuf *b, const char *s)
+{
+	return rbuf_add(b, s, strlen(s) + 1);
+}
+
+/**
+ * @brief add a record with a key made of type, name and domain
+ * @param cm the database
+ * @param type the type character of the key
+ * @param name the name part of the key
+ * @param domain the domain part of the key, NULL if the key has none
+ * @param data the value of the record
+ * @param dlen length of data
+ * @return 0 on success, -1 on error
+ */
+static int
+add_record(struct cdb_make *cm, const char type, const char *name, const char *domain,
+		const char *data, const size_t dlen)
+{
+	const size_t nlen = strlen(name);
+	const size_t domlen = (domain == NULL) ? 0 : strlen(domain) + 1;
+	char key[1 + nlen + domlen];
+
+	key[0] = type;
+	memcpy(key + 1, name, nlen);
+	if (domain != NULL) {
+		key[1 + nlen] = '@';
+		memcpy(key + 2 + nlen, domain, domlen - 1);
+	}
+
+	return cdb_make_add(cm, key, sizeof(key), data, dlen);
+}
+
+/**
+ * @brief check if a directory entry can be opened
+ * @param dirfd descriptor of the directory
+ * @param de the entry
+ * @param st the type of the entry is returned here
+ * @return if the entry exists
+ * @retval 1 the entry exists
+ * @retval 0 the entry does not exist (e.g. a dangling symlink)
+ * @retval -1 on error
+ *
+ * Symlinks are followed as openat() would do. If the entry can not be
+ * examined st_mode is set to 0.
+ */
+static int
+entry_exists(int dirfd, const struct dirent *de, struct stat *st)
+{
+	switch (de->d_type) {
+	case DT_DIR:
+		st->st_mode = S_IFDIR;
+		return 1;
+	case DT_REG:
+		st->st_mode = S_IFREG;
+		return 1;
+	case DT_LNK:
+	case DT_UNKNOWN:
+		break;
+	default:
+		st->st_mode = 0;
+		return 1;
+	}
+
+	if (fstatat(dirfd, de->d_name, st, 0) == 0)
+		return 1;
+
+	st->st_mode = 0;
+	switch (errno) {
+	case EACCES:
+		return 1;
+	case ENOENT:
+	case ELOOP:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * @brief check if .qmail-default accepts all mail
+ * @param dirfd descriptor of the domain directory
+ * @param vpopbounce contents of control/vpopbounce, may be NULL
+ * @return the domain flag
+ * @retval -1 on error
+ */
+static int
+catchall(int dirfd, const char *vpopbounce)
+{
+	const int fd = openat(dirfd, ".qmail-default", O_RDONLY | O_CLOEXEC);
+	char buff[2 * ((vpopbounce == NULL) ? 0 : strlen(vpopbounce)) + 1];
+	ssize_t r;
+
+	if (fd < 0)
+		return (errno == EACCES) ? RCPTMAP_CATCHALL : -1;
+	if (vpopbounce == NULL) {
+		close(fd);
+		return RCPTMAP_CATCHALL;
+	}
+
+	/* the same test that the vpopmail backend does */
+	r = read(fd, buff, sizeof(buff) - 1);
+	close(fd);
+	if (r < 0)
+		return -1;
+	buff[r] = '\0';
+
+	return (strcmp(buff, vpopbounce) == 0) ? RCPTMAP_NOCATCHALL : RCPTMAP_CATCHALL;
+}
+
+/**
+ * @brief add the file list and the filterconf lines of a directory to a record
+ * @param cm the database, NULL if the entries of the directory should not be added as records
+ * @param dirfd descriptor of the directory
+ * @param path path of the directory including the trailing '/'
+ * @param realdomain the real domain if this is a domain directory, NULL otherwise
+ * @param vpopbounce contents of control/vpopbounce
+ * @param rec the record
+ * @param flag the domain flag is returned here for domain directories, may be NULL otherwise
+ * @return 0 on success, -1 on error
+ */
+static int
+scan_dir(struct cdb_make *cm, int dirfd, const char *path, const char *realdomain,
+		const char *vpopbounce, struct rbuf *rec, char *flag)
+{
+	const size_t qmlen = strlen(".qmail-");
+	const size_t plen = strlen(path);
+	struct dirent *de;
+	char **conf;
+	DIR *dir;
+	int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if ((fd < 0) || ((dir = fdopendir(fd)) == NULL)) {
+		if (fd >= 0)
+			close(fd);
+		if (errno != EACCES)
+			return -1;
+		/* the file system must be asked at runtime */
+		return rbuf_add(rec, "/\0", 3);
+	}
+
+	errno = 0;
+	while ((de = readdir(dir)) != NULL) {
+		const size_t len = strlen(de->d_name);
+		struct stat st;
+		int r;
+
+		if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0))
+			continue;
+
+		r = entry_exists(dirfd, de, &st);
+		if (r < 0)
+			break;
+		else if (r == 0)
+			continue;
+
+		if ((realdomain != NULL) && (len > qmlen) && (strncmp(de->d_name, ".qmail-", qmlen) == 0)) {
+			if (strcmp(de->d_name + qmlen, "default") == 0) {
+				r = catchall(dirfd, vpopbounce);
+				if (r < 0)
+					break;
+				*flag = r;
+			}
+
+			if ((cm != NULL) && (add_record(cm, 'q', de->d_name + qmlen, realdomain, NULL, 0) != 0))
+				break;
+		} else if (S_ISREG(st.st_mode)) {
+			if ((rbuf_add(rec, de->d_name, len) != 0) || (rbuf_add(rec, "/", 1) != 0))
+				break;
+		} else if (S_ISDIR(st.st_mode) && (realdomain != NULL) && (cm != NULL)) {
+			struct rbuf urec = { .s = NULL };
+			char upath[plen + len + 2];
+			int ufd;
+
+			memcpy(upath, path, plen);
+			memcpy(upath + plen, de->d_name, len);
+			upath[plen + len] = '/';
+			upath[plen + len + 1] = '\0';
+
+			ufd = openat(dirfd, de->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if ((ufd < 0) && (errno != EACCES))
+				break;
+
+			if ((rbuf_addstr(&urec, upath) != 0) ||
+					((ufd < 0) && (rbuf_add(&urec, "/\0", 3) != 0)) ||
+					((ufd >= 0) && (scan_dir(NULL, ufd, upath, NULL, vpopbounce, &urec, NULL) != 0)) ||
+					(add_record(cm, 'u', de->d_name, realdomain, urec.s, urec.len) != 0)) {
+				const int e = errno;
+				if (ufd >= 0)
+					close(ufd);
+				free(urec.s);
+				errno = e;
+				break;
+			}
+			if (ufd >= 0)
+				close(ufd);
+			free(urec.s);
+		}
+		errno = 0;
+	}
+
+	if (errno != 0) {
+		const int e = errno;
+		closedir(dir);
+		errno = e;
+		return -1;
+	}
+	closedir(dir);
+
+	if (rbuf_add(rec, "", 1) != 0)
+		return -1;
+
+	if (loadlistfd(openat(dirfd, "filterconf", O_RDONLY | O_CLOEXEC), &conf, NULL) != 0)
+		return -1;
+	for (unsigned int i = 0; (conf != NULL) && (conf[i] != NULL); i++) {
+		if (rbuf_addstr(rec, conf[i]) != 0) {
+			free(conf);
+			return -1;
+		}
+	}
+	free(conf);
+
+	return rbuf_add(rec, "", 1);
+}
+
+/**
+ * @brief add the records for one domain of users/assign
+ * @param cm the database
+ * @param domain the domain
+ * @param realdomain the domain the directory belongs to
+ * @param dir the domain directory
+ * @param vpopbounce contents of control/vpopbounce
+ * @return 0 on success, -1 on error
+ *
+ * The records of the users are only added for the real domain, aliases
+ * only get their own domain record.
+ */
+static int
+add_domain(struct cdb_make *cm, const char *domain, const char *realdomain, const char *dir,
+		const char *vpopbounce)
+{
+	struct rbuf rec = { .s = NULL };
+	size_t dlen = strlen(dir);
+	char flag = RCPTMAP_NOCATCHALL;
+	int fd;
+	int r;
+
+	while ((dlen > 0) && (dir[dlen - 1] == '/'))
+		dlen--;
+
+	char path[dlen + 2];
+
+	memcpy(path, dir, dlen);
+	path[dlen] = '/';
+	path[dlen + 1] = '\0';
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		switch (errno) {
+		case ENOENT:
+		case ENOTDIR:
+			flag = RCPTMAP_NODIR;
+			break;
+		case EACCES:
+			flag = RCPTMAP_NOACCESS;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	/* the flag is updated once the directory has been read */
+	r = rbuf_add(&rec, &flag, 1);
+	if (r == 0)
+		r = rbuf_addstr(&rec, realdomain);
+	if (r == 0)
+		r = rbuf_addstr(&rec, path);
+	if ((r == 0) && (fd < 0))
+		r = rbuf_add(&rec, "/\0", 3);
+	else if (r == 0)
+		r = scan_dir((strcmp(domain, realdomain) == 0) ? cm : NULL, fd, path, realdomain, vpopbounce, &rec, &flag);
+	if (r == 0) {
+		rec.s[0] = flag;
+		r = add_record(cm, 'd', domain, NULL, rec.s, rec.len);
+	}
+
+	if (fd >= 0) {
+		const int e = errno;
+		close(fd);
+		errno = e;
+	}
+	free(rec.s);
+
+	return r;
+}
+
+/**
+ * @brief write the recipient map
+ * @param fd descriptor of the output file
+ * @param vpopbounce contents of control/vpopbounce, may be NULL
+ * @return 0 on success, -1 on error (errno is set)
+ *
+ * The domains are read from users/assign, all paths are relative to the
+ * current working directory.
+ */
+int
+rcptmap_make(int fd, const char *vpopbounce)
+{
+	struct cdb_make cm;
+	char *assign;
+	size_t len;
+	size_t pos = 0;
+
+	len = lloadfilefd(open("users/assign", O_RDONLY | O_CLOEXEC), &assign, 0);
+	if (len == (size_t)-1)
+		return -1;
+
+	if (cdb_make_start(&cm, fd) != 0) {
+		free(assign);
+		return -1;
+	}
+
+	/* the lines look like "+domain-:realdomain:uid:gid:dir:-::" */
+	while (pos < len) {
+		char *line = assign + pos;
+		char *end = memchr(line, '\n', len - pos);
+		char *fields[5];
+		unsigned int i;
+
+		if (end == NULL)
+			end = assign + len;
+		*end = '\0';
+		pos = end - assign + 1;
+
+		if (*line != '+')
+			continue;
+
+		fields[0] = line + 1;
+		for (i = 1; i < 5; i++) {
+			fields[i] = strchr(fields[i - 1], ':');
+			if (fields[i] == NULL)
+				break;
+			*fields[i]++ = '\0';
+		}
+		if (i < 5)
+			continue;
+		if (strchr(fields[4], ':') != NULL)
+			*strchr(fields[4], ':') = '\0';
+
+		/* only domain entries end with '-' */
+		const size_t klen = strlen(fields[0]);
+		if ((klen < 2) || (fields[0][klen - 1] != '-'))
+			continue;
+		fields[0][klen - 1] = '\0';
+
+		if (add_domain(&cm, fields[0], fields[1], fields[4], vpopbounce) != 0) {
+			free(assign);
+			return cdb_make_abort(&cm);
+		}
+	}
+
+	free(assign);
+
+	return cdb_make_finish(&cm);
+}
@@ -10,11 +10,40 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <unistd.h>
 
+/**
+ * @brief check if a file is known to be missing
+ * @param files list of file names, each one followed by '/', may be NULL
+ * @param fn name of the file
+ * @return if fn is not in files
+ *
+ * If no list is given the file system needs to be asked.
+ */
+static int
+notlisted(const char *files, const char *fn)
+{
+	const size_t len = strlen(fn);
+
+	if (files == NULL)
+		return 0;
+
+	while (*files != '\0') {
+		const char *end = strchr(files, '/');
+
+		if ((end - files == (ptrdiff_t)len) && (strncmp(files, fn, len) == 0))
+			return 0;
+		files = end + 1;
+	}
+
+	errno = ENOENT;
+	return 1;
+}
+
 int
 getfile(const struct userconf *ds, const char *fn, enum config_domain *type, const unsigned int flags)
 {
@@ -23,7 +52,10 @@ getfile(const struct userconf *ds, const char *fn, enum config_domain *type, con
 	if (ds->userdirfd >= 0) {
 		*type = CONFIG_USER;
 
-		fd = openat(ds->userdirfd, fn, O_RDONLY | O_CLOEXEC);
+		if (notlisted(ds->userfiles, fn))
+			fd = -1;
+		else
+			fd = openat(ds->userdirfd, fn, O_RDONLY | O_CLOEXEC);
 
 		if ((fd >= 0) || (errno != ENOENT))
 			return fd;
@@ -32,7 +64,10 @@ getfile(const struct userconf *ds, const char *fn, enum config_domain *type, con
 	if (ds->domaindirfd >= 0) {
 		*type = CONFIG_DOMAIN;
 
-		fd = openat(ds->domaindirfd, fn, O_RDONLY | O_CLOEXEC);
+		if (notlisted(ds->domainfiles, fn))
+			fd = -1;
+		else
+			fd = openat(ds->domaindirfd, fn, O_RDONLY | O_CLOEXEC);
 
 		if (!(flags & userconf_global) || (fd != -1) || (errno != ENOENT))
 			return fd;
@@ -47,56 +82,99 @@ getfile(const struct userconf *ds, const char *fn, enum config_domain *type, con
 	return openat(controldir_fd, fn, O_RDONLY | O_CLOEXEC);
 }
 
+/** @brief the names of the settings as used in the "filterconf" files */
+static const char *setting_names[SETTING_COUNT] = {
+	[SETTING_BLOCK_SOBERG] = "block_SoberG",
+	[SETTING_BLOCK_WILDCARDNS] = "block_wildcardns",
+	[SETTING_CHECK_STRICT_RFC2822] = "check_strict_rfc2822",
+	[SETTING_FAIL_HARD_ON_TEMP] = "fail_hard_on_temp",
+	[SETTING_FORCESTARTTLS] = "forcestarttls",
+	[SETTING_FROMDOMAIN] = "fromdomain",
+	[SETTING_HELOVALID] = "helovalid",
+	[SETTING_NOAPOS] = "noapos",
+	[SETTING_NOBOUNCE] = "nobounce",
+	[SETTING_NONEXIST_ON_BLOCK] = "nonexist_on_block",
+	[SETTING_REJECT_IPV6ONLY] = "reject_ipv6only",
+	[SETTING_SMTP_SPACE_BUG] = "smtp_space_bug",
+	[SETTING_SPFPOLICY] = "spfpolicy",
+	[SETTING_USERSIZE] = "usersize",
+	[SETTING_WHITELISTAUTH] = "whitelistauth"
+};
+
+void
+config_settings_parse(struct config_settings *settings, const char * const *config)
+{
+	settings->present = 0;
+	settings->invalid = 0;
+
+	for (unsigned int i = 0; (config != NULL) && (config[i] != NULL); i++) {
+		const char *eq = strchr(config[i], '=');
+		const size_t l = (eq == NULL) ? strlen(config[i]) : (size_t)(eq - config[i]);
+		unsigned int f;
+
+		for (f = 0; f < SETTING_COUNT; f++) {
+			if ((strncmp(config[i], setting_names[f], l) == 0) && (setting_names[f][l] == '\0'))
+				break;
+		}
+
+		/* unknown setting or already set by a previous line */
+		if ((f == SETTING_COUNT) || (settings->present & (1UL << f)))
+			continue;
+
+		settings->present |= (1UL << f);
+		if (eq == NULL) {
+			/* only the name of the value is given: implicitely set to 1 */
+			settings->values[f] = 1;
+		} else {
+			char *end;
+
+			settings->values[f] = strtol(eq + 1, &end, 10);
+			if (*end != '\0')
+				settings->invalid |= (1UL << f);
+		}
+	}
+}
+
 /**
- * search a value in a given list of config values
+ * get the value of a setting from one configuration level
  *
- * @param config list of settings, last entry has to be NULL, list may be NULL
- * @param flag the value to find
- * @param l strlen(flag)
+ * @param settings the parsed configuration
+ * @param flag the setting to get
  * @return the value assotiated with flag
  * @retval 0 no match
  * @retval -1 syntax error
  */
 static long
-checkconfig(const char * const *config, const char *flag, const size_t l)
+checkconfig(const struct config_settings *settings, const enum config_setting flag)
 {
-	int i = 0;
+	const unsigned long bit = 1UL << flag;
 
 	errno = 0;
-	if (!config || !*config)
+	if (!(settings->present & bit))
 		return 0;
-	while (config[i]) {
-		if (!strncmp(config[i], flag, l)) {
-			if (!config[i][l]) {
-				/* only the name of the value is given: implicitely set to 1 */
-				return 1;
-			} else {
-				if (config[i][l] == '=') {
-					char *s;
-					long r;
-
-					r = strtol(config[i] + l + 1, &s, 10);
-					if (*s) {
-						errno = EINVAL;
-						return -1;
-					}
-					return r;
-				}
-			}
-		}
-		i++;
+	if (settings->invalid & bit) {
+		errno = EINVAL;
+		return -1;
 	}
-	return 0;
+	return settings->values[flag];
+}
+
+static struct config_settings globalsettings;	/**< the parsed global configuration */
+static int globalparsed;			/**< if globalsettings is valid for globalconf */
+
+void
+globalconf_changed(void)
+{
+	globalparsed = 0;
 }
 
 static long
-getsetting_internal(const struct userconf *ds, const char *flag, enum config_domain *type, const unsigned int flags)
+getsetting_internal(const struct userconf *ds, const enum config_setting flag, enum config_domain *type, const unsigned int flags)
 {
-	size_t l = strlen(flag);
 	long r;
 
 	*type = CONFIG_USER;
-	r = checkconfig((const char **)ds->userconf, flag, l);
+	r = checkconfig(&ds->usersettings, flag);
 	if (r > 0) {
 		return r;
 	} else if (r < 0) {
@@ -106,7 +184,7 @@ getsetting_internal(const struct userconf *ds, const char *flag, enum config_dom
 		return 0;
 	}
 	*type = CONFIG_DOMAIN;
-	r = checkconfig((const char **)ds->domainconf, flag, l);
+	r = checkconfig(&ds->domainsettings, flag);
 	if (r > 0) {
 		return r;
 	} else if (r < 0) {
@@ -118,8 +196,13 @@ getsetting_internal(const struct userconf *ds, const char *flag, enum config_dom
 	if (!(flags & userconf_global))
 		return 0;
 
+	if (!globalparsed) {
+		config_settings_parse(&globalsettings, globalconf);
+		globalparsed = 1;
+	}
+
 	*type = CONFIG_GLOBAL;
-	r = checkconfig(globalconf, flag, l);
+	r = checkconfig(&globalsettings, flag);
 	if ((r < 0) && !errno)
 		return 0;
 	return r;
@@ -129,7 +212,7 @@ getsetting_internal(const struct userconf *ds, const char *flag, enum config_dom
  * get setting from user or domain filterconf file
  *
  * @param ds struct with the user/domain config info
- * @param flag name of the setting to find (case sensitive)
+ * @param flag the setting to find
  * @param type if user or domain directory matched, undefined if result != 1)
  * @return value of setting
  * @retval 1 boolean setting or no number given
@@ -137,7 +220,7 @@ getsetting_internal(const struct userconf *ds, const char *flag, enum config_dom
  * @retval -1 on syntax error
  */
 long
-getsetting(const struct userconf *ds, const char *flag, enum config_domain *type)
+getsetting(const struct userconf *ds, const enum config_setting flag, enum config_domain *type)
 {
 	return getsetting_internal(ds, flag, type, 0);
 }
@@ -146,7 +229,7 @@ getsetting(const struct userconf *ds, const char *flag, enum config_domain *type
  * use getsetting and fall back to /var/qmail/control if this finds nothing
  *
  * @param ds struct with the user/domain config info
- * @param flag name of the setting to find (case sensitive)
+ * @param flag the setting to find
  * @param type if user, domain or global file matched, undefined if result != 1
  * @return value of setting
  * @retval 1 boolean setting or no number given
@@ -154,7 +237,7 @@ getsetting(const struct userconf *ds, const char *flag, enum config_domain *type
  * @retval -1 on syntax error
  */
 long
-getsettingglobal(const struct userconf *ds, const char *flag, enum config_domain *type)
+getsettingglobal(const struct userconf *ds, const enum config_setting flag, enum config_domain *type)
 {
 	return getsetting_internal(ds, flag, type, 1);
 }
@@ -0,0 +1,159 @@
+/** \file userconf.c
+ * \brief functions to access the user and domain configuration files
+ */
+
+#include <qsmtpd/userconf.h>
+
+#include <control.h>
+#include <qsmtpd/userfilters.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void
+userconf_init(struct userconf *ds)
+{
+	STREMPTY(ds->domainpath);
+	ds->userconf = NULL;
+	ds->domainconf = NULL;
+	ds->usersettings.present = 0;
+	ds->domainsettings.present = 0;
+	ds->domaindirfd = -1;
+	ds->userdirfd = -1;
+	ds->userfiles = NULL;
+	ds->domainfiles = NULL;
+}
+
+void
+userconf_free(struct userconf *ds)
+{
+	free(ds->domainpath.s);
+	free(ds->userconf);
+	free(ds->domainconf);
+	if (ds->domaindirfd >= 0)
+		close(ds->domaindirfd);
+	if (ds->userdirfd >= 0)
+		close(ds->userdirfd);
+
+	userconf_init(ds);
+}
+
+int
+userconf_get_buffer(const struct userconf *ds, const char *key, char ***values, checkfunc cf, const unsigned int flags)
+{
+	enum config_domain type;
+	int fd;
+	int r;
+	const char *inherit = "!inherit";
+
+	fd = getfile(ds, key, &type, flags);
+
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return CONFIG_NONE;
+		else
+			return -errno;
+	}
+
+	r = loadlistfd(fd, values, cf);
+	if (r < 0)
+		return -errno;
+
+	if (*values == NULL)
+		return CONFIG_NONE;
+
+	if (flags & userconf_inherit &&
+			((type == CONFIG_USER) || ((type == CONFIG_DOMAIN) && (flags & userconf_global)))) {
+		unsigned int i = 0;
+		while (((*values)[i] != NULL) && (strcmp((*values)[i], inherit) != 0))
+			i++;
+		if ((*values)[i] != NULL) {
+			/* found "!inherit", so go up one level */
+			struct userconf uc = *ds;
+			char **inhvals = NULL;
+
+			/* force next lookup level */
+			uc.userdirfd = -1;
+			if (type == CONFIG_DOMAIN)
+				uc.domaindirfd = -1;
+
+			r = userconf_get_buffer(&uc, key, &inhvals, cf, flags);
+			if ((r == CONFIG_DOMAIN) || (r == CONFIG_GLOBAL)) {
+				/* shortcut for the case no new allocation is needed */
+				if ((inhvals[1] == NULL) && (strlen(*inhvals) <= strlen(inherit))) {
+					strncpy((*values)[i], *inhvals, strlen(inherit));
+					free(inhvals);
+				} else {
+					/* count how many entries exist in both lists */
+					unsigned int ocnt = 0, ncnt = 0, s, t;
+					size_t dsize = 0;
+					char **rbuf;
+					char *dbuf;
+
+					while ((*values)[ocnt] != NULL)
+						dsize += strlen((*values)[ocnt++]) + 1;
+					while (inhvals[ncnt] != NULL)
+						dsize += strlen(inhvals[ncnt++]) + 1;
+
+					rbuf = data_array(ocnt + ncnt - 1, dsize, NULL, 0);
+					if (rbuf == NULL) {
+						free(*values);
+						free(inhvals);
+						*values = NULL;
+						return -ENOMEM;
+					}
+
+					dbuf = (char *)(rbuf + ocnt + ncnt + 1);
+					for (s = t = 0; s < ocnt; s++) {
+						if (s == i) {
+							/* this is the "!inherit" line */
+							continue;
+						}
+						rbuf[t++] = dbuf;
+						strcpy(dbuf, (*values)[s]);
+						dbuf += 1 + strlen((*values)[s]);
+					}
+					for (s = 0; s < ncnt; s++) {
+						rbuf[t++] = dbuf;
+						strcpy(dbuf, inhvals[s]);
+						dbuf += 1 + strlen(inhvals[s]);
+					}
+					free(*values);
+					free(inhvals);
+					*values = rbuf;
+				}
+			} else if (r < 0) {
+				free(*values);
+				*values = NULL;
+				return r;
+			}
+		}
+	}
+
+	return type;
+}
+
+int
+userconf_find_domain(const struct userconf *ds, const char *key, const char *domain, const unsigned int flags)
+{
+	enum config_domain type;
+	int fd;
+	int r;
+
+	fd = getfile(ds, key, &type, flags);
+
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return CONFIG_NONE;
+		else
+			return -errno;
+	}
+
+	r = finddomainfd(fd, domain, 1);
+	if ((r < 0) && (errno == 0))
+		return CONFIG_NONE;
+	else
+		return (r > 0) ? type : r;
+}
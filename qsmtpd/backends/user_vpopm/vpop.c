@@ -13,18 +13,216 @@
 #include <qsmtpd/userfilters.h>
 #include <sstring.h>
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 static char *vpopbounce;			/**< the bounce command in vpopmails .qmail-default */
 static struct userconf uconf;			/**< global userconfig cache */
+static struct cdb users_cdb = CDB_INIT;		/**< the users/cdb file */
+
+/**
+ * @brief index of the entries of a domain directory
+ *
+ * Most recipients of dictionary attacks do not exist, so every lookup would
+ * need one failing openat() for every possible .qmail file. Once a session
+ * has seen DIRIDX_MISSES nonexistent recipients, the domain directory is
+ * read once and all further lookups are answered from memory
+ * until the modification time of the directory changes. Ordinary sessions
+ * with only a few recipients never pay for reading the whole directory.
+ */
+static struct {
+	dev_t dev;			/**< device of the indexed directory */
+	ino_t ino;			/**< inode of the indexed directory */
+	struct timespec mtime;		/**< modification time of the directory when it was read */
+	int valid;			/**< if the index may be used */
+	int stable;			/**< if the index may be reused for later lookups */
+	char *names;			/**< the entries, each one a type byte followed by the 0-terminated name */
+	size_t nameslen;		/**< used length of names */
+	uint32_t *slots;		/**< hash table of offsets into names plus 1, 0 is an empty slot */
+	uint32_t nslots;		/**< size of slots, a power of 2 */
+	unsigned int misses;		/**< number of nonexistent recipients in this session */
+} dirindex;
+
+#define DIRIDX_ENTRY	'e'	/**< the entry exists */
+#define DIRIDX_PROBE	'p'	/**< the type of the entry is unknown, ask the file system */
+#define DIRIDX_MISSES	3	/**< nonexistent recipients in a session before directories are indexed */
+
+static void
+dirindex_free(void)
+{
+	free(dirindex.names);
+	free(dirindex.slots);
+	dirindex.names = NULL;
+	dirindex.slots = NULL;
+	dirindex.nameslen = 0;
+	dirindex.nslots = 0;
+	dirindex.valid = 0;
+}
+
+/**
+ * @brief read all entries of a directory into the index
+ * @param dirfd descriptor of the directory
+ * @return 0 on success, -1 on error
+ */
+static int
+dirindex_read(int dirfd)
+{
+	size_t alloc = 0;
+	unsigned int count = 0;
+	struct dirent *de;
+	DIR *dir;
+	int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+
+	dir = fdopendir(fd);
+	if (dir == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	errno = 0;
+	while ((de = readdir(dir)) != NULL) {
+		const size_t len = strlen(de->d_name);
+
+		if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0))
+			continue;
+
+		if (dirindex.nameslen + len + 2 > alloc) {
+			const size_t n = alloc ? 2 * alloc : 4096;
+			char *tmp;
+
+			if ((n < dirindex.nameslen + len + 2) || (n >= UINT32_MAX)) {
+				errno = E2BIG;
+				break;
+			}
+			tmp = realloc(dirindex.names, n);
+			if (tmp == NULL)
+				break;
+			dirindex.names = tmp;
+			alloc = n;
+		}
+
+		/* openat() follows symlinks, so for them the target decides */
+		if ((de->d_type == DT_LNK) || (de->d_type == DT_UNKNOWN))
+			dirindex.names[dirindex.nameslen] = DIRIDX_PROBE;
+		else
+			dirindex.names[dirindex.nameslen] = DIRIDX_ENTRY;
+		memcpy(dirindex.names + dirindex.nameslen + 1, de->d_name, len + 1);
+		dirindex.nameslen += len + 2;
+		count++;
+		errno = 0;
+	}
+
+	if (errno != 0) {
+		const int e = errno;
+		closedir(dir);
+		errno = e;
+		return -1;
+	}
+	closedir(dir);
+
+	dirindex.nslots = 16;
+	while (dirindex.nslots < 2 * count)
+		dirindex.nslots *= 2;
+	dirindex.slots = calloc(dirindex.nslots, sizeof(*dirindex.slots));
+	if (dirindex.slots == NULL)
+		return -1;
+
+	for (size_t off = 0; off < dirindex.nameslen; ) {
+		const char *name = dirindex.names + off + 1;
+		const size_t len = strlen(name);
+		uint32_t i = cdb_hash(name, len) & (dirindex.nslots - 1);
+
+		while (dirindex.slots[i] != 0)
+			i = (i + 1) & (dirindex.nslots - 1);
+		dirindex.slots[i] = off + 1;
+
+		off += len + 2;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief make sure the index matches the given directory
+ * @param dirfd descriptor of the domain directory
+ *
+ * The index is only built once DIRIDX_MISSES nonexistent recipients were
+ * seen in this session. If the index is not built the lookups fall back to
+ * asking the file system, so errors are not reported.
+ */
+static void
+dirindex_load(int dirfd)
+{
+	struct stat st;
+
+	if (fstat(dirfd, &st) != 0) {
+		dirindex_free();
+		return;
+	}
+
+	if (dirindex.valid && dirindex.stable && (dirindex.dev == st.st_dev) && (dirindex.ino == st.st_ino) &&
+			(dirindex.mtime.tv_sec == st.st_mtim.tv_sec) &&
+			(dirindex.mtime.tv_nsec == st.st_mtim.tv_nsec))
+		return;
+
+	dirindex_free();
+
+	if (dirindex.misses < DIRIDX_MISSES)
+		return;
+
+	if (dirindex_read(dirfd) != 0) {
+		dirindex_free();
+		return;
+	}
+
+	dirindex.dev = st.st_dev;
+	dirindex.ino = st.st_ino;
+	dirindex.mtime = st.st_mtim;
+	dirindex.valid = 1;
+	/* the file system may not store the modification time precise enough
+	 * to notice a change that happened in the same second the directory
+	 * was read, so such an index is only used for this lookup */
+	dirindex.stable = (st.st_mtim.tv_sec + 1 < time(NULL));
+}
+
+/**
+ * @brief look up a name in the directory index
+ * @param name the name of the directory entry
+ * @param len length of name
+ * @retval 0 the entry does not exist
+ * @retval 1 the entry exists
+ * @retval -1 the file system needs to be asked
+ */
+static int
+dirindex_lookup(const char *name, const size_t len)
+{
+	uint32_t i;
+
+	if (!dirindex.valid)
+		return -1;
+
+	i = cdb_hash(name, len) & (dirindex.nslots - 1);
+	while (dirindex.slots[i] != 0) {
+		const char *e = dirindex.names + dirindex.slots[i] - 1;
+
+		if ((strncmp(e + 1, name, len) == 0) && (e[len + 1] == '\0'))
+			return (*e == DIRIDX_ENTRY) ? 1 : -1;
+		i = (i + 1) & (dirindex.nslots - 1);
+	}
+
+	return 0;
+}
 
 /*
  * The function vget_dir is a modified copy of vget_assign from vpopmail. It gets the domain directory out of
@@ -55,13 +253,10 @@ static struct userconf uconf;			/**< global userconfig cache */
 int
 vget_dir(const char *domain, struct userconf *ds)
 {
-	int fd;
 	char cdb_key[264];	/* maximum length of domain + 3 byte for !-\0 + padding to be sure */
 	size_t cdbkeylen;
 	const char *cdb_buf;
-	char *cdb_mmap = NULL;
-	int err;
-	struct stat st;
+	uint32_t cdb_len;
 	size_t len;
 
 	cdbkeylen = strlen(domain) + 2;
@@ -72,9 +267,8 @@ vget_dir(const char *domain, struct userconf *ds)
 	cdb_key[cdbkeylen - 1] = '-';
 	cdb_key[cdbkeylen] = '\0';
 
-	/* try to open the cdb file */
-	fd = open("users/cdb", O_RDONLY | O_CLOEXEC);
-	if (fd < 0) {
+	/* the file stays mapped between calls, it is only mapped again if it was replaced */
+	if (cdb_open(&users_cdb, AT_FDCWD, "users/cdb") != 0) {
 		switch (errno) {
 		case ENOENT:
 			/* no database, no match */
@@ -89,32 +283,15 @@ vget_dir(const char *domain, struct userconf *ds)
 		}
 	}
 
-	if (fstat(fd, &st) < 0) {
-		err = -errno;
-		close(fd);
-		return err;
-	}
-	if (!st.st_size) {
-		err = 0;
-		if (close(fd) < 0)
-			err = -errno;
-		return err;
-	}
-
 	/* search the cdb file for our requested domain */
-	cdb_buf = cdb_seekmm(fd, cdb_key, cdbkeylen, &cdb_mmap, &st);
-	if (cdb_buf == NULL) {
-		switch (errno) {
-		case 0:
-			return 0;
-		case EMFILE:
-		case ENFILE:
-		case ENOMEM:
-			return -ENOMEM;
-		default:
-			err_control("users/cdb");
-			return -EDONE;
-		}
+	switch (cdb_find(&users_cdb, cdb_key, cdbkeylen, &cdb_buf, &cdb_len)) {
+	case 0:
+		return 0;
+	case 1:
+		break;
+	default:
+		err_control("users/cdb");
+		return -EDONE;
 	}
 
 	/* format of cdb_buf is :
@@ -135,10 +312,8 @@ vget_dir(const char *domain, struct userconf *ds)
 		char *tmp;
 
 		tmp = realloc(ds->domainpath.s, len + 2);
-		if (tmp == NULL) {
-			munmap(cdb_mmap, st.st_size);
+		if (tmp == NULL)
 			return -ENOMEM;
-		}
 
 		/* the domain has changed, clear all contents */
 		ds->domainpath.s = NULL;
@@ -159,7 +334,6 @@ vget_dir(const char *domain, struct userconf *ds)
 		ds->userconf = NULL;
 	}
 
-	munmap(cdb_mmap, st.st_size);
 	return 1;
 }
 
@@ -177,7 +351,8 @@ vget_dir(const char *domain, struct userconf *ds)
  * @retval 1 file exists
  * @retval <0 error code from opening the file
  *
- * The contents of fd are undefined if the return value is not 1.
+ * The contents of fd are undefined if the return value is not 1. The
+ * directory index must have been loaded for domaindirfd before.
  */
 static int
 qmexists(int domaindirfd, const char *suff1, const size_t len, const int def, int *fd)
@@ -220,6 +395,19 @@ qmexists(int domaindirfd, const char *suff1, const size_t len, const int def, in
 	}
 	filetmp[l] = 0;
 
+	/* the file system only needs to be asked if the file may exist or it
+	 * needs to be opened */
+	switch (dirindex_lookup(filetmp, l)) {
+	case 0:
+		return 0;
+	case 1:
+		if (fd == NULL)
+			return 1;
+		break;
+	default:
+		break;
+	}
+
 	/* these files should not be open long enough to reach a fork, but
 	 * make sure it is not accidentially leaked. */
 	tmpfd = openat(domaindirfd, filetmp, O_RDONLY | O_CLOEXEC);
@@ -308,8 +496,15 @@ user_exists(const string *localpart, const char *domain, struct userconf *dsp)
 		memcpy(fnbuf, localpart->s, localpart->len);
 		fnbuf[localpart->len] = '\0';
 
+		dirindex_load(ds->domaindirfd);
+
 		/* does directory (ds->domainpath.s)+'/'+localpart exist? */
-		ds->userdirfd = get_dirfd(ds->domaindirfd, fnbuf);
+		if (dirindex_lookup(fnbuf, localpart->len) == 0) {
+			ds->userdirfd = -1;
+			errno = ENOENT;
+		} else {
+			ds->userdirfd = get_dirfd(ds->domaindirfd, fnbuf);
+		}
 		if (ds->userdirfd >= 0) {
 			return 1;
 		} else if ((errno != ENOENT) && (errno != ENOTDIR)) {
@@ -361,6 +556,7 @@ user_exists(const string *localpart, const char *domain, struct userconf *dsp)
 	res = qmexists(ds->domaindirfd, NULL, 0, 1, &fd);
 	if (res == 0) {
 		/* no local user with that address */
+		dirindex.misses++;
 		userconf_free(ds);
 		return 0;
 	} else if (res < 0) {
@@ -388,6 +584,7 @@ user_exists(const string *localpart, const char *domain, struct userconf *dsp)
 
 		/* mail would be bounced or catched by .qmail-default */
 		if (strcmp(buff, vpopbounce) == 0) {
+			dirindex.misses++;
 			userconf_free(ds);
 			return 0;
 		} else {
@@ -419,34 +616,11 @@ void
 userbackend_free(void)
 {
 	userconf_free(&uconf);
+	dirindex_free();
 
 	free(vpopbounce);
 }
 
-void
-userconf_init(struct userconf *ds)
-{
-	STREMPTY(ds->domainpath);
-	ds->userconf = NULL;
-	ds->domainconf = NULL;
-	ds->domaindirfd = -1;
-	ds->userdirfd = -1;
-}
-
-void
-userconf_free(struct userconf *ds)
-{
-	free(ds->domainpath.s);
-	free(ds->userconf);
-	free(ds->domainconf);
-	if (ds->domaindirfd >= 0)
-		close(ds->domaindirfd);
-	if (ds->userdirfd >= 0)
-		close(ds->userdirfd);
-
-	userconf_init(ds);
-}
-
 int
 userconf_load_configs(struct userconf *ds)
 {
@@ -463,132 +637,19 @@ userconf_load_configs(struct userconf *ds)
 		/* the domain buffer was loaded because there is no user buffer */
 		ds->domainconf = ds->userconf;
 		ds->userconf = NULL;
-		return 0;
-	}
-
-	/* make sure this one opens the domain file: just set user fd to -1 */
-	ds->userdirfd = -1;
-	r = loadlistfd(getfile(ds, "filterconf", &type, 0), &(ds->domainconf), NULL);
-
-	ds->userdirfd = ufd;
-
-	return r ? errno : 0;
-}
-
-int
-userconf_get_buffer(const struct userconf *ds, const char *key, char ***values, checkfunc cf, const unsigned int flags)
-{
-	enum config_domain type;
-	int fd;
-	int r;
-	const char *inherit = "!inherit";
+	} else {
+		/* make sure this one opens the domain file: just set user fd to -1 */
+		ds->userdirfd = -1;
+		r = loadlistfd(getfile(ds, "filterconf", &type, 0), &(ds->domainconf), NULL);
 
-	fd = getfile(ds, key, &type, flags);
+		ds->userdirfd = ufd;
 
-	if (fd < 0) {
-		if (errno == ENOENT)
-			return CONFIG_NONE;
-		else
-			return -errno;
+		if (r)
+			return errno;
 	}
 
-	r = loadlistfd(fd, values, cf);
-	if (r < 0)
-		return -errno;
-
-	if (*values == NULL)
-		return CONFIG_NONE;
-
-	if (flags & userconf_inherit &&
-			((type == CONFIG_USER) || ((type == CONFIG_DOMAIN) && (flags & userconf_global)))) {
-		unsigned int i = 0;
-		while (((*values)[i] != NULL) && (strcmp((*values)[i], inherit) != 0))
-			i++;
-		if ((*values)[i] != NULL) {
-			/* found "!inherit", so go up one level */
-			struct userconf uc = *ds;
-			char **inhvals = NULL;
-
-			/* force next lookup level */
-			uc.userdirfd = -1;
-			if (type == CONFIG_DOMAIN)
-				uc.domaindirfd = -1;
-
-			r = userconf_get_buffer(&uc, key, &inhvals, cf, flags);
-			if ((r == CONFIG_DOMAIN) || (r == CONFIG_GLOBAL)) {
-				/* shortcut for the case no new allocation is needed */
-				if ((inhvals[1] == NULL) && (strlen(*inhvals) <= strlen(inherit))) {
-					strncpy((*values)[i], *inhvals, strlen(inherit));
-					free(inhvals);
-				} else {
-					/* count how many entries exist in both lists */
-					unsigned int ocnt = 0, ncnt = 0, s, t;
-					size_t dsize = 0;
-					char **rbuf;
-					char *dbuf;
-
-					while ((*values)[ocnt] != NULL)
-						dsize += strlen((*values)[ocnt++]) + 1;
-					while (inhvals[ncnt] != NULL)
-						dsize += strlen(inhvals[ncnt++]) + 1;
-
-					rbuf = data_array(ocnt + ncnt - 1, dsize, NULL, 0);
-					if (rbuf == NULL) {
-						free(*values);
-						free(inhvals);
-						*values = NULL;
-						return -ENOMEM;
-					}
-
-					dbuf = (char *)(rbuf + ocnt + ncnt + 1);
-					for (s = t = 0; s < ocnt; s++) {
-						if (s == i) {
-							/* this is the "!inherit" line */
-							continue;
-						}
-						rbuf[t++] = dbuf;
-						strcpy(dbuf, (*values)[s]);
-						dbuf += 1 + strlen((*values)[s]);
-					}
-					for (s = 0; s < ncnt; s++) {
-						rbuf[t++] = dbuf;
-						strcpy(dbuf, inhvals[s]);
-						dbuf += 1 + strlen(inhvals[s]);
-					}
-					free(*values);
-					free(inhvals);
-					*values = rbuf;
-				}
-			} else if (r < 0) {
-				free(*values);
-				*values = NULL;
-				return r;
-			}
-		}
-	}
-
-	return type;
-}
+	config_settings_parse(&ds->usersettings, (const char **)ds->userconf);
+	config_settings_parse(&ds->domainsettings, (const char **)ds->domainconf);
 
-int
-userconf_find_domain(const struct userconf *ds, const char *key, const char *domain, const unsigned int flags)
-{
-	enum config_domain type;
-	int fd;
-	int r;
-
-	fd = getfile(ds, key, &type, flags);
-
-	if (fd < 0) {
-		if (errno == ENOENT)
-			return CONFIG_NONE;
-		else
-			return -errno;
-	}
-
-	r = finddomainfd(fd, domain, 1);
-	if ((r < 0) && (errno == 0))
-		return CONFIG_NONE;
-	else
-		return (r > 0) ? type : r;
+	return 0;
 }
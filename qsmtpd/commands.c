@@ -6,6 +6,7 @@
 #include <netio.h>
 #include <qsmtpd/addrparse.h>
 #include <qsmtpd/antispam.h>
+#include <qsmtpd/filtercache.h>
 #include <qsmtpd/qsauth.h>
 #include <qsmtpd/queue.h>
 #include <qsmtpd/qsmtpd.h>
@@ -503,7 +504,7 @@ smtp_rcpt(void)
 	case FILTER_DENIED_TEMPORARY:
 		{
 		enum config_domain t;
-		if (!getsetting(&ds, "fail_hard_on_temp", &t)) {
+		if (!getsetting(&ds, SETTING_FAIL_HARD_ON_TEMP, &t)) {
 			if ( (i = netwrite("450 4.7.0 mail temporary denied for policy reasons\r\n")) )
 				e = errno;
 			break;
@@ -516,7 +517,7 @@ smtp_rcpt(void)
 	case FILTER_DENIED_UNSPECIFIC:
 		{
 		enum config_domain t;
-		if (!getsetting(&ds, "nonexist_on_block", &t)) {
+		if (!getsetting(&ds, SETTING_NONEXIST_ON_BLOCK, &t)) {
 			if ( (i = netwrite("550 5.7.1 mail denied for policy reasons\r\n")) )
 				e = errno;
 			break;
@@ -767,6 +768,7 @@ smtp_from(void)
 	xmitstat.thisbytes = 0;
 	xmitstat.datatype = 0;
 	STREMPTY(xmitstat.mailfrom);
+	filtercache_clear();
 
 	r = smtp_from_inner();
 
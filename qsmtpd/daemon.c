@@ -0,0 +1,519 @@
+/** \file daemon.c
+ \brief standalone listener mode of Qsmtpd
+
+ If Qsmtpd is started with -d as first argument it does not expect to be run
+ by tcpserver. The master process loads the configuration once, opens the
+ listening socket and preforks a number of worker processes. Every worker
+ accepts connections and forks a child for each of them that gets the same
+ environment tcpserver would set up and then handles the SMTP session using
+ the already loaded configuration. A worker is replaced by a new one after it
+ has accepted a given number of connections.
+
+ The connection processes are detached from the worker by a double fork, the
+ master process is their subreaper and collects all of them. The number of
+ connections handled at the same time is limited by a pipe that initially
+ holds one byte per allowed connection: a worker takes one byte out of it
+ before it forks the connection process, the master puts it back when the
+ connection process has exited. Workers can therefore be replaced at any time
+ without losing track of the connections they have started.
+ */
+
+#define _GNU_SOURCE /* for accept4() */
+#include <qsmtpd/daemon.h>
+
+#include <fmt.h>
+#include <log.h>
+#include <qdns.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif /* __linux__ */
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#ifndef SOCK_CLOEXEC
+#define SOCK_CLOEXEC 0
+#endif /* SOCK_CLOEXEC */
+
+static volatile sig_atomic_t stop;	/**< if the master process was asked to terminate */
+
+static void
+sigterm(int sig __attribute__ ((unused)))
+{
+	stop = 1;
+}
+
+/**
+ * @brief parse a positive number from a command line option
+ * @param arg the option argument
+ * @param value the number is stored here
+ * @return if the argument was valid
+ */
+static int
+parse_count(const char *arg, unsigned long *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtoul(arg, &end, 10);
+
+	return (errno == 0) && (*end == '\0') && (end != arg) && (*value > 0);
+}
+
+/**
+ * @brief open the listening socket
+ * @param addr the local address to listen on, NULL for all addresses
+ * @param port the local port
+ * @return the socket descriptor or -1 on error
+ *
+ * If IPv6 is supported a single socket accepts connections for both IPv4 and
+ * IPv6. SO_REUSEPORT is set so a new instance of the daemon can be started
+ * before the old one is stopped, e.g. to load a changed configuration.
+ */
+static int
+listen_socket(const char *addr, const unsigned short port)
+{
+	const int one = 1;
+	int sd;
+#ifdef IPV4ONLY
+	struct sockaddr_in sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	if ((addr != NULL) && (inet_pton(AF_INET, addr, &sa.sin_addr) <= 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else /* IPV4ONLY */
+	struct sockaddr_in6 sa;
+	const int zero = 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin6_family = AF_INET6;
+	sa.sin6_port = htons(port);
+	if ((addr != NULL) && (inet_pton(AF_INET6, addr, &sa.sin6_addr) <= 0) &&
+			(inet_pton_v4mapped(addr, &sa.sin6_addr) <= 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sd = socket(PF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if ((sd >= 0) && (setsockopt(sd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero)) != 0)) {
+		const int e = errno;
+
+		close(sd);
+		errno = e;
+		return -1;
+	}
+#endif /* IPV4ONLY */
+
+	if (sd < 0)
+		return -1;
+
+	if ((setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0) ||
+#ifdef SO_REUSEPORT
+			(setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) ||
+#endif /* SO_REUSEPORT */
+			(bind(sd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+			(listen(sd, SOMAXCONN) != 0)) {
+		const int e = errno;
+
+		close(sd);
+		errno = e;
+		return -1;
+	}
+
+	return sd;
+}
+
+/**
+ * @brief set one address and port pair in the environment
+ * @param prefix "LOCAL" or "REMOTE"
+ * @param sa the socket address
+ * @return 0 on success, -1 on error
+ */
+static int
+setenv_addr(const char *prefix, const struct sockaddr_storage *sa)
+{
+	char name[16];
+	char ip[INET6_ADDRSTRLEN];
+	char port[ULSTRLEN];
+#ifdef IPV4ONLY
+	const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+
+	if (inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip)) == NULL)
+		return -1;
+	ultostr(ntohs(sin->sin_port), port);
+#else /* IPV4ONLY */
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sa;
+
+	if (inet_ntop(AF_INET6, &sin6->sin6_addr, ip, sizeof(ip)) == NULL)
+		return -1;
+	ultostr(ntohs(sin6->sin6_port), port);
+
+	strcpy(name, "TCP6");
+	strcat(name, prefix);
+	strcat(name, "IP");
+	if (setenv(name, ip, 1) != 0)
+		return -1;
+	strcpy(name + strlen(name) - 2, "PORT");
+	if (setenv(name, port, 1) != 0)
+		return -1;
+
+	/* the IPv4 variables contain IPv4 addresses in the usual notation */
+	if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr))
+		memmove(ip, ip + strlen("::ffff:"), strlen(ip + strlen("::ffff:")) + 1);
+#endif /* IPV4ONLY */
+
+	strcpy(name, "TCP");
+	strcat(name, prefix);
+	strcat(name, "IP");
+	if (setenv(name, ip, 1) != 0)
+		return -1;
+	strcpy(name + strlen(name) - 2, "PORT");
+	return setenv(name, port, 1);
+}
+
+/**
+ * @brief set up the environment for a connection like tcpserver does
+ * @param sd the connected socket
+ * @return 0 on success, -1 on error
+ */
+static int
+setenv_conn(const int sd)
+{
+	struct sockaddr_storage local, remote;
+	socklen_t llen = sizeof(local);
+	socklen_t rlen = sizeof(remote);
+
+	if ((getsockname(sd, (struct sockaddr *)&local, &llen) != 0) ||
+			(getpeername(sd, (struct sockaddr *)&remote, &rlen) != 0))
+		return -1;
+
+#ifdef IPV4ONLY
+	if (setenv("PROTO", "TCP", 1) != 0)
+		return -1;
+#else /* IPV4ONLY */
+	if (setenv("PROTO", "TCP6", 1) != 0)
+		return -1;
+#endif /* IPV4ONLY */
+
+	/* there is no remote host lookup or ident query */
+	unsetenv("TCPLOCALHOST");
+	unsetenv("TCPREMOTEHOST");
+	unsetenv("TCPREMOTEINFO");
+
+	if (setenv_addr("LOCAL", &local) != 0)
+		return -1;
+	return setenv_addr("REMOTE", &remote);
+}
+
+/**
+ * @brief give a connection slot back
+ * @param slots the connection slot pipe
+ */
+static void
+slot_release(const int slots[2])
+{
+	const char c = 's';
+
+	if (write(slots[1], &c, 1) != 1)
+		log_write(LOG_ERR, "cannot release connection slot");
+}
+
+/**
+ * @brief accept connections in a worker process
+ * @param lsd the listening socket
+ * @param maxconn number of connections to accept before the worker exits
+ * @param slots the connection slot pipe
+ *
+ * This only returns in the process that handles an accepted connection. The
+ * connection is then available on descriptors 0 and 1. An accepted connection
+ * is only handed over if a connection slot is free, otherwise the worker waits
+ * until one of the running connection processes exits.
+ */
+static void
+worker(const int lsd, const unsigned long maxconn, const int slots[2])
+{
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+
+	for (unsigned long handled = 0; handled < maxconn; ) {
+		pid_t pid;
+		int status;
+		int sd;
+		char c;
+
+		sd = accept4(lsd, NULL, NULL, SOCK_CLOEXEC);
+		if (sd < 0) {
+			switch (errno) {
+			case EINTR:
+			case ECONNABORTED:
+				break;
+			default:
+				log_write(LOG_ERR, "cannot accept connection");
+				/* do not spin if the system is out of ressources */
+				sleep(1);
+			}
+			continue;
+		}
+
+		handled++;
+
+		while (read(slots[0], &c, 1) != 1) {
+			if (errno != EINTR) {
+				log_write(LOG_ERR, "cannot get connection slot");
+				exit(1);
+			}
+		}
+
+		/* the intermediate process exits immediately, so the connection
+		 * process is reparented to the master process */
+		pid = fork();
+		if (pid == 0) {
+			pid = fork();
+			if (pid != 0)
+				_exit((pid < 0) ? 1 : 0);
+
+			close(lsd);
+			close(slots[0]);
+			close(slots[1]);
+			if ((setenv_conn(sd) != 0) || (dup2(sd, 0) != 0) || (dup2(sd, 1) != 1)) {
+				log_write(LOG_ERR, "cannot set up connection");
+				_exit(1);
+			}
+			close(sd);
+			return;
+		}
+		close(sd);
+
+		if ((pid < 0) || (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) ||
+				(WEXITSTATUS(status) != 0)) {
+			log_write(LOG_ERR, "cannot fork child process for connection");
+			slot_release(slots);
+		}
+	}
+
+	exit(0);
+}
+
+/**
+ * @brief create the connection slot pipe
+ * @param slots the descriptors of the pipe are stored here
+ * @param concurrency the number of connection slots
+ * @return 0 on success, error code else
+ */
+static int
+slots_open(int slots[2], const unsigned long concurrency)
+{
+	char buf[512];
+
+	if (pipe2(slots, O_CLOEXEC) != 0)
+		return errno;
+
+	/* the write end is non-blocking so a too high limit is detected */
+	if (fcntl(slots[1], F_SETFL, O_NONBLOCK) != 0) {
+		const int e = errno;
+
+		close(slots[0]);
+		close(slots[1]);
+		return e;
+	}
+
+	memset(buf, 's', sizeof(buf));
+	for (unsigned long left = concurrency; left > 0; ) {
+		const size_t len = (left > sizeof(buf)) ? sizeof(buf) : left;
+		ssize_t w = write(slots[1], buf, len);
+
+		if (w <= 0) {
+			const int e = (w == 0) ? EINVAL : errno;
+
+			close(slots[0]);
+			close(slots[1]);
+			return (e == EAGAIN) ? EINVAL : e;
+		}
+		left -= w;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief run Qsmtpd as a standalone daemon
+ * @param argc the argument count, will be adjusted to the arguments after the options
+ * @param argv the arguments, will be adjusted to the arguments after the options
+ * @return 0 in the child processes that handle a connection, else error code
+ *
+ * The options are parsed starting at argv[1], which must be "-d". The master
+ * and worker processes never return unless the startup fails. In the child
+ * processes argv[0] is kept and the arguments following the options are
+ * passed on as if Qsmtpd was called with only these arguments.
+ *
+ * This needs PR_SET_CHILD_SUBREAPER, on other systems ENOSYS is returned.
+ */
+int
+daemon_run(int *argc, char ***argv)
+{
+	const char *addr = NULL;
+	unsigned long port = 25;
+	unsigned long workers = 4;
+	unsigned long maxconn = 100;
+	unsigned long concurrency = 40;
+	struct sigaction sa;
+	pid_t *pids;
+	int slots[2];
+	int lsd;
+	int i;
+	int r;
+
+	for (i = 2; (i < *argc) && ((*argv)[i][0] == '-'); i++) {
+		const char *opt = (*argv)[i];
+		const char *arg = (*argv)[i + 1];
+		int valid = 1;
+
+		if (strcmp(opt, "--") == 0) {
+			i++;
+			break;
+		}
+
+		if (arg == NULL)
+			valid = 0;
+		else if (strcmp(opt, "-l") == 0)
+			addr = arg;
+		else if (strcmp(opt, "-p") == 0)
+			valid = parse_count(arg, &port) && (port <= 65535);
+		else if (strcmp(opt, "-w") == 0)
+			valid = parse_count(arg, &workers);
+		else if (strcmp(opt, "-n") == 0)
+			valid = parse_count(arg, &maxconn);
+		else if (strcmp(opt, "-c") == 0)
+			valid = parse_count(arg, &concurrency);
+		else
+			valid = 0;
+
+		if (!valid) {
+			const char *logmsg[] = { "invalid daemon option ", opt, NULL };
+
+			log_writen(LOG_ERR, logmsg);
+			return EINVAL;
+		}
+		i++;
+	}
+
+#ifdef PR_SET_CHILD_SUBREAPER
+	/* the connection processes are collected by the master process */
+	if (prctl(PR_SET_CHILD_SUBREAPER, 1) != 0) {
+		const int e = errno;
+
+		log_write(LOG_ERR, "cannot become subreaper for the connection processes");
+		return e;
+	}
+#else /* PR_SET_CHILD_SUBREAPER */
+	log_write(LOG_ERR, "daemon mode is not supported on this system");
+	return ENOSYS;
+#endif /* PR_SET_CHILD_SUBREAPER */
+
+	r = slots_open(slots, concurrency);
+	if (r != 0) {
+		log_write(LOG_ERR, "cannot set up the connection limit");
+		return r;
+	}
+
+	lsd = listen_socket(addr, port);
+	if (lsd < 0) {
+		const int e = errno;
+
+		log_write(LOG_ERR, "cannot open listening socket");
+		close(slots[0]);
+		close(slots[1]);
+		return e;
+	}
+
+	pids = calloc(workers, sizeof(*pids));
+	if (pids == NULL) {
+		close(lsd);
+		close(slots[0]);
+		close(slots[1]);
+		return ENOMEM;
+	}
+
+	/* no SA_RESTART, wait() must be interrupted by the signal */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigterm;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	while (!stop) {
+		unsigned long w;
+		int status;
+		pid_t pid;
+
+		for (w = 0; (w < workers) && !stop; w++) {
+			if (pids[w] > 0)
+				continue;
+
+			pids[w] = fork();
+			if (pids[w] == 0) {
+				free(pids);
+				worker(lsd, maxconn, slots);
+
+				/* this is now the child handling a connection */
+				(*argv)[i - 1] = (*argv)[0];
+				*argv += i - 1;
+				*argc -= i - 1;
+				return 0;
+			} else if (pids[w] < 0) {
+				log_write(LOG_ERR, "cannot fork worker process");
+				pids[w] = 0;
+				sleep(1);
+			}
+		}
+
+		pid = wait(&status);
+		if (pid <= 0)
+			continue;
+
+		for (w = 0; w < workers; w++) {
+			if (pids[w] == pid) {
+				pids[w] = 0;
+				break;
+			}
+		}
+
+		/* every other process is a finished connection process */
+		if (w == workers) {
+			slot_release(slots);
+			continue;
+		}
+
+		/* a worker that did not exit normally may fail again immediately */
+		if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			log_write(LOG_WARNING, "worker process terminated abnormally");
+			sleep(1);
+		}
+	}
+
+	close(lsd);
+	close(slots[0]);
+	close(slots[1]);
+	for (unsigned long w = 0; w < workers; w++) {
+		if (pids[w] > 0)
+			kill(pids[w], SIGTERM);
+	}
+	free(pids);
+
+	exit(0);
+}
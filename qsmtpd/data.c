@@ -6,6 +6,7 @@
 #define _GNU_SOURCE
 #include <qsmtpd/qsdata.h>
 
+#include <bufscan.h>
 #include <fmt.h>
 #include <log.h>
 #include <netio.h>
@@ -84,9 +85,82 @@ date822(char *buf)
 	two_digit(buf + 29, tz % 60);
 }
 
+#define QUEUEBUF_SIZE	(64 * 1024)	/* size of the buffer for message data to qmail-queue */
+
+static char queuebuf[QUEUEBUF_SIZE];	/* message data not yet sent to qmail-queue */
+static size_t queuebuf_len;		/* number of bytes used in queuebuf */
+
+/**
+ * @brief send all buffered message data to qmail-queue
+ * @retval 0 all data was written
+ * @retval -1 an error occurred (errno is set)
+ *
+ * The buffer is empty afterwards in any case.
+ */
+static int
+queue_flush(void)
+{
+	size_t off = 0;
+
+	while (off < queuebuf_len) {
+		const ssize_t w = write(queuefd_data, queuebuf + off, queuebuf_len - off);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			queuebuf_len = 0;
+			return -1;
+		}
+		off += w;
+	}
+
+	queuebuf_len = 0;
+	return 0;
+}
+
+/**
+ * @brief add message data to the buffer for qmail-queue
+ * @param buf data to write
+ * @param len length of buf
+ * @retval 0 data was buffered or written
+ * @retval -1 an error occurred (errno is set)
+ *
+ * The buffer is only written out once it is full, use queue_flush()
+ * at the end of the message.
+ */
+static int
+queue_write(const char *buf, size_t len)
+{
+	while (len > 0) {
+		size_t part = sizeof(queuebuf) - queuebuf_len;
+
+		if (part > len)
+			part = len;
+		memcpy(queuebuf + queuebuf_len, buf, part);
+		queuebuf_len += part;
+		buf += part;
+		len -= part;
+
+		if ((queuebuf_len == sizeof(queuebuf)) && (queue_flush() != 0))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief abort the message and discard all buffered message data
+ */
+static void
+queue_drop(void)
+{
+	queuebuf_len = 0;
+	queue_reset();
+}
+
 #define WRITE(buf,len) \
 		do { \
-			if ( (rc = write(queuefd_data, buf, len)) < 0 ) { \
+			if ( (rc = queue_write(buf, len)) < 0 ) { \
 				return rc; \
 			} \
 		} while (0)
@@ -111,7 +185,8 @@ write_received(const int chunked)
 	const char afterprot[]     =  "\n\tfor <";	/* the string to be written after the protocol */
 	const char afterprotauth[] = "A\n\tfor <";	/* the string to be written after the protocol for authenticated mails*/
 
-	/* write "Received-SPF: " line */
+	/* write "Received-SPF: " line, this is written directly to the
+	 * queue, so nothing may be in the buffer before */
 	if (!is_authenticated_client() && (relayclient != 1)) {
 		if ( (rc = spfreceived(queuefd_data, xmitstat.spf)) )
 			return rc;
@@ -186,7 +261,7 @@ write_received(const int chunked)
 #undef WRITE
 #define WRITE(buf, len) \
 		do { \
-			if ( (rc = write(queuefd_data, buf, len)) < 0 ) { \
+			if ( (rc = queue_write(buf, len)) < 0 ) { \
 				goto err_write; \
 			} \
 		} while (0)
@@ -207,10 +282,8 @@ check_rfc822_headers(unsigned int *headerflags, const char **hdrname)
 	const char *searchpattern[] = { "Date:", "From:", "Message-Id:", NULL };
 	int j;
 
-	for (j = linein.len - 1; j >= 0; j--) {
-		if (((signed char)linein.s[j]) < 0)
-			return -8;
-	}
+	if (has_8bit(linein.s, linein.len))
+		return -8;
 
 	for (j = 0; searchpattern[j] != NULL; j++) {
 		if (!strncasecmp(searchpattern[j], linein.s, strlen(searchpattern[j]))) {
@@ -229,6 +302,33 @@ check_rfc822_headers(unsigned int *headerflags, const char **hdrname)
 
 static unsigned long msgsize;
 
+/**
+ * @brief drop the rest of the message body
+ * @return the size of the dropped data as counted for the message size
+ */
+static unsigned long
+drain_body(void)
+{
+	unsigned long dropped = 0;
+
+	for (;;) {
+		const char *body;
+		size_t lines;
+		const size_t blen = net_readbody(&body, &lines);
+
+		if (blen == 0)
+			return dropped;
+
+		if (blen != (size_t) -1)
+			dropped += blen + lines;
+		else if ((errno == EINVAL) || (errno == E2BIG))
+			/* count the broken line like an empty one */
+			dropped += 2;
+		else
+			return dropped;
+	}
+}
+
 static void log_recips(const char *reason)
 {
 #define LOG_BRACES "] ("
@@ -271,6 +371,8 @@ smtp_data(void)
 	const char *errmsg = NULL;
 	char errbuf[96];			/* for dynamically constructed error messages */
 	unsigned int hops = 0;		/* number of "Received:"-lines */
+	int inbody = 0;			/* 1 while the message body is read using net_readbody(),
+					 * 2 once the end of data was found there */
 
 	msgsize = 0;
 
@@ -283,6 +385,7 @@ smtp_data(void)
 
 	if ( (i = queue_init()) )
 		return i;
+	queuebuf_len = 0;
 
 	if (netwrite("354 Start mail input; end with <CRLF>.<CRLF>\r\n")) {
 		int e = errno;
@@ -428,27 +531,32 @@ smtp_data(void)
 		/* if (linein.len) message has no body and we already are at the end */
 		WRITEL("\n");
 		msgsize += 2;
-		if (net_read(1))
-			goto loop_data;
-		while (((linein.len != 1) || (linein.s[0] != '.')) && (msgsize <= maxbytes)) {
-			unsigned int offset;
-
-			if ((xmitstat.check2822 & 1) && !xmitstat.datatype) {
-				for (i = linein.len - 1; i >= 0; i--)
-					if (((signed char)linein.s[i]) < 0) {
-						logreason = "8bit-character in message body}";
-						errmsg = "550 5.6.0 message contains 8bit characters\r\n";
-						goto loop_data;
-					}
+		/* the body needs no further inspection per line, so read it in
+		 * big blocks that are already converted to LF line endings */
+		inbody = 1;
+		while (msgsize <= maxbytes) {
+			const char *body;
+			size_t lines;
+			const size_t blen = net_readbody(&body, &lines);
+
+			if (blen == 0) {
+				inbody = 2;
+				break;
+			} else if (blen == (size_t) -1) {
+				/* count the broken line like an empty one */
+				msgsize += 2;
+				goto loop_data;
 			}
 
-			offset = (linein.s[0] == '.') ? 1 : 0;
-			WRITE(linein.s + offset, linein.len - offset);
-			msgsize += linein.len + 2 - offset;
+			msgsize += blen + lines;
 
-			WRITEL("\n");
-			if (net_read(1))
+			if ((xmitstat.check2822 & 1) && !xmitstat.datatype && has_8bit(body, blen)) {
+				logreason = "8bit-character in message body}";
+				errmsg = "550 5.6.0 message contains 8bit characters\r\n";
 				goto loop_data;
+			}
+
+			WRITE(body, blen);
 		}
 	}
 	if (msgsize > maxbytes) {
@@ -462,18 +570,22 @@ smtp_data(void)
 	in_data = 0;
 #endif
 
-	if (!queue_envelope(msgsize, 0))
+	if ((queue_flush() == 0) && !queue_envelope(msgsize, 0))
 		return queue_result();
 
 err_write:
 	rc = errno;
-	queue_reset();
+	queue_drop();
 	freedata();
 
 /* first check, then read: if the error happens on the last line nothing will be read here */
-	while ((linein.len != 1) || (linein.s[0] != '.')) {
-		if (net_read(1))
-			break;
+	if (inbody == 1) {
+		drain_body();
+	} else if (inbody == 0) {
+		while ((linein.len != 1) || (linein.s[0] != '.')) {
+			if (net_read(1))
+				break;
+		}
 	}
 
 #ifdef DEBUG_IO
@@ -522,14 +634,19 @@ loop_data:
 			logreason = "read error}";
 		}
 	}
-	queue_reset();
+	/* the message is dropped anyway, do not feed it to qmail-queue */
+	queue_drop();
 	/* eat all data until the transmission ends. But just drop it and return
 	 * an error defined before jumping here */
-	while ((linein.len != 1) || (linein.s[0] != '.')) {
-		msgsize += linein.len + 2;
-		if (linein.s[0] == '.')
-			msgsize--;
-		net_read(1);
+	if (inbody == 1) {
+		msgsize += drain_body();
+	} else if (inbody == 0) {
+		while ((linein.len != 1) || (linein.s[0] != '.')) {
+			msgsize += linein.len + 2;
+			if (linein.s[0] == '.')
+				msgsize--;
+			net_read(1);
+		}
 	}
 
 	log_recips(logreason);
@@ -582,6 +699,7 @@ smtp_bdat(void)
 		lastcr = 0;
 
 		bdaterr = queue_init();
+		queuebuf_len = 0;
 
 		if (!bdaterr)
 			bdaterr = write_received(1);
@@ -657,7 +775,7 @@ smtp_bdat(void)
 	}
 	/* send envelope data if this is last chunk */
 	if (*more && !bdaterr) {
-		if (queue_envelope(msgsize, 1))
+		if ((queue_flush() != 0) || queue_envelope(msgsize, 1))
 			goto err_write;
 
 		return queue_result();
@@ -665,7 +783,7 @@ smtp_bdat(void)
 
 	if (bdaterr) {
 		if (queuefd_hdr >= 0)
-			queue_reset();
+			queue_drop();
 		freedata();
 	} else if (hops > MAXHOPS) {
 		log_recips(loop_logmsg);
@@ -686,7 +804,7 @@ smtp_bdat(void)
 	return bdaterr;
 err_write:
 	rc = errno;
-	queue_reset();
+	queue_drop();
 	freedata();
 
 	switch (rc) {
@@ -13,7 +13,7 @@
 enum filter_result
 cb_boolean(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 {
-	if (getsettingglobal(ds, "whitelistauth", t) > 0) {
+	if (getsettingglobal(ds, SETTING_WHITELISTAUTH, t) > 0) {
 		if (is_authenticated_client())
 			return FILTER_WHITELISTED;
 	}
@@ -23,7 +23,7 @@ cb_boolean(const struct userconf *ds, const char **logmsg, enum config_domain *t
 	 *     STARTTLS extension in order to deliver mail locally.
 	 * We offer it for paranoid users but don't use getsettingglobal here so
 	 * it can't be turned on for everyone by accident (or stupid postmaster) */
-	if (!ssl && (getsetting(ds, "forcestarttls", t) > 0)) {
+	if (!ssl && (getsetting(ds, SETTING_FORCESTARTTLS, t) > 0)) {
 		int rc = netwrite("501 5.7.1 recipient requires encrypted message transmission\r\n");
 		*logmsg = "TLS required";
 		return (rc != 0) ? FILTER_ERROR : FILTER_DENIED_WITH_MESSAGE;
@@ -33,7 +33,7 @@ cb_boolean(const struct userconf *ds, const char **logmsg, enum config_domain *t
 	 * But if you are sure that there can't be any bounce messages (e.g. the address
 	 * is only used on a website or as a usenet From or Reply-To address) this will
 	 * block spamruns, joe-jobs and bounces from braindead virus scanners */
-	if (!xmitstat.mailfrom.len && (getsetting(ds, "nobounce", t) > 0)) {
+	if (!xmitstat.mailfrom.len && (getsetting(ds, SETTING_NOBOUNCE, t) > 0)) {
 		const char *logmess[] = {"rejected message to <", THISRCPT, "> from IP [", xmitstat.remoteip,
 					"] {no bounces allowed}", NULL};
 
@@ -42,7 +42,7 @@ cb_boolean(const struct userconf *ds, const char **logmsg, enum config_domain *t
 		return (rc != 0) ? FILTER_ERROR : FILTER_DENIED_WITH_MESSAGE;
 	}
 
-	if ((getsetting(ds, "noapos", t) > 0) && xmitstat.mailfrom.len) {
+	if ((getsetting(ds, SETTING_NOAPOS, t) > 0) && xmitstat.mailfrom.len) {
 		const char *at = strchr(xmitstat.mailfrom.s, '@');
 
 		if (memchr(xmitstat.mailfrom.s, '\'', at - xmitstat.mailfrom.s)) {
@@ -18,7 +18,7 @@ cb_check2822(const struct userconf *ds, const char **logmsg __attribute__ ((unus
 	if (!xmitstat.check2822)
 		return FILTER_PASSED;
 
-	if (!getsettingglobal(ds, "check_strict_rfc2822", t)) {
+	if (!getsettingglobal(ds, SETTING_CHECK_STRICT_RFC2822, t)) {
 		/* no setting: the user has to explicitely enable this check so
 		 * we disable the check and can stop here */
 		xmitstat.check2822 = 0;
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <syslog.h>
 #include <qsmtpd/antispam.h>
+#include <qsmtpd/filtercache.h>
 #include "control.h"
 #include "log.h"
 #include "netio.h"
@@ -37,7 +38,7 @@ cb_dnsbl(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 		return FILTER_PASSED;
 	}
 
-	i = check_rbl(a, &txt);
+	i = check_rbl_cached(a, &txt);
 	if (i >= 0) {
 		int j, u;
 		char **c = NULL;		/* same like **a, just for whitelist */
@@ -50,7 +51,7 @@ cb_dnsbl(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 			j = -1;
 			errno = 0;
 		} else {
-			j = check_rbl(c, NULL);
+			j = check_rbl_cached(c, NULL);
 		}
 
 		if (j >= 0) {
@@ -0,0 +1,243 @@
+/** \file filtercache.c
+ \brief per-transaction cache of recipient independent filter results
+
+ Several filters do lookups that only depend on the connection or the sender,
+ but not on the recipient: RBL queries for the remote IP, IP list lookups, and
+ lookups for the sender domain. Their results are remembered here for the
+ current transaction, keyed by the kind of lookup and a hash of the effective
+ configuration used (the list contents or the identity of the file). The cache
+ is cleared on a new MAIL FROM and on RSET.
+ */
+
+#include <qsmtpd/filtercache.h>
+
+#include <qsmtpd/antispam.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILTERCACHE_SIZE	16	/**< maximum number of cached results */
+
+/**
+ * @brief one cached result
+ */
+struct filtercache_entry {
+	uint64_t key;			/**< hash of the effective configuration */
+	char *txt;			/**< optional message text of the result */
+	int result;			/**< the cached result */
+	enum filtercache_type type;	/**< kind of lookup, 0 if entry is unused */
+	int hastxt;			/**< if txt was looked up */
+};
+
+static struct filtercache_entry entries[FILTERCACHE_SIZE];
+static unsigned int nextentry;		/**< index of the entry to use next */
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+static uint64_t
+fnv_add(uint64_t h, const unsigned char *data, size_t len)
+{
+	while (len-- > 0) {
+		h ^= *data++;
+		h *= FNV_PRIME;
+	}
+
+	return h;
+}
+
+/**
+ * @brief calculate the cache key for a list of strings
+ * @param list a NULL terminated array of strings
+ * @return the hash of the list contents
+ */
+uint64_t
+filtercache_key_list(char *const *list)
+{
+	uint64_t h = FNV_OFFSET;
+
+	for (unsigned int i = 0; list[i] != NULL; i++)
+		/* include the terminating 0 byte to separate the entries */
+		h = fnv_add(h, (const unsigned char *)list[i], strlen(list[i]) + 1);
+
+	return h;
+}
+
+/**
+ * @brief calculate the cache key for an opened file
+ * @param fd the file descriptor
+ * @param key the key is stored here
+ * @return 0 on success, -1 on error (errno is set)
+ *
+ * The key is built from the identity of the file and its modification time
+ * and size, so a changed file will get a different key.
+ */
+int
+filtercache_key_fd(int fd, uint64_t *key)
+{
+	struct stat st;
+	uint64_t h = FNV_OFFSET;
+
+	if (fstat(fd, &st) != 0)
+		return -1;
+
+	h = fnv_add(h, (const unsigned char *)&st.st_dev, sizeof(st.st_dev));
+	h = fnv_add(h, (const unsigned char *)&st.st_ino, sizeof(st.st_ino));
+	h = fnv_add(h, (const unsigned char *)&st.st_size, sizeof(st.st_size));
+	h = fnv_add(h, (const unsigned char *)&st.st_mtim, sizeof(st.st_mtim));
+	*key = h;
+
+	return 0;
+}
+
+/**
+ * @brief look up a cached result
+ * @param type the kind of lookup
+ * @param key the key of the effective configuration
+ * @param result the cached result is stored here
+ * @param txt if not NULL a copy of the cached message text is stored here
+ * @return if a cached result was found
+ *
+ * If txt is not NULL only results stored with a looked up text will be
+ * returned. The copy of the text must be freed by the caller.
+ */
+int
+filtercache_get(const enum filtercache_type type, const uint64_t key, int *result, char **txt)
+{
+	for (unsigned int i = 0; i < FILTERCACHE_SIZE; i++) {
+		const struct filtercache_entry *e = entries + i;
+
+		if ((e->type != type) || (e->key != key))
+			continue;
+		if ((txt != NULL) && !e->hastxt)
+			continue;
+
+		if (txt != NULL) {
+			*txt = NULL;
+			/* if this fails the generic message is used instead, that is no problem */
+			if (e->txt != NULL)
+				*txt = strdup(e->txt);
+		}
+		*result = e->result;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief store a result in the cache
+ * @param type the kind of lookup
+ * @param key the key of the effective configuration
+ * @param result the result to store
+ * @param txt the message text of the result, may be NULL
+ * @param hastxt if the message text was looked up
+ *
+ * If the cache is full the oldest entry is replaced.
+ */
+void
+filtercache_put(const enum filtercache_type type, const uint64_t key, const int result, const char *txt, const int hastxt)
+{
+	struct filtercache_entry *e = NULL;
+	char *t = NULL;
+
+	if (txt != NULL) {
+		t = strdup(txt);
+		/* don't cache something incomplete */
+		if (t == NULL)
+			return;
+	}
+
+	/* replace an older result for the same lookup */
+	for (unsigned int i = 0; i < FILTERCACHE_SIZE; i++) {
+		if ((entries[i].type == type) && (entries[i].key == key)) {
+			e = entries + i;
+			break;
+		}
+	}
+
+	if (e == NULL) {
+		e = entries + nextentry;
+		nextentry = (nextentry + 1) % FILTERCACHE_SIZE;
+	}
+
+	free(e->txt);
+	e->type = type;
+	e->key = key;
+	e->result = result;
+	e->txt = t;
+	e->hastxt = hastxt;
+}
+
+/**
+ * @brief forget all cached results
+ */
+void
+filtercache_clear(void)
+{
+	for (unsigned int i = 0; i < FILTERCACHE_SIZE; i++) {
+		free(entries[i].txt);
+		entries[i].txt = NULL;
+		entries[i].type = 0;
+	}
+	nextentry = 0;
+}
+
+/**
+ * @brief check_rbl() with results cached for the current transaction
+ * @param rbls a NULL terminated array of rbls
+ * @param txt pointer to "char *" where the TXT record of the listing will be stored if existent
+ * @return same as check_rbl()
+ *
+ * Only definitive results are cached, lookups with DNS errors will be
+ * repeated on the next call.
+ */
+int
+check_rbl_cached(char *const *rbls, char **txt)
+{
+	const uint64_t key = filtercache_key_list(rbls);
+	int r;
+
+	if (filtercache_get(FILTERCACHE_RBL, key, &r, txt)) {
+		errno = 0;
+		return r;
+	}
+
+	r = check_rbl(rbls, txt);
+	if ((r >= 0) || (errno == 0))
+		filtercache_put(FILTERCACHE_RBL, key, r, ((txt != NULL) && (r >= 0)) ? *txt : NULL, txt != NULL);
+
+	return r;
+}
+
+/**
+ * @brief lookupipbl() with results cached for the current transaction
+ * @param fd file descriptor to file
+ * @return same as lookupipbl()
+ *
+ * fd will always be closed.
+ */
+int
+lookupipbl_cached(int fd)
+{
+	uint64_t key;
+	int r;
+
+	if (filtercache_key_fd(fd, &key) != 0)
+		return lookupipbl(fd);
+
+	if (filtercache_get(FILTERCACHE_IPBL, key, &r, NULL)) {
+		close(fd);
+		errno = 0;
+		return r;
+	}
+
+	r = lookupipbl(fd);
+	if (r >= 0)
+		filtercache_put(FILTERCACHE_IPBL, key, r, NULL, 0);
+
+	return r;
+}
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <qsmtpd/antispam.h>
+#include <qsmtpd/filtercache.h>
 #include "control.h"
 #include <qsmtpd/qsmtpd.h>
 #include <qsmtpd/userconf.h>
@@ -34,7 +35,7 @@ cb_forceesmtp(const struct userconf *ds, const char **logmsg, enum config_domain
 		return FILTER_PASSED;
 	}
 
-	i = check_rbl(a, NULL);
+	i = check_rbl_cached(a, NULL);
 	free(a);
 	if (i < 0) {
 		if (errno) {
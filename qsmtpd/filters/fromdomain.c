@@ -113,7 +113,7 @@ cb_fromdomain(const struct userconf *ds, const char **logmsg, enum config_domain
 		return FILTER_PASSED;
 
 	/* if there is a syntax error in the file it's the users fault and this mail will be accepted */
-	if ( (u = getsettingglobal(ds, "fromdomain", t)) <= 0)
+	if ( (u = getsettingglobal(ds, SETTING_FROMDOMAIN, t)) <= 0)
 		return FILTER_PASSED;
 
 	if (u & FROMDOMAIN_DOMAIN_IN_DNS) {
@@ -212,7 +212,7 @@ cb_fromdomain(const struct userconf *ds, const char **logmsg, enum config_domain
 		struct ips *thisip;
 		unsigned short s;
 
-		if ( (flaghit = getsettingglobal(ds, "reject_ipv6only", t)) <= 0)
+		if ( (flaghit = getsettingglobal(ds, SETTING_REJECT_IPV6ONLY, t)) <= 0)
 			return FILTER_PASSED;
 
 		FOREACH_STRUCT_IPS(thisip, s, xmitstat.frommx) {
@@ -19,7 +19,7 @@ cb_helo(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 {
 	if (xmitstat.helostatus) {
 		/* see qdns.h for the meaning of helostatus */
-		const long l = getsettingglobal(ds, "helovalid", t);
+		const long l = getsettingglobal(ds, SETTING_HELOVALID, t);
 
 		if ((1 << xmitstat.helostatus) & l) {
 			const char *badtypes[] = {"HELO is my name", "HELO is [my IP]", "HELO is syntactically invalid",
@@ -7,6 +7,7 @@
 #include <qsmtpd/userconf.h>
 
 #include <qsmtpd/antispam.h>
+#include <qsmtpd/filtercache.h>
 #include "log.h"
 #include <qsmtpd/qsmtpd.h>
 
@@ -30,7 +31,7 @@ cb_ipbl(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 	if ( (fd = getfile(ds, fnb, t, userconf_global)) < 0)
 		return (errno == ENOENT) ? FILTER_PASSED : FILTER_ERROR;
 
-	i = lookupipbl(fd);
+	i = lookupipbl_cached(fd);
 	if (errno == ENOLCK)
 		return FILTER_PASSED;
 
@@ -42,7 +43,7 @@ cb_ipbl(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 				return FILTER_ERROR;
 			i = 0;
 		} else {
-			i = lookupipbl(fd);
+			i = lookupipbl_cached(fd);
 		}
 		if (i > 0) {
 			logwhitelisted("ipbl", *t, u);
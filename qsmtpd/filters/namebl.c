@@ -6,10 +6,11 @@
 #include <stdlib.h>
 #include <syslog.h>
 #include <qsmtpd/antispam.h>
+#include <qsmtpd/filtercache.h>
 #include "control.h"
-#include "libowfatconn.h"
 #include "log.h"
 #include "netio.h"
+#include "qdns.h"
 #include <qsmtpd/qsmtpd.h>
 #include <qsmtpd/userconf.h>
 
@@ -27,6 +28,8 @@ cb_namebl(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 				blocktype[*t], " namebl}", NULL};
 	int flagtemp = 0;	/* true at least one list failed with temporary error */
 	char *fromdomain;
+	uint64_t key;		/* cache key of the list of blacklists */
+	int cached;		/* cached index of the matching blacklist */
 
 	if (!xmitstat.mailfrom.len)
 		return FILTER_PASSED;
@@ -39,56 +42,110 @@ cb_namebl(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 		return FILTER_PASSED;
 	}
 
-	fromdomain = strchr(xmitstat.mailfrom.s, '@') + 1;
-
-	while (a[i] && (rc == FILTER_PASSED)) {
-		char *d = fromdomain;
-		size_t alen = strlen(a[i]) + 1;
-
-		while ((d != NULL) && (rc == FILTER_PASSED)) {
-			size_t dlen = strlen(d);
-			char blname[DOMAINNAME_MAX + 1];	/* maximum length of a valid DNS domain name + \0 */
-
-			if (dlen + alen < sizeof(blname)) {
-				int k;
-
-				memcpy(blname, d, dlen);
-				blname[dlen++] = '.';
-				/* This is no overrun as alen already includes the terminating
-				 * '\0', and the size was checked for being smaller than the
-				 * buffer length before. */
-				memcpy(blname + dlen, a[i], alen);
-
-				k = ask_dnsa(blname, NULL);
-				switch (k) {
-				case DNS_ERROR_LOCAL:
-					rc = FILTER_ERROR;
-					break;
-				case DNS_ERROR_TEMP:
-					flagtemp = 1;
-					break;
-				case 0:
-					/* no match, keep checking */
-					break;
-				case DNS_ERROR_PERM:
-					/* invalid bl entry, ignore */
-					break;
-				default:
-					/* ask_dnsa() returns >0 on success, that means we have a match */
-					assert(k > 0);
-
-					/* if there is any error here we just write the generic
-					 * message to the client so that's no real problem for us */
-					(void) dnstxt(&txt, blname);
-					rc = FILTER_DENIED_UNSPECIFIC;
-					break;
+	key = filtercache_key_list(a);
+	if (filtercache_get(FILTERCACHE_NAMEBL, key, &cached, &txt)) {
+		/* the index is incremented after the match in the loop below */
+		if (cached >= 0) {
+			i = cached + 1;
+			rc = FILTER_DENIED_UNSPECIFIC;
+		}
+	} else {
+		char (*blname)[DOMAINNAME_MAX + 1];	/* names to look up */
+		const char **names;
+		unsigned int *listidx;		/* index of the blacklist of the names */
+		int *results;
+		unsigned int cnt = 0;		/* number of lists */
+		unsigned int parts = 1;		/* number of domain suffixes to check */
+		unsigned int n = 0;
+
+		fromdomain = strchr(xmitstat.mailfrom.s, '@') + 1;
+
+		while (a[cnt])
+			cnt++;
+		for (const char *d = strchr(fromdomain, '.'); d != NULL; d = strchr(d + 1, '.'))
+			parts++;
+
+		blname = malloc(cnt * parts * sizeof(*blname));
+		names = malloc(cnt * parts * sizeof(*names));
+		listidx = malloc(cnt * parts * sizeof(*listidx));
+		results = malloc(cnt * parts * sizeof(*results));
+		if ((blname == NULL) || (names == NULL) || (listidx == NULL) || (results == NULL)) {
+			free(blname);
+			free(names);
+			free(listidx);
+			free(results);
+			free(a);
+			errno = ENOMEM;
+			return FILTER_ERROR;
+		}
+
+		/* build all names in the order they would be checked one after
+		 * another, so the first match still wins */
+		for (unsigned int j = 0; j < cnt; j++) {
+			char *d = fromdomain;
+			size_t alen = strlen(a[j]) + 1;
+
+			while (d != NULL) {
+				size_t dlen = strlen(d);
+
+				if (dlen + alen < sizeof(*blname)) {
+					memcpy(blname[n], d, dlen);
+					blname[n][dlen++] = '.';
+					/* This is no overrun as alen already includes the terminating
+					 * '\0', and the size was checked for being smaller than the
+					 * buffer length before. */
+					memcpy(blname[n] + dlen, a[j], alen);
+					names[n] = blname[n];
+					listidx[n] = j;
+					n++;
 				}
+				d = strchr(d, '.');
+				if (d != NULL)
+					d++;
 			}
-			d = strchr(d, '.');
-			if (d != NULL)
-				d++;
 		}
-		i++;
+
+		if ((n > 0) && (ask_dnsa_parallel(names, n, results) != 0))
+			rc = FILTER_ERROR;
+
+		for (unsigned int j = 0; (j < n) && (rc == FILTER_PASSED); j++) {
+			switch (results[j]) {
+			case DNS_ERROR_LOCAL:
+				rc = FILTER_ERROR;
+				break;
+			case DNS_ERROR_TEMP:
+				flagtemp = 1;
+				break;
+			case 0:
+				/* no match, keep checking */
+				break;
+			case DNS_ERROR_PERM:
+				/* invalid bl entry, ignore */
+				break;
+			default:
+				/* ask_dnsa() returns >0 on success, that means we have a match */
+				assert(results[j] > 0);
+
+				/* if there is any error here we just write the generic
+				 * message to the client so that's no real problem for us */
+				(void) ask_dnstxt(&txt, names[j]);
+				rc = FILTER_DENIED_UNSPECIFIC;
+				/* the index is decremented again below */
+				i = listidx[j] + 1;
+				break;
+			}
+		}
+
+		free(blname);
+		free(names);
+		free(listidx);
+		free(results);
+
+		/* results with temporary errors are not cached so they are retried */
+		if (rc == FILTER_DENIED_UNSPECIFIC)
+			filtercache_put(FILTERCACHE_NAMEBL, key, i - 1, txt, 1);
+		else if ((rc == FILTER_PASSED) && !flagtemp)
+			filtercache_put(FILTERCACHE_NAMEBL, key, -1, NULL, 1);
 	}
 
 	assert(rc != FILTER_WHITELISTED);
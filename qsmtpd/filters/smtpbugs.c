@@ -30,7 +30,7 @@ cb_smtpbugs(const struct userconf *ds, const char **logmsg __attribute__ ((unuse
 	if (xmitstat.spacebug == 0)
 		return FILTER_PASSED;
 
-	if ((filter = getsettingglobal(ds, "smtp_space_bug", t)) <= 0)
+	if ((filter = getsettingglobal(ds, SETTING_SMTP_SPACE_BUG, t)) <= 0)
 		return FILTER_PASSED;
 
 	switch (filter) {
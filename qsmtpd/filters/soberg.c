@@ -19,7 +19,7 @@ cb_soberg(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 
 	if (!xmitstat.mailfrom.len)
 		return FILTER_PASSED;
-	if (getsettingglobal(ds, "block_SoberG", t) <= 0)
+	if (getsettingglobal(ds, SETTING_BLOCK_SOBERG, t) <= 0)
 		return FILTER_PASSED;
 
 	/* this can't fail, either mailfrom.len is 0 or there is an '@' and at least one '.',
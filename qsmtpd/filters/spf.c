@@ -9,11 +9,40 @@
 #include <syslog.h>
 #include "control.h"
 #include <qsmtpd/antispam.h>
+#include <qsmtpd/filtercache.h>
 #include "log.h"
 #include <qsmtpd/qsmtpd.h>
 #include <qsmtpd/userconf.h>
 #include "netio.h"
 
+/**
+ * @brief check_host() for a rSPF domain with results cached for the current transaction
+ * @param spfname the domain to check
+ * @param exps the explanation string of the result is stored here
+ * @return same as check_host()
+ */
+static int
+check_host_cached(char *spfname, char **exps)
+{
+	char *names[] = { spfname, NULL };
+	const uint64_t key = filtercache_key_list(names);
+	int spfs;
+
+	if (filtercache_get(FILTERCACHE_RSPF, key, &spfs, exps))
+		return spfs;
+
+	spfs = check_host(spfname);
+	/* check_host() will record the exp= modifier result in xmitstat,
+	 * make sure it does not leak to another user */
+	*exps = xmitstat.spfexp;
+	xmitstat.spfexp = NULL;
+
+	if ((spfs >= 0) && (spfs != SPF_TEMPERROR))
+		filtercache_put(FILTERCACHE_RSPF, key, spfs, *exps, 1);
+
+	return spfs;
+}
+
 /* Values for spfpolicy:
  *
  * 1: temporary DNS errors will block mail temporary
@@ -46,7 +75,7 @@ cb_spf(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 	if ((spfs == SPF_PASS) || (spfs == SPF_IGNORE))
 		return FILTER_PASSED;
 
-	p = getsettingglobal(ds, "spfpolicy", t);
+	p = getsettingglobal(ds, SETTING_SPFPOLICY, t);
 
 	if (p <= 0)
 		return FILTER_PASSED;
@@ -105,11 +134,7 @@ cb_spf(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 				/* In case you have an SPF_PERMERROR rSPF and afterwards a different
 				* error code the information how the record was malformed is lost. */
 				free(exps);
-				spfs = check_host(spfname);
-				/* check_host() will record the exp= modifier result in xmitstat,
-				* make sure it does not leak to another user */
-				exps = xmitstat.spfexp;
-				xmitstat.spfexp = NULL;
+				spfs = check_host_cached(spfname, &exps);
 			}
 			free(a);
 
@@ -215,7 +240,7 @@ cb_spf(const struct userconf *ds, const char **logmsg, enum config_domain *t)
 			free(exps);
 		if (errno != 0)
 			return FILTER_ERROR;
-	} else if ((r == FILTER_DENIED_TEMPORARY) && (getsetting(ds, "fail_hard_on_temp", &tmpt) <= 0)) {
+	} else if ((r == FILTER_DENIED_TEMPORARY) && (getsetting(ds, SETTING_FAIL_HARD_ON_TEMP, &tmpt) <= 0)) {
 		*logmsg = "temp SPF";
 		if (xmitstat.spfexp == NULL)
 			free(exps);
@@ -7,7 +7,7 @@ cb_usersize(const struct userconf *ds, const char **logmsg, enum config_domain *
 {
 	long usize;
 
-	if ((usize = getsetting(ds, "usersize", t)) <= 0)
+	if ((usize = getsetting(ds, SETTING_USERSIZE, t)) <= 0)
 		return FILTER_PASSED;
 
 	if (xmitstat.thisbytes <= (unsigned long) usize)
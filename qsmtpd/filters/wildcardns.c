@@ -96,7 +96,7 @@ cb_wildcardns(const struct userconf *ds, const char **logmsg, enum config_domain
 		return FILTER_PASSED;
 
 	/* if there is a syntax error in the file it's the users fault and this mail will be accepted */
-	if (getsettingglobal(ds, "block_wildcardns", t) <= 0)
+	if (getsettingglobal(ds, SETTING_BLOCK_WILDCARDNS, t) <= 0)
 		return FILTER_PASSED;
 
 	/* the only case this returns an error is ENOMEM */
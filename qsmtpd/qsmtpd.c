@@ -9,6 +9,7 @@
 
 #include <control.h>
 #include <diropen.h>
+#include <dnsshm.h>
 #include <log.h>
 #include <mmap.h>
 #include <netio.h>
@@ -16,11 +17,14 @@
 #include <qmaildir.h>
 #include <qsmtpd/antispam.h>
 #include <qsmtpd/commands.h>
+#include <qsmtpd/daemon.h>
+#include <qsmtpd/filtercache.h>
 #include <qsmtpd/qsauth.h>
 #include <qsmtpd/qsdata.h>
 #include <qsmtpd/starttls.h>
 #include <qsmtpd/syntax.h>
 #include <qsmtpd/userconf.h>
+#include <qsmtpd/userfilters.h>
 #include <sstring.h>
 #include <tls.h>
 #include <version.h>
@@ -142,15 +146,21 @@ dieerror(int error)
 	conn_cleanup(error);
 }
 
+/**
+ * @brief load the configuration that does not depend on the connection
+ * @return 0 on success, else error code
+ */
 static int
-setup(void)
+setup_config(void)
 {
 	int j;
-	char *tmp;
 	unsigned long tl;
 	char **tmpconf;
 	int rcpthfd;		/* file descriptor of control/rcpthosts */
 	sigset_t mask;
+#ifdef DEBUG_IO
+	char *tmp;
+#endif
 
 #ifdef USESYSLOG
 	openlog("Qsmtpd", LOG_PID, LOG_MAIL);
@@ -170,6 +180,10 @@ setup(void)
 		return EINVAL;
 	}
 
+	/* the shared DNS cache is optional */
+	if ((dnsshm_open(AT_FDCWD, DNSSHM_FILE) != 0) && (errno != ENOENT))
+		log_write(LOG_WARNING, "cannot use shared DNS cache " AUTOQMAIL "/" DNSSHM_FILE);
+
 #ifdef DEBUG_IO
 	tmp = getenv("QSMTPD_DEBUG");
 	if ((tmp != NULL) && (*tmp != '\0'))
@@ -240,50 +254,9 @@ setup(void)
 		return 1;
 	}
 
-#ifdef IPV4ONLY
-	tmp = getenv("TCPLOCALIP");
-	if (!tmp || !*tmp) {
-		log_write(LOG_ERR, "can't figure out local IP (TCPLOCALIP not set)");
-		return 1;
-	}
-	strncpy(xmitstat.remoteip, "::ffff:", sizeof(xmitstat.remoteip));
-	strncat(xmitstat.remoteip + strlen("::ffff:"), tmp, sizeof(xmitstat.remoteip) - strlen("::ffff:") - 1);
-	if (inet_pton(AF_INET6, xmitstat.remoteip, &xmitstat.slocalip) <= 0) {
-		log_write(LOG_ERR, "can't figure out local IP (parse error)");
-		return 1;
-	}
-	strcpy(xmitstat.localip, tmp);
-
-	tmp = getenv("TCPREMOTEIP");
-	if (!tmp || !*tmp) {
-		log_write(LOG_ERR, "can't figure out IP of remote host (TCPREMOTEIP not set)");
-		return 1;
-	}
-	xmitstat.remoteip[strlen("::ffff:")] = '\0';
-	strncat(xmitstat.remoteip + strlen("::ffff:"), tmp, sizeof(xmitstat.remoteip) - strlen("::ffff:") - 1);
-	if (inet_pton(AF_INET6, xmitstat.remoteip, &xmitstat.sremoteip) <= 0) {
-		log_write(LOG_ERR, "can't figure out IP of remote host (parse error)");
-		return 1;
-	}
-#else /* IPV4ONLY */
-	tmp = getenv("TCP6LOCALIP");
-	if (!tmp || !*tmp || (inet_pton(AF_INET6, tmp, &xmitstat.slocalip) <= 0)) {
-		log_write(LOG_ERR, "can't figure out local IP");
-		return 1;
-	}
-	if (IN6_IS_ADDR_V4MAPPED(&xmitstat.slocalip)) {
-		memcpy(xmitstat.localip, tmp + 7, strlen(tmp + 7));
-	} else {
-		memcpy(xmitstat.localip, tmp, strlen(tmp));
-	}
-
-	tmp = getenv("TCP6REMOTEIP");
-	if (!tmp || !*tmp || (inet_pton(AF_INET6, tmp, &xmitstat.sremoteip) <= 0)) {
-		log_write(LOG_ERR, "can't figure out IP of remote host");
-		return 1;
-	}
-	memcpy(xmitstat.remoteip, tmp, strlen(tmp));
-#endif /* IPV4ONLY */
+	/* the compiled index is optional, the list itself is searched without it */
+	if ((rcpthosts != NULL) && (loaddomainidx(rcpthosts, controldir_fd, "rcpthosts") < 0))
+		log_write(LOG_WARNING, "cannot use control/rcpthosts.cdb");
 
 	/* RfC 2821, section 4.5.3.2: "Timeouts"
 	 * An SMTP server SHOULD have a timeout of at least 5 minutes while it
@@ -311,6 +284,11 @@ setup(void)
 		authhide = tl ? 1 : 0;
 	}
 
+	if ( (j = loadintfd(openat(controldir_fd, "tarpithandoff", O_RDONLY | O_CLOEXEC), &tarpit_handoff_count, 0)) ) {
+		log_write(LOG_ERR, "parse error in control/tarpithandoff");
+		tarpit_handoff_count = 0;
+	}
+
 	if ( (j = loadintfd(openat(controldir_fd, "forcesslauth", O_RDONLY | O_CLOEXEC), &sslauth, 0)) ) {
 		int e = errno;
 		log_write(LOG_ERR, "parse error in control/forcesslauth");
@@ -326,6 +304,7 @@ setup(void)
 		}
 	}
 	globalconf = (const char **)tmpconf;
+	globalconf_changed();
 
 	j = userbackend_init();
 	if (j != 0)
@@ -342,6 +321,74 @@ setup(void)
 	return j;
 }
 
+/**
+ * @brief read the addresses of the connection from the environment
+ * @return 0 on success, else error code
+ */
+static int
+setup_conn(void)
+{
+	char *tmp;
+
+#ifdef IPV4ONLY
+	tmp = getenv("TCPLOCALIP");
+	if (!tmp || !*tmp) {
+		log_write(LOG_ERR, "can't figure out local IP (TCPLOCALIP not set)");
+		return 1;
+	}
+	strncpy(xmitstat.remoteip, "::ffff:", sizeof(xmitstat.remoteip));
+	strncat(xmitstat.remoteip + strlen("::ffff:"), tmp, sizeof(xmitstat.remoteip) - strlen("::ffff:") - 1);
+	if (inet_pton(AF_INET6, xmitstat.remoteip, &xmitstat.slocalip) <= 0) {
+		log_write(LOG_ERR, "can't figure out local IP (parse error)");
+		return 1;
+	}
+	strcpy(xmitstat.localip, tmp);
+
+	tmp = getenv("TCPREMOTEIP");
+	if (!tmp || !*tmp) {
+		log_write(LOG_ERR, "can't figure out IP of remote host (TCPREMOTEIP not set)");
+		return 1;
+	}
+	xmitstat.remoteip[strlen("::ffff:")] = '\0';
+	strncat(xmitstat.remoteip + strlen("::ffff:"), tmp, sizeof(xmitstat.remoteip) - strlen("::ffff:") - 1);
+	if (inet_pton(AF_INET6, xmitstat.remoteip, &xmitstat.sremoteip) <= 0) {
+		log_write(LOG_ERR, "can't figure out IP of remote host (parse error)");
+		return 1;
+	}
+#else /* IPV4ONLY */
+	tmp = getenv("TCP6LOCALIP");
+	if (!tmp || !*tmp || (inet_pton(AF_INET6, tmp, &xmitstat.slocalip) <= 0)) {
+		log_write(LOG_ERR, "can't figure out local IP");
+		return 1;
+	}
+	if (IN6_IS_ADDR_V4MAPPED(&xmitstat.slocalip)) {
+		memcpy(xmitstat.localip, tmp + 7, strlen(tmp + 7));
+	} else {
+		memcpy(xmitstat.localip, tmp, strlen(tmp));
+	}
+
+	tmp = getenv("TCP6REMOTEIP");
+	if (!tmp || !*tmp || (inet_pton(AF_INET6, tmp, &xmitstat.sremoteip) <= 0)) {
+		log_write(LOG_ERR, "can't figure out IP of remote host");
+		return 1;
+	}
+	memcpy(xmitstat.remoteip, tmp, strlen(tmp));
+#endif /* IPV4ONLY */
+
+	return 0;
+}
+
+static int
+setup(void)
+{
+	int j = setup_config();
+
+	if (j != 0)
+		return j;
+
+	return setup_conn();
+}
+
 /** initialize variables related to this connection */
 static int
 connsetup(void)
@@ -394,6 +441,7 @@ freedata(void)
 	}
 	rcptcount = 0;
 	goodrcpt = 0;
+	filtercache_clear();
 }
 
 /**
@@ -443,11 +491,16 @@ fork_clean()
 void
 conn_cleanup(const int rc)
 {
+	/* replies collected for pipelined commands */
+	(void) net_flush();
+
 	freedata();
 	userbackend_free();
 	free(xmitstat.authname.s);
 
 	free(globalconf);
+	globalconf = NULL;
+	globalconf_changed();
 	free(heloname.s);
 	free(msgidhost.s);
 	exit(rc);
@@ -648,9 +701,28 @@ smtploop(void)
 int
 main(int argc, char **argv)
 {
-	const char *localport = getenv("TCPLOCALPORT");
+	const char *localport;
+	int r;
+
+	if ((argc > 1) && (strcmp(argv[1], "-d") == 0)) {
+		/* the configuration is loaded only once by the master process, only
+		 * the child processes handling a connection return from daemon_run() */
+		if (setup_config() != 0) {
+			log_write(LOG_ERR, "invalid configuration, not starting daemon");
+			return EINVAL;
+		}
+		tls_load_params();
+		r = daemon_run(&argc, &argv);
+		if (r != 0)
+			return r;
+		r = setup_conn();
+	} else {
+		r = setup();
+	}
+
+	localport = getenv("TCPLOCALPORT");
 
-	if (setup()) {
+	if (r) {
 		/* setup failed: make sure we wait until the "quit" of the other host but
 		 * do not process any mail. Commands RSET, QUIT and NOOP are still allowed.
 		 * The state will not change so a client ignoring our error code will get
@@ -673,5 +745,7 @@ main(int argc, char **argv)
 
 	if (connsetup() < 0)
 		flagbogus = errno;
+	/* answer a group of pipelined commands with a single write */
+	net_batching = 1;
 	smtploop();
 }
@@ -0,0 +1,112 @@
+/** \file qtarpitd.c
+ \brief main function of the tarpit daemon
+
+ Qtarpitd listens on the unix socket TARPIT_SOCKET in the qmail directory
+ for connections handed over by Qsmtpd. It has to run as the same user as
+ Qsmtpd: the socket is only accessible for this user, and handoffs from
+ processes of other users are rejected.
+ */
+
+#include <qsmtpd/tarpitd.h>
+
+#include <control.h>
+#include <log.h>
+#include <qmaildir.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+void
+dieerror(int error)
+{
+	exit(error);
+}
+
+static int
+listen_socket(void)
+{
+	struct sockaddr_un sa;
+	mode_t oldmask;
+	int sd;
+	int r;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, TARPIT_SOCKET, sizeof(sa.sun_path) - 1);
+
+	sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		return -1;
+
+	/* a socket left over from a previous instance */
+	if ((unlink(TARPIT_SOCKET) != 0) && (errno != ENOENT))
+		goto err;
+
+	/* the socket must never be accessible for others, not even for a moment */
+	oldmask = umask(0177);
+	r = bind(sd, (struct sockaddr *)&sa, sizeof(sa));
+	umask(oldmask);
+
+	if ((r != 0) || (chmod(TARPIT_SOCKET, 0600) != 0) || (listen(sd, SOMAXCONN) != 0))
+		goto err;
+
+	return sd;
+err:
+	close(sd);
+	return -1;
+}
+
+int
+main(void)
+{
+	char *helo;
+	unsigned long idle;
+	int sd;
+
+#ifdef USESYSLOG
+	openlog("Qtarpitd", LOG_PID, LOG_MAIL);
+#endif
+
+	if (chdir(AUTOQMAIL)) {
+		log_write(LOG_ERR, "cannot chdir to qmail directory");
+		return EINVAL;
+	}
+
+	if (loadoneliner(AT_FDCWD, "control/me", &helo, 0) == (size_t)-1) {
+		log_write(LOG_ERR, "cannot read control/me");
+		return errno;
+	}
+
+	if (loadintfd(open("control/timeoutsmtpd", O_RDONLY | O_CLOEXEC), &idle, 320)) {
+		log_write(LOG_ERR, "parse error in control/timeoutsmtpd");
+		return errno;
+	}
+
+	/* writes to clients that went away are detected by their return value */
+	signal(SIGPIPE, SIG_IGN);
+
+	sd = listen_socket();
+	if (sd < 0) {
+		log_write(LOG_ERR, "cannot listen on " AUTOQMAIL "/" TARPIT_SOCKET);
+		return errno;
+	}
+
+	if (tarpitd_init(sd, helo, idle) != 0) {
+		log_write(LOG_ERR, "cannot set up event loop");
+		return errno;
+	}
+
+	while (tarpitd_step(-1) == 0)
+		;
+
+	log_write(LOG_ERR, "error waiting for events");
+	return errno;
+}
@@ -7,10 +7,10 @@
 #include <qsmtpd/antispam.h>
 
 #include <fmt.h>
-#include <libowfatconn.h>
 #include <match.h>
 #include <mime_chars.h>
 #include <netio.h>
+#include <qdns.h>
 #include <qsmtpd/qsmtpd.h>
 #include <sstring.h>
 
@@ -1455,7 +1455,7 @@ spfip6(const char *domain)
  * @brief lookup TXT record taking SPF specialities into account
  * @param txt result pointer
  * @param domain domain token to look up
- * @returns the same error codes as dnstxt()
+ * @returns the same error codes as ask_dnstxt()
  *
  * This will take two SPF specific contraints into account:
  * - trailing dots are ignored
@@ -1489,7 +1489,7 @@ txtlookup(char **txt, const char *domain)
 	memcpy(lookup, domain + offs, len - offs);
 	lookup[len - offs] = '\0';
 
-	return dnstxt(txt, lookup);
+	return ask_dnstxt(txt, lookup);
 }
 
 /**
@@ -1649,7 +1649,7 @@ spflookup(const char *domain, unsigned int *queries)
 	if (*queries == 0) {
 		if (domainvalid(domain))
 			return SPF_PERMERROR;
-		i = dnstxt(&txt, domain);
+		i = ask_dnstxt(&txt, domain);
 	} else {
 		i = txtlookup(&txt, domain);
 	}
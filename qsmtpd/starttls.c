@@ -12,98 +12,240 @@
 #include <qsmtpd/addrparse.h>
 #include <qsmtpd/qsmtpd.h>
 #include <qsmtpd/syntax.h>
+#include <qsmtpd/tlstickets.h>
 #include <ssl_timeoutio.h>
 #include <tls.h>
 #include <version.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
 
-static RSA *
-tmp_rsa_cb(SSL *s __attribute__ ((unused)), int export __attribute__ ((unused)), int keylen)
-{
-	BIGNUM *bn;
+static DH *dhparams;			/**< the DH group from control/dh<N>.pem */
 #if !((OPENSSL_VERSION_NUMBER >= 0x10100000L) && !defined(LIBRESSL_VERSION_NUMBER))
-	BIGNUM bn_store;
+static RSA *rsaparams;			/**< the temporary RSA key from control/rsa2048.pem */
 #endif
-	RSA *rsa;
+static int params_loaded;
+
+/**
+ * @brief load the precomputed key exchange parameters
+ *
+ * Generating these parameters takes many seconds of CPU time, so this is
+ * never done while a client waits for the handshake. If a file is missing
+ * the builtin DH groups of the SSL library are used if available, otherwise
+ * the corresponding key exchange is not offered and ECDHE is used instead.
+ *
+ * The DH group is read from dh2048.pem. If that does not exist the larger
+ * groups in dh3072.pem, dh4096.pem and dh8192.pem are tried in this order.
+ * Smaller groups are ignored with a warning.
+ *
+ * The daemon mode calls this once in the master process, otherwise it is
+ * done on the first STARTTLS.
+ */
+void
+tls_load_params(void)
+{
+	static const unsigned int dhsizes[] = { 2048, 3072, 4096, 8192 };
+	static const char *weakdh[] = { "dh1024.pem", "dh512.pem", NULL };
+	FILE *in;
+
+	if (params_loaded)
+		return;
+	params_loaded = 1;
 
-	if (keylen < 2048)
-		keylen = 2048;
-	if (keylen == 2048) {
-		FILE *in = fdopen(openat(controldir_fd, "rsa2048.pem", O_RDONLY | O_CLOEXEC), "r");
-		if (in) {
-			rsa = PEM_read_RSAPrivateKey(in, NULL, NULL, NULL);
+	for (unsigned int i = 0; (i < sizeof(dhsizes) / sizeof(dhsizes[0])) && (dhparams == NULL); i++) {
+		char fname[ULSTRLEN + strlen("dh.pem") + 1];
 
-			fclose(in);
+		strcpy(fname, "dh");
+		ultostr(dhsizes[i], fname + strlen("dh"));
+		strcat(fname, ".pem");
 
-			if (rsa)
-				return rsa;
+		in = fdopen(openat(controldir_fd, fname, O_RDONLY | O_CLOEXEC), "r");
+		if (in == NULL)
+			continue;
+
+		dhparams = PEM_read_DHparams(in, NULL, NULL, NULL);
+		fclose(in);
+		if (dhparams == NULL) {
+			const char *logmsg[] = { "cannot parse control/", fname, ", file is ignored", NULL };
+
+			log_writen(LOG_WARNING, logmsg);
 		}
 	}
 
-	rsa = RSA_new();
-	if (rsa == NULL)
-		return NULL;
+	for (unsigned int i = 0; (weakdh[i] != NULL) && (dhparams == NULL); i++) {
+		if (faccessat(controldir_fd, weakdh[i], F_OK, 0) == 0) {
+			const char *logmsg[] = { "control/", weakdh[i], " is ignored, DH groups need at least 2048 bits", NULL };
 
-#if (OPENSSL_VERSION_NUMBER >= 0x10100000L) && !defined(LIBRESSL_VERSION_NUMBER)
-	bn = BN_new();
-	if (bn == NULL)
-		return NULL;
-#else
-	bn = &bn_store;
+			log_writen(LOG_WARNING, logmsg);
+		}
+	}
+
+#if !((OPENSSL_VERSION_NUMBER >= 0x10100000L) && !defined(LIBRESSL_VERSION_NUMBER))
+	/* only needed for export ciphers, which newer versions do not support at all */
+	in = fdopen(openat(controldir_fd, "rsa2048.pem", O_RDONLY | O_CLOEXEC), "r");
+	if (in) {
+		rsaparams = PEM_read_RSAPrivateKey(in, NULL, NULL, NULL);
+		fclose(in);
+	}
 #endif
+}
 
-	BN_set_word(bn, RSA_F4);
-	if (RSA_generate_key_ex(rsa, keylen, bn, NULL) == 0) {
-		RSA_free(rsa);
-		rsa = NULL;
+static struct tls_ticket_key ticketkeys[TLSTICKET_MAXKEYS];	/**< the session ticket keys */
+static unsigned int ticketkeycount;	/**< number of valid entries in ticketkeys */
+static ino_t ticketino;			/**< inode of the key file when it was read */
+static struct timespec ticketmtime;	/**< modification time of the key file when it was read */
+
+/**
+ * @brief read the session ticket keys if the key file changed
+ *
+ * If the file does not exist or is invalid no session tickets are issued.
+ */
+static void
+tls_load_ticketkeys(void)
+{
+	struct stat st;
+	ssize_t r;
+	int fd = openat(controldir_fd, TLSTICKET_FILE, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		if (errno != ENOENT)
+			log_write(LOG_WARNING, "cannot open control/" TLSTICKET_FILE);
+		ticketkeycount = 0;
+		return;
 	}
 
-#if (OPENSSL_VERSION_NUMBER >= 0x10100000L) && !defined(LIBRESSL_VERSION_NUMBER)
-	BN_free(bn);
-#endif
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		ticketkeycount = 0;
+		return;
+	}
+
+	if ((ticketkeycount > 0) && (st.st_ino == ticketino) &&
+			(st.st_mtim.tv_sec == ticketmtime.tv_sec) &&
+			(st.st_mtim.tv_nsec == ticketmtime.tv_nsec)) {
+		close(fd);
+		return;
+	}
+
+	r = read(fd, ticketkeys, sizeof(ticketkeys));
+	close(fd);
+	if ((r <= 0) || (r != st.st_size) || (r % sizeof(ticketkeys[0]) != 0)) {
+		log_write(LOG_WARNING, "invalid control/" TLSTICKET_FILE ", no session tickets are issued");
+		ticketkeycount = 0;
+		return;
+	}
 
-	return rsa;
+	ticketkeycount = r / sizeof(ticketkeys[0]);
+	ticketino = st.st_ino;
+	ticketmtime = st.st_mtim;
 }
 
-static DH *
-tmp_dh_cb(SSL *s __attribute__ ((unused)), int export __attribute__ ((unused)), int keylen)
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX ticket_hmac_ctx;
+#else
+typedef HMAC_CTX ticket_hmac_ctx;
+#endif
+
+/**
+ * @brief set up the encryption of a session ticket
+ * @param s the SSL connection
+ * @param key_name the name of the key, set here when enc is set
+ * @param iv the initialization vector, set here when enc is set
+ * @param cctx the cipher context to initialize
+ * @param hctx the HMAC context to initialize
+ * @param enc if a ticket is encrypted or decrypted
+ * @retval 1 the contexts were initialized
+ * @retval 2 the ticket was encrypted with an old key, the client gets a new one
+ * @retval 0 the key of the ticket is unknown, a full handshake is done
+ * @retval -1 an error occurred
+ */
+static int
+ticket_key_cb(SSL *s __attribute__ ((unused)), unsigned char key_name[16], unsigned char *iv,
+		EVP_CIPHER_CTX *cctx, ticket_hmac_ctx *hctx, int enc)
 {
-	FILE *in = NULL;
-	char fname[ULSTRLEN + strlen("dh.pem") + 1];
-	DH *dh;
+	const struct tls_ticket_key *k = NULL;
+	int ret = 1;
+
+	if (enc) {
+		k = ticketkeys;
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+			return -1;
+		memcpy(key_name, k->name, sizeof(k->name));
+	} else {
+		for (unsigned int i = 0; i < ticketkeycount; i++) {
+			if (memcmp(key_name, ticketkeys[i].name, sizeof(ticketkeys[i].name)) == 0) {
+				k = ticketkeys + i;
+				ret = (i == 0) ? 1 : 2;
+				break;
+			}
+		}
+		if (k == NULL)
+			return 0;
+	}
 
-	if (keylen < 2048)
-		keylen = 2048;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	char digest[] = "SHA256";
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+		OSSL_PARAM_construct_end()
+	};
+
+	if (EVP_MAC_init(hctx, k->hmac, sizeof(k->hmac), params) != 1)
+		return -1;
+#else
+	if (HMAC_Init_ex(hctx, k->hmac, sizeof(k->hmac), EVP_sha256(), NULL) != 1)
+		return -1;
+#endif
+	if (EVP_CipherInit_ex(cctx, EVP_aes_256_cbc(), NULL, k->aes, iv, enc) != 1)
+		return -1;
 
-	strcpy(fname, "dh");
-	ultostr(keylen, fname + strlen("dh"));
-	strcat(fname, ".pem");
+	return ret;
+}
 
-	in = fdopen(openat(controldir_fd, fname, O_RDONLY | O_CLOEXEC), "r");
-	if (in) {
-		dh = PEM_read_DHparams(in, NULL, NULL, NULL);
+/**
+ * @brief count a handshake in the statistics file
+ * @param resumed if a session was resumed
+ *
+ * Nothing is counted if the statistics file does not exist.
+ */
+static void
+tls_count_handshake(const int resumed)
+{
+	struct tls_stats *stats;
+	struct stat st;
+	int fd = open(TLSSTATS_FILE, O_RDWR | O_CLOEXEC);
 
-		fclose(in);
+	if (fd < 0)
+		return;
 
-		if (dh)
-			return dh;
+	if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(*stats))) {
+		close(fd);
+		return;
 	}
 
-	dh = DH_new();
-	if (dh == NULL)
-		return NULL;
+	stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (stats == MAP_FAILED)
+		return;
 
-	if (DH_generate_parameters_ex(dh, keylen, DH_GENERATOR_2, NULL) != 1) {
-		DH_free(dh);
-		dh = NULL;
-	}
+	if (memcmp(stats->magic, TLSSTATS_MAGIC, sizeof(TLSSTATS_MAGIC)) == 0)
+		__atomic_fetch_add(resumed ? &stats->resumed : &stats->full, 1, __ATOMIC_RELAXED);
 
-	return dh;
+	munmap(stats, sizeof(*stats));
 }
 
 static int __attribute__((nonnull(1, 2)))
@@ -285,6 +427,36 @@ tls_init()
 	/* disable obsolete and insecure protocol versions */
 	SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
 
+	/* Every connection is handled by a new process, so sessions can only be
+	 * resumed using tickets encrypted with the shared keys. */
+	if (SSL_CTX_set_session_id_context(ctx, (const unsigned char *)VERSIONSTRING, strlen(VERSIONSTRING)) != 1) {
+		SSL_CTX_free(ctx);
+		return tls_err("setting session id failed");
+	}
+	tls_load_ticketkeys();
+	if (ticketkeycount > 0) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_cb);
+#else
+		SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_cb);
+#endif
+	} else {
+		ssl_options |= SSL_OP_NO_TICKET;
+#if (OPENSSL_VERSION_NUMBER >= 0x10101000L) && !defined(LIBRESSL_VERSION_NUMBER)
+		SSL_CTX_set_num_tickets(ctx, 0);
+#endif
+	}
+
+	/* prefer the cheap elliptic curve key exchange */
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L) && !defined(LIBRESSL_VERSION_NUMBER)
+	if (SSL_CTX_set1_curves_list(ctx, "X25519:P-256:P-384") != 1) {
+		SSL_CTX_free(ctx);
+		return tls_err("unable to set curves");
+	}
+#elif defined(SSL_CTX_set_ecdh_auto)
+	SSL_CTX_set_ecdh_auto(ctx, 1);
+#endif
+
 	if (!SSL_CTX_use_certificate_chain_file(ctx, certfilename)) {
 		SSL_CTX_free(ctx);
 		return tls_err("missing certificate");
@@ -349,8 +521,22 @@ tls_init()
 		return tls_err("unable to set ciphers");
 	}
 
-	SSL_set_tmp_rsa_callback(myssl, tmp_rsa_cb);
-	SSL_set_tmp_dh_callback(myssl, tmp_dh_cb);
+	tls_load_params();
+	if (dhparams != NULL)
+		j = SSL_set_tmp_dh(myssl, dhparams);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	else
+		j = SSL_set_dh_auto(myssl, 1);
+#endif
+#if !((OPENSSL_VERSION_NUMBER >= 0x10100000L) && !defined(LIBRESSL_VERSION_NUMBER))
+	if ((j == 1) && (rsaparams != NULL))
+		j = SSL_set_tmp_rsa(myssl, rsaparams);
+#endif
+	if (j != 1) {
+		ssl_free(myssl);
+		return tls_err("unable to set key exchange parameters");
+	}
+
 	j = SSL_set_rfd(myssl, 0);
 	if (j == 1)
 		j = SSL_set_wfd(myssl, socketd);
@@ -381,6 +567,8 @@ tls_init()
 		return -tls_out("connection failed", err, -EDONE);
 	}
 
+	tls_count_handshake(SSL_session_reused(ssl));
+
 	/* have to discard the pre-STARTTLS HELO/EHLO argument, if any */
 	return 0;
 }
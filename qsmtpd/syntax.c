@@ -9,6 +9,7 @@
 
 #include <log.h>
 #include <netio.h>
+#include <qsmtpd/antispam.h>
 #include <qsmtpd/commands.h>
 #include <qsmtpd/qsmtpd.h>
 
@@ -55,6 +56,9 @@ wait_for_quit(void)
 {
 	const char quitcmd[] = "QUIT";
 
+	/* a tarpitted client may wait here for a long time, let Qtarpitd do that */
+	tarpit_handoff();
+
 	/* this is the bastard version of the main command loop */
 	while (1) {
 		/* once again we don't care for the return code here as we only want to get rid of this session */
@@ -0,0 +1,183 @@
+/** \file tarpit.c
+ \brief delaying replies to clients that look like spammers
+
+ The replies to a tarpitted client are delayed by a growing number of
+ seconds. The delays happen in the Qsmtpd process: the session may still
+ deliver mail afterwards, and its state can not be passed to another process.
+ If control/tarpithandoff is set a connection that has been tarpitted this
+ often is handed over to Qtarpitd once the session only waits for QUIT.
+ Qtarpitd keeps these connections of all Qsmtpd instances in a single process,
+ the Qsmtpd process exits instead of waiting for the client.
+ */
+
+#include <qsmtpd/antispam.h>
+
+#include <log.h>
+#include <netio.h>
+#include <qsmtpd/qsmtpd.h>
+#include <qsmtpd/syntax.h>
+#include <qsmtpd/tarpitd.h>
+#include <tls.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+unsigned long tarpit_handoff_count;	/**< number of tarpit() calls after which the connection may be handed off, 0 to disable */
+static unsigned int tarpitcount = 0;	/**< number of extra seconds from tarpit */
+
+/**
+ * delay the next reply to the client
+ *
+ * This should be used in all places where the client seems to be a spammer. This will
+ * delay him so he can't send so much spams.
+ *
+ * tarpit does not sleep if there is input pending. If the client is using pipelining or (more likely) a worm or spambot
+ * ignoring our replies we kick him earlier and save some traffic.
+ */
+void
+tarpit(void)
+{
+	int i = data_pending();
+	if (i > 0)
+		return;
+	if (i < 0)
+		dieerror(-i);
+	if (ssl) {
+		/* SSL encoding is too much overhead for worms and friends, so at the other side we can expect a real
+		 * mail server. We just have to check here if there is data pending (he's using PIPELINING) or not. */
+		sleep(5 + tarpitcount);
+	} else {
+		struct pollfd rfd = {
+			.fd = 0,
+			.events = POLLIN
+		};
+
+		/* don't care about the return value here: if something goes wrong we will only not
+		 * sleep long enough here. If something is really bad (ENOMEM or something) the error
+		 * will happen again and will be caught at another place */
+		(void) poll(&rfd, 1, (5 + tarpitcount) * 1000);
+	}
+
+	/* maximum sleep time is 4 minutes */
+	if (tarpitcount < 235)
+		tarpitcount++;
+}
+
+/**
+ * @brief send the connection to Qtarpitd
+ * @param input input already read from the client but not yet processed
+ * @param len length of input
+ * @return 0 on success, -1 on error (errno is set)
+ */
+static int
+send_handoff(const char *input, const size_t len)
+{
+	struct sockaddr_un sa;
+	struct tarpit_handoff hdr;
+	struct iovec iov[2];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+	ssize_t r;
+	int sd;
+
+	if (len > TARPIT_MAXINPUT) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, TARPIT_SOCKET, sizeof(sa.sun_path) - 1);
+
+	/* never wait for Qtarpitd, if it is busy just sleep here */
+	sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sd < 0)
+		return -1;
+
+	if (connect(sd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		const int e = errno;
+
+		close(sd);
+		errno = e;
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = TARPIT_VERSION;
+	hdr.badcmds = badcmds;
+	hdr.inputlen = len;
+	strncpy(hdr.remoteip, xmitstat.remoteip, sizeof(hdr.remoteip) - 1);
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *)input;
+	iov[1].iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memset(CMSG_DATA(cmsg), 0, sizeof(int));	/* the client connection is fd 0 */
+
+	r = sendmsg(sd, &msg, MSG_NOSIGNAL);
+	close(sd);
+
+	if (r < 0)
+		return -1;
+	if ((size_t)r != sizeof(hdr) + len) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief hand the connection to Qtarpitd when the session only waits for QUIT
+ *
+ * This is called by wait_for_quit() before the first command is read. The
+ * connection is only handed off if it was tarpitted at least
+ * tarpit_handoff_count times and is not encrypted. Qtarpitd then handles the
+ * rest of the session exactly like wait_for_quit() would. If the handoff
+ * succeeds the process exits, otherwise the session simply continues here.
+ */
+void
+tarpit_handoff(void)
+{
+	const char *input;
+	size_t len;
+
+	if ((tarpit_handoff_count == 0) || (tarpitcount < tarpit_handoff_count) || ssl)
+		return;
+
+	/* Qtarpitd must not write before all replies collected for pipelined
+	 * commands have been sent */
+	if (net_flush() != 0)
+		return;
+
+	/* commands already read, e.g. by data_pending(), are passed on */
+	len = net_buffered(&input);
+	if (send_handoff(input, len) == 0) {
+		const char *logmsg[] = { "handed tarpitted connection from [", xmitstat.remoteip,
+				"] to Qtarpitd", NULL };
+
+		log_writen(LOG_INFO, logmsg);
+		conn_cleanup(0);
+	}
+}
@@ -0,0 +1,455 @@
+/** \file tarpitd.c
+ \brief event loop of the tarpit daemon
+
+ Qtarpitd takes over connections of tarpitted clients from Qsmtpd processes
+ that would otherwise only wait for QUIT. All connections are kept in a single
+ epoll set and the timeouts are enforced by a timer wheel with a resolution of
+ one second, so an idle connection costs only a few kilobytes of memory instead
+ of a process.
+
+ A connection that was handed over behaves exactly like wait_for_quit(): QUIT
+ is accepted, every other command is answered with "bad sequence of commands"
+ and the connection is dropped after too many of them.
+ */
+
+#define _GNU_SOURCE /* for accept4() and struct ucred */
+#include <qsmtpd/tarpitd.h>
+
+#include <log.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#define MAXBADCMDS	5		/**< maximum number of illegal commands in a row, same as in Qsmtpd */
+#define WHEEL_SLOTS	512		/**< number of one second slots in the timer wheel */
+#define MAXEVENTS	64		/**< events handled per epoll_wait() call */
+
+/** @brief state of a connection */
+enum tp_state {
+	tp_handoff,	/**< waiting for the handoff message on the control socket */
+	tp_idle		/**< waiting for the next command */
+};
+
+/**
+ * @brief a connection owned by the daemon
+ */
+struct tp_conn {
+	LIST_ENTRY(tp_conn) wheel;	/**< entry in the timer wheel slot */
+	int fd;				/**< the control socket in tp_handoff state, else the client connection */
+	enum tp_state state;		/**< current state */
+	time_t expires;			/**< when the timer of the current state expires */
+	unsigned int badcmds;		/**< bad commands in a row */
+	size_t inlen;			/**< length of input data in in */
+	char remoteip[INET6_ADDRSTRLEN];	/**< address of the client */
+	char in[TARPIT_MAXINPUT + 1];	/**< input not yet processed */
+};
+
+static LIST_HEAD(tp_slot, tp_conn) wheel[WHEEL_SLOTS];	/**< the timer wheel */
+static time_t wheelnow;			/**< the last second the timer wheel was advanced to */
+static int epfd = -1;			/**< the epoll instance */
+static int listensd = -1;		/**< the listening socket for handoffs, -1 if none */
+static const char *heloname;		/**< the name used in the QUIT reply */
+static time_t idletimeout;		/**< how long to wait for the next command */
+static unsigned int conncount;		/**< number of connections */
+
+/**
+ * @brief set up the event loop
+ * @param listenfd listening socket for handoffs, -1 if connections are only added by tarpitd_add()
+ * @param helo the name used in the QUIT reply
+ * @param idle how many seconds to wait for the next command
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int
+tarpitd_init(const int listenfd, const char *helo, const time_t idle)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = NULL
+	};
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		return -1;
+
+	if ((listenfd >= 0) && (epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) != 0)) {
+		const int e = errno;
+
+		close(epfd);
+		epfd = -1;
+		errno = e;
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < WHEEL_SLOTS; i++)
+		LIST_INIT(&wheel[i]);
+
+	listensd = listenfd;
+	heloname = helo;
+	idletimeout = idle;
+	wheelnow = time(NULL);
+
+	return 0;
+}
+
+/**
+ * @brief put a connection into the timer wheel
+ * @param c the connection
+ * @param expires when the timer expires
+ *
+ * The slot is only determined by the expiry time modulo the wheel size, timers
+ * further in the future stay in their slot for more than one round.
+ */
+static void
+schedule(struct tp_conn *c, const time_t expires)
+{
+	if (c->expires != 0)
+		LIST_REMOVE(c, wheel);
+
+	/* a slot is only checked after wheelnow has passed it */
+	c->expires = (expires > wheelnow) ? expires : wheelnow + 1;
+	LIST_INSERT_HEAD(&wheel[c->expires % WHEEL_SLOTS], c, wheel);
+}
+
+static void
+drop_conn(struct tp_conn *c)
+{
+	if (c->expires != 0)
+		LIST_REMOVE(c, wheel);
+	if (c->fd >= 0)
+		close(c->fd);
+	free(c);
+	conncount--;
+}
+
+/**
+ * @brief send data to the client
+ * @return if the data was sent completely
+ *
+ * The replies are small and the socket buffer of an idle connection is empty,
+ * so a client that does not take the data is not worth waiting for.
+ */
+static int
+send_client(struct tp_conn *c, const char *s, const size_t len)
+{
+	return send(c->fd, s, len, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)len;
+}
+
+/**
+ * @brief handle one command line of the client
+ * @param c the connection
+ * @param line the command, without line ending
+ * @return if the connection is still open
+ */
+static int
+handle_line(struct tp_conn *c, const char *line)
+{
+	static const char badseq[] = "503 5.5.1 Bad sequence of commands\r\n";
+
+	if (strcasecmp(line, "QUIT") == 0) {
+		const char *msg[] = { "221 2.0.0 ", heloname, " service closing transmission channel\r\n", NULL };
+		char buf[512];
+
+		buf[0] = '\0';
+		for (unsigned int i = 0; msg[i] != NULL; i++)
+			strncat(buf, msg[i], sizeof(buf) - strlen(buf) - 1);
+		(void) send_client(c, buf, strlen(buf));
+		drop_conn(c);
+		return 0;
+	}
+
+	if (c->badcmds++ > MAXBADCMDS) {
+		static const char die[] = "550-5.7.1 too many bad commands\r\n550 5.7.1 die slow and painful\r\n";
+		const char *logmsg[] = { "dropped connection from [", c->remoteip,
+				"] {too many bad commands}", NULL };
+
+		(void) send_client(c, die, strlen(die));
+		log_writen(LOG_INFO, logmsg);
+		drop_conn(c);
+		return 0;
+	}
+
+	if (!send_client(c, badseq, strlen(badseq))) {
+		drop_conn(c);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief handle all complete lines in the input buffer
+ * @param c the connection
+ */
+static void
+handle_input(struct tp_conn *c)
+{
+	for (;;) {
+		char *eol = memchr(c->in, '\n', c->inlen);
+		size_t linelen;
+
+		if (eol != NULL) {
+			linelen = eol - c->in + 1;
+			*eol = '\0';
+			if ((eol > c->in) && (eol[-1] == '\r'))
+				eol[-1] = '\0';
+		} else if (c->inlen == sizeof(c->in) - 1) {
+			/* too long line, this is a bad command anyway */
+			linelen = c->inlen;
+			c->in[linelen] = '\0';
+		} else {
+			break;
+		}
+
+		if (!handle_line(c, c->in))
+			return;
+
+		c->inlen -= linelen;
+		memmove(c->in, c->in + linelen, c->inlen);
+	}
+}
+
+/**
+ * @brief read input from the client and handle all complete lines
+ * @param c the connection
+ */
+static void
+client_input(struct tp_conn *c)
+{
+	ssize_t r = recv(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen - 1, MSG_DONTWAIT);
+
+	if (r <= 0) {
+		if ((r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+			return;
+		drop_conn(c);
+		return;
+	}
+	c->inlen += r;
+	schedule(c, time(NULL) + idletimeout);
+
+	handle_input(c);
+}
+
+/**
+ * @brief receive the handoff message from Qsmtpd
+ * @param c the connection in tp_handoff state
+ */
+static void
+receive_handoff(struct tp_conn *c)
+{
+	struct tarpit_handoff hdr;
+	struct iovec iov[2];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLRDHUP,
+		.data.ptr = c
+	};
+	ssize_t r;
+	int fd = -1;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = c->in;
+	iov[1].iov_len = TARPIT_MAXINPUT;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	r = recvmsg(c->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if ((r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+		return;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if ((r > 0) && (cmsg != NULL) && (cmsg->cmsg_level == SOL_SOCKET) &&
+			(cmsg->cmsg_type == SCM_RIGHTS) && (cmsg->cmsg_len == CMSG_LEN(sizeof(int))))
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+
+	close(c->fd);
+	c->fd = fd;
+
+	if ((fd < 0) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || (r < (ssize_t)sizeof(hdr)) ||
+			(hdr.version != TARPIT_VERSION) || (hdr.inputlen != r - sizeof(hdr))) {
+		log_write(LOG_WARNING, "invalid handoff message received");
+		drop_conn(c);
+		return;
+	}
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		log_write(LOG_ERR, "cannot add connection to epoll set");
+		drop_conn(c);
+		return;
+	}
+
+	memcpy(c->remoteip, hdr.remoteip, sizeof(c->remoteip));
+	c->remoteip[sizeof(c->remoteip) - 1] = '\0';
+	c->badcmds = hdr.badcmds;
+	c->inlen = hdr.inputlen;
+	c->state = tp_idle;
+
+	schedule(c, time(NULL) + idletimeout);
+
+	/* the commands Qsmtpd has already read come first */
+	handle_input(c);
+}
+
+/**
+ * @brief check that a handoff connection comes from a process of the same user
+ * @param sd the accepted control socket
+ * @return if the peer may hand off connections
+ */
+static int
+peer_allowed(const int sd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(sd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+		return 0;
+
+	return (len == sizeof(cred)) && (cred.uid == geteuid());
+}
+
+/**
+ * @brief add a control socket a handoff message will be received from
+ * @param ctlfd the socket, it is owned by the event loop afterwards
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int
+tarpitd_add(const int ctlfd)
+{
+	struct tp_conn *c = calloc(1, sizeof(*c));
+	struct epoll_event ev = {
+		.events = EPOLLIN
+	};
+
+	if (c == NULL) {
+		close(ctlfd);
+		return -1;
+	}
+
+	c->fd = ctlfd;
+	c->state = tp_handoff;
+	ev.data.ptr = c;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, ctlfd, &ev) != 0) {
+		const int e = errno;
+
+		close(ctlfd);
+		free(c);
+		errno = e;
+		return -1;
+	}
+
+	conncount++;
+	/* Qsmtpd sends the message directly after connecting */
+	schedule(c, time(NULL) + 10);
+
+	return 0;
+}
+
+/**
+ * @brief handle the connections whose timer has expired
+ */
+static void
+advance_wheel(void)
+{
+	const time_t now = time(NULL);
+	time_t end = now;
+
+	/* no need to look at a slot more than once */
+	if (end - wheelnow > WHEEL_SLOTS)
+		end = wheelnow + WHEEL_SLOTS;
+
+	while (wheelnow < end) {
+		struct tp_conn *c;
+
+		wheelnow++;
+		c = LIST_FIRST(&wheel[wheelnow % WHEEL_SLOTS]);
+		while (c != NULL) {
+			struct tp_conn *next = LIST_NEXT(c, wheel);
+
+			/* handoff not received in time or idle timeout */
+			if (c->expires <= now)
+				drop_conn(c);
+			c = next;
+		}
+	}
+
+	wheelnow = now;
+}
+
+/**
+ * @brief wait for events and handle them
+ * @param maxwait maximum time to wait in milliseconds, -1 to wait until the next timer expires
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int
+tarpitd_step(const int maxwait)
+{
+	struct epoll_event events[MAXEVENTS];
+	int wait = maxwait;
+	int n;
+
+	/* the timer wheel is checked at least once per second while there are connections */
+	if ((conncount != 0) && ((wait < 0) || (wait > 1000)))
+		wait = 1000;
+
+	n = epoll_wait(epfd, events, MAXEVENTS, wait);
+	if (n < 0) {
+		if (errno != EINTR)
+			return -1;
+		n = 0;
+	}
+
+	for (int i = 0; i < n; i++) {
+		struct tp_conn *c = events[i].data.ptr;
+
+		if (c == NULL) {
+			const int sd = accept4(listensd, NULL, NULL, SOCK_CLOEXEC);
+
+			if (sd < 0) {
+				if ((errno == EMFILE) || (errno == ENFILE))
+					log_write(LOG_ERR, "too many open files, cannot take over connection");
+				continue;
+			}
+			if (!peer_allowed(sd)) {
+				log_write(LOG_WARNING, "rejected handoff from a process of another user");
+				close(sd);
+				continue;
+			}
+			(void) tarpitd_add(sd);
+		} else if (c->state == tp_handoff) {
+			receive_handoff(c);
+		} else {
+			client_input(c);
+		}
+	}
+
+	advance_wheel();
+
+	return 0;
+}
+
+/**
+ * @brief get the number of connections owned by the event loop
+ */
+unsigned int
+tarpitd_connections(void)
+{
+	return conncount;
+}
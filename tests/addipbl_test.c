@@ -0,0 +1,289 @@
+/** \file addipbl_test.c
+ \brief testcases for the addipbl helper program
+ */
+
+#include <ipbl.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char testfile[] = "addipbl_test.ipbl";
+static const char *addipbl;
+
+/**
+ * @brief run addipbl on the test file
+ * @param args the addresses to add, terminated by NULL
+ * @return exit code of addipbl, -1 if it did not exit normally
+ */
+static int
+run_addipbl(const char **args)
+{
+	const char *argv[8] = { addipbl, testfile };
+	unsigned int i;
+	pid_t pid;
+	int status;
+
+	for (i = 0; args[i] != NULL; i++)
+		argv[i + 2] = args[i];
+	argv[i + 2] = NULL;
+
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "cannot fork: %i\n", errno);
+		exit(1);
+	} else if (pid == 0) {
+		execv(addipbl, (char **)argv);
+		_exit(127);
+	}
+
+	if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status))
+		return -1;
+
+	return WEXITSTATUS(status);
+}
+
+static void
+write_testfile(const unsigned char *data, const size_t len)
+{
+	int fd = open(testfile, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0600);
+
+	if ((fd < 0) || (write(fd, data, len) != (ssize_t)len) || (close(fd) != 0)) {
+		fprintf(stderr, "cannot write %s\n", testfile);
+		exit(1);
+	}
+}
+
+/**
+ * @brief compare the contents of the test file
+ * @param msg test description
+ * @param expect the expected records, without header
+ * @param len length of expect
+ * @param iplen expected address length in the header
+ * @return if the file does not match
+ */
+static int
+check_testfile(const char *msg, const unsigned char *expect, const size_t len, const unsigned char iplen)
+{
+	unsigned char buf[256];
+	int fd = open(testfile, O_RDONLY | O_CLOEXEC);
+	ssize_t r;
+
+	if (fd < 0) {
+		fprintf(stderr, "%s: cannot open %s\n", msg, testfile);
+		return 1;
+	}
+	r = read(fd, buf, sizeof(buf));
+	close(fd);
+
+	if (r != (ssize_t)(len + IPBL_HEADERLEN)) {
+		fprintf(stderr, "%s: file has length %zi, expected %zu\n", msg, r, len + IPBL_HEADERLEN);
+		return 1;
+	}
+	if ((memcmp(buf, IPBL_MAGIC, IPBL_MAGICLEN) != 0) || (buf[IPBL_MAGICLEN] != IPBL_VERSION) ||
+			(buf[IPBL_MAGICLEN + 1] != iplen)) {
+		fprintf(stderr, "%s: file has an invalid header\n", msg);
+		return 1;
+	}
+	if (memcmp(buf + IPBL_HEADERLEN, expect, len) != 0) {
+		fprintf(stderr, "%s: ranges in file do not match\n", msg);
+		for (ssize_t i = IPBL_HEADERLEN; i < r; i++)
+			fprintf(stderr, "%s%u", (i == IPBL_HEADERLEN) ? "" : ".", buf[i]);
+		fputc('\n', stderr);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief merge new addresses into a file in the old unsorted format
+ */
+static int
+test_convert_v4(void)
+{
+	const unsigned char oldfile[] = {
+		192, 0, 2, 5, 32,
+		10, 0, 1, 0, 24,
+		10, 0, 0, 0, 24,
+		198, 51, 100, 0, 24
+	};
+	const unsigned char expect[] = {
+		10, 0, 0, 0, 10, 0, 3, 255,
+		192, 0, 2, 4, 192, 0, 2, 5,
+		198, 51, 100, 0, 198, 51, 100, 255
+	};
+	const char *args[] = { "10.0.2.0/23", "192.0.2.4", "198.51.100.17", NULL };
+	int r;
+
+	write_testfile(oldfile, sizeof(oldfile));
+	r = run_addipbl(args);
+	if (r != 0) {
+		fprintf(stderr, "addipbl failed to convert old IPv4 file: %i\n", r);
+		return 1;
+	}
+
+	return check_testfile("convert IPv4", expect, sizeof(expect), 4);
+}
+
+/**
+ * @brief add ranges to an existing sorted file
+ *
+ * The new ranges are placed before, between and after the existing ones, and
+ * one of them joins the two existing ranges.
+ */
+static int
+test_merge_sorted(void)
+{
+	const unsigned char sorted[] = {
+		'Q', 'S', 'i', 'p', 'b', 'l', IPBL_VERSION, 4,
+		10, 0, 0, 0, 10, 0, 0, 255,
+		10, 0, 2, 0, 10, 0, 2, 255
+	};
+	const unsigned char expect1[] = {
+		1, 2, 3, 4, 1, 2, 3, 4,
+		10, 0, 0, 0, 10, 0, 0, 255,
+		10, 0, 2, 0, 10, 0, 2, 255,
+		203, 0, 113, 0, 203, 0, 113, 127
+	};
+	const unsigned char expect2[] = {
+		1, 2, 3, 4, 1, 2, 3, 4,
+		10, 0, 0, 0, 10, 0, 2, 255,
+		203, 0, 113, 0, 203, 0, 113, 127
+	};
+	const char *args1[] = { "203.0.113.0/25", "1.2.3.4", NULL };
+	const char *args2[] = { "10.0.1.128/25", "10.0.1.0/25", "10.0.2.16/28", NULL };
+	int err = 0;
+	int r;
+
+	write_testfile(sorted, sizeof(sorted));
+	r = run_addipbl(args1);
+	if (r != 0) {
+		fprintf(stderr, "addipbl failed to add to sorted IPv4 file: %i\n", r);
+		return 1;
+	}
+	err += check_testfile("add to sorted IPv4", expect1, sizeof(expect1), 4);
+
+	r = run_addipbl(args2);
+	if (r != 0) {
+		fprintf(stderr, "addipbl failed to merge into sorted IPv4 file: %i\n", r);
+		return 1;
+	}
+	err += check_testfile("merge into sorted IPv4", expect2, sizeof(expect2), 4);
+
+	return err;
+}
+
+/**
+ * @brief a sorted file with unordered and overlapping ranges is repaired
+ */
+static int
+test_resort(void)
+{
+	const unsigned char unsorted[] = {
+		'Q', 'S', 'i', 'p', 'b', 'l', IPBL_VERSION, 4,
+		192, 0, 2, 0, 192, 0, 2, 127,
+		10, 0, 0, 0, 10, 0, 0, 255,
+		192, 0, 2, 64, 192, 0, 2, 200,
+		255, 255, 255, 0, 255, 255, 255, 255
+	};
+	const unsigned char expect[] = {
+		10, 0, 0, 0, 10, 0, 0, 255,
+		192, 0, 2, 0, 192, 0, 2, 200,
+		255, 255, 255, 0, 255, 255, 255, 255
+	};
+	const char *args[] = { NULL };
+	int r;
+
+	write_testfile(unsorted, sizeof(unsorted));
+	r = run_addipbl(args);
+	if (r != 0) {
+		fprintf(stderr, "addipbl failed to resort IPv4 file: %i\n", r);
+		return 1;
+	}
+
+	return check_testfile("resort IPv4", expect, sizeof(expect), 4);
+}
+
+static int
+test_convert_v6(void)
+{
+	unsigned char oldfile[2 * 17] = {
+		0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 64,
+		0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 64
+	};
+	unsigned char expect[2 * 32];
+	const char *args[] = { "fd00::1", NULL };
+	int r;
+
+	/* 2001:db8::/63 */
+	memset(expect, 0, 16);
+	memcpy(expect, oldfile + 17, 8);
+	memset(expect + 16, 0xff, 16);
+	memcpy(expect + 16, oldfile, 8);
+	/* fd00::1/128 */
+	memset(expect + 32, 0, 32);
+	expect[32] = 0xfd;
+	expect[47] = 1;
+	expect[48] = 0xfd;
+	expect[63] = 1;
+
+	write_testfile(oldfile, sizeof(oldfile));
+	r = run_addipbl(args);
+	if (r != 0) {
+		fprintf(stderr, "addipbl failed to convert old IPv6 file: %i\n", r);
+		return 1;
+	}
+
+	return check_testfile("convert IPv6", expect, sizeof(expect), 16);
+}
+
+/**
+ * @brief adding an address of the wrong family must not touch the file
+ */
+static int
+test_mixed(void)
+{
+	const unsigned char sorted[] = {
+		'Q', 'S', 'i', 'p', 'b', 'l', IPBL_VERSION, 4,
+		10, 0, 0, 0, 10, 0, 0, 255
+	};
+	const char *args[] = { "2001:db8::1", NULL };
+	int r;
+
+	write_testfile(sorted, sizeof(sorted));
+	r = run_addipbl(args);
+	if (r != EINVAL) {
+		fprintf(stderr, "adding IPv6 address to IPv4 file returned %i instead of %i\n", r, EINVAL);
+		return 1;
+	}
+
+	return check_testfile("mixed families", sorted + IPBL_HEADERLEN, sizeof(sorted) - IPBL_HEADERLEN, 4);
+}
+
+int
+main(int argc, char **argv)
+{
+	int err = 0;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s path/to/addipbl\n", argv[0]);
+		return 1;
+	}
+	addipbl = argv[1];
+
+	err += test_convert_v4();
+	err += test_merge_sorted();
+	err += test_resort();
+	err += test_convert_v6();
+	err += test_mixed();
+
+	unlink(testfile);
+
+	return err;
+}
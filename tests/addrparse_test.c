@@ -122,6 +122,8 @@ userconf_init(struct userconf *ds)
 	ds->domainconf = NULL;
 	ds->domaindirfd = -1;
 	ds->userdirfd = -1;
+	ds->userfiles = NULL;
+	ds->domainfiles = NULL;
 }
 
 void
@@ -2,9 +2,9 @@
 
 #include <control.h>
 #include <diropen.h>
-#include <libowfatconn.h>
 #include <qsmtpd/addrparse.h>
 #include <qsmtpd/antispam.h>
+#include <qsmtpd/filtercache.h>
 #include <qsmtpd/qsmtpd.h>
 #include <qsmtpd/userconf.h>
 #include "test_io/testcase_io.h"
@@ -231,8 +231,8 @@ static struct {
 	},
 };
 
-int
-dnstxt(char **a, const char *b)
+static int
+test_ask_dnstxt(char **a, const char *b)
 {
 	if (testdata[testindex].dnstxt_reply == NULL) {
 		errno = ENOENT;
@@ -429,6 +429,7 @@ main(void)
 	testcase_setup_netnwrite(testcase_netnwrite_compare);
 	testcase_setup_net_writen(testcase_net_writen_combine);
 	testcase_setup_ask_dnsa(test_ask_dnsa);
+	testcase_setup_ask_dnstxt(test_ask_dnstxt);
 
 	while (testindex < sizeof(testdata) / sizeof(testdata[0])) {
 		char userpath[PATH_MAX];
@@ -439,6 +440,8 @@ main(void)
 
 		/* set default configuration */
 		default_session_config();
+		/* every configuration is a new transaction */
+		filtercache_clear();
 
 		thisrecip = &dummyrecip;
 		firstrecip.to.s = "baz@example.com";
@@ -486,6 +489,7 @@ main(void)
 			uc.userconf = NULL;
 		else
 			uc.userconf = map_from_list(testdata[testindex].userconf);
+		config_settings_parse(&uc.usersettings, (const char **)uc.userconf);
 
 		snprintf(confpath, sizeof(confpath), "%u/domain/", testindex);
 		uc.domaindirfd = get_dirfd(AT_FDCWD, confpath);
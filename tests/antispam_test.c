@@ -191,6 +191,10 @@ test_ask_dnsa(const char *a, struct in6_addr **b)
 			/* found a match, now use the rbl name to get the result */
 			if (strstr(a, "timeout") != NULL)
 				return DNS_ERROR_TEMP;
+			if (strstr(a, "nomem") != NULL) {
+				errno = ENOMEM;
+				return DNS_ERROR_LOCAL;
+			}
 			return 1;
 		}
 	}
@@ -198,8 +202,8 @@ test_ask_dnsa(const char *a, struct in6_addr **b)
 	return 0;
 }
 
-int
-dnstxt(char **a, const char *b)
+static int
+test_ask_dnstxt(char **a, const char *b)
 {
 	if (b == NULL)
 		return -1;
@@ -208,6 +212,34 @@ dnstxt(char **a, const char *b)
 	return 0;
 }
 
+/**
+ * @brief a local error of a lookup is passed to the caller
+ */
+static int
+test_rbl_local(void)
+{
+	char * const rbls[] = {
+		"foo.nomem.example.com",
+		"bar.example.com",
+		NULL
+	};
+	const char *entries[] = { "1.0.0.10.foo.nomem.example.com", NULL };
+	int r;
+
+	inet_pton(AF_INET6, "::ffff:10.0.0.1", &xmitstat.sremoteip);
+	xmitstat.ipv4conn = 1;
+	dnsentries = entries;
+
+	r = check_rbl(rbls, NULL);
+	dnsentries = NULL;
+	if ((r != DNS_ERROR_LOCAL) || (errno != ENOMEM)) {
+		fprintf(stderr, "check_rbl() with local error returned %i, errno %i\n", r, errno);
+		return 1;
+	}
+
+	return 0;
+}
+
 int
 main(void)
 {
@@ -215,8 +247,10 @@ main(void)
 
 	testcase_setup_log_writen(test_log_writen);
 	testcase_setup_ask_dnsa(test_ask_dnsa);
+	testcase_setup_ask_dnstxt(test_ask_dnstxt);
 
 	err += test_rbl();
+	err += test_rbl_local();
 
 	return err;
 }
@@ -0,0 +1,165 @@
+/** \file batch_test.c
+ \brief testcases for the job lists of Qremote's batch mode
+ */
+
+#include <qremote/batch.h>
+#include <qremote/qremote.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* the terminating 0 byte of the literals is part of the lists */
+static const struct {
+	const char *list;
+	size_t len;
+} invalid_lists[] = {
+	{ "", 0 },
+	{ "", 1 },					/* no message file */
+	{ "msg", 4 },					/* no sender */
+	{ "msg\0foo@example.com", 20 },			/* no recipients */
+	{ "msg\0foo@example.com\0", 21 },		/* no recipients */
+	{ "msg\0foo@example.com\0bar@example.net", 36 },	/* unterminated recipient list */
+	{ "msg\0foo@example.com\0bar@example.net\0", 35 },	/* last byte is not 0 */
+	{ "msg\0\0bar@example.net\0\0\0", 24 },		/* empty job */
+	{ NULL, 0 }
+};
+
+static unsigned int statuscount;
+
+void
+write_status(const char *str)
+{
+	if (strncmp(str, "Z4.4.2 ", 7) != 0) {
+		fprintf(stderr, "unexpected status for skipped job: %s\n", str);
+		exit(1);
+	}
+	statuscount++;
+}
+
+static int
+check_skipped(void)
+{
+	int err = 0;
+
+	batch_report_skipped(1, 4);
+	if (statuscount != 3) {
+		fprintf(stderr, "3 skipped jobs got %u reports\n", statuscount);
+		err++;
+	}
+
+	statuscount = 0;
+	batch_report_skipped(4, 4);
+	if (statuscount != 0) {
+		fprintf(stderr, "no skipped jobs got %u reports\n", statuscount);
+		err++;
+	}
+
+	return err;
+}
+
+static int
+check_valid(void)
+{
+	char list[] = "/var/qmail/queue/mess/1/42\0foo@example.com\0bar@example.net\0\0"
+			"/var/qmail/queue/mess/2/43\0\0a@example.net\0b@example.net\0c@example.net\0";
+	struct batch_job *jobs;
+	int err = 0;
+	int r;
+
+	r = batch_parse(list, sizeof(list), &jobs);
+	if (r != 2) {
+		fprintf(stderr, "valid list returned %i instead of 2\n", r);
+		return 1;
+	}
+
+	if ((strcmp(jobs[0].msgfile, "/var/qmail/queue/mess/1/42") != 0) ||
+			(strcmp(jobs[0].sender, "foo@example.com") != 0) ||
+			(jobs[0].rcptcount != 1) || (strcmp(jobs[0].rcpts[0], "bar@example.net") != 0)) {
+		fputs("first job was not parsed correctly\n", stderr);
+		err++;
+	}
+
+	/* empty sender as used for bounces */
+	if ((strcmp(jobs[1].msgfile, "/var/qmail/queue/mess/2/43") != 0) ||
+			(*jobs[1].sender != '\0') || (jobs[1].rcptcount != 3) ||
+			(strcmp(jobs[1].rcpts[0], "a@example.net") != 0) ||
+			(strcmp(jobs[1].rcpts[1], "b@example.net") != 0) ||
+			(strcmp(jobs[1].rcpts[2], "c@example.net") != 0)) {
+		fputs("second job was not parsed correctly\n", stderr);
+		err++;
+	}
+
+	free(jobs);
+
+	return err;
+}
+
+static int
+check_read(void)
+{
+	const char list[] = "msg\0foo@example.com\0bar@example.net\0";
+	struct batch_job *jobs;
+	char *buf;
+	int fds[2];
+	int r;
+
+	if (pipe(fds) != 0) {
+		fputs("cannot create pipe\n", stderr);
+		return 1;
+	}
+
+	if (write(fds[1], list, sizeof(list)) != sizeof(list)) {
+		fputs("cannot write to pipe\n", stderr);
+		return 1;
+	}
+	close(fds[1]);
+
+	r = batch_read(fds[0], &buf, &jobs);
+	close(fds[0]);
+	if (r != 1) {
+		fprintf(stderr, "reading the list returned %i instead of 1\n", r);
+		return 1;
+	}
+
+	r = (strcmp(jobs[0].rcpts[0], "bar@example.net") != 0);
+	if (r)
+		fputs("list read from pipe was not parsed correctly\n", stderr);
+
+	free(jobs);
+	free(buf);
+
+	return r;
+}
+
+int
+main(void)
+{
+	int err = 0;
+
+	for (unsigned int i = 0; invalid_lists[i].list != NULL; i++) {
+		char buf[invalid_lists[i].len + 1];
+		struct batch_job *jobs;
+		int r;
+
+		memcpy(buf, invalid_lists[i].list, invalid_lists[i].len);
+		r = batch_parse(buf, invalid_lists[i].len, &jobs);
+		if (r != -EINVAL) {
+			fprintf(stderr, "invalid list %u returned %i instead of %i\n", i, r, -EINVAL);
+			err++;
+		}
+		if (jobs != NULL) {
+			fprintf(stderr, "invalid list %u returned jobs\n", i);
+			free(jobs);
+			err++;
+		}
+	}
+
+	err += check_valid();
+	err += check_read();
+	err += check_skipped();
+
+	return err ? 1 : 0;
+}
@@ -0,0 +1,279 @@
+/** \file bufscan_test.c
+ \brief testcase and benchmark for the message data classifier
+
+ Without arguments all available implementations are checked against a simple
+ reference implementation. If file names are given the implementations are
+ benchmarked on these files.
+ */
+
+#include "../lib/bufscan.c"
+
+#include <mmap.h>
+#include "test_io/testcase_io.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct {
+	const char *name;
+	void (*scan)(const char *, const size_t, struct bufscan *);
+	int (*has8bit)(const char *, const size_t);
+} impls[3];
+static unsigned int implcount;
+
+static void
+setup_impls(void)
+{
+	impls[implcount].name = "generic";
+	impls[implcount].scan = scan_generic;
+	impls[implcount].has8bit = has_8bit_generic;
+	implcount++;
+
+#ifdef BUFSCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		impls[implcount].name = "SSE2";
+		impls[implcount].scan = scan_sse2;
+		impls[implcount].has8bit = has_8bit_sse2;
+		implcount++;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		impls[implcount].name = "AVX2";
+		impls[implcount].scan = scan_avx2;
+		impls[implcount].has8bit = has_8bit_avx2;
+		implcount++;
+	}
+#endif
+}
+
+static void
+reference_scan(const char *buf, const size_t len, struct bufscan *res)
+{
+	size_t llen = 0;
+	int in_header = 1;
+	size_t pos;
+
+	memset(res, 0, sizeof(*res));
+
+	for (pos = 0; pos <= len; pos++) {
+		size_t *max;
+
+		if (pos < len) {
+			if (buf[pos] == '\0')
+				res->flags |= BUFSCAN_NUL;
+			else if (((signed char)buf[pos]) < 0)
+				res->flags |= BUFSCAN_8BIT;
+
+			if ((buf[pos] != '\r') && (buf[pos] != '\n')) {
+				llen++;
+				continue;
+			}
+
+			if ((buf[pos] == '\r') && (pos + 1 < len) && (buf[pos + 1] == '\n'))
+				pos++;
+		} else if (llen == 0) {
+			break;
+		}
+
+		max = in_header ? &res->hdrmaxline : &res->maxline;
+		if (llen > *max)
+			*max = llen;
+
+		if ((llen == 0) && in_header) {
+			in_header = 0;
+			res->headerend = (buf[pos] == '\n') && (pos > 0) && (buf[pos - 1] == '\r') ? pos - 1 : pos;
+		}
+		llen = 0;
+	}
+
+	if (in_header)
+		res->headerend = len;
+}
+
+static int
+compare_impls(const char *buf, const size_t len)
+{
+	struct bufscan expect;
+	int expect8;
+	int err = 0;
+
+	reference_scan(buf, len, &expect);
+	expect8 = (expect.flags & BUFSCAN_8BIT) != 0;
+
+	for (unsigned int i = 0; i < implcount; i++) {
+		struct bufscan res;
+
+		memset(&res, 0, sizeof(res));
+		impls[i].scan(buf, len, &res);
+
+		if (memcmp(&res, &expect, sizeof(res)) != 0) {
+			fprintf(stderr, "%s: scan of buffer with length %zu returned flags %u, header end %zu, line lengths %zu/%zu, "
+					"expected %u, %zu, %zu/%zu\n", impls[i].name, len,
+					res.flags, res.headerend, res.hdrmaxline, res.maxline,
+					expect.flags, expect.headerend, expect.hdrmaxline, expect.maxline);
+			err++;
+		}
+
+		if ((impls[i].has8bit(buf, len) != 0) != expect8) {
+			fprintf(stderr, "%s: 8bit check of buffer with length %zu returned wrong result\n",
+					impls[i].name, len);
+			err++;
+		}
+	}
+
+	return err;
+}
+
+static int
+check_patterns(void)
+{
+	const char *patterns[] = {
+		"",
+		"\r\n",
+		"\n\r",
+		"\r\r\n",
+		"Subject: foo\r\n\r\nbody\r\n",
+		"Subject: foo\n\nbody",
+		"Subject: foo\r\rbody\r\n",
+		"Subject: foo\r\n\r\n\xe4\r\n",
+		"Subject: \xe4\r\n\r\nbody\r\n",
+		"Subject: foo, but longer than one vector\r\nFrom: <foo@example.com>\r\n\r\n",
+		NULL
+	};
+	int err = 0;
+
+	for (unsigned int i = 0; patterns[i] != NULL; i++)
+		err += compare_impls(patterns[i], strlen(patterns[i]));
+
+	/* NUL bytes can't be passed in C strings */
+	err += compare_impls("abc\0def\r\n\r\nghi", 15);
+
+	return err;
+}
+
+static int
+check_random(void)
+{
+	const char alphabet[] = "\r\n\r\n\0abc \x80\xff";
+	char buf[4200];
+	int err = 0;
+
+	srand(42);
+
+	for (unsigned int i = 0; i < 2000; i++) {
+		const size_t len = rand() % sizeof(buf);
+		/* mostly long lines, sometimes short ones */
+		const int linemod = (i % 4) ? 1200 : 40;
+
+		for (size_t j = 0; j < len; j++) {
+			const int r = rand();
+
+			if (r % linemod == 0)
+				buf[j] = alphabet[r % 4];
+			else if (r % 997 == 0)
+				buf[j] = alphabet[4 + (r % 7)];
+			else
+				buf[j] = 'a' + (r % 26);
+		}
+
+		/* check every alignment of the data */
+		err += compare_impls(buf + (i % 32), len > (i % 32) ? len - (i % 32) : 0);
+	}
+
+	return err;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+benchmark(int argc, char **argv)
+{
+	const unsigned int rounds = 200;
+	const char **bufs = calloc(argc, sizeof(*bufs));
+	off_t *lens = calloc(argc, sizeof(*lens));
+	off_t total = 0;
+	int err = 0;
+
+	if ((bufs == NULL) || (lens == NULL)) {
+		free(bufs);
+		free(lens);
+		return 1;
+	}
+
+	for (int i = 0; i < argc; i++) {
+		int fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0) {
+			fprintf(stderr, "can not open %s\n", argv[i]);
+			err++;
+			continue;
+		}
+
+		bufs[i] = mmap_fd(fd, &lens[i]);
+		close(fd);
+		if (bufs[i] != NULL) {
+			total += lens[i];
+			err += compare_impls(bufs[i], lens[i]);
+		}
+	}
+
+	for (unsigned int k = 0; (k < implcount) && (total > 0); k++) {
+		const double start = now();
+		double diff;
+		unsigned int found = 0;
+
+		for (unsigned int r = 0; r < rounds; r++) {
+			for (int i = 0; i < argc; i++) {
+				struct bufscan res;
+
+				if (bufs[i] == NULL)
+					continue;
+
+				memset(&res, 0, sizeof(res));
+				impls[k].scan(bufs[i], lens[i], &res);
+				found += res.flags;
+			}
+		}
+
+		diff = now() - start;
+		printf("%s: %u rounds over %lli bytes in %.3f s, %.1f MiB/s (%u)\n", impls[k].name, rounds,
+				(long long)total, diff, (total * (double)rounds) / (diff * 1024 * 1024), found);
+	}
+
+	for (int i = 0; i < argc; i++)
+		if (bufs[i] != NULL)
+			munmap((void *)bufs[i], lens[i]);
+
+	free(bufs);
+	free(lens);
+
+	return err;
+}
+
+int
+main(int argc, char **argv)
+{
+	int err = 0;
+
+	setup_impls();
+
+	if (argc > 1)
+		return benchmark(argc - 1, argv + 1);
+
+	err += check_patterns();
+	err += check_random();
+
+	return err;
+}
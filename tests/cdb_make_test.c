@@ -0,0 +1,247 @@
+/** \file cdb_make_test.c
+ \brief testcases for writing CDB databases and reading them back
+ */
+
+#include <cdb.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char dbname[] = "cdb_make_test.cdb";
+static const char tmpname[] = "cdb_make_test.tmp";
+
+/**
+ * @brief write a database and move it in place
+ * @param keys the keys of the records
+ * @param values the values of the records
+ * @param count number of records
+ * @return 0 on success
+ */
+static int
+write_db(const char **keys, const char **values, const unsigned int count)
+{
+	struct cdb_make cm;
+	int fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+	if (fd < 0) {
+		fprintf(stderr, "can not create %s: %i\n", tmpname, errno);
+		return 1;
+	}
+
+	if (cdb_make_start(&cm, fd) != 0) {
+		fprintf(stderr, "cdb_make_start() failed: %i\n", errno);
+		close(fd);
+		return 1;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		if (cdb_make_add(&cm, keys[i], strlen(keys[i]), values[i], strlen(values[i])) != 0) {
+			fprintf(stderr, "cdb_make_add() failed: %i\n", errno);
+			close(fd);
+			return 1;
+		}
+	}
+
+	if (cdb_make_finish(&cm) != 0) {
+		fprintf(stderr, "cdb_make_finish() failed: %i\n", errno);
+		close(fd);
+		return 1;
+	}
+
+	close(fd);
+
+	if (rename(tmpname, dbname) != 0) {
+		fprintf(stderr, "can not rename %s: %i\n", tmpname, errno);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief check that all values of a key are found in the expected order
+ * @param c the database
+ * @param key the key to search for
+ * @param values the expected values, terminated by NULL
+ * @return number of errors
+ */
+static int
+check_key(struct cdb *c, const char *key, const char **values)
+{
+	const char *data;
+	uint32_t dlen;
+	int r = cdb_find(c, key, strlen(key), &data, &dlen);
+	int err = 0;
+	unsigned int i;
+
+	for (i = 0; values[i] != NULL; i++) {
+		if (r != 1) {
+			fprintf(stderr, "value %u of key %s not found: %i\n", i, key, r);
+			return err + 1;
+		}
+		if ((dlen != strlen(values[i])) || (memcmp(data, values[i], dlen) != 0)) {
+			fprintf(stderr, "value %u of key %s is %.*s, but expected was %s\n",
+					i, key, (int)dlen, data, values[i]);
+			err++;
+		}
+		r = cdb_findnext(c, &data, &dlen);
+	}
+
+	if (r != 0) {
+		fprintf(stderr, "key %s has more than the expected %u values: %i\n", key, i, r);
+		err++;
+	}
+
+	return err;
+}
+
+static int
+test_duplicates(void)
+{
+	const char *keys[] = { "alias", "user", "alias", "", "alias" };
+	const char *values[] = { "first", "user", "second", "empty key", "" };
+	const char *aliasv[] = { "first", "second", "", NULL };
+	const char *userv[] = { "user", NULL };
+	const char *emptyv[] = { "empty key", NULL };
+	const char *nonev[] = { NULL };
+	struct cdb c = CDB_INIT;
+	int err;
+
+	if (write_db(keys, values, sizeof(keys) / sizeof(keys[0])) != 0)
+		return 1;
+
+	if (cdb_open(&c, AT_FDCWD, dbname) != 0) {
+		fprintf(stderr, "can not open %s: %i\n", dbname, errno);
+		return 1;
+	}
+
+	err = check_key(&c, "alias", aliasv);
+	err += check_key(&c, "user", userv);
+	err += check_key(&c, "", emptyv);
+	err += check_key(&c, "users", nonev);
+	err += check_key(&c, "alia", nonev);
+
+	cdb_close(&c);
+
+	return err;
+}
+
+static int
+test_many(void)
+{
+	struct cdb_make cm;
+	struct cdb c = CDB_INIT;
+	int err = 0;
+	int fd = open(dbname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+	if (fd < 0) {
+		fprintf(stderr, "can not create %s: %i\n", dbname, errno);
+		return 1;
+	}
+
+	/* enough records that the output buffer is flushed multiple times
+	 * and all hash tables are used */
+	if (cdb_make_start(&cm, fd) != 0) {
+		close(fd);
+		return 1;
+	}
+	for (unsigned int i = 0; i < 5000; i++) {
+		char key[16];
+		char value[16];
+
+		snprintf(key, sizeof(key), "key%u", i);
+		snprintf(value, sizeof(value), "%u", i * 7);
+		if (cdb_make_add(&cm, key, strlen(key), value, strlen(value)) != 0) {
+			fprintf(stderr, "cdb_make_add() failed: %i\n", errno);
+			close(fd);
+			return 1;
+		}
+	}
+	if (cdb_make_finish(&cm) != 0) {
+		fprintf(stderr, "cdb_make_finish() failed: %i\n", errno);
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	if (cdb_open(&c, AT_FDCWD, dbname) != 0) {
+		fprintf(stderr, "can not open %s: %i\n", dbname, errno);
+		return 1;
+	}
+
+	for (unsigned int i = 0; i < 5000; i++) {
+		char key[16];
+		char value[16];
+		const char *values[] = { value, NULL };
+
+		snprintf(key, sizeof(key), "key%u", i);
+		snprintf(value, sizeof(value), "%u", i * 7);
+		err += check_key(&c, key, values);
+	}
+
+	cdb_close(&c);
+
+	return err;
+}
+
+static int
+test_reload(void)
+{
+	const char *keys[] = { "key" };
+	const char *oldv[] = { "old" };
+	const char *newv[] = { "new" };
+	const char *oldexp[] = { "old", NULL };
+	const char *newexp[] = { "new", NULL };
+	struct cdb c = CDB_INIT;
+	int err;
+
+	if (write_db(keys, oldv, 1) != 0)
+		return 1;
+
+	if (cdb_open(&c, AT_FDCWD, dbname) != 0) {
+		fprintf(stderr, "can not open %s: %i\n", dbname, errno);
+		return 1;
+	}
+	err = check_key(&c, "key", oldexp);
+
+	/* replacing the file must be noticed on the next open */
+	if (write_db(keys, newv, 1) != 0) {
+		cdb_close(&c);
+		return err + 1;
+	}
+	if (cdb_open(&c, AT_FDCWD, dbname) != 0) {
+		fprintf(stderr, "can not open %s again: %i\n", dbname, errno);
+		return err + 1;
+	}
+	err += check_key(&c, "key", newexp);
+
+	/* a removed file closes the database */
+	unlink(dbname);
+	if ((cdb_open(&c, AT_FDCWD, dbname) != -1) || (errno != ENOENT) || (c.map != NULL)) {
+		fprintf(stderr, "opening the removed database did not fail\n");
+		err++;
+	}
+
+	cdb_close(&c);
+
+	return err;
+}
+
+int
+main(void)
+{
+	int err = 0;
+
+	err += test_duplicates();
+	err += test_many();
+	err += test_reload();
+
+	unlink(dbname);
+	unlink(tmpname);
+
+	return err;
+}
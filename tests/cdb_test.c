@@ -105,12 +105,64 @@ test_cdb(void)
 	return errcnt;
 }
 
+static int
+test_cdb_handle(void)
+{
+	int errcnt = 0;
+	struct cdb c = CDB_INIT;
+	const char *map;
+
+	if (cdb_open(&c, AT_FDCWD, "users/cdb") != 0) {
+		puts("ERROR: can not open users/cdb");
+		return 1;
+	}
+	map = c.map;
+
+	for (unsigned int tvidx = 0; cdb_testvector[tvidx].key != NULL; tvidx++) {
+		char cdb_key[260];
+		const size_t cdbkeylen = strlen(cdb_testvector[tvidx].key) + 2;
+		const char *data;
+		uint32_t dlen;
+		int r;
+
+		cdb_key[0] = '!';
+		memcpy(cdb_key + 1, cdb_testvector[tvidx].key, cdbkeylen - 2);
+		cdb_key[cdbkeylen - 1] = '-';
+
+		/* the file is not changed, so the mapping must be kept */
+		if ((cdb_open(&c, AT_FDCWD, "users/cdb") != 0) || (c.map != map)) {
+			puts("ERROR: opening the unchanged users/cdb again did not keep the mapping");
+			errcnt++;
+		}
+
+		r = cdb_find(&c, cdb_key, cdbkeylen, &data, &dlen);
+		if (r != (cdb_testvector[tvidx].value != NULL)) {
+			printf("ERROR: cdb_find() for key %s returned %i\n", cdb_testvector[tvidx].key, r);
+			errcnt++;
+		} else if ((r == 1) && ((strlen(cdb_testvector[tvidx].realdomain) >= dlen) ||
+				(strcmp(data, cdb_testvector[tvidx].realdomain) != 0))) {
+			printf("ERROR: cdb_find() for key %s returned the wrong value\n", cdb_testvector[tvidx].key);
+			errcnt++;
+		}
+	}
+
+	cdb_close(&c);
+
+	if ((cdb_open(&c, AT_FDCWD, "users/nonexistent") != -1) || (errno != ENOENT)) {
+		puts("ERROR: opening a nonexistent file did not fail with ENOENT");
+		errcnt++;
+	}
+
+	return errcnt;
+}
+
 int
 main(void)
 {
 	int err = 0;
 
 	err = test_cdb();
+	err += test_cdb_handle();
 
 	return err;
 }
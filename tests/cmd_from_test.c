@@ -125,6 +125,11 @@ lookupipbl(int x __attribute__ ((unused)))
 	abort();
 }
 
+void
+filtercache_clear(void)
+{
+}
+
 int
 finddomain(const char *buf, const off_t size, const char *domain)
 {
@@ -151,7 +156,7 @@ user_exists(const string *localpart, const char *domain, struct userconf *ds)
 }
 
 long
-getsetting(const struct userconf *ds, const char *key, enum config_domain *t)
+getsetting(const struct userconf *ds, const enum config_setting key, enum config_domain *t)
 {
 	const char *conf;
 	if (ds->userconf != NULL) {
@@ -167,12 +172,14 @@ getsetting(const struct userconf *ds, const char *key, enum config_domain *t)
 
 	assert(strlen(conf) > 2);
 
-	if (strcmp(key, "fail_hard_on_temp") == 0)
+	switch (key) {
+	case SETTING_FAIL_HARD_ON_TEMP:
 		return (conf[1] == 'f');
-	else if (strcmp(key, "nonexist_on_block") == 0)
+	case SETTING_NONEXIST_ON_BLOCK:
 		return (conf[2] == 'n');
-	else
+	default:
 		abort();
+	}
 }
 
 static const char *err_m1, *err_m2;
@@ -182,6 +182,11 @@ lookupipbl(int x __attribute__ ((unused)))
 	abort();
 }
 
+void
+filtercache_clear(void)
+{
+}
+
 void
 freeips(struct ips *x)
 {
@@ -226,7 +231,7 @@ addrparse(char *in, const int flags, string *addr, char **more, struct userconf
 }
 
 long
-getsetting(const struct userconf *ds, const char *key, enum config_domain *t)
+getsetting(const struct userconf *ds, const enum config_setting key, enum config_domain *t)
 {
 	const char *conf;
 	if (ds->userconf != NULL) {
@@ -242,12 +247,14 @@ getsetting(const struct userconf *ds, const char *key, enum config_domain *t)
 
 	assert(strlen(conf) > 2);
 
-	if (strcmp(key, "fail_hard_on_temp") == 0)
+	switch (key) {
+	case SETTING_FAIL_HARD_ON_TEMP:
 		return (conf[1] == 'f');
-	else if (strcmp(key, "nonexist_on_block") == 0)
+	case SETTING_NONEXIST_ON_BLOCK:
 		return (conf[2] == 'n');
-	else
+	default:
 		abort();
+	}
 }
 
 static const char *err_m1, *err_m2;
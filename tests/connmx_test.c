@@ -3,6 +3,7 @@
 #include <netio.h>
 #include <qdns_dane.h>
 #include <qremote/greeting.h>
+#include <qremote/pool.h>
 #include "test_io/testcase_io.h"
 
 #include <assert.h>
@@ -265,6 +266,21 @@ getrhost(const struct ips *mx __attribute__ ((unused)))
 {
 }
 
+int
+pool_get(struct ips *mx __attribute__ ((unused)), const struct in6_addr *outip4 __attribute__ ((unused)),
+		const struct in6_addr *outip6 __attribute__ ((unused)))
+{
+	return 0;
+}
+
+static unsigned int reports[MXHEALTH_GREETING + 1];
+
+void
+tryconn_report(const enum mxhealth_reason reason)
+{
+	reports[reason]++;
+}
+
 int
 dnstlsa(const char *host, const unsigned short port, struct daneinfo **out)
 {
@@ -298,6 +314,13 @@ main(void)
 		ret++;
 	}
 
+	if ((reports[MXHEALTH_OK] != 3) || (reports[MXHEALTH_RESET] != 2) || (reports[MXHEALTH_GREETING] != 6) ||
+			(reports[MXHEALTH_CONNECT] != 0) || (reports[MXHEALTH_TIMEOUT] != 0)) {
+		fprintf(stderr, "wrong connection results reported: %u successes, %u resets, %u invalid greetings\n",
+				reports[MXHEALTH_OK], reports[MXHEALTH_RESET], reports[MXHEALTH_GREETING]);
+		ret++;
+	}
+
 	if (socketd >= 0)
 		close(socketd);
 
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 static const char contents[] =
@@ -666,6 +667,98 @@ test_listload()
 	return err;
 }
 
+static int
+test_domainidx(void)
+{
+	const char ctrl_testfile[] = "domainidx_testfile";
+	const char ctrl_idxfile[] = "domainidx_testfile.cdb";
+	/* make sure the index is newer than the list */
+	const struct timespec past[2] = { { .tv_sec = 1000000000, .tv_nsec = 0 }, { .tv_sec = 1000000000, .tv_nsec = 0 } };
+	int err = 0;
+	int fd;
+
+	puts("== Running tests for the domain index");
+
+	createTestFile(ctrl_testfile, contents);
+	if (utimensat(AT_FDCWD, ctrl_testfile, past, 0) != 0) {
+		fputs("cannot set the time of the domain list\n", stderr);
+		unlink(ctrl_testfile);
+		return 1;
+	}
+
+	if (loaddomainidx(contents, AT_FDCWD, ctrl_testfile) != 0) {
+		fputs("loading a not existing index did not return 0\n", stderr);
+		err++;
+	}
+
+	fd = open(ctrl_idxfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if ((fd < 0) || (makedomainidx(contents, strlen(contents), fd) != 0)) {
+		fputs("cannot write the domain index\n", stderr);
+		if (fd >= 0)
+			close(fd);
+		unlink(ctrl_idxfile);
+		unlink(ctrl_testfile);
+		return err + 1;
+	}
+	close(fd);
+
+	if (loaddomainidx(contents, AT_FDCWD, ctrl_testfile) != 1) {
+		fputs("the domain index was not loaded\n", stderr);
+		err++;
+	}
+
+	/* the size is not looked at when the index is used, so every domain
+	 * in the list would be missing when the list itself was searched */
+	for (int i = 0; present[i] != NULL; i++) {
+		if (finddomain(contents, 0, present[i]) != 1) {
+			printf("\t ERROR: present domain %s not found in index\n", present[i]);
+			err++;
+		}
+
+		fd = open(ctrl_testfile, O_RDONLY | O_CLOEXEC);
+		if (finddomainfd(fd, present[i], 1) != 1) {
+			printf("\t ERROR: present domain %s not found in index using finddomainfd()\n", present[i]);
+			err++;
+		}
+	}
+
+	for (int i = 0; absent[i] != NULL; i++) {
+		if (finddomain(contents, strlen(contents), absent[i]) != 0) {
+			printf("\t ERROR: absent domain %s found in index\n", absent[i]);
+			err++;
+		}
+
+		fd = open(ctrl_testfile, O_RDONLY | O_CLOEXEC);
+		if (finddomainfd(fd, absent[i], 1) != 0) {
+			printf("\t ERROR: absent domain %s found in index using finddomainfd()\n", absent[i]);
+			err++;
+		}
+	}
+
+	/* case is ignored like when searching the list itself */
+	if (finddomain(contents, 0, "Bar.FOO.example.NET") != 1) {
+		puts("\t ERROR: search in index is case sensitive");
+		err++;
+	}
+
+	/* an index older than the list is not used */
+	if (utimensat(AT_FDCWD, ctrl_idxfile, past, 0) != 0) {
+		fputs("cannot set the time of the domain index\n", stderr);
+		err++;
+	} else if (loaddomainidx(contents, AT_FDCWD, ctrl_testfile) != 0) {
+		fputs("an outdated domain index was loaded\n", stderr);
+		err++;
+	} else if (finddomain(contents, 0, present[0]) != 0) {
+		fputs("an outdated domain index was used\n", stderr);
+		err++;
+	}
+
+	unlink(ctrl_idxfile);
+	unlink(ctrl_testfile);
+
+	return err;
+}
+
 void test_log_writen(int priority __attribute__ ((unused)), const char **msg __attribute__ ((unused)))
 {
 	logcnt++;
@@ -783,6 +876,7 @@ main(void)
 
 	unlink(ctrl_testfile);
 
+	error += test_domainidx();
 	error += test_data_array();
 	error += test_oneliner();
 	error += test_lload();
@@ -0,0 +1,344 @@
+/** \file daemon_test.c
+ \brief testcases for the standalone listener mode of Qsmtpd
+ */
+
+#include <qsmtpd/daemon.h>
+#include "test_io/testcase_io.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <syslog.h>
+#include <unistd.h>
+
+static void
+test_log_write(int priority __attribute__ ((unused)), const char *s)
+{
+	fprintf(stderr, "log: %s\n", s);
+}
+
+static int
+test_options(void)
+{
+	const char *invalid[][6] = {
+		{ "Qsmtpd", "-d", "-x", "1", NULL },
+		{ "Qsmtpd", "-d", "-p", "0", NULL },
+		{ "Qsmtpd", "-d", "-p", "65536", NULL },
+		{ "Qsmtpd", "-d", "-w", "two", NULL },
+		{ "Qsmtpd", "-d", "-n", NULL },
+		{ "Qsmtpd", "-d", "-l", "no.address", "-p", NULL }
+	};
+	int err = 0;
+
+	for (unsigned int i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		char **argv = (char **)invalid[i];
+		int argc = 0;
+		int r;
+
+		while (argv[argc] != NULL)
+			argc++;
+
+		r = daemon_run(&argc, &argv);
+		if (r != EINVAL) {
+			fprintf(stderr, "invalid options %u: daemon_run() returned %i instead of %i (EINVAL)\n",
+					i, r, EINVAL);
+			err++;
+		}
+	}
+
+	return err;
+}
+
+/**
+ * @brief the connection handler: report the environment to the client
+ *
+ * The connection is held open until the client closes it.
+ */
+static void __attribute__ ((noreturn))
+report_connection(const int argc, char **argv)
+{
+	char buf[64];
+
+	const char *vars[] = { "PROTO", "TCPLOCALIP", "TCPREMOTEIP", "TCPLOCALPORT",
+#ifndef IPV4ONLY
+			"TCP6LOCALIP", "TCP6REMOTEIP",
+#endif
+			NULL };
+
+	for (unsigned int i = 0; vars[i] != NULL; i++) {
+		const char *v = getenv(vars[i]);
+
+		printf("%s=%s\n", vars[i], (v == NULL) ? "" : v);
+	}
+	printf("argc=%i\nargv=%s %s\n", argc, argv[0], (argc > 1) ? argv[1] : "");
+	fflush(stdout);
+
+	while (read(0, buf, sizeof(buf)) > 0)
+		;
+
+	_exit(0);
+}
+
+/**
+ * @brief connect to the daemon
+ * @return the connected socket, -1 on error
+ */
+static int
+connect_daemon(const unsigned short port)
+{
+	struct sockaddr_in sa;
+	int sd = -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	/* the daemon may not be listening yet */
+	for (int tries = 0; tries < 50; tries++) {
+		sd = socket(PF_INET, SOCK_STREAM, 0);
+		if (sd < 0)
+			return -1;
+		if (connect(sd, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+			break;
+		close(sd);
+		sd = -1;
+		usleep(100000);
+	}
+
+	return sd;
+}
+
+/**
+ * @brief connect to the daemon and read the report of the connection handler
+ */
+static int
+fetch_report(const unsigned short port, char *buf, const size_t buflen)
+{
+	size_t len = 0;
+	int sd = connect_daemon(port);
+
+	if ((sd < 0) || (shutdown(sd, SHUT_WR) != 0))
+		return -1;
+
+	for (;;) {
+		ssize_t r = read(sd, buf + len, buflen - len - 1);
+
+		if (r <= 0)
+			break;
+		len += r;
+	}
+	buf[len] = '\0';
+	close(sd);
+
+	return 0;
+}
+
+static unsigned short
+free_port(void)
+{
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	int sd = socket(PF_INET, SOCK_STREAM, 0);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((sd < 0) || (bind(sd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+			(getsockname(sd, (struct sockaddr *)&sa, &salen) != 0)) {
+		fprintf(stderr, "cannot find a free port\n");
+		exit(1);
+	}
+	close(sd);
+
+	return ntohs(sa.sin_port);
+}
+
+static int
+check_var(const char *report, const char *line)
+{
+	const char *p = strstr(report, line);
+
+	if ((p == NULL) || ((p != report) && (p[-1] != '\n')) || (p[strlen(line)] != '\n')) {
+		fprintf(stderr, "\"%s\" not found in report:\n%s\n", line, report);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_daemon(void)
+{
+	const unsigned short port = free_port();
+	char portstr[8];
+	char report[2][1024];
+	char portline[32];
+	pid_t daemon;
+	int status;
+	int err = 0;
+
+	snprintf(portstr, sizeof(portstr), "%u", port);
+
+	daemon = fork();
+	if (daemon < 0) {
+		fprintf(stderr, "cannot fork\n");
+		return 1;
+	}
+
+	if (daemon == 0) {
+		const char *args[] = { "Qsmtpd", "-d", "-l", "127.0.0.1", "-p", portstr, "-w", "1", "-n", "1",
+				"--", "auth.example.com", NULL };
+		char **argv = (char **)args;
+		int argc = sizeof(args) / sizeof(args[0]) - 1;
+		int r = daemon_run(&argc, &argv);
+
+		if (r != 0)
+			_exit(r);
+		report_connection(argc, argv);
+	}
+
+	/* there is only one worker that accepts only one connection, so the
+	 * second connection can only succeed if the worker was replaced */
+	for (unsigned int i = 0; i < 2; i++) {
+		if (fetch_report(port, report[i], sizeof(report[i])) != 0) {
+			fprintf(stderr, "cannot connect to daemon\n");
+			kill(daemon, SIGTERM);
+			waitpid(daemon, NULL, 0);
+			return err + 1;
+		}
+	}
+
+	snprintf(portline, sizeof(portline), "TCPLOCALPORT=%u", port);
+	for (unsigned int i = 0; i < 2; i++) {
+		err += check_var(report[i], "TCPLOCALIP=127.0.0.1");
+		err += check_var(report[i], "TCPREMOTEIP=127.0.0.1");
+		err += check_var(report[i], portline);
+#ifdef IPV4ONLY
+		err += check_var(report[i], "PROTO=TCP");
+#else
+		err += check_var(report[i], "PROTO=TCP6");
+		err += check_var(report[i], "TCP6LOCALIP=::ffff:127.0.0.1");
+		err += check_var(report[i], "TCP6REMOTEIP=::ffff:127.0.0.1");
+#endif
+		err += check_var(report[i], "argc=2");
+		err += check_var(report[i], "argv=Qsmtpd auth.example.com");
+	}
+
+	kill(daemon, SIGTERM);
+	if ((waitpid(daemon, &status, 0) != daemon) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "daemon did not terminate cleanly\n");
+		err++;
+	}
+
+	return err;
+}
+
+/**
+ * @brief the connection limit is shared by all workers and survives their replacement
+ */
+static int
+test_limit(void)
+{
+	const unsigned short port = free_port();
+	char portstr[8];
+	char report[1024];
+	struct pollfd pfd;
+	pid_t daemon;
+	int status;
+	int err = 0;
+	int sd;
+
+	snprintf(portstr, sizeof(portstr), "%u", port);
+
+	daemon = fork();
+	if (daemon < 0) {
+		fprintf(stderr, "cannot fork\n");
+		return 1;
+	}
+
+	if (daemon == 0) {
+		const char *args[] = { "Qsmtpd", "-d", "-l", "127.0.0.1", "-p", portstr, "-w", "2", "-n", "1",
+				"-c", "1", NULL };
+		char **argv = (char **)args;
+		int argc = sizeof(args) / sizeof(args[0]) - 1;
+		int r = daemon_run(&argc, &argv);
+
+		if (r != 0)
+			_exit(r);
+		report_connection(argc, argv);
+	}
+
+	/* the first connection is held open, the worker that accepted it has
+	 * already been replaced */
+	sd = connect_daemon(port);
+	pfd.fd = sd;
+	pfd.events = POLLIN;
+	if ((sd < 0) || (poll(&pfd, 1, 5000) != 1)) {
+		fprintf(stderr, "first connection to daemon was not handled\n");
+		kill(daemon, SIGTERM);
+		waitpid(daemon, NULL, 0);
+		return 1;
+	}
+
+	/* the second connection is accepted, but must not be handled while the
+	 * first one is still open */
+	pfd.fd = connect_daemon(port);
+	if ((pfd.fd < 0) || (shutdown(pfd.fd, SHUT_WR) != 0)) {
+		fprintf(stderr, "cannot connect to daemon\n");
+		err++;
+	} else if (poll(&pfd, 1, 500) != 0) {
+		fprintf(stderr, "connection limit was exceeded\n");
+		err++;
+	}
+
+	/* once the first connection is closed the second one is handled */
+	close(sd);
+	if ((err == 0) && (poll(&pfd, 1, 5000) != 1)) {
+		fprintf(stderr, "second connection was not handled after the first one was closed\n");
+		err++;
+	} else if (err == 0) {
+		ssize_t r = read(pfd.fd, report, sizeof(report) - 1);
+
+		if (r <= 0) {
+			fprintf(stderr, "no report received on second connection\n");
+			err++;
+		} else {
+			report[r] = '\0';
+			err += check_var(report, "TCPLOCALIP=127.0.0.1");
+		}
+	}
+	if (pfd.fd >= 0)
+		close(pfd.fd);
+
+	kill(daemon, SIGTERM);
+	if ((waitpid(daemon, &status, 0) != daemon) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "daemon did not terminate cleanly\n");
+		err++;
+	}
+
+	return err;
+}
+
+int
+main(void)
+{
+	int err = 0;
+
+	testcase_setup_log_write(test_log_write);
+	testcase_setup_log_writen(testcase_log_writen_combine);
+
+	err += test_options();
+	err += test_daemon();
+	err += test_limit();
+
+	return err;
+}
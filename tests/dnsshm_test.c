@@ -0,0 +1,269 @@
+/** \file dnsshm_test.c
+ \brief testcases for the DNS cache shared between processes
+ */
+
+#include <dnsshm.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char cachefile[] = "dnsshm_test_cache";
+
+static int
+check_entry(const enum dnscache_type type, const char *name, const char *expect, const size_t explen, const int expneg)
+{
+	char *out = NULL;
+	size_t len;
+	int negative;
+
+	if (!dnsshm_get(type, name, &out, &len, &negative)) {
+		fprintf(stderr, "no cached entry found for %s\n", name);
+		return 1;
+	}
+
+	if ((len != explen) || (negative != expneg) || ((len > 0) && (memcmp(out, expect, len) != 0))) {
+		fprintf(stderr, "wrong cached entry returned for %s\n", name);
+		free(out);
+		return 1;
+	}
+
+	free(out);
+	return 0;
+}
+
+static int
+test_open(void)
+{
+	int err = 0;
+	int fd;
+
+	unlink(cachefile);
+	if ((dnsshm_open(AT_FDCWD, cachefile) != -1) || (errno != ENOENT)) {
+		fprintf(stderr, "opening a nonexistent cache file did not fail with ENOENT\n");
+		err++;
+	}
+
+	/* a file with invalid contents is not used */
+	fd = open(cachefile, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0600);
+	if ((fd < 0) || (write(fd, "this is no cache file", 21) != 21)) {
+		fprintf(stderr, "cannot write %s\n", cachefile);
+		exit(1);
+	}
+	close(fd);
+
+	if ((dnsshm_open(AT_FDCWD, cachefile) != -1) || (errno != EINVAL)) {
+		fprintf(stderr, "opening an invalid cache file did not fail with EINVAL\n");
+		err++;
+	}
+
+	/* an empty file is initialized */
+	fd = open(cachefile, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "cannot create %s\n", cachefile);
+		exit(1);
+	}
+	close(fd);
+
+	/* but not if others could modify it */
+	if (chmod(cachefile, 0620) != 0) {
+		fprintf(stderr, "cannot chmod %s\n", cachefile);
+		exit(1);
+	}
+	if ((dnsshm_open(AT_FDCWD, cachefile) != -1) || (errno != EPERM)) {
+		fprintf(stderr, "opening a group writable cache file did not fail with EPERM\n");
+		err++;
+	}
+	if (chmod(cachefile, 0600) != 0) {
+		fprintf(stderr, "cannot chmod %s\n", cachefile);
+		exit(1);
+	}
+
+	if (dnsshm_open(AT_FDCWD, cachefile) != 0) {
+		fprintf(stderr, "opening an empty cache file failed with error %i\n", errno);
+		exit(1);
+	}
+
+	return err;
+}
+
+static int
+test_entries(void)
+{
+	const char mx[] = "\0\12mx.example.com";
+	char longname[300];
+	char *out = NULL;
+	size_t len;
+	int negative;
+	int err = 0;
+
+	if (dnsshm_get(DNSCACHE_A, "example.com", &out, &len, &negative)) {
+		fprintf(stderr, "empty cache returned an entry\n");
+		free(out);
+		err++;
+	}
+
+	dnsshm_put(DNSCACHE_A, "example.com", 0, "\x0a\x00\x00\x01", 4, 60);
+	dnsshm_put(DNSCACHE_MX, "example.com", 0, mx, sizeof(mx), 60);
+	dnsshm_put(DNSCACHE_A, "nonexistent.example.com", 1, NULL, 0, 60);
+
+	err += check_entry(DNSCACHE_A, "example.com", "\x0a\x00\x00\x01", 4, 0);
+	err += check_entry(DNSCACHE_A, "EXAMPLE.com", "\x0a\x00\x00\x01", 4, 0);
+	err += check_entry(DNSCACHE_MX, "example.com", mx, sizeof(mx), 0);
+	err += check_entry(DNSCACHE_A, "nonexistent.example.com", NULL, 0, 1);
+
+	if (dnsshm_get(DNSCACHE_AAAA, "example.com", &out, &len, &negative)) {
+		fprintf(stderr, "entry of different type was returned\n");
+		free(out);
+		err++;
+	}
+
+	/* replace an entry */
+	dnsshm_put(DNSCACHE_A, "example.com", 0, "\x0a\x00\x00\x02", 4, 60);
+	err += check_entry(DNSCACHE_A, "example.com", "\x0a\x00\x00\x02", 4, 0);
+
+	/* entries without lifetime and names that are too long are not stored */
+	dnsshm_put(DNSCACHE_A, "nottl.example.com", 0, "\x0a\x00\x00\x03", 4, 0);
+	memset(longname, 'a', sizeof(longname) - 1);
+	longname[sizeof(longname) - 1] = '\0';
+	dnsshm_put(DNSCACHE_A, longname, 0, "\x0a\x00\x00\x03", 4, 60);
+	if (dnsshm_get(DNSCACHE_A, "nottl.example.com", &out, &len, &negative) ||
+			dnsshm_get(DNSCACHE_A, longname, &out, &len, &negative)) {
+		fprintf(stderr, "entry was stored that should have been rejected\n");
+		free(out);
+		err++;
+	}
+
+	return err;
+}
+
+static int
+test_shared(void)
+{
+	int err = 0;
+	int status;
+	pid_t child = fork();
+
+	if (child < 0) {
+		fprintf(stderr, "cannot fork\n");
+		return 1;
+	}
+
+	/* the child uses a separate mapping of the file */
+	if (child == 0) {
+		dnsshm_close();
+		if (dnsshm_open(AT_FDCWD, cachefile) != 0)
+			_exit(1);
+		dnsshm_put(DNSCACHE_TXT, "child.example.com", 0, "from child", 11, 60);
+		_exit(check_entry(DNSCACHE_A, "example.com", "\x0a\x00\x00\x02", 4, 0));
+	}
+
+	if ((waitpid(child, &status, 0) != child) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "child process did not see the cached entries\n");
+		err++;
+	}
+
+	err += check_entry(DNSCACHE_TXT, "child.example.com", "from child", 11, 0);
+
+	/* the entries survive reopening the file */
+	dnsshm_close();
+	if (dnsshm_open(AT_FDCWD, cachefile) != 0) {
+		fprintf(stderr, "reopening the cache file failed with error %i\n", errno);
+		return err + 1;
+	}
+	err += check_entry(DNSCACHE_MX, "example.com", "\0\12mx.example.com", 17, 0);
+
+	return err;
+}
+
+/**
+ * @brief a slot left locked by a writer that died is taken over
+ */
+static int
+test_stale(void)
+{
+	const char name[] = "stale.example.com";
+	const size_t namelen = strlen(name);
+	struct stat st;
+	char *buf;
+	char *out = NULL;
+	size_t len;
+	int negative;
+	off_t slot = -1;
+	uint32_t seq;
+	int err = 0;
+	int fd;
+
+	dnsshm_put(DNSCACHE_A, name, 0, "\x0a\x00\x00\x04", 4, 60);
+
+	/* find the slot of the entry, the sequence counter is its first member */
+	fd = open(cachefile, O_RDWR | O_CLOEXEC);
+	if ((fd < 0) || (fstat(fd, &st) != 0)) {
+		fprintf(stderr, "cannot open %s\n", cachefile);
+		exit(1);
+	}
+	buf = malloc(st.st_size);
+	if ((buf == NULL) || (read(fd, buf, st.st_size) != st.st_size)) {
+		fprintf(stderr, "cannot read %s\n", cachefile);
+		exit(1);
+	}
+	for (off_t off = sizeof(struct dnsshm_header); (slot < 0) && (off < st.st_size); off += DNSSHM_SLOTSIZE) {
+		for (size_t i = 0; i + namelen <= DNSSHM_SLOTSIZE; i++) {
+			if (memcmp(buf + off + i, name, namelen) == 0) {
+				slot = off;
+				break;
+			}
+		}
+	}
+	free(buf);
+
+	if (slot < 0) {
+		fprintf(stderr, "slot of %s not found in cache file\n", name);
+		close(fd);
+		return 1;
+	}
+
+	/* simulate a writer that locked the slot and died */
+	if (pread(fd, &seq, sizeof(seq), slot) != sizeof(seq)) {
+		fprintf(stderr, "cannot read %s\n", cachefile);
+		exit(1);
+	}
+	seq++;
+	if (pwrite(fd, &seq, sizeof(seq), slot) != sizeof(seq)) {
+		fprintf(stderr, "cannot write %s\n", cachefile);
+		exit(1);
+	}
+	close(fd);
+
+	if (dnsshm_get(DNSCACHE_A, name, &out, &len, &negative)) {
+		fprintf(stderr, "entry was returned from a locked slot\n");
+		free(out);
+		err++;
+	}
+
+	dnsshm_put(DNSCACHE_A, name, 0, "\x0a\x00\x00\x05", 4, 60);
+	err += check_entry(DNSCACHE_A, name, "\x0a\x00\x00\x05", 4, 0);
+
+	return err;
+}
+
+int
+main(void)
+{
+	int err = 0;
+
+	err += test_open();
+	err += test_entries();
+	err += test_shared();
+	err += test_stale();
+
+	dnsshm_close();
+	unlink(cachefile);
+
+	return err;
+}
@@ -40,6 +40,7 @@ check_expect(const int r_expect, const char *name, const char *elog)
 	assert((r_expect == 0) == (elog == NULL));
 
 	fprintf(stderr, "Test: %s\n", name);
+	config_settings_parse(&ds.usersettings, (const char **)ds.userconf);
 	int r = cb_fromdomain(&ds, &logmsg, &t);
 
 	if (logmsg == NULL) {
@@ -30,14 +30,18 @@ enum filter_result cb_forceesmtp(const struct userconf *d __attribute__ ((unused
 enum filter_result cb_namebl(const struct userconf *d __attribute__ ((unused)), const char **l __attribute__ ((unused)), enum config_domain *t __attribute__ ((unused))) { abort(); }
 enum filter_result cb_wildcardns(const struct userconf *d __attribute__ ((unused)), const char **l __attribute__ ((unused)), enum config_domain *t __attribute__ ((unused))) { abort(); }
 
+/* referenced by the filter cache, but not used by the SPF filter */
+int check_rbl(char *const *rbls __attribute__ ((unused)), char **txt __attribute__ ((unused))) { abort(); }
+int lookupipbl(int fd __attribute__ ((unused))) { abort(); }
+
 /* This test (ab)uses the fields in struct userconf to set the expected
  * results of getsetting() and getsettingglobal().
  *
  * userdirfd & 0xff00   -> config domain (must only be user, domain, or none)
- * userdirfd & 0x0001   -> return value for getsetting(ds, "fail_hard_on_temp", t)
+ * userdirfd & 0x0001   -> return value for getsetting(ds, SETTING_FAIL_HARD_ON_TEMP, t)
  *
  * domaindirfd & 0xff00 -> config domain (all values permitted)
- * domaindirfd & 0x00ff -> return value for getsettingglobal(ds, "spfpolicy", t)
+ * domaindirfd & 0x00ff -> return value for getsettingglobal(ds, SETTING_SPFPOLICY, t)
  */
 
 static enum config_domain
@@ -57,9 +61,9 @@ decode_config_domain(const int i)
 }
 
 long
-getsetting(const struct userconf *ds, const char *c, enum config_domain  *t)
+getsetting(const struct userconf *ds, const enum config_setting c, enum config_domain *t)
 {
-	assert(strcmp(c, "fail_hard_on_temp") == 0);
+	assert(c == SETTING_FAIL_HARD_ON_TEMP);
 
 	*t = decode_config_domain(ds->userdirfd);
 	assert(*t != CONFIG_GLOBAL);
@@ -71,9 +75,9 @@ getsetting(const struct userconf *ds, const char *c, enum config_domain  *t)
 }
 
 long
-getsettingglobal(const struct userconf *ds, const char *c, enum config_domain *t)
+getsettingglobal(const struct userconf *ds, const enum config_setting c, enum config_domain *t)
 {
-	assert(strcmp(c, "spfpolicy") == 0);
+	assert(c == SETTING_SPFPOLICY);
 
 	if (ds == NULL)
 		return 0;
@@ -23,9 +23,9 @@ int controldir_fd = AT_FDCWD;
 extern int cb_wildcardns(const struct userconf *ds, const char **logmsg, enum config_domain *t);
 
 long
-getsettingglobal(const struct userconf *ds __attribute__ ((unused)), const char *a, enum config_domain *t)
+getsettingglobal(const struct userconf *ds __attribute__ ((unused)), const enum config_setting a, enum config_domain *t)
 {
-	assert(strcmp(a, "block_wildcardns") == 0);
+	assert(a == SETTING_BLOCK_WILDCARDNS);
 	*t = CONFIG_DOMAIN;
 	return 1;
 }
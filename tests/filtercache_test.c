@@ -0,0 +1,202 @@
+/** \file filtercache_test.c
+ \brief testcases for the per-transaction filter result cache
+ */
+
+#include <qsmtpd/filtercache.h>
+#include <qsmtpd/antispam.h>
+#include "test_io/testcase_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static unsigned int rbl_calls;
+static int rbl_result;
+static int rbl_errno;
+static unsigned int ipbl_calls;
+
+int
+check_rbl(char *const *rbls __attribute__ ((unused)), char **txt)
+{
+	rbl_calls++;
+
+	if ((rbl_result >= 0) && (txt != NULL))
+		*txt = strdup("listed for testing");
+
+	errno = rbl_errno;
+	return rbl_result;
+}
+
+int
+lookupipbl(int fd)
+{
+	ipbl_calls++;
+	close(fd);
+
+	return 1;
+}
+
+static int
+test_generic(void)
+{
+	char *l1[] = { "a.example.com", "b.example.com", NULL };
+	char *l2[] = { "a.example.co", "mb.example.com", NULL };
+	char *txt = NULL;
+	int r;
+	int err = 0;
+
+	if (filtercache_key_list(l1) == filtercache_key_list(l2)) {
+		fprintf(stderr, "different lists have the same cache key\n");
+		err++;
+	}
+
+	if (filtercache_get(FILTERCACHE_RBL, 42, &r, NULL)) {
+		fprintf(stderr, "empty cache returned a result\n");
+		err++;
+	}
+
+	filtercache_put(FILTERCACHE_RBL, 42, 3, NULL, 0);
+	if (!filtercache_get(FILTERCACHE_RBL, 42, &r, NULL) || (r != 3)) {
+		fprintf(stderr, "cached result was not returned\n");
+		err++;
+	}
+
+	if (filtercache_get(FILTERCACHE_NAMEBL, 42, &r, NULL)) {
+		fprintf(stderr, "cached result was returned for different type\n");
+		err++;
+	}
+
+	if (filtercache_get(FILTERCACHE_RBL, 42, &r, &txt)) {
+		fprintf(stderr, "cached result without text was returned when text was requested\n");
+		err++;
+	}
+
+	filtercache_put(FILTERCACHE_RBL, 42, 2, "foo", 1);
+	if (!filtercache_get(FILTERCACHE_RBL, 42, &r, &txt) || (r != 2) ||
+			(txt == NULL) || (strcmp(txt, "foo") != 0)) {
+		fprintf(stderr, "cached result with text was not returned\n");
+		err++;
+	}
+	free(txt);
+
+	/* fill the cache, the oldest entry must be replaced */
+	for (uint64_t k = 100; k < 200; k++)
+		filtercache_put(FILTERCACHE_IPBL, k, 1, NULL, 0);
+
+	if (filtercache_get(FILTERCACHE_RBL, 42, &r, NULL)) {
+		fprintf(stderr, "oldest entry was not replaced\n");
+		err++;
+	}
+	if (!filtercache_get(FILTERCACHE_IPBL, 199, &r, NULL)) {
+		fprintf(stderr, "newest entry was not found\n");
+		err++;
+	}
+
+	filtercache_clear();
+	if (filtercache_get(FILTERCACHE_IPBL, 199, &r, NULL)) {
+		fprintf(stderr, "entry was found after clearing the cache\n");
+		err++;
+	}
+
+	return err;
+}
+
+static int
+test_rbl(void)
+{
+	char *rbls[] = { "rbl.example.com", NULL };
+	char *txt = NULL;
+	int err = 0;
+	int r;
+
+	/* temporary errors are not cached */
+	rbl_result = -1;
+	rbl_errno = EAGAIN;
+	rbl_calls = 0;
+	check_rbl_cached(rbls, NULL);
+	r = check_rbl_cached(rbls, NULL);
+	if ((r != -1) || (errno != EAGAIN) || (rbl_calls != 2)) {
+		fprintf(stderr, "temporary RBL error was cached\n");
+		err++;
+	}
+
+	rbl_result = 0;
+	rbl_errno = 0;
+	rbl_calls = 0;
+	r = check_rbl_cached(rbls, NULL);
+	/* the text was not looked up before */
+	r += check_rbl_cached(rbls, &txt);
+	free(txt);
+	txt = NULL;
+	r += check_rbl_cached(rbls, &txt);
+	r += check_rbl_cached(rbls, NULL);
+	if ((r != 0) || (rbl_calls != 2) || (txt == NULL) || (strcmp(txt, "listed for testing") != 0)) {
+		fprintf(stderr, "RBL result was not cached, %u calls\n", rbl_calls);
+		err++;
+	}
+	free(txt);
+
+	filtercache_clear();
+	r = check_rbl_cached(rbls, NULL);
+	if ((r != 0) || (rbl_calls != 3)) {
+		fprintf(stderr, "RBL result was not looked up again after clearing the cache\n");
+		err++;
+	}
+
+	filtercache_clear();
+
+	return err;
+}
+
+static int
+test_ipbl(void)
+{
+	char fnbuf[22] = "filtercache_XXXXXX";
+	int fd = mkstemp(fnbuf);
+	int err = 0;
+
+	if (fd == -1) {
+		fprintf(stderr, "can not open temporary file\n");
+		return 1;
+	}
+
+	ipbl_calls = 0;
+	if ((lookupipbl_cached(fd) != 1) || (lookupipbl_cached(open(fnbuf, O_RDONLY | O_CLOEXEC)) != 1) ||
+			(ipbl_calls != 1)) {
+		fprintf(stderr, "lookupipbl() result was not cached, %u calls\n", ipbl_calls);
+		err++;
+	}
+
+	/* a changed file has a different key */
+	fd = open(fnbuf, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if ((fd == -1) || (write(fd, "x", 1) != 1)) {
+		fprintf(stderr, "can not write to temporary file\n");
+		err++;
+	}
+	close(fd);
+
+	if ((lookupipbl_cached(open(fnbuf, O_RDONLY | O_CLOEXEC)) != 1) || (ipbl_calls != 2)) {
+		fprintf(stderr, "lookupipbl() result of changed file was taken from cache\n");
+		err++;
+	}
+
+	unlink(fnbuf);
+	filtercache_clear();
+
+	return err;
+}
+
+int
+main(void)
+{
+	int err = 0;
+
+	err += test_generic();
+	err += test_rbl();
+	err += test_ipbl();
+
+	return err;
+}
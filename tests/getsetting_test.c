@@ -7,33 +7,46 @@
 const char **globalconf;
 
 static const char *dconfdata[] = {
-		"simple",
-		"one=1",
-		"two=2",
-		"twentytwo=22",
-		"twenty=20",
-		"domain=42",
-		"invalid=invalid",
-		"forcenull=-2",
+		"whitelistauth",
+		"nobounce=1",
+		"helovalid=2",
+		"usersizes=22",
+		"usersize=20",
+		"check_strict_rfc2822=42",
+		"spfpolicy=invalid",
+		"noapos=-2",
+		"nobounce=7",
 		NULL
 };
 
 static const char *uconfdata[] = {
-		"domain=-1",
+		"check_strict_rfc2822=-1",
 		NULL
 };
 
 static const char *gconfdata[] = {
-		"forcenull=2",
-		"global=3",
-		"globalforcenull=-3",
+		"noapos=2",
+		"block_SoberG=3",
+		"smtp_space_bug=-3",
+		NULL
+};
+
+static const char *gconfdata2[] = {
+		"block_SoberG=4",
 		NULL
 };
 
 static struct userconf ds;
 
+static void
+parse_configs(void)
+{
+	config_settings_parse(&ds.usersettings, (const char **)ds.userconf);
+	config_settings_parse(&ds.domainsettings, (const char **)ds.domainconf);
+}
+
 static int
-test_flag(const char *flag, const long expect, const enum config_domain expecttype)
+test_flag(const enum config_setting flag, const char *name, const long expect, const enum config_domain expecttype)
 {
 	enum config_domain t = -1;
 	long r;
@@ -43,7 +56,7 @@ test_flag(const char *flag, const long expect, const enum config_domain expectty
 		if ((r != expect) || (t != expecttype)) {
 			fprintf(stderr, "searching for '%s' with getsetting() should return "
 					"%li (type %i), but returned %li (type %i)\n",
-					flag, expect, expecttype, r, t);
+					name, expect, expecttype, r, t);
 			return 1;
 		}
 	}
@@ -53,13 +66,15 @@ test_flag(const char *flag, const long expect, const enum config_domain expectty
 	if ((r != expect) || (t != expecttype)) {
 		fprintf(stderr, "searching for '%s' with getsettingglobal() should return "
 				"%li (type %i), but returned %li (type %i)\n",
-				flag, expect, expecttype, r, t);
+				name, expect, expecttype, r, t);
 		return 1;
 	}
 
 	return 0;
 }
 
+#define TEST_FLAG(flag, expect, type) test_flag(SETTING_##flag, #flag, expect, type)
+
 int main()
 {
 	int err = 0;
@@ -68,35 +83,54 @@ int main()
 	memset(&ds, 0, sizeof(ds));
 	ds.domainconf = (char **)dconfdata;
 	ds.userconf = (char **)uconfdata;
+	parse_configs();
 
-	err += test_flag("domain", 0, CONFIG_USER);
-	err += test_flag("simple", 1, CONFIG_DOMAIN);
-	err += test_flag("one", 1, CONFIG_DOMAIN);
-	err += test_flag("two", 2, CONFIG_DOMAIN);
-	err += test_flag("invalid", -1, CONFIG_DOMAIN);
-	err += test_flag("forcenull", 0, CONFIG_DOMAIN);
+	err += TEST_FLAG(CHECK_STRICT_RFC2822, 0, CONFIG_USER);
+	err += TEST_FLAG(WHITELISTAUTH, 1, CONFIG_DOMAIN);
+	err += TEST_FLAG(NOBOUNCE, 1, CONFIG_DOMAIN);
+	err += TEST_FLAG(HELOVALID, 2, CONFIG_DOMAIN);
+	err += TEST_FLAG(SPFPOLICY, -1, CONFIG_DOMAIN);
+	err += TEST_FLAG(NOAPOS, 0, CONFIG_DOMAIN);
 
 	/* now without userconfig, checks other branches */
 	ds.userconf = NULL;
+	parse_configs();
 
-	err += test_flag("twenty", 20, CONFIG_DOMAIN);
-	err += test_flag("twentytwo", 22, CONFIG_DOMAIN);
+	err += TEST_FLAG(USERSIZE, 20, CONFIG_DOMAIN);
+	err += TEST_FLAG(CHECK_STRICT_RFC2822, 42, CONFIG_DOMAIN);
 
 	/* now with user and global config */
 	globalconf = gconfdata;
+	globalconf_changed();
 	ds.userconf = (char **)uconfdata;
-	err += test_flag("forcenull", 0, CONFIG_DOMAIN);
-	err += test_flag("global", 3, CONFIG_GLOBAL);
-	err += test_flag("nonexistent", 0, CONFIG_GLOBAL);
-	err += test_flag("globalforcenull", 0, CONFIG_GLOBAL);
+	parse_configs();
+	err += TEST_FLAG(NOAPOS, 0, CONFIG_DOMAIN);
+	err += TEST_FLAG(BLOCK_SOBERG, 3, CONFIG_GLOBAL);
+	err += TEST_FLAG(REJECT_IPV6ONLY, 0, CONFIG_GLOBAL);
+	err += TEST_FLAG(SMTP_SPACE_BUG, 0, CONFIG_GLOBAL);
 
 	t = -1;
-	long r = getsetting(&ds, "nonexistent", &t);
+	long r = getsetting(&ds, SETTING_REJECT_IPV6ONLY, &t);
 	if ((r != 0) || (t != CONFIG_DOMAIN)) {
-		fprintf(stderr, "searching for 'nonexistent' with getsetting() should return "
+		fprintf(stderr, "searching for 'REJECT_IPV6ONLY' with getsetting() should return "
 				"0 (type 1), but returned %li (type %i)\n", r, t);
 		return 1;
 	}
 
+	/* a new global configuration must be used */
+	globalconf = gconfdata2;
+	globalconf_changed();
+	err += TEST_FLAG(BLOCK_SOBERG, 4, CONFIG_GLOBAL);
+	err += TEST_FLAG(SMTP_SPACE_BUG, 0, CONFIG_GLOBAL);
+
+	/* a configuration reloaded at the same address must be used, too */
+	gconfdata2[0] = "block_SoberG=5";
+	globalconf_changed();
+	err += TEST_FLAG(BLOCK_SOBERG, 5, CONFIG_GLOBAL);
+
+	globalconf = NULL;
+	globalconf_changed();
+	err += TEST_FLAG(BLOCK_SOBERG, 0, CONFIG_GLOBAL);
+
 	return err;
 }
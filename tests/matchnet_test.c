@@ -2,6 +2,7 @@
  \brief IP address with netmask testcases
  */
 
+#include <ipbl.h>
 #include <match.h>
 #include <qsmtpd/antispam.h>
 #include <qsmtpd/qsmtpd.h>
@@ -321,9 +322,138 @@ matchdomain_test()
 	return err;
 }
 
-int dnstxt(char **out __attribute__ ((unused)), const char *host __attribute__ ((unused)))
+/**
+ * @brief look up the current remote address in a sorted file with the given ranges
+ * @param ranges the ranges as text, each 2 consecutive entries are first and last address
+ * @param af address family of the ranges
+ * @param version the version to write into the header
+ * @return the result of lookupipbl()
+ */
+static int
+sorted_lookup(const char **ranges, const int af, const unsigned char version)
 {
-	return 0;
+	char fnbuf[22] = "ipbl_sorted_XXXXXX";
+	const unsigned char iplen = (af == AF_INET) ? 4 : 16;
+	unsigned char header[IPBL_HEADERLEN];
+	int fd = mkstemp(fnbuf);
+	int r;
+
+	if (fd == -1) {
+		fprintf(stderr, "can not open temporary file\n");
+		return -2;
+	}
+
+	memcpy(header, IPBL_MAGIC, IPBL_MAGICLEN);
+	header[IPBL_MAGICLEN] = version;
+	header[IPBL_MAGICLEN + 1] = iplen;
+	write(fd, header, sizeof(header));
+
+	for (unsigned int i = 0; ranges[i] != NULL; i++) {
+		struct in6_addr ip;
+
+		r = inet_pton(af, ranges[i], &ip);
+		assert(r == 1);
+		write(fd, &ip, iplen);
+	}
+
+	r = lookupipbl(fd);
+	unlink(fnbuf);
+
+	return r;
+}
+
+static int
+sorted_test(void)
+{
+	const char *ranges4[] = {
+		"10.0.0.0", "10.255.255.255",
+		"172.17.42.0", "172.17.42.127",
+		"172.17.42.200", "172.17.42.200",
+		"192.0.2.0", "192.0.2.255",
+		NULL
+	};
+	const char *ranges6[] = {
+		"2001:db8::", "2001:db8::ffff",
+		"fe80::", "fe80::ffff:ffff:ffff:ffff",
+		NULL
+	};
+	const struct {
+		const char *ip;
+		int result;
+	} checks4[] = {
+		{ "::ffff:9.255.255.255", 0 },
+		{ "::ffff:10.0.0.0", 1 },
+		{ "::ffff:10.42.42.42", 1 },
+		{ "::ffff:10.255.255.255", 1 },
+		{ "::ffff:172.17.42.127", 1 },
+		{ "::ffff:172.17.42.128", 0 },
+		{ "::ffff:172.17.42.199", 0 },
+		{ "::ffff:172.17.42.200", 1 },
+		{ "::ffff:172.17.42.201", 0 },
+		{ "::ffff:192.0.2.255", 1 },
+		{ "::ffff:192.0.3.0", 0 },
+		{ NULL, 0 }
+	}, checks6[] = {
+		{ "::1", 0 },
+		{ "2001:db8::1", 1 },
+		{ "2001:db8::1:0", 0 },
+		{ "fe80::1234:6789:50ab:cdef", 1 },
+		{ "fe80:0:0:1::", 0 },
+		{ NULL, 0 }
+	};
+	const char *empty[] = { NULL };
+	int err = 0;
+	int r;
+
+	memset(&xmitstat, 0, sizeof(xmitstat));
+	xmitstat.ipv4conn = 1;
+
+	for (unsigned int i = 0; checks4[i].ip != NULL; i++) {
+		r = inet_pton(AF_INET6, checks4[i].ip, &xmitstat.sremoteip);
+		assert(r == 1);
+
+		r = sorted_lookup(ranges4, AF_INET, IPBL_VERSION);
+		if (r != checks4[i].result) {
+			fprintf(stderr, "lookupipbl() of %s in sorted file returned %i, expected %i\n",
+					checks4[i].ip, r, checks4[i].result);
+			err++;
+		}
+	}
+
+	if ((r = sorted_lookup(empty, AF_INET, IPBL_VERSION)) != 0) {
+		fprintf(stderr, "lookupipbl() in empty sorted file returned %i\n", r);
+		err++;
+	}
+
+	if ((r = sorted_lookup(ranges4, AF_INET, IPBL_VERSION + 1)) != -1) {
+		fprintf(stderr, "lookupipbl() in sorted file with unknown version returned %i\n", r);
+		err++;
+	}
+
+	if ((r = sorted_lookup(ranges6, AF_INET6, IPBL_VERSION)) != -1) {
+		fprintf(stderr, "lookupipbl() of IPv4 address in IPv6 sorted file returned %i\n", r);
+		err++;
+	}
+
+#ifndef IPV4ONLY
+	xmitstat.ipv4conn = 0;
+
+	for (unsigned int i = 0; checks6[i].ip != NULL; i++) {
+		r = inet_pton(AF_INET6, checks6[i].ip, &xmitstat.sremoteip);
+		assert(r == 1);
+
+		r = sorted_lookup(ranges6, AF_INET6, IPBL_VERSION);
+		if (r != checks6[i].result) {
+			fprintf(stderr, "lookupipbl() of %s in sorted file returned %i, expected %i\n",
+					checks6[i].ip, r, checks6[i].result);
+			err++;
+		}
+	}
+#else
+	(void) checks6;
+#endif
+
+	return err;
 }
 
 int main(void)
@@ -341,6 +471,9 @@ int main(void)
 	if (matchdomain_test())
 		errcnt++;
 
+	if (sorted_test())
+		errcnt++;
+
 	/* Now ignore the log calls. Until now they were an error,
 	 * now lookupipbl() should complain about not being able to lock. */
 	testcase_ignore_log_writen();
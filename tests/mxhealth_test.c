@@ -0,0 +1,302 @@
+/** \file mxhealth_test.c
+ \brief testcases for the persistent MX host health database
+ */
+
+#include <mxhealth.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char healthdir[] = "mxhealth_test_dir";
+
+static struct in6_addr
+mkaddr(const unsigned char last)
+{
+	struct in6_addr a;
+
+	inet_pton(AF_INET6, "2001:db8::", &a);
+	a.s6_addr[15] = last;
+
+	return a;
+}
+
+static int
+test_backoff(void)
+{
+	struct mxhealth_record rec = {
+		.version = MXHEALTH_VERSION,
+		.failures = 0,
+		.lastfailure = 1000000
+	};
+	const struct {
+		uint32_t failures;
+		time_t now;
+		time_t expect;
+	} tests[] = {
+		{ 0, 1000000, 0 },
+		{ 1, 1000000, MXHEALTH_BACKOFF },
+		{ 1, 1000000 + MXHEALTH_BACKOFF - 1, 1 },
+		{ 1, 1000000 + MXHEALTH_BACKOFF, 0 },
+		{ 2, 1000010, 2 * MXHEALTH_BACKOFF - 10 },
+		{ 3, 1000000, 4 * MXHEALTH_BACKOFF },
+		{ 100, 1000000, MXHEALTH_MAXBACKOFF },
+		{ 100, 1000000 + MXHEALTH_MAXBACKOFF, 0 },
+		{ 0, 0, 0 }
+	};
+	int err = 0;
+
+	for (unsigned int i = 0; tests[i].now != 0; i++) {
+		time_t r;
+
+		rec.failures = tests[i].failures;
+		r = mxhealth_backoff(&rec, tests[i].now);
+		if (r != tests[i].expect) {
+			fprintf(stderr, "backoff for %u failures at %li was %li instead of %li\n",
+					tests[i].failures, (long)tests[i].now, (long)r, (long)tests[i].expect);
+			err++;
+		}
+	}
+
+	return err;
+}
+
+static int
+test_records(void)
+{
+	const struct in6_addr a = mkaddr(1);
+	struct mxhealth_record rec;
+	int err = 0;
+
+	mxhealth_report(&a, MXHEALTH_RESET, 0);
+	if (mxhealth_get(&a, &rec)) {
+		fprintf(stderr, "record was stored without open database\n");
+		err++;
+	}
+
+	if (mxhealth_open(AT_FDCWD, healthdir) != 0) {
+		fprintf(stderr, "cannot open the database directory: %i\n", errno);
+		exit(1);
+	}
+
+	if (mxhealth_get(&a, &rec)) {
+		fprintf(stderr, "record found in empty database\n");
+		err++;
+	}
+
+	mxhealth_report(&a, MXHEALTH_RESET, 0);
+	mxhealth_report(&a, MXHEALTH_GREETING, 0);
+	if (!mxhealth_get(&a, &rec) || (rec.failures != 2) || (rec.reason != MXHEALTH_GREETING) ||
+			(rec.lastfailure == 0) || (rec.lastsuccess != 0)) {
+		fprintf(stderr, "failures were not recorded correctly\n");
+		err++;
+	}
+
+	mxhealth_report(&a, MXHEALTH_OK, 42);
+	if (!mxhealth_get(&a, &rec) || (rec.failures != 0) || (rec.rtt != 42) || (rec.lastsuccess == 0) ||
+			(rec.reason != MXHEALTH_GREETING)) {
+		fprintf(stderr, "success was not recorded correctly\n");
+		err++;
+	}
+
+	return err;
+}
+
+static int
+test_sort(void)
+{
+	struct in6_addr a1[3] = { mkaddr(11), mkaddr(12), mkaddr(13) };
+	struct in6_addr a2[1] = { mkaddr(21) };
+	struct in6_addr a3[2] = { mkaddr(31), mkaddr(32) };
+	struct in6_addr a4[1] = { mkaddr(41) };
+	struct ips mx[4] = {
+		{ .addr = a1, .count = 3, .priority = 10, .next = mx + 1 },
+		{ .addr = a2, .count = 1, .priority = 10, .next = mx + 2 },
+		{ .addr = a3, .count = 2, .priority = 10, .next = mx + 3 },
+		{ .addr = a4, .count = 1, .priority = 20, .next = NULL }
+	};
+	struct ips *p = mx;
+	int err = 0;
+
+	/* 11 and 13 are bad, the first entry is still used first */
+	mxhealth_report(a1 + 0, MXHEALTH_TIMEOUT, 0);
+	mxhealth_report(a1 + 2, MXHEALTH_CONNECT, 0);
+	/* the complete second entry is bad */
+	mxhealth_report(a2 + 0, MXHEALTH_CONNECT, 0);
+	/* the entry with the next priority must not move up */
+	mxhealth_report(a4 + 0, MXHEALTH_CONNECT, 0);
+
+	mxhealth_sort(&p);
+
+	if ((p != mx) || (mx[0].next != mx + 2) || (mx[2].next != mx + 1) ||
+			(mx[1].next != mx + 3) || (mx[3].next != NULL)) {
+		fprintf(stderr, "MX entries were not sorted correctly\n");
+		err++;
+	}
+
+	if ((a1[0].s6_addr[15] != 12) || (a1[1].s6_addr[15] != 11) || (a1[2].s6_addr[15] != 13)) {
+		fprintf(stderr, "addresses of MX entry were not sorted correctly\n");
+		err++;
+	}
+
+	/* if the head is bad it is replaced */
+	mxhealth_report(a1 + 0, MXHEALTH_CONNECT, 0);
+	mxhealth_sort(&p);
+	if ((p != mx + 2) || (mx[2].next != mx) || (mx[0].next != mx + 1) || (mx[1].next != mx + 3)) {
+		fprintf(stderr, "MX entries were not sorted correctly when the first one is bad\n");
+		err++;
+	}
+
+	return err;
+}
+
+/**
+ * @brief concurrent reports for the same host must not get lost
+ */
+static int
+test_concurrent(void)
+{
+	const struct in6_addr a = mkaddr(2);
+	const unsigned int children = 4;
+	const unsigned int reports = 200;
+	struct mxhealth_record rec;
+	int err = 0;
+
+	for (unsigned int i = 0; i < children; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			fprintf(stderr, "cannot fork: %i\n", errno);
+			exit(1);
+		} else if (pid == 0) {
+			for (unsigned int j = 0; j < reports; j++)
+				mxhealth_report(&a, MXHEALTH_TIMEOUT, 0);
+			_exit(0);
+		}
+	}
+
+	for (unsigned int i = 0; i < children; i++) {
+		int status;
+
+		if ((wait(&status) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			fprintf(stderr, "child did not exit normally\n");
+			err++;
+		}
+	}
+
+	if (!mxhealth_get(&a, &rec) || (rec.failures != children * reports)) {
+		fprintf(stderr, "concurrent reports were lost: %u failures recorded instead of %u\n",
+				rec.failures, children * reports);
+		err++;
+	}
+
+	return err;
+}
+
+/**
+ * @brief records not updated for MXHEALTH_EXPIRE are removed
+ */
+static int
+test_expire(void)
+{
+	const struct in6_addr aold = mkaddr(3);
+	const struct in6_addr anew = mkaddr(4);
+	const struct in6_addr atrigger = mkaddr(5);
+	const time_t now = time(NULL);
+	struct mxhealth_record rec;
+	struct timespec ts[2] = { { .tv_sec = now - MXHEALTH_CLEANUP - 1 }, { .tv_sec = now - MXHEALTH_CLEANUP - 1 } };
+	char fn[INET6_ADDRSTRLEN];
+	int err = 0;
+	int dirfd;
+	int fd;
+
+	mxhealth_report(&anew, MXHEALTH_CONNECT, 0);
+
+	memset(&rec, 0, sizeof(rec));
+	rec.version = MXHEALTH_VERSION;
+	rec.failures = 3;
+	rec.lastfailure = now - MXHEALTH_EXPIRE - 1;
+	rec.lastsuccess = now - MXHEALTH_EXPIRE - 10;
+
+	dirfd = open(healthdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	inet_ntop(AF_INET6, &aold, fn, sizeof(fn));
+	fd = openat(dirfd, fn, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if ((fd < 0) || (write(fd, &rec, sizeof(rec)) != (ssize_t)sizeof(rec)) || (close(fd) != 0)) {
+		fprintf(stderr, "cannot write old record\n");
+		exit(1);
+	}
+
+	/* the last cleanup is recent, nothing is removed */
+	mxhealth_report(&atrigger, MXHEALTH_OK, 1);
+	if (!mxhealth_get(&aold, &rec)) {
+		fprintf(stderr, "expired record was removed before the cleanup interval passed\n");
+		err++;
+	}
+
+	if (utimensat(dirfd, MXHEALTH_STAMP, ts, 0) != 0) {
+		fprintf(stderr, "cannot set time of cleanup stamp: %i\n", errno);
+		exit(1);
+	}
+	close(dirfd);
+
+	mxhealth_report(&atrigger, MXHEALTH_OK, 1);
+	if (mxhealth_get(&aold, &rec)) {
+		fprintf(stderr, "expired record was not removed\n");
+		err++;
+	}
+	if (!mxhealth_get(&anew, &rec) || !mxhealth_get(&atrigger, &rec)) {
+		fprintf(stderr, "current record was removed\n");
+		err++;
+	}
+
+	return err;
+}
+
+static void
+cleanup(void)
+{
+	int dirfd = open(healthdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (dirfd >= 0) {
+		for (unsigned char i = 0; i < 50; i++) {
+			const struct in6_addr a = mkaddr(i);
+			char fn[INET6_ADDRSTRLEN];
+
+			inet_ntop(AF_INET6, &a, fn, sizeof(fn));
+			unlinkat(dirfd, fn, 0);
+		}
+		unlinkat(dirfd, MXHEALTH_STAMP, 0);
+		close(dirfd);
+	}
+	rmdir(healthdir);
+}
+
+int
+main(void)
+{
+	int err = 0;
+
+	cleanup();
+	if (mkdir(healthdir, 0700) != 0) {
+		fprintf(stderr, "cannot create %s\n", healthdir);
+		return 1;
+	}
+
+	err += test_backoff();
+	err += test_records();
+	err += test_sort();
+	err += test_concurrent();
+	err += test_expire();
+
+	mxhealth_close();
+	cleanup();
+
+	return err;
+}
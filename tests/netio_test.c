@@ -10,6 +10,7 @@
 #include <openssl/conf.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -523,6 +524,144 @@ test_long_lines(void)
 	return ret;
 }
 
+static int
+readbody_check(const char *expect, const size_t expect_lines, const int errcode)
+{
+	char buf[2048];
+	size_t len = 0;
+	size_t lines = 0;
+	unsigned int errors = 0;
+	int ret = 0;
+
+	for (;;) {
+		const char *data;
+		size_t l;
+		const size_t r = net_readbody(&data, &l);
+
+		if (r == 0)
+			break;
+
+		if (r == (size_t)-1) {
+			if (errno != errcode) {
+				fprintf(stderr, "%s: net_readbody() returned error %i, but expected was %i\n",
+						testname, errno, errcode);
+				ret++;
+			}
+			errors++;
+			continue;
+		}
+
+		if (len + r > sizeof(buf)) {
+			fprintf(stderr, "%s: net_readbody() returned too much data\n", testname);
+			return ++ret;
+		}
+
+		memcpy(buf + len, data, r);
+		len += r;
+		lines += l;
+	}
+
+	if ((errors != 0) != (errcode != 0)) {
+		fprintf(stderr, "%s: net_readbody() returned %u errors\n", testname, errors);
+		ret++;
+	}
+
+	if ((len != strlen(expect)) || (memcmp(buf, expect, len) != 0)) {
+		fprintf(stderr, "%s: net_readbody() returned %zu bytes of unexpected data\n", testname, len);
+		ret++;
+	}
+
+	if (lines != expect_lines) {
+		fprintf(stderr, "%s: net_readbody() returned %zu lines, but expected was %zu\n",
+				testname, lines, expect_lines);
+		ret++;
+	}
+
+	return ret;
+}
+
+static int
+test_body(void)
+{
+	int ret = 0;
+	int i;
+	const char *data;
+	size_t lines;
+
+	testname = "message body";
+
+	if (unexpected_pending())
+		return 1;
+
+	/* simple body, followed by a pipelined command */
+	send_all_test_data("first\r\n..dot\r\n\r\n.\r\nQUIT\r\n");
+
+	if (readbody_check("first\n.dot\n\n", 3, 0))
+		ret++;
+
+	if (read_check("QUIT"))
+		ret++;
+
+	/* empty body */
+	send_all_test_data(".\r\n");
+
+	if (readbody_check("", 0, 0))
+		ret++;
+
+	/* line end and end of data split over multiple reads */
+	send_all_test_data("first\r");
+	if (net_readbody(&data, &lines) != 5) {
+		fprintf(stderr, "%s: net_readbody() did not return the beginning of the line\n", testname);
+		ret++;
+	}
+	send_all_test_data("\n.\r");
+	if ((net_readbody(&data, &lines) != 1) || (*data != '\n') || (lines != 1)) {
+		fprintf(stderr, "%s: net_readbody() did not return the end of the line\n", testname);
+		ret++;
+	}
+	send_all_test_data("\n");
+	if (net_readbody(&data, &lines) != 0) {
+		fprintf(stderr, "%s: net_readbody() did not detect the end of data\n", testname);
+		ret++;
+	}
+
+	/* bare LF and bare CR */
+	send_all_test_data("foo\nbar\r\n.\r\n");
+	if (readbody_check("bar\n", 1, EINVAL))
+		ret++;
+
+	send_all_test_data("foo\rbar\r\n.\r\n");
+	if (readbody_check("foobar\n", 1, EINVAL))
+		ret++;
+
+	send_all_test_data(".\rX\r\n.\r\n");
+	if (readbody_check("X\n", 1, EINVAL))
+		ret++;
+
+	/* a line of the maximum length, and one that is too long */
+	for (i = 0; i < 99; i++)
+		send_all_test_data(digits);
+	send_all_test_data("123456789\r\n.\r\n");
+
+	if (net_readbody(&data, &lines) != 1000) {
+		fprintf(stderr, "%s: net_readbody() did not accept a line of maximum length\n", testname);
+		ret++;
+	}
+	if (net_readbody(&data, &lines) != 0) {
+		fprintf(stderr, "%s: net_readbody() did not detect the end of data\n", testname);
+		ret++;
+	}
+
+	for (i = 0; i < 100; i++)
+		send_all_test_data(digits);
+	send_all_test_data("\r\nvalid\r\n.\r\n");
+
+	if (readbody_check("valid\n", 1, E2BIG))
+		ret++;
+
+	return ret;
+}
+
 static int
 test_binary(void)
 {
@@ -900,6 +1039,208 @@ test_net_write_multiline(void)
 	return ret;
 }
 
+static int
+test_readview(void)
+{
+	int ret = 0;
+	cstring first, second;
+	/* fills the input buffer so the partial line at the end has to be moved */
+	static char bulk[64 * 1000 + 600];
+	char tail[300 + 3];
+
+	testname = "readview";
+
+	if (unexpected_pending())
+		return ++ret;
+
+	send_all_test_data("first\r\nsecond\r\n");
+
+	if ((net_readview(&first, 0) != 0) || (net_readview(&second, 0) != 0)) {
+		fprintf(stderr, "%s: reading good data did not succeed\n", testname);
+		return ++ret;
+	}
+
+	if ((first.len != 5) || (strncmp(first.s, "first", 5) != 0) ||
+			(second.len != 6) || (strcmp(second.s, "second") != 0)) {
+		fprintf(stderr, "%s: reading valid data did not return the correct data\n", testname);
+		ret++;
+	}
+	/* both lines were read at once and must not have been copied */
+	if (second.s != first.s + first.len + 2) {
+		fprintf(stderr, "%s: the lines are not returned from the input buffer\n", testname);
+		ret++;
+	}
+	if ((linein.s != second.s) || (linein.len != second.len)) {
+		fprintf(stderr, "%s: linein does not match the returned line\n", testname);
+		ret++;
+	}
+
+	testname = "readview wrap";
+
+	for (unsigned int i = 0; i < 64; i++) {
+		memset(bulk + i * 1000, 'a' + (i % 26), 998);
+		memcpy(bulk + i * 1000 + 998, "\r\n", 2);
+	}
+	memset(bulk + 64 * 1000, 'b', 600);
+	send_test_data(bulk, sizeof(bulk));
+
+	for (unsigned int i = 0; i < 64; i++) {
+		cstring line;
+
+		if (net_readview(&line, 0) != 0) {
+			fprintf(stderr, "%s: reading line %u did not succeed\n", testname, i);
+			return ++ret;
+		}
+		if ((line.len != 998) || (line.s[0] != 'a' + (int)(i % 26)) || (line.s[997] != line.s[0])) {
+			fprintf(stderr, "%s: line %u was not read correctly\n", testname, i);
+			ret++;
+		}
+	}
+
+	memset(tail, 'b', sizeof(tail) - 3);
+	memcpy(tail + sizeof(tail) - 3, "\r\n", 3);
+	send_all_test_data(tail);
+	send_all_test_data("last\r\n");
+
+	if (net_readview(&first, 0) != 0) {
+		fprintf(stderr, "%s: reading the wrapped line did not succeed\n", testname);
+		return ++ret;
+	}
+	if ((first.len != 900) || (strspn(first.s, "b") != 900)) {
+		fprintf(stderr, "%s: the wrapped line was not read correctly\n", testname);
+		ret++;
+	}
+	if (read_check("last"))
+		ret++;
+
+	return ret;
+}
+
+static int
+test_net_buffered(void)
+{
+	int ret = 0;
+	const char *buf;
+
+	testname = "net_buffered";
+
+	if (unexpected_pending())
+		return ++ret;
+
+	if (net_buffered(&buf) != 0) {
+		fprintf(stderr, "%s: input buffered at start of test\n", testname);
+		ret++;
+	}
+
+	send_all_test_data("NOOP\r\nQUIT\r\n");
+
+	if (read_check("NOOP"))
+		ret++;
+	if ((net_buffered(&buf) != 6) || (strncmp(buf, "QUIT\r\n", 6) != 0)) {
+		fprintf(stderr, "%s: net_buffered() did not return the next command\n", testname);
+		ret++;
+	}
+
+	if (read_check("QUIT"))
+		ret++;
+	if (net_buffered(&buf) != 0) {
+		fprintf(stderr, "%s: input still buffered after reading it\n", testname);
+		ret++;
+	}
+
+	/* the byte read by data_pending() is buffered, too */
+	send_all_test_data("QUIT\r\n");
+	if (data_pending() != 1) {
+		fprintf(stderr, "%s: no data pending\n", testname);
+		ret++;
+	}
+	if ((net_buffered(&buf) != 1) || (*buf != 'Q')) {
+		fprintf(stderr, "%s: net_buffered() did not return the byte read by data_pending()\n", testname);
+		ret++;
+	}
+	if (read_check("QUIT"))
+		ret++;
+
+	return ret;
+}
+
+static int
+test_net_batching(void)
+{
+	int ret = 0;
+	struct pollfd rfd = {
+		.fd = 0,
+		.events = POLLIN
+	};
+
+	testname = "net_batching";
+
+	if (unexpected_pending())
+		return ++ret;
+
+	send_all_test_data("MAIL FROM:<>\r\nRCPT TO:<a@example.com>\r\nDATA\r\n");
+
+	net_batching = 1;
+
+	if (read_check("MAIL FROM:<>"))
+		ret++;
+	/* the next command is already there, so this reply must be collected */
+	if (netwrite("250 2.1.5 sender ok\r\n") != 0) {
+		fprintf(stderr, "%s: cannot write first reply\n", testname);
+		ret++;
+	}
+	if (poll(&rfd, 1, 0) != 0) {
+		fprintf(stderr, "%s: reply to first command was sent\n", testname);
+		ret++;
+	}
+
+	if (read_check("RCPT TO:<a@example.com>"))
+		ret++;
+	if (netwrite("250 2.1.0 recipient ok\r\n") != 0) {
+		fprintf(stderr, "%s: cannot write second reply\n", testname);
+		ret++;
+	}
+	if (poll(&rfd, 1, 0) != 0) {
+		fprintf(stderr, "%s: reply to second command was sent\n", testname);
+		ret++;
+	}
+
+	/* the last command of the group sends all replies at once */
+	if (read_check("DATA"))
+		ret++;
+	if (netwrite("354 go ahead\r\n") != 0) {
+		fprintf(stderr, "%s: cannot write last reply\n", testname);
+		ret++;
+	}
+	if (poll(&rfd, 1, 0) != 1) {
+		fprintf(stderr, "%s: replies were not sent\n", testname);
+		ret++;
+	}
+
+	net_batching = 0;
+
+	if (read_check("250 2.1.5 sender ok"))
+		ret++;
+	if (read_check("250 2.1.0 recipient ok"))
+		ret++;
+	if (read_check("354 go ahead"))
+		ret++;
+
+	/* collected replies are sent before waiting for input */
+	send_all_test_data("NOOP\r\nNOOP\r\n");
+	net_batching = 1;
+	if (read_check("NOOP"))
+		ret++;
+	netwrite("250 ok\r\n");
+	if (read_check("NOOP"))
+		ret++;
+	if (read_check("250 ok"))
+		ret++;
+	net_batching = 0;
+
+	return ret;
+}
+
 /**
  * @brief create a socketpair between 0 and the return value
  * @return a socket descriptor
@@ -1128,7 +1469,7 @@ main(int argc, char **argv)
 	socketd = pipefd[1];
 
 	/* test any combination of tests */
-	for (i = 1; i < 0x400; i++) {
+	for (i = 1; i < 0x800; i++) {
 		if (i & 1)
 			ret += test_pending();
 		if (i & 2)
@@ -1149,10 +1490,15 @@ main(int argc, char **argv)
 			ret += test_binary();
 		if (i & 0x200)
 			ret += test_readline();
+		if (i & 0x400)
+			ret += test_body();
 	}
 
+	ret += test_readview();
 	ret += test_net_writen();
 	ret += test_net_write_multiline();
+	ret += test_net_buffered();
+	ret += test_net_batching();
 
 	i = data_pending();
 	if (i != 0) {
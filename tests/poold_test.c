@@ -0,0 +1,767 @@
+/** \file poold_test.c
+ \brief testcases for the event loop of the connection pool daemon
+
+ The pooled connections are real TCP connections to a fake SMTP server on the
+ loopback interface, the requests are sent through a listening unix socket
+ like Qremote does.
+ */
+
+#define _GNU_SOURCE /* for accept4() */
+#include <qremote/pool.h>
+#include "test_io/testcase_io.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IDLE		2	/**< idle timeout of the connections */
+#define PERHOST		2	/**< connections kept per host */
+#define CTLSOCKET	"poold_test.socket"	/**< the socket requests are sent to */
+
+static unsigned int invalidcount;
+static unsigned int mismatchcount;
+static int srvsd = -1;			/**< listening socket of the fake SMTP server */
+static uint32_t srvport;		/**< port of the fake SMTP server */
+static struct in6_addr mx4;		/**< IPv4 address of the remote host */
+static struct in6_addr mx6;		/**< IPv6 address of the remote host, there are never connections to it */
+static struct in6_addr out4;		/**< outgoing IPv4 address */
+static struct in6_addr out6;		/**< outgoing IPv6 address */
+static struct in6_addr other4;		/**< an IPv4 address neither the remote nor the local host has */
+
+static void
+test_log_write(int priority, const char *s)
+{
+	if ((priority == LOG_WARNING) && (strcmp(s, "invalid pool request received") == 0)) {
+		invalidcount++;
+		return;
+	}
+	if ((priority == LOG_WARNING) && (strcmp(s, "returned connection does not match the pool request") == 0)) {
+		mismatchcount++;
+		return;
+	}
+
+	fprintf(stderr, "unexpected log message %i: %s\n", priority, s);
+}
+
+/**
+ * @brief send a request to the event loop
+ * @param req the request
+ * @param addrs the addresses of the request
+ * @param fd the connection to pass, -1 if none
+ * @return the control socket, -1 on error
+ */
+static int
+send_request(const struct pool_request *req, const struct in6_addr *addrs, const int fd)
+{
+	struct sockaddr_un sa;
+	struct iovec iov[2];
+	struct msghdr msg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+	int ctl;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, CTLSOCKET, sizeof(sa.sun_path) - 1);
+
+	ctl = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (ctl < 0)
+		return -1;
+	if (connect(ctl, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		close(ctl);
+		return -1;
+	}
+
+	iov[0].iov_base = (void *)req;
+	iov[0].iov_len = sizeof(*req);
+	iov[1].iov_base = (void *)addrs;
+	iov[1].iov_len = req->count * sizeof(*addrs);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	if (fd >= 0) {
+		struct cmsghdr *cmsg;
+
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof(cbuf.buf);
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	if (sendmsg(ctl, &msg, 0) != (ssize_t)(iov[0].iov_len + iov[1].iov_len)) {
+		close(ctl);
+		return -1;
+	}
+
+	return ctl;
+}
+
+/**
+ * @brief wait until the event loop has closed a control socket
+ * @param ctl the client end of the control socket
+ * @return 0 if the socket was closed without sending anything
+ */
+static int
+expect_ctl_closed(const int ctl)
+{
+	char c;
+
+	for (unsigned int i = 0; i < 10; i++) {
+		if (poold_step(100) != 0)
+			return 1;
+		if (recv(ctl, &c, 1, MSG_DONTWAIT) == 0) {
+			close(ctl);
+			return 0;
+		}
+	}
+
+	close(ctl);
+	return 1;
+}
+
+/**
+ * @brief connect to the fake SMTP server
+ * @param peer the server end of the connection is returned here
+ * @return the client end of the connection, -1 on error
+ *
+ * The greeting of the server has already been read from the connection, as
+ * Qremote does before it returns a connection.
+ */
+static int
+connect_remote(int *peer)
+{
+	struct sockaddr_in sa;
+	char buf[32];
+	int fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(srvport);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	*peer = accept4(srvsd, NULL, NULL, SOCK_CLOEXEC);
+	if (*peer < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if ((send(*peer, "220 fake ESMTP\r\n", 16, 0) != 16) || (recv(fd, buf, sizeof(buf), 0) != 16)) {
+		close(*peer);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * @brief return a connection to the pool
+ * @param addr the address of the remote host
+ * @param port the port of the remote host
+ * @param outip the outgoing IPv4 address
+ * @param fd the connection, it is closed afterwards
+ * @return 0 on success
+ *
+ * Success only means the request was processed, not that the connection
+ * was accepted into the pool.
+ */
+static int
+put_fd(const struct in6_addr *addr, const uint32_t port, const struct in6_addr *outip, const int fd)
+{
+	struct pool_request req = {
+		.version = POOL_VERSION,
+		.op = POOL_PUT,
+		.port = port,
+		.count = 1,
+		.outip4 = *outip,
+		.outip6 = out6
+	};
+	const int ctl = send_request(&req, addr, fd);
+
+	/* the daemon now owns the only other reference */
+	close(fd);
+
+	return (ctl < 0) || (expect_ctl_closed(ctl) != 0);
+}
+
+/**
+ * @brief return a new connection to the fake SMTP server to the pool
+ * @return the server end of the connection, -1 on error
+ */
+static int
+put(void)
+{
+	int peer;
+	const int fd = connect_remote(&peer);
+
+	if (fd < 0)
+		return -1;
+
+	if (put_fd(&mx4, srvport, &out4, fd) != 0) {
+		close(peer);
+		return -1;
+	}
+
+	return peer;
+}
+
+/**
+ * @brief ask the pool for a connection
+ * @param req the request, only addresses and count are filled in by the caller
+ * @param addrs the addresses to ask for
+ * @param index the index of the address of the connection is returned here
+ * @return the connection, -1 if none was returned
+ */
+static int
+get(struct pool_request *req, const struct in6_addr *addrs, uint32_t *index)
+{
+	struct pool_reply rep;
+	struct iovec iov = {
+		.iov_base = &rep,
+		.iov_len = sizeof(rep)
+	};
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+	ssize_t r = -1;
+	int fd = -1;
+	int ctl;
+
+	req->version = POOL_VERSION;
+	req->op = POOL_GET;
+
+	ctl = send_request(req, addrs, -1);
+	if (ctl < 0)
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	for (unsigned int i = 0; (i < 10) && (r < 0); i++) {
+		poold_step(100);
+		r = recvmsg(ctl, &msg, MSG_DONTWAIT);
+	}
+	close(ctl);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if ((r > 0) && (cmsg != NULL) && (cmsg->cmsg_type == SCM_RIGHTS))
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+
+	if ((r != sizeof(rep)) || (rep.version != POOL_VERSION)) {
+		fprintf(stderr, "invalid reply to POOL_GET, size %zi\n", r);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	*index = rep.index;
+	if ((fd < 0) != (rep.index == req->count)) {
+		fprintf(stderr, "reply index %u does not match the connection %i\n", rep.index, fd);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * @brief check that a connection handed out by the pool reaches the remote end
+ *
+ * The connection is used like Qremote does after getting it from the pool:
+ * EHLO is sent and the reply of the server is read.
+ */
+static int
+check_link(const int fd, const int peer)
+{
+	char buf[16];
+
+	if (send(fd, "EHLO\r\n", 6, 0) != 6)
+		return 1;
+	if ((recv(peer, buf, sizeof(buf), 0) != 6) || (memcmp(buf, "EHLO\r\n", 6) != 0))
+		return 1;
+	if (send(peer, "250 fake\r\n", 10, 0) != 10)
+		return 1;
+	if ((recv(fd, buf, sizeof(buf), 0) != 10) || (memcmp(buf, "250 fake\r\n", 10) != 0))
+		return 1;
+
+	return 0;
+}
+
+/**
+ * @brief run the event loop until the remote end received QUIT and the connection was closed
+ * @param peer the remote end of the connection
+ * @param maxwait how many seconds to wait at most
+ * @param quit if QUIT is expected before the connection is closed
+ */
+static int
+expect_closed(const int peer, const time_t maxwait, const int quit)
+{
+	const time_t end = time(NULL) + maxwait;
+	char buf[64];
+	size_t len = 0;
+
+	while (time(NULL) <= end) {
+		ssize_t r;
+
+		if (poold_step(100) != 0) {
+			fprintf(stderr, "poold_step() failed: %i\n", errno);
+			return 1;
+		}
+
+		/* the connection is reset if the daemon closes it with unread input */
+		r = recv(peer, buf + len, sizeof(buf) - len - 1, MSG_DONTWAIT);
+		if ((r == 0) || ((r < 0) && (errno == ECONNRESET))) {
+			buf[len] = '\0';
+			if (strcmp(buf, quit ? "QUIT\r\n" : "") != 0) {
+				fprintf(stderr, "unexpected data before close: %s\n", buf);
+				return 1;
+			}
+			return 0;
+		} else if (r > 0) {
+			len += r;
+		}
+	}
+
+	fprintf(stderr, "connection was not closed\n");
+	return 1;
+}
+
+static int
+test_reuse(void)
+{
+	struct in6_addr addrs[2] = { mx6, mx4 };
+	struct pool_request req = {
+		.port = srvport,
+		.count = 2,
+		.outip4 = out4,
+		.outip6 = out6
+	};
+	const int peer = put();
+	uint32_t index;
+	int err = 0;
+	int fd;
+
+	if (peer < 0) {
+		fprintf(stderr, "%s: cannot return connection\n", __func__);
+		return 1;
+	}
+
+	if (poold_connections() != 1) {
+		fprintf(stderr, "%s: pool has %u connections instead of 1\n", __func__, poold_connections());
+		err++;
+	}
+
+	fd = get(&req, addrs, &index);
+	if (fd < 0) {
+		fprintf(stderr, "%s: connection was not handed out\n", __func__);
+		close(peer);
+		return err + 1;
+	}
+	if (index != 1) {
+		fprintf(stderr, "%s: connection has index %u instead of 1\n", __func__, index);
+		err++;
+	}
+	if (check_link(fd, peer) != 0) {
+		fprintf(stderr, "%s: the connection does not reach the remote host\n", __func__);
+		err++;
+	}
+
+	/* the same connection can be returned again after it was used */
+	if (put_fd(&mx4, srvport, &out4, fd) != 0) {
+		fprintf(stderr, "%s: cannot return connection again\n", __func__);
+		close(peer);
+		return err + 1;
+	}
+	fd = get(&req, addrs, &index);
+	if ((fd < 0) || (check_link(fd, peer) != 0)) {
+		fprintf(stderr, "%s: connection was not handed out again\n", __func__);
+		err++;
+	}
+	if (fd >= 0)
+		close(fd);
+	close(peer);
+
+	/* the server has seen only the first connection */
+	fd = accept(srvsd, NULL, NULL);
+	if (fd >= 0) {
+		fprintf(stderr, "%s: a new connection was made to the server\n", __func__);
+		close(fd);
+		err++;
+	}
+
+	/* it is gone from the pool now */
+	fd = get(&req, addrs, &index);
+	if (fd >= 0) {
+		fprintf(stderr, "%s: connection was handed out twice\n", __func__);
+		close(fd);
+		err++;
+	}
+
+	return err;
+}
+
+static int
+test_mismatch(void)
+{
+	struct pool_request req = {
+		.port = srvport + 1,
+		.count = 1,
+		.outip4 = out4,
+		.outip6 = out6
+	};
+	const int peer = put();
+	uint32_t index;
+	int err = 0;
+	int fd;
+
+	if (peer < 0) {
+		fprintf(stderr, "%s: cannot return connection\n", __func__);
+		return 1;
+	}
+
+	/* wrong port */
+	fd = get(&req, &mx4, &index);
+	if (fd >= 0) {
+		fprintf(stderr, "%s: connection to wrong port was handed out\n", __func__);
+		close(fd);
+		err++;
+	}
+
+	/* wrong outgoing address */
+	req.port = srvport;
+	req.outip4 = other4;
+	fd = get(&req, &mx4, &index);
+	if (fd >= 0) {
+		fprintf(stderr, "%s: connection from wrong address was handed out\n", __func__);
+		close(fd);
+		err++;
+	}
+
+	/* the IPv6 outgoing address does not matter for an IPv4 connection */
+	req.outip4 = out4;
+	req.outip6 = mx6;
+	fd = get(&req, &mx4, &index);
+	if (fd < 0) {
+		fprintf(stderr, "%s: matching connection was not handed out\n", __func__);
+		err++;
+	} else {
+		close(fd);
+	}
+	close(peer);
+
+	return err;
+}
+
+static int
+test_limit(void)
+{
+	struct pool_request req = {
+		.port = srvport,
+		.count = 1,
+		.outip4 = out4,
+		.outip6 = out6
+	};
+	int peers[PERHOST + 1];
+	uint32_t index;
+	int err = 0;
+
+	for (unsigned int i = 0; i < PERHOST + 1; i++) {
+		peers[i] = put();
+		if (peers[i] < 0) {
+			fprintf(stderr, "%s: cannot return connection %u\n", __func__, i);
+			return 1;
+		}
+	}
+
+	/* the last one is beyond the limit */
+	err += expect_closed(peers[PERHOST], 1, 1);
+
+	if (poold_connections() != PERHOST) {
+		fprintf(stderr, "%s: pool has %u connections instead of %u\n", __func__,
+				poold_connections(), PERHOST);
+		err++;
+	}
+
+	/* the most recently returned one is handed out first */
+	for (int i = PERHOST - 1; i >= 0; i--) {
+		const int fd = get(&req, &mx4, &index);
+
+		if ((fd < 0) || (check_link(fd, peers[i]) != 0)) {
+			fprintf(stderr, "%s: connection %i was not handed out\n", __func__, i);
+			err++;
+		}
+		if (fd >= 0)
+			close(fd);
+	}
+
+	for (unsigned int i = 0; i < PERHOST + 1; i++)
+		close(peers[i]);
+
+	return err;
+}
+
+static int
+test_remote(void)
+{
+	int peer = put();
+	int err = 0;
+
+	if (peer < 0) {
+		fprintf(stderr, "%s: cannot return connection\n", __func__);
+		return 1;
+	}
+
+	/* the remote host closes the connection */
+	close(peer);
+	for (unsigned int i = 0; (i < 10) && (poold_connections() != 0); i++)
+		poold_step(100);
+	if (poold_connections() != 0) {
+		fprintf(stderr, "%s: closed connection was not dropped\n", __func__);
+		err++;
+	}
+
+	/* the remote host sends something while idle */
+	peer = put();
+	if (peer < 0) {
+		fprintf(stderr, "%s: cannot return connection\n", __func__);
+		return err + 1;
+	}
+	if (send(peer, "421 timeout\r\n", 13, 0) != 13) {
+		fprintf(stderr, "%s: cannot send reply\n", __func__);
+		err++;
+	}
+	err += expect_closed(peer, 1, 0);
+	close(peer);
+
+	return err;
+}
+
+static int
+test_idle(void)
+{
+	const int peer = put();
+	int err;
+
+	if (peer < 0) {
+		fprintf(stderr, "%s: cannot return connection\n", __func__);
+		return 1;
+	}
+
+	err = expect_closed(peer, IDLE + 2, 1);
+	close(peer);
+
+	return err;
+}
+
+/**
+ * @brief connections that do not match their request are not pooled
+ *
+ * A local process must not be able to plant a connection to a host it
+ * controls for one the next Qremote would connect to.
+ */
+static int
+test_forged(void)
+{
+	int sp[2];
+	int peer;
+	int fd;
+	int err = 0;
+
+	/* connected to another host than claimed */
+	fd = connect_remote(&peer);
+	if ((fd < 0) || (put_fd(&other4, srvport, &out4, fd) != 0)) {
+		fprintf(stderr, "%s: cannot return connection with wrong host\n", __func__);
+		return 1;
+	}
+	err += expect_closed(peer, 1, 0);
+	close(peer);
+
+	/* connected to another port than claimed */
+	fd = connect_remote(&peer);
+	if ((fd < 0) || (put_fd(&mx4, srvport + 1, &out4, fd) != 0)) {
+		fprintf(stderr, "%s: cannot return connection with wrong port\n", __func__);
+		return err + 1;
+	}
+	err += expect_closed(peer, 1, 0);
+	close(peer);
+
+	/* not made from the claimed outgoing address */
+	fd = connect_remote(&peer);
+	if ((fd < 0) || (put_fd(&mx4, srvport, &other4, fd) != 0)) {
+		fprintf(stderr, "%s: cannot return connection with wrong outgoing address\n", __func__);
+		return err + 1;
+	}
+	err += expect_closed(peer, 1, 0);
+	close(peer);
+
+	/* not a TCP connection at all */
+	if ((socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sp) != 0) ||
+			(put_fd(&mx4, srvport, &out4, sp[1]) != 0)) {
+		fprintf(stderr, "%s: cannot return unix socket\n", __func__);
+		return err + 1;
+	}
+	err += expect_closed(sp[0], 1, 0);
+	close(sp[0]);
+
+	if (poold_connections() != 0) {
+		fprintf(stderr, "%s: pool has %u connections instead of 0\n", __func__, poold_connections());
+		err++;
+	}
+
+	if (mismatchcount != 4) {
+		fprintf(stderr, "%s: the mismatches were logged %u times\n", __func__, mismatchcount);
+		err++;
+	}
+
+	return err;
+}
+
+static int
+test_invalid(void)
+{
+	struct pool_request req = {
+		.version = POOL_VERSION,
+		.op = POOL_PUT,
+		.port = 25,
+		.count = 1
+	};
+	int ctl;
+	int err = 0;
+
+	/* a connection must be passed with POOL_PUT */
+	ctl = send_request(&req, &mx4, -1);
+	if ((ctl < 0) || (expect_ctl_closed(ctl) != 0)) {
+		fprintf(stderr, "%s: control socket was not closed\n", __func__);
+		err++;
+	}
+
+	/* unknown version */
+	req.version = POOL_VERSION + 1;
+	req.op = POOL_GET;
+	ctl = send_request(&req, &mx4, -1);
+	if ((ctl < 0) || (expect_ctl_closed(ctl) != 0)) {
+		fprintf(stderr, "%s: control socket was not closed\n", __func__);
+		err++;
+	}
+
+	if (invalidcount != 2) {
+		fprintf(stderr, "%s: the invalid messages were logged %u times\n", __func__, invalidcount);
+		err++;
+	}
+
+	return err;
+}
+
+/**
+ * @brief open the listening sockets of the fake SMTP server and the event loop
+ * @return the listening socket for requests, -1 on error
+ */
+static int
+setup_sockets(void)
+{
+	struct sockaddr_un sa;
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int sd;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	srvsd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ((srvsd < 0) || (bind(srvsd, (struct sockaddr *)&sin, sizeof(sin)) != 0) ||
+			(listen(srvsd, 8) != 0) || (getsockname(srvsd, (struct sockaddr *)&sin, &len) != 0)) {
+		fprintf(stderr, "cannot set up fake SMTP server: %i\n", errno);
+		return -1;
+	}
+	srvport = ntohs(sin.sin_port);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, CTLSOCKET, sizeof(sa.sun_path) - 1);
+
+	(void) unlink(CTLSOCKET);
+	sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if ((sd < 0) || (bind(sd, (struct sockaddr *)&sa, sizeof(sa)) != 0) || (listen(sd, 8) != 0)) {
+		fprintf(stderr, "cannot set up request socket: %i\n", errno);
+		return -1;
+	}
+
+	return sd;
+}
+
+int
+main(void)
+{
+	int err = 0;
+	int sd;
+
+	testcase_setup_log_write(test_log_write);
+	testcase_setup_log_writen(testcase_log_writen_combine);
+
+	inet_pton(AF_INET6, "::ffff:127.0.0.1", &mx4);
+	inet_pton(AF_INET6, "::1", &mx6);
+	inet_pton(AF_INET6, "::ffff:127.0.0.1", &out4);
+	inet_pton(AF_INET6, "2001:db8:1::1", &out6);
+	inet_pton(AF_INET6, "::ffff:192.0.2.25", &other4);
+
+	sd = setup_sockets();
+	if (sd < 0)
+		return 1;
+
+	if (poold_init(sd, IDLE, PERHOST) != 0) {
+		fprintf(stderr, "cannot set up event loop\n");
+		return 1;
+	}
+
+	err += test_reuse();
+	err += test_mismatch();
+	err += test_limit();
+	err += test_remote();
+	err += test_idle();
+	err += test_forged();
+	err += test_invalid();
+
+	if (poold_connections() != 0) {
+		fprintf(stderr, "%u connections left after tests\n", poold_connections());
+		err++;
+	}
+
+	close(sd);
+	close(srvsd);
+	unlink(CTLSOCKET);
+
+	return err;
+}
@@ -66,6 +66,9 @@ static struct {
 
 static const char timeouthost[] = "timeout.example.com";
 static const char timeoutmx[] = "timeoutmx.example.com";
+static unsigned int dnsip4_calls;	/* number of calls to dnsip4() */
+static unsigned int dnstxt_calls;	/* number of calls to dnstxt() */
+static unsigned int dnsip4_ttl = 300;	/* TTL returned by dnsip4() */
 
 static int
 findip(const char *name, struct in6_addr *addr, int start)
@@ -92,10 +95,12 @@ findip(const char *name, struct in6_addr *addr, int start)
 	return -1;
 }
 
-int dnsip4(char **out, size_t *len, const char *host)
+int dnsip4(char **out, size_t *len, const char *host, unsigned int *ttl)
 {
 	struct in6_addr addr;
 
+	dnsip4_calls++;
+	*ttl = dnsip4_ttl;
 	*out = NULL;
 	*len = 0;
 
@@ -140,7 +145,24 @@ int dnsip4(char **out, size_t *len, const char *host)
 	return 0;
 }
 
-int dnsip6(char **out, size_t *len, const char *host)
+int dnsip4_parallel(const char *const *hosts, const unsigned int count, struct dnsip4_result *results, const unsigned int timeout)
+{
+	assert(timeout > 0);
+
+	for (unsigned int i = 0; i < count; i++) {
+		/* a local error for a single query */
+		if (strcmp(hosts[i], "nomem.example.net") == 0)
+			results[i].status = -ENOMEM;
+		else if (dnsip4(&results[i].out, &results[i].len, hosts[i], &results[i].ttl) != 0)
+			results[i].status = -errno;
+		else
+			results[i].status = results[i].len / 4;
+	}
+
+	return 0;
+}
+
+int dnsip6(char **out, size_t *len, const char *host, unsigned int *ttl __attribute__((unused)))
 {
 	struct in6_addr addr;
 
@@ -183,8 +205,10 @@ int dnsip6(char **out, size_t *len, const char *host)
 	return 0;
 }
 
-int dnstxt(char **out __attribute__((unused)), const char *host __attribute__((unused)))
+int dnstxt(char **out __attribute__((unused)), const char *host __attribute__((unused)),
+		unsigned int *ttl __attribute__((unused)))
 {
+	dnstxt_calls++;
 	errno = ENOENT;
 	return -1;
 }
@@ -284,7 +308,7 @@ static struct {
 	{ }
 };
 
-int dnsmx(char **out, size_t *len, const char *host)
+int dnsmx(char **out, size_t *len, const char *host, unsigned int *ttl __attribute__((unused)))
 {
 	*len = 0;
 
@@ -344,7 +368,7 @@ int dnsmx(char **out, size_t *len, const char *host)
 	}
 }
 
-int dnsname(char **out, const struct in6_addr *ip)
+int dnsname(char **out, const struct in6_addr *ip, unsigned int *ttl __attribute__((unused)))
 {
 	char ipstr[INET6_ADDRSTRLEN];
 	int i = 0;
@@ -600,6 +624,156 @@ test_errors(void)
 	return err;
 }
 
+static int
+test_parallel(void)
+{
+	const char *names[] = { "first.a.example.net", timeouthost, "nonexistent.example.net",
+			"third.a.example.net", "first.aaaa.example.net" };
+	const int expect[] = { 1, DNS_ERROR_TEMP, 0, 3, 0 };
+	/* the first name is cached, so the others are not looked up anymore */
+	const int expect_cached[] = { 1, DNS_ERROR_TEMP, DNS_ERROR_TEMP, DNS_ERROR_TEMP, DNS_ERROR_TEMP };
+	int results[sizeof(names) / sizeof(names[0])];
+	int err = 0;
+
+	dnscache_clear();
+
+	if (ask_dnsa_parallel(names, sizeof(names) / sizeof(names[0]), results) != 0) {
+		fprintf(stderr, "parallel lookup failed\n");
+		return 1;
+	}
+
+	for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (results[i] != expect[i]) {
+			fprintf(stderr, "parallel lookup of %s returned %i instead of %i\n",
+					names[i], results[i], expect[i]);
+			err++;
+		}
+	}
+
+	dnsip4_calls = 0;
+	if (ask_dnsa_parallel(names, sizeof(names) / sizeof(names[0]), results) != 0) {
+		fprintf(stderr, "cached parallel lookup failed\n");
+		return err + 1;
+	}
+
+	for (unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (results[i] != expect_cached[i]) {
+			fprintf(stderr, "cached parallel lookup of %s returned %i instead of %i\n",
+					names[i], results[i], expect_cached[i]);
+			err++;
+		}
+	}
+
+	/* the results of the parallel lookup are used by ask_dnsa() */
+	if ((ask_dnsa("third.a.example.net", NULL) != 3) || (ask_dnsa("nonexistent.example.net", NULL) != 0) ||
+			(dnsip4_calls != 0)) {
+		fprintf(stderr, "results of parallel lookup were not cached, %u queries done\n", dnsip4_calls);
+		err++;
+	}
+
+	dnscache_clear();
+
+	/* the errno of a local error is not overwritten by a later name */
+	{
+		const char *lnames[] = { "nomem.example.net", "nonexistent.example.net" };
+		int lresults[2];
+
+		if ((ask_dnsa_parallel(lnames, 2, lresults) != 0) || (lresults[0] != DNS_ERROR_LOCAL) ||
+				(lresults[1] != 0) || (errno != ENOMEM)) {
+			fprintf(stderr, "parallel lookup with local error returned %i %i, errno %i\n",
+					lresults[0], lresults[1], errno);
+			err++;
+		}
+	}
+
+	dnscache_clear();
+
+	return err;
+}
+
+static int
+test_cache(void)
+{
+	struct in6_addr *a = NULL;
+	char *txt = NULL;
+	unsigned long hits, misses;
+	int err = 0;
+	int r;
+
+	dnscache_clear();
+	dnsip4_calls = 0;
+
+	r = ask_dnsa("second.a.example.net", &a);
+	free(a);
+	a = NULL;
+	if (r == 2)
+		r = ask_dnsa("Second.A.example.net", &a);
+	if ((r != 2) || (dnsip4_calls != 1)) {
+		fprintf(stderr, "cached lookup returned %i, %u queries done\n", r, dnsip4_calls);
+		err++;
+	} else if ((a[0].s6_addr32[3] != htonl(0x0a000002)) || (a[1].s6_addr32[3] != htonl(0x0a000202))) {
+		fprintf(stderr, "cached lookup returned wrong addresses\n");
+		err++;
+	}
+	free(a);
+
+	/* negative results are cached */
+	r = ask_dnsa("nonexistent.example.net", NULL);
+	r += ask_dnsa("nonexistent.example.net", NULL);
+	if ((r != 0) || (dnsip4_calls != 2)) {
+		fprintf(stderr, "negative result was not cached, %u queries done\n", dnsip4_calls);
+		err++;
+	}
+
+	dnstxt_calls = 0;
+	r = ask_dnstxt(&txt, "nonexistent.example.net");
+	if ((r == -1) && (errno == ENOENT))
+		r = ask_dnstxt(&txt, "nonexistent.example.net");
+	if ((r != -1) || (errno != ENOENT) || (dnstxt_calls != 1)) {
+		fprintf(stderr, "negative TXT result was not cached, %u queries done\n", dnstxt_calls);
+		err++;
+	}
+
+	/* temporary errors are not */
+	r = ask_dnsa(timeouthost, NULL);
+	r += ask_dnsa(timeouthost, NULL);
+	if ((r != 2 * DNS_ERROR_TEMP) || (dnsip4_calls != 4)) {
+		fprintf(stderr, "temporary error was cached, %u queries done\n", dnsip4_calls);
+		err++;
+	}
+
+	dnscache_stats(&hits, &misses);
+	if ((hits != 3) || (misses != 5)) {
+		fprintf(stderr, "cache statistics are %lu hits, %lu misses, expected 3 and 5\n", hits, misses);
+		err++;
+	}
+
+	dnscache_clear();
+	r = ask_dnsa("second.a.example.net", NULL);
+	dnscache_stats(&hits, &misses);
+	if ((r != 2) || (dnsip4_calls != 5) || (hits != 0) || (misses != 1)) {
+		fprintf(stderr, "lookup was answered from cache after clearing it\n");
+		err++;
+	}
+
+	/* answers with a TTL of 0 must not be cached */
+	dnscache_clear();
+	dnsip4_ttl = 0;
+	r = ask_dnsa("second.a.example.net", NULL);
+	r += ask_dnsa("nonexistent.example.net", NULL);
+	r += ask_dnsa("second.a.example.net", NULL);
+	r += ask_dnsa("nonexistent.example.net", NULL);
+	dnsip4_ttl = 300;
+	if ((r != 4) || (dnsip4_calls != 9)) {
+		fprintf(stderr, "answers with TTL 0 were cached, %u queries done\n", dnsip4_calls);
+		err++;
+	}
+
+	dnscache_clear();
+
+	return err;
+}
+
 /**
  * @brief test the FOREACH_STRUCT_IPS macro
  */
@@ -683,6 +857,8 @@ main(void)
 	err += test_implicit_mx();
 	err += test_mx();
 	err += test_errors();
+	err += test_parallel();
+	err += test_cache();
 	err += test_foreach();
 
 	return err;
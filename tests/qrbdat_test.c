@@ -4,6 +4,7 @@
 #endif /* CHUNKING */
 
 #include <netio.h>
+#include <qremote/greeting.h>
 #include <qremote/qrdata.h>
 #include <qremote/qremote.h>
 #include "test_io/testcase_io.h"
@@ -12,12 +13,14 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 unsigned int may_log_count;
 
 string heloname;
 unsigned int smtpext;
+unsigned int chunkwindow;
 
 const char *msgdata;
 off_t msgsize;
@@ -33,10 +36,11 @@ static unsigned int expect_quit;
 static const char **write_msgs;
 static unsigned int write_msg_index;
 static struct checkreply_data {
-	const char *status;
+	const char *status;	/**< expected status, "-" for NULL */
 	int result;
 } const *checkreply_msgs;
 static unsigned int checkreply_index;
+static const unsigned int *checkreply_written;	/**< number of chunks sent before each call to checkreply() */
 
 void
 quit(void)
@@ -72,12 +76,21 @@ checkreply(const char *status, const char **pre __attribute__ ((unused)), const
 		exit(EFAULT);
 	}
 
+	if (status == NULL)
+		status = "-";
+
 	if (strcmp(status, checkreply_msgs[checkreply_index].status) != 0) {
 		fprintf(stderr, "expected message at index %u not received, got '%s', expected '%s'\n",
 			checkreply_index, status, checkreply_msgs[checkreply_index].status);
 		exit(EINVAL);
 	}
 
+	if ((checkreply_written != NULL) && (checkreply_written[checkreply_index] != write_msg_index)) {
+		fprintf(stderr, "reply at index %u was read after %u chunks, expected after %u\n",
+			checkreply_index, write_msg_index, checkreply_written[checkreply_index]);
+		exit(EINVAL);
+	}
+
 	return checkreply_msgs[checkreply_index++].result;
 }
 
@@ -390,6 +403,142 @@ test_wrap_fail(void)
 	return 1;
 }
 
+static int pending_result;
+
+static int
+test_data_pending(void)
+{
+	return pending_result;
+}
+
+static int
+test_pipelined(void)
+{
+	const char *netmsgs[] = {
+		"BDAT 3\r\nabc",
+		"BDAT 3\r\ndef",
+		"BDAT 3\r\nghi",
+		"BDAT 1 LAST\r\nj",
+		NULL
+	};
+	const struct checkreply_data chrmsgs[] = {
+		{ " ZD", 250 },
+		{ " ZD", 250 },
+		{ " ZD", 250 },
+		{ "KZD", 250 },
+		{ NULL, 0 }
+	};
+	/* 2 chunks may be in flight, the replies are only read when needed */
+	const unsigned int written[] = { 2, 3, 4, 4 };
+	/* replies that are already there are read immediately */
+	const unsigned int written_pending[] = { 1, 2, 3, 4 };
+	int ret = 0;
+
+	smtpext = esmtp_pipelining;
+	chunkwindow = 2;
+	testcase_setup_netnwrite(test_netnwrite);
+	testcase_setup_data_pending(test_data_pending);
+
+	for (int i = 0; i < 2; i++) {
+		msgdata = "abcdefghij";
+		msgsize = strlen(msgdata);
+		may_log_count = 0;
+		chunksize = 18;
+		write_msg_index = 0;
+		write_msgs = netmsgs;
+		checkreply_index = 0;
+		checkreply_msgs = chrmsgs;
+		checkreply_written = (i == 0) ? written : written_pending;
+		pending_result = i;
+
+		send_bdat(0);
+
+		if (checkreply_msgs[checkreply_index].status != NULL) {
+			fprintf(stderr, "%s: not all replies were read in round %i\n", __func__, i);
+			ret++;
+		}
+	}
+
+	smtpext = 0;
+	checkreply_written = NULL;
+
+	return ret;
+}
+
+static void
+test_pipelined_shutdown(const enum conn_shutdown_type sdtype __attribute__((unused)))
+{
+	if (checkreply_msgs[checkreply_index].status != NULL) {
+		fprintf(stderr, "not all replies were read before QUIT\n");
+		exit(EINVAL);
+	}
+	if (write_msgs[write_msg_index] != NULL) {
+		fprintf(stderr, "not all calls to netnwrite() were done\n");
+		exit(EINVAL);
+	}
+}
+
+static int
+test_pipelined_fail(void)
+{
+	const char *netmsgs[] = {
+		"BDAT 3\r\nabc",
+		"BDAT 3\r\ndef",
+		"BDAT 3\r\nghi",
+		"BDAT 1 LAST\r\nj",
+		NULL
+	};
+	/* the replies of the chunks after the failed one are consumed silently */
+	const struct checkreply_data chrmsgs[] = {
+		{ " ZD", 250 },
+		{ " ZD", 452 },
+		{ "-", 503 },
+		{ "-", 503 },
+		{ NULL, 0 }
+	};
+	/* no reply is needed before the window is full */
+	const unsigned int written[] = { 4, 4, 4, 4 };
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "%s: fork() failed\n", __func__);
+		return 1;
+	}
+
+	if (pid == 0) {
+		msgdata = "abcdefghij";
+		msgsize = strlen(msgdata);
+		may_log_count = 0;
+		chunksize = 18;
+		write_msg_index = 0;
+		write_msgs = netmsgs;
+		checkreply_index = 0;
+		checkreply_msgs = chrmsgs;
+		checkreply_written = written;
+		smtpext = esmtp_pipelining;
+		chunkwindow = 4;
+		pending_result = 0;
+
+		testcase_setup_netnwrite(test_netnwrite);
+		testcase_setup_data_pending(test_data_pending);
+		testcase_setup_net_conn_shutdown(test_pipelined_shutdown);
+
+		send_bdat(0);
+
+		fprintf(stderr, "%s: send_bdat() should not have returned\n", __func__);
+		exit(1);
+	}
+
+	if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "%s: child failed\n", __func__);
+		return 1;
+	}
+
+	return 0;
+}
+
 int
 main(void)
 {
@@ -400,6 +549,8 @@ main(void)
 	ret += test_wrap_single_line();
 	ret += test_wrap_multi_lines();
 	ret += test_newline_crlf_errors();
+	ret += test_pipelined();
+	ret += test_pipelined_fail();
 
 	if (ret != 0) {
 		fprintf(stderr, "%i errors before calling final test\n", ret);
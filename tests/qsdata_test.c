@@ -462,6 +462,26 @@ check_msgbody(const char *expect)
 	return 0;
 }
 
+/**
+ * @brief check that nothing was sent to qmail-queue
+ */
+static int
+check_msgbody_empty(void)
+{
+	char c;
+	const ssize_t r = read(queuefd_data_recv, &c, 1);
+
+	if (r > 0) {
+		fprintf(stderr, "data of a rejected message was sent to qmail-queue\n");
+		return 1;
+	} else if ((r < 0) && (errno != EAGAIN)) {
+		fprintf(stderr, "read failed with error %i\n", errno);
+		return 5;
+	}
+
+	return 0;
+}
+
 static int
 check_queueheader(void)
 {
@@ -638,7 +658,7 @@ check_queueheader(void)
 
 		printf("%s: Running test: %s\n", __func__, testname);
 
-		if (write_received(chunked)) {
+		if (write_received(chunked) || queue_flush()) {
 			err = 4;
 			break;
 		}
@@ -943,8 +963,7 @@ check_data_body(void)
 	const char *dotline[] = { "..", "...", "....", ".", NULL };
 	const char *delivered[] = { "Delivered-To: test@example.com", ".", NULL };
 	const char *received_ofl[MAXHOPS + 3];
-	char rcvdbuf[strlen(RCVDHDR) + MAXHOPS * (strlen(RCVDDUMMYLINE) + 1) + 16];
-	char rcvdbuf_body[sizeof(rcvdbuf) + 4];
+	char rcvdbuf_body[strlen(RCVDHDR) + MAXHOPS * (strlen(RCVDDUMMYLINE) + 1) + 20];
 	struct {
 		const char *name;
 		const char *data_expect;
@@ -1040,8 +1059,6 @@ check_data_body(void)
 		},
 		{
 			.name = "message too big",
-			.data_expect = RCVDHDR
-				FOOHDR,
 			.logmsg = "rejected message to <test@example.com> from <foo@example.com> from IP [::ffff:192.0.2.24] (27 bytes) {message too big}",
 			.netmsg = FOOLINE,
 			.netmsg_more = dotline,
@@ -1051,9 +1068,6 @@ check_data_body(void)
 		},
 		{
 			.name = "822 missing From:",
-			.data_expect = RCVDHDR
-				FOOHDR
-				"Date: Wed, 11 Apr 2012 18:32:17 +0200\n",
 			.netmsg = FOOLINE,
 			.netmsg_more = date_hdr,
 			.netwrite_msg = "550 5.6.0 message does not comply to RfC2822: 'From:' missing\r\n",
@@ -1065,9 +1079,6 @@ check_data_body(void)
 		},
 		{
 			.name = "822 missing Date:",
-			.data_expect = RCVDHDR
-				FOOHDR
-				"From: <foo@example.com>\n",
 			.netmsg = FOOLINE,
 			.netmsg_more = from_hdr,
 			.netwrite_msg = "550 5.6.0 message does not comply to RfC2822: 'Date:' missing\r\n",
@@ -1079,9 +1090,6 @@ check_data_body(void)
 		},
 		{
 			.name = "822 duplicate From:",
-			.data_expect = RCVDHDR
-				FOOHDR
-				"From: <foo@example.com>\n",
 			.netmsg = FOOLINE,
 			.netmsg_more = from2_hdr,
 			.netwrite_msg = "550 5.6.0 message does not comply to RfC2822: more than one 'From:'\r\n",
@@ -1093,9 +1101,6 @@ check_data_body(void)
 		},
 		{
 			.name = "822 duplicate Date:",
-			.data_expect = RCVDHDR
-				FOOHDR
-				"Date: Wed, 11 Apr 2012 18:32:17 +0200\n",
 			.netmsg = FOOLINE,
 			.netmsg_more = date2_hdr,
 			.netwrite_msg = "550 5.6.0 message does not comply to RfC2822: more than one 'Date:'\r\n",
@@ -1107,7 +1112,6 @@ check_data_body(void)
 		},
 		{
 			.name = "8bit data in header",
-			.data_expect = RCVDHDR,
 			.netmsg = body8bit[3],
 			.netwrite_msg = "550 5.6.0 message does not comply to RfC2822: 8bit character in message header\r\n",
 			.logmsg = "rejected message to <test@example.com> from <foo@example.com> from IP [::ffff:192.0.2.24] (3 bytes) {8bit-character in message header}",
@@ -1118,10 +1122,6 @@ check_data_body(void)
 		},
 		{
 			.name = "8bit data in body",
-			.data_expect = RCVDHDR
-				FOOHDR
-				"Date: Wed, 11 Apr 2012 18:32:17 +0200\n"
-				"From: <foo@example.com>\n\n",
 			.netmsg = FOOLINE,
 			.netmsg_more = body8bit,
 			.netwrite_msg = "550 5.6.0 message contains 8bit characters\r\n",
@@ -1133,7 +1133,6 @@ check_data_body(void)
 		},
 		{
 			.name = "too many received lines",
-			.data_expect = rcvdbuf,
 			.netmsg = RCVDDUMMYLINE,
 			.netmsg_more = received_ofl,
 			.netwrite_msg = "554 5.4.6 too many hops, this message is looping\r\n",
@@ -1144,7 +1143,6 @@ check_data_body(void)
 		},
 		{
 			.name = "Delivered-To: loop",
-			.data_expect = RCVDHDR,
 			.netmsg = delivered[0],
 			.netmsg_more = twolines,
 			.netwrite_msg = "554 5.4.6 message is looping, found a \"Delivered-To:\" line with one of the recipients\r\n",
@@ -1186,11 +1184,9 @@ check_data_body(void)
 	strncpy(xmitstat.remoteip, "::ffff:192.0.2.24", sizeof(xmitstat.remoteip));
 
 	int r;
-	snprintf(rcvdbuf, sizeof(rcvdbuf), "%s", RCVDHDR);
-	snprintf(rcvdbuf_body, sizeof(rcvdbuf), "%s\n", RCVDHDR);
+	snprintf(rcvdbuf_body, sizeof(rcvdbuf_body), "%s\n", RCVDHDR);
 	for (r = 0; r < MAXHOPS; r++) {
 		received_ofl[r] = RCVDDUMMYLINE;
-		strcat(rcvdbuf, RCVDDUMMYLINE "\n");
 		strcat(rcvdbuf_body, RCVDDUMMYLINE "\n");
 	}
 	received_ofl[r++] = "";
@@ -1248,8 +1244,13 @@ check_data_body(void)
 		if (r != testdata[idx].data_result)
 			ret++;
 
-		if (check_msgbody(testdata[idx].data_expect) != 0)
+		/* rejected messages never reach qmail-queue */
+		if (testdata[idx].data_expect == NULL) {
+			if (check_msgbody_empty() != 0)
+				ret++;
+		} else if (check_msgbody(testdata[idx].data_expect) != 0) {
 			ret++;
+		}
 
 		if (testcase_netnwrite_check(testdata[idx].name)) {
 			ret++;
@@ -1360,6 +1361,126 @@ check_data_read_fails(void)
 	return ret;
 }
 
+#define BENCH_LINE_LEN 78
+static unsigned long bench_lines;
+
+// generate a message with a single header line and bench_lines body lines
+static int
+bench_net_read(const int fatal)
+{
+	static unsigned long line;
+
+	if (fatal != 1)
+		abort();
+
+	if (line == 0) {
+		strcpy(linein.s, "Subject: benchmark");
+	} else if (line == 1) {
+		linein.s[0] = '\0';
+	} else if (line < bench_lines + 2) {
+		memset(linein.s, 'a', BENCH_LINE_LEN);
+		linein.s[BENCH_LINE_LEN] = '\0';
+	} else {
+		strcpy(linein.s, ".");
+		line = 0;
+		linein.len = 1;
+		return 0;
+	}
+	linein.len = strlen(linein.s);
+	line++;
+
+	return 0;
+}
+
+/**
+ * @brief read the number of write syscalls done by this process so far
+ * @return number of write syscalls
+ * @retval -1 the information is not available
+ */
+static long long
+read_syscw(void)
+{
+	FILE *f = fopen("/proc/self/io", "r");
+	char buf[64];
+	long long ret = -1;
+
+	if (f == NULL)
+		return -1;
+
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		if (strncmp(buf, "syscw: ", strlen("syscw: ")) == 0) {
+			ret = strtoll(buf + strlen("syscw: "), NULL, 10);
+			break;
+		}
+	}
+
+	fclose(f);
+
+	return ret;
+}
+
+// count the write() calls needed to send a message to the queue
+static int
+check_data_syscalls(void)
+{
+	const unsigned long bench_size = 1024 * 1024;
+	int ret = 0;
+
+	printf("%s\n", __func__);
+
+	if (read_syscw() < 0) {
+		printf("%s: /proc/self/io not available, skipping\n", __func__);
+		return 0;
+	}
+
+	bench_lines = bench_size / (BENCH_LINE_LEN + 2);
+
+	testcase_setup_net_read(bench_net_read);
+	goodrcpt = 1;
+	relayclient = 1;
+	queue_init_result = 0;
+	pass_354 = 1;
+	maxbytes = 2 * bench_size;
+	xmitstat.check2822 = 0;
+	submission_mode = 0;
+	expect_queue_chunked = 0;
+	expect_queue_envelope = strlen("Subject: benchmark") + 2 + 2 + bench_lines * (BENCH_LINE_LEN + 2);
+	queuefd_data = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (queuefd_data < 0)
+		return 1;
+
+	setup_recip();
+
+	fflush(stdout);
+	fflush(stderr);
+
+	const long long before = read_syscw();
+	int r = smtp_data();
+	const long long writes = read_syscw() - before;
+
+	if (r != 0)
+		ret++;
+	if (expect_queue_envelope != (unsigned long)-1)
+		ret++;
+
+	printf("%s: %lld write() calls for %lu bytes of message data (%.1f per MiB)\n", __func__,
+			writes, bench_size, (double)writes * 1024 * 1024 / bench_size);
+
+	/* everything should go out in buffer sized blocks, allow a few more for the Received: line */
+	if (writes > (long long)(bench_size / QUEUEBUF_SIZE) + 4) {
+		fprintf(stderr, "%s: too many write() calls: %lld\n", __func__, writes);
+		ret++;
+	}
+
+	if (queuefd_data >= 0)
+		close(queuefd_data);
+	queuefd_data = -1;
+	freedata();
+	testcase_setup_net_read(testcase_net_read_simple);
+
+	return ret;
+}
+
 static int
 check_bdat_no_rcpt(void)
 {
@@ -1631,7 +1752,8 @@ check_bdat_readerror(void)
 	if (comstate != 0x0800)
 		ret++;
 
-	if (check_msgbody(RCVDHDRCHUNKED) != 0)
+	/* the Received: line was only buffered and must be dropped with the message */
+	if (check_msgbody_empty() != 0)
 		ret++;
 
 	if (testcase_netnwrite_check(__func__))
@@ -2073,6 +2195,7 @@ main()
 	ret += check_data_354_fail();
 
 	testcase_setup_net_read(testcase_net_read_simple);
+	testcase_setup_net_readbody(testcase_net_readbody_lines);
 	testcase_setup_log_writen(testcase_log_writen_combine);
 	testcase_setup_log_write(testcase_log_write_compare);
 
@@ -2081,6 +2204,7 @@ main()
 	ret += check_data_body();
 
 	ret += check_data_read_fails();
+	ret += check_data_syscalls();
 
 	ssl = NULL;
 
@@ -66,6 +66,7 @@ test_ask_dnsaaaa(const char *domain, struct in6_addr **ips)
 
 static unsigned int targetport = 0;
 static unsigned long expectedport;
+static unsigned long expectedpool;
 static struct in6_addr expectedrip;
 static struct in6_addr expectedoip = IN6ADDR_ANY_INIT;
 static struct in6_addr expectedoip6 = IN6ADDR_ANY_INIT;
@@ -89,6 +90,11 @@ verify_route(void)
 		return 1;
 	}
 
+	if ((unsigned long)poolroute != expectedpool) {
+		fprintf(stderr, "expected pool flag %lu, but got %i\n", expectedpool, poolroute);
+		return 1;
+	}
+
 	if (strcmp(expected_cert, clientcertname) != 0) {
 		fprintf(stderr, "expected cert name %s, but got %s\n", expected_cert, clientcertname);
 		return 4;
@@ -175,6 +181,11 @@ main(void)
 		return EFAULT;
 	}
 
+	if (loadintfd(open("expected_pool", O_RDONLY | O_CLOEXEC), &expectedpool, 0) != 0) {
+		fprintf(stderr, "error loading the expected pool flag");
+		return EFAULT;
+	}
+
 	r = loadip("expected_ip", &ipexpect, &ipe_len, &expectedrip);
 	if (r == 0)
 		loadip("expected_outip", &outipexpect, &oipe_len, &expectedoip);
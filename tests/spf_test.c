@@ -306,8 +306,8 @@ dns_resolve_txt(char **out, const char *host, const enum dnstype stype)
 	return 0;
 }
 
-int
-dnstxt(char **out, const char *host)
+static int
+test_ask_dnstxt(char **out, const char *host)
 {
 	return dns_resolve_txt(out, host, DNSTYPE_TXT);
 }
@@ -3918,6 +3918,7 @@ int main(int argc, char **argv)
 	testcase_setup_ask_dnsaaaa(test_ask_dnsaaaa);
 	testcase_setup_ask_dnsmx(test_ask_dnsmx);
 	testcase_setup_ask_dnsname(test_ask_dnsname);
+	testcase_setup_ask_dnstxt(test_ask_dnstxt);
 
 	if (argc != 2)
 		return EINVAL;
@@ -0,0 +1,256 @@
+/** \file tarpitd_test.c
+ \brief testcases for the event loop of the tarpit daemon
+ */
+
+#include <qsmtpd/tarpitd.h>
+#include "test_io/testcase_io.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char badseq[] = "503 5.5.1 Bad sequence of commands\r\n";
+static const char quitmsg[] = "221 2.0.0 test.example.com service closing transmission channel\r\n";
+static unsigned int logcount;
+static unsigned int invalidcount;
+
+static void
+test_log_write(int priority, const char *s)
+{
+	if ((priority == LOG_INFO) && (strcmp(s, "dropped connection from [::ffff:192.0.2.4] {too many bad commands}") == 0)) {
+		logcount++;
+		return;
+	}
+	if ((priority == LOG_WARNING) && (strcmp(s, "invalid handoff message received") == 0)) {
+		invalidcount++;
+		return;
+	}
+
+	fprintf(stderr, "unexpected log message %i: %s\n", priority, s);
+}
+
+/**
+ * @brief hand a new connection to the event loop
+ * @param hdr the header of the handoff message
+ * @param input the input not yet processed by Qsmtpd
+ * @return the client end of the connection, -1 on error
+ */
+static int
+handoff(struct tarpit_handoff *hdr, const char *input)
+{
+	int ctl[2];
+	int conn[2];
+	struct iovec iov[2];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, ctl) != 0)
+		return -1;
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, conn) != 0)
+		return -1;
+	if (tarpitd_add(ctl[1]) != 0)
+		return -1;
+
+	strcpy(hdr->remoteip, "::ffff:192.0.2.4");
+	hdr->inputlen = strlen(input);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(*hdr);
+	iov[1].iov_base = (void *)input;
+	iov[1].iov_len = hdr->inputlen;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &conn[1], sizeof(int));
+
+	if (sendmsg(ctl[0], &msg, 0) != (ssize_t)(sizeof(*hdr) + hdr->inputlen))
+		return -1;
+
+	/* the daemon now owns the only other references */
+	close(ctl[0]);
+	close(conn[1]);
+
+	return conn[0];
+}
+
+/**
+ * @brief run the event loop until the expected data was received
+ * @param client the client end of the connection
+ * @param expect the expected data
+ * @param maxwait how many seconds to wait at most
+ * @param closed if the connection must be closed afterwards
+ * @return 0 if the expected data was received
+ */
+static int
+expect_data(const int client, const char *expect, const time_t maxwait, const int closed)
+{
+	const time_t end = time(NULL) + maxwait;
+	char buf[1024];
+	size_t len = 0;
+	int eof = 0;
+
+	while ((time(NULL) <= end) && !eof && ((len < strlen(expect)) || closed)) {
+		ssize_t r;
+
+		if (tarpitd_step(100) != 0) {
+			fprintf(stderr, "tarpitd_step() failed: %i\n", errno);
+			return 1;
+		}
+
+		r = recv(client, buf + len, sizeof(buf) - len - 1, MSG_DONTWAIT);
+		if (r == 0)
+			eof = 1;
+		else if (r > 0)
+			len += r;
+	}
+	buf[len] = '\0';
+
+	if (strcmp(buf, expect) != 0) {
+		fprintf(stderr, "expected:\n%sreceived:\n%s\n", expect, buf);
+		return 1;
+	}
+	if (closed && !eof) {
+		fprintf(stderr, "connection was not closed\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief input already read by Qsmtpd is handled first, every command is
+ * answered without delay like in wait_for_quit()
+ */
+static int
+test_input(void)
+{
+	struct tarpit_handoff hdr = {
+		.version = TARPIT_VERSION
+	};
+	const int client = handoff(&hdr, "NOOP\r\nQU");
+	char expect[256];
+	int err = 0;
+
+	if (client < 0) {
+		fprintf(stderr, "%s: cannot hand off connection\n", __func__);
+		return 1;
+	}
+
+	err += expect_data(client, badseq, 1, 0);
+
+	/* the rest of the partial command, QUIT with arguments is a bad command */
+	if (send(client, "IT now\r\nquit\r\n", 14, 0) != 14) {
+		fprintf(stderr, "%s: cannot send QUIT\n", __func__);
+		err++;
+	}
+	snprintf(expect, sizeof(expect), "%s%s", badseq, quitmsg);
+	err += expect_data(client, expect, 1, 1);
+	close(client);
+
+	return err;
+}
+
+static int
+test_badcmds(void)
+{
+	struct tarpit_handoff hdr = {
+		.version = TARPIT_VERSION,
+		.badcmds = 1
+	};
+	const int client = handoff(&hdr, "");
+	char expect[512] = "";
+	int err = 0;
+
+	if (client < 0) {
+		fprintf(stderr, "%s: cannot hand off connection\n", __func__);
+		return 1;
+	}
+
+	/* the limit includes the bad commands seen by Qsmtpd */
+	for (unsigned int i = 0; i < 6; i++) {
+		if (send(client, "RCPT TO:<foo@example.com>\r\n", 27, 0) != 27) {
+			fprintf(stderr, "%s: cannot send command\n", __func__);
+			err++;
+		}
+	}
+	for (unsigned int i = 0; i < 5; i++)
+		strcat(expect, badseq);
+	strcat(expect, "550-5.7.1 too many bad commands\r\n550 5.7.1 die slow and painful\r\n");
+
+	err += expect_data(client, expect, 2, 1);
+	close(client);
+
+	if (logcount != 1) {
+		fprintf(stderr, "%s: dropping the connection was logged %u times\n", __func__, logcount);
+		err++;
+	}
+
+	return err;
+}
+
+static int
+test_invalid(void)
+{
+	struct tarpit_handoff hdr = {
+		.version = TARPIT_VERSION + 1
+	};
+	const int client = handoff(&hdr, "250 ok\r\n");
+	int err;
+
+	if (client < 0) {
+		fprintf(stderr, "%s: cannot hand off connection\n", __func__);
+		return 1;
+	}
+
+	err = expect_data(client, "", 2, 1);
+	close(client);
+
+	if (invalidcount != 1) {
+		fprintf(stderr, "%s: the invalid message was logged %u times\n", __func__, invalidcount);
+		err++;
+	}
+
+	return err;
+}
+
+int
+main(void)
+{
+	int err = 0;
+
+	testcase_setup_log_write(test_log_write);
+	testcase_setup_log_writen(testcase_log_writen_combine);
+
+	if (tarpitd_init(-1, "test.example.com", 10) != 0) {
+		fprintf(stderr, "cannot set up event loop\n");
+		return 1;
+	}
+
+	err += test_input();
+	err += test_badcmds();
+	err += test_invalid();
+
+	if (tarpitd_connections() != 0) {
+		fprintf(stderr, "%u connections left after tests\n", tarpitd_connections());
+		err++;
+	}
+
+	return err;
+}
@@ -20,6 +20,7 @@ TC_SETUP(net_write_multiline);
 TC_SETUP(netnwrite);
 TC_SETUP(net_readbin);
 TC_SETUP(net_readline);
+TC_SETUP(net_readbody);
 TC_SETUP(data_pending);
 TC_SETUP(net_conn_shutdown);
 
@@ -34,6 +35,7 @@ TC_SETUP(ask_dnsmx);
 TC_SETUP(ask_dnsaaaa);
 TC_SETUP(ask_dnsa);
 TC_SETUP(ask_dnsname);
+TC_SETUP(ask_dnstxt);
 
 void
 qs_backtrace(void)
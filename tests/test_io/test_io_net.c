@@ -25,6 +25,19 @@ net_read(const int fatal)
 	return testcase_net_read(fatal);
 }
 
+int
+net_readview(cstring *line, const int fatal)
+{
+	const int r = net_read(fatal);
+
+	if (r == 0) {
+		line->s = linein.s;
+		line->len = linein.len;
+	}
+
+	return r;
+}
+
 int
 testcase_net_read_simple(const int fatal)
 {
@@ -248,6 +261,43 @@ tc_ignore_net_readline(size_t a __attribute__((unused)), char *b __attribute__((
 	return 0;
 }
 
+size_t
+net_readbody(const char **a, size_t *b)
+{
+	ASSERT_CALLBACK(testcase_net_readbody);
+
+	return testcase_net_readbody(a, b);
+}
+
+size_t
+tc_ignore_net_readbody(const char **a __attribute__((unused)), size_t *b __attribute__((unused)))
+{
+	return 0;
+}
+
+size_t
+testcase_net_readbody_lines(const char **data, size_t *lines)
+{
+	static char bodybuf[TESTIO_MAX_LINELEN + 1];
+
+	*data = bodybuf;
+	*lines = 0;
+
+	if (net_read(1) != 0)
+		return -1;
+
+	if ((linein.len == 1) && (linein.s[0] == '.'))
+		return 0;
+
+	const size_t offset = (linein.s[0] == '.') ? 1 : 0;
+
+	memcpy(bodybuf, linein.s + offset, linein.len - offset);
+	bodybuf[linein.len - offset] = '\n';
+	*lines = 1;
+
+	return linein.len - offset + 1;
+}
+
 int
 data_pending(void)
 {
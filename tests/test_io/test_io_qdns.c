@@ -48,6 +48,30 @@ tc_ignore_ask_dnsa(const char *a __attribute__ ((unused)), struct in6_addr **b _
 	return 0;
 }
 
+/*
+ * Emulate the parallel lookup using the ask_dnsa() callback, the names are
+ * queried in order until the first match or local error like the real
+ * implementation would report them.
+ */
+int
+ask_dnsa_parallel(const char *const *names, const unsigned int count, int *results)
+{
+	unsigned int i = 0;
+
+	while (i < count) {
+		const int r = ask_dnsa(names[i], NULL);
+
+		results[i++] = r;
+		if ((r > 0) || (r == DNS_ERROR_LOCAL))
+			break;
+	}
+
+	while (i < count)
+		results[i++] = DNS_ERROR_TEMP;
+
+	return 0;
+}
+
 int
 ask_dnsname(const struct in6_addr *a, char **b)
 {
@@ -61,3 +85,31 @@ tc_ignore_ask_dnsname(const struct in6_addr *a __attribute__ ((unused)), char **
 {
 	return 0;
 }
+
+int
+ask_dnstxt(char **a, const char *b)
+{
+	ASSERT_CALLBACK(testcase_ask_dnstxt);
+
+	return testcase_ask_dnstxt(a, b);
+}
+
+int
+tc_ignore_ask_dnstxt(char **a, const char *b __attribute__ ((unused)))
+{
+	*a = NULL;
+	return 0;
+}
+
+/* the stubs do not cache anything */
+void
+dnscache_stats(unsigned long *hits, unsigned long *misses)
+{
+	*hits = 0;
+	*misses = 0;
+}
+
+void
+dnscache_clear(void)
+{
+}
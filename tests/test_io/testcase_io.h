@@ -100,6 +100,19 @@ DECLARE_TC_SETUP(net_readbin);
 typedef size_t (func_net_readline)(size_t, char *);
 DECLARE_TC_SETUP(net_readline);
 
+typedef size_t (func_net_readbody)(const char **, size_t *);
+DECLARE_TC_SETUP(net_readbody);
+
+/**
+ * @brief simple helper for net_readbody()
+ *
+ * This function may be passed to testcase_setup_net_readbody() to get the
+ * message body from net_read(). Every line returned from there is passed to
+ * the caller as a single block of data, until a line containing only a '.'
+ * is found.
+ */
+extern size_t testcase_net_readbody_lines(const char **data, size_t *lines);
+
 typedef int (func_data_pending)(void);
 DECLARE_TC_SETUP(data_pending);
 
@@ -164,4 +177,7 @@ DECLARE_TC_SETUP(ask_dnsa);
 typedef int (func_ask_dnsname)(const struct in6_addr *, char **);
 DECLARE_TC_SETUP(ask_dnsname);
 
+typedef int (func_ask_dnstxt)(char **, const char *);
+DECLARE_TC_SETUP(ask_dnstxt);
+
 #endif /* _TESTCASE_IO_P_H */
@@ -17,6 +17,7 @@ DECLARE_TC_PTR(net_write_multiline);
 DECLARE_TC_PTR(netnwrite);
 DECLARE_TC_PTR(net_readbin);
 DECLARE_TC_PTR(net_readline);
+DECLARE_TC_PTR(net_readbody);
 DECLARE_TC_PTR(data_pending);
 DECLARE_TC_PTR(net_conn_shutdown);
 
@@ -31,6 +32,7 @@ DECLARE_TC_PTR(ask_dnsmx);
 DECLARE_TC_PTR(ask_dnsaaaa);
 DECLARE_TC_PTR(ask_dnsa);
 DECLARE_TC_PTR(ask_dnsname);
+DECLARE_TC_PTR(ask_dnstxt);
 
 #define ASSERT_CALLBACK(a) \
 	do { \
@@ -0,0 +1,611 @@
+#include <control.h>
+#include <diropen.h>
+#include <log.h>
+#include <netio.h>
+#include <qsmtpd/qsmtpd.h>
+#include <qsmtpd/starttls.h>
+#include <qsmtpd/tlstickets.h>
+#include <qremote/qremote.h>
+#include <qremote/starttlsr.h>
+#include <tls.h>
+
+#include <dirent.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct xmitstat xmitstat;
+char certfilename[] = "control/servercert.pem";
+char *partner_fqdn = "testcert.example.org";
+char *rhost = "testcert.example.org";
+int socketd;
+
+int
+checkaddr(const char *const a __attribute__((unused)))
+{
+	return 0;
+}
+
+void
+log_writen(int priority, const char **s)
+{
+	unsigned int pos = 0;
+
+	printf("SERVER: log(%i, ", priority);
+	while (s[pos] != NULL)
+		printf("%s", s[pos++]);
+	printf(")\n");
+}
+
+void
+log_write(int priority, const char *s)
+{
+	const char *msg[] = { s, NULL };
+	log_writen(priority, msg);
+}
+
+void
+err_mem(const int doquit __attribute__ ((unused)))
+{
+	abort();
+}
+
+void
+err_conf(const char *m)
+{
+	fprintf(stderr, "err_conf(%s) called\n", m);
+	exit(1);
+}
+
+void
+net_conn_shutdown(const enum conn_shutdown_type sd_type __attribute__ ((unused)))
+{
+	fprintf(stderr, "net_conn_shutdown() called\n");
+	exit(1);
+}
+
+void
+write_status(const char *str)
+{
+	printf("CLIENT: status %s\n", str);
+}
+
+void
+write_status_m(const char **strs, const unsigned int count)
+{
+	printf("CLIENT: status ");
+	for (unsigned int i = 0; i < count; i++)
+		printf("%s", strs[i]);
+	printf("\n");
+}
+
+void
+quitmsg(void)
+{
+}
+
+void
+sync_pipelining(void)
+{
+}
+
+int
+err_control2(const char *a __attribute__ ((unused)), const char *b __attribute__ ((unused)))
+{
+	abort();
+}
+
+static const char query[] = "ping";
+static const char answer[] = "250 pong";
+
+/**
+ * @brief the server side of a connection, run in a separate process like Qsmtpd
+ */
+static int
+server(const int sd)
+{
+	char buf[16];
+	const char stls[] = "STARTTLS\r\n";
+	const char *pong[] = { answer, NULL };
+
+	if (dup2(sd, 0) != 0) {
+		fprintf(stderr, "server: cannot move socket to fd 0: %i\n", errno);
+		return 1;
+	}
+	socketd = sd;
+
+	memset(buf, 0, sizeof(buf));
+	if ((read(socketd, buf, sizeof(buf)) != (ssize_t)strlen(stls)) || (strcmp(buf, stls) != 0)) {
+		fprintf(stderr, "server: did not receive STARTTLS command\n");
+		return 1;
+	}
+
+	xmitstat.esmtp = 1;
+	if (smtp_starttls() != 0) {
+		fprintf(stderr, "server: smtp_starttls() failed\n");
+		return 1;
+	}
+
+	if ((net_read(0) != 0) || (strcmp(linein.s, query) != 0)) {
+		fprintf(stderr, "server: did not receive the query\n");
+		return 1;
+	}
+
+	if (net_writen(pong) != 0)
+		return 1;
+
+	ssl_free(ssl);
+	ssl = NULL;
+
+	return 0;
+}
+
+/**
+ * @brief read a line from the unencrypted connection
+ */
+static int
+read_plain(const int sd, char *buf, const size_t len)
+{
+	size_t pos = 0;
+
+	while (pos < len - 1) {
+		if (read(sd, buf + pos, 1) != 1)
+			return -1;
+		if (buf[pos++] == '\n')
+			break;
+	}
+	buf[pos] = '\0';
+
+	return 0;
+}
+
+/**
+ * @brief do one STARTTLS connection to a new server process
+ * @param cctx the client context
+ * @param sess the session to resume, the new session is returned here
+ * @param expect_resumed if the session is expected to be resumed
+ * @param expect_ticket if a new ticket is expected, -1 if this is not checked
+ * @return number of errors
+ */
+static int
+connect_once(SSL_CTX *cctx, SSL_SESSION **sess, const int expect_resumed, const int expect_ticket)
+{
+	int sockets[2];
+	char buf[64];
+	SSL *c;
+	int status = -1;
+	int ret = 0;
+	pid_t child;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+		fprintf(stderr, "cannot create socket pair: %i\n", errno);
+		return 1;
+	}
+
+	fflush(stdout);
+	child = fork();
+	if (child < 0) {
+		fprintf(stderr, "cannot fork: %i\n", errno);
+		close(sockets[0]);
+		close(sockets[1]);
+		return 1;
+	} else if (child == 0) {
+		close(sockets[1]);
+		exit(server(sockets[0]));
+	}
+
+	close(sockets[0]);
+
+	if ((write(sockets[1], "STARTTLS\r\n", 10) != 10) ||
+			(read_plain(sockets[1], buf, sizeof(buf)) != 0) ||
+			(strncmp(buf, "220 ", 4) != 0)) {
+		fprintf(stderr, "client: STARTTLS was not accepted\n");
+		close(sockets[1]);
+		waitpid(child, &status, 0);
+		return 1;
+	}
+
+	c = SSL_new(cctx);
+	if ((c == NULL) || (SSL_set_fd(c, sockets[1]) != 1) ||
+			((*sess != NULL) && (SSL_set_session(c, *sess) != 1)) ||
+			(SSL_connect(c) != 1)) {
+		fprintf(stderr, "client: handshake failed\n");
+		ret++;
+	} else {
+		int l;
+
+		if ((SSL_write(c, "ping\r\n", 6) != 6) ||
+				((l = SSL_read(c, buf, sizeof(buf) - 1)) <= 0)) {
+			fprintf(stderr, "client: exchanging data failed\n");
+			ret++;
+		} else {
+			buf[l] = '\0';
+			if (strcmp(buf, "250 pong\r\n") != 0) {
+				fprintf(stderr, "client: got '%s' instead of the answer\n", buf);
+				ret++;
+			}
+		}
+
+		if (SSL_session_reused(c) != expect_resumed) {
+			fprintf(stderr, "client: session was %sresumed\n", expect_resumed ? "not " : "");
+			ret++;
+		}
+
+		if (*sess != NULL)
+			SSL_SESSION_free(*sess);
+		*sess = SSL_get1_session(c);
+#if (OPENSSL_VERSION_NUMBER >= 0x10101000L) && !defined(LIBRESSL_VERSION_NUMBER)
+		if ((expect_ticket >= 0) && (SSL_SESSION_is_resumable(*sess) != expect_ticket)) {
+			fprintf(stderr, "client: %s ticket received\n", expect_ticket ? "no" : "unexpected");
+			ret++;
+		}
+#else
+		(void) expect_ticket;
+#endif
+
+		SSL_shutdown(c);
+	}
+
+	SSL_free(c);
+	close(sockets[1]);
+
+	waitpid(child, &status, 0);
+	if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "server process failed\n");
+		ret++;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief do one STARTTLS connection using the Qremote client code
+ * @param expect_resumed if the session is expected to be resumed
+ * @param expect_init the expected return value of tls_init()
+ * @return number of errors
+ */
+static int
+client_once(const int expect_resumed, const int expect_init)
+{
+	const char *ping[] = { query, NULL };
+	int sockets[2];
+	int status = -1;
+	int ret = 0;
+	pid_t child;
+	int r;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+		fprintf(stderr, "cannot create socket pair: %i\n", errno);
+		return 1;
+	}
+
+	fflush(stdout);
+	child = fork();
+	if (child < 0) {
+		fprintf(stderr, "cannot fork: %i\n", errno);
+		close(sockets[0]);
+		close(sockets[1]);
+		return 1;
+	} else if (child == 0) {
+		close(sockets[1]);
+		exit(server(sockets[0]));
+	}
+
+	close(sockets[0]);
+	if (dup2(sockets[1], 0) != 0) {
+		fprintf(stderr, "client: cannot move socket to fd 0: %i\n", errno);
+		close(sockets[1]);
+		waitpid(child, &status, 0);
+		return 1;
+	}
+	socketd = sockets[1];
+
+	r = tls_init();
+	if (r != expect_init) {
+		fprintf(stderr, "client: tls_init() returned %i instead of %i\n", r, expect_init);
+		ret++;
+	} else if (r == 0) {
+		/* the reply is needed to receive the session tickets of TLS 1.3 */
+		if ((net_writen(ping) != 0) || (netget(0) != 250)) {
+			fprintf(stderr, "client: exchanging data failed\n");
+			ret++;
+		}
+
+		if (SSL_session_reused(ssl) != expect_resumed) {
+			fprintf(stderr, "client: session was %sresumed\n", expect_resumed ? "not " : "");
+			ret++;
+		}
+	}
+
+	if (ssl != NULL) {
+		ssl_free(ssl);
+		ssl = NULL;
+	}
+	close(sockets[1]);
+	close(0);
+
+	waitpid(child, &status, 0);
+	/* the server can't finish the session if the client gave up */
+	if ((expect_init == 0) && (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))) {
+		fprintf(stderr, "server process failed\n");
+		ret++;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief count the entries of the client session cache
+ */
+static unsigned int
+cache_entries(void)
+{
+	DIR *dir = opendir("tlssessions");
+	struct dirent *de;
+	unsigned int cnt = 0;
+
+	if (dir == NULL)
+		return 0;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] != '.')
+			cnt++;
+	}
+	closedir(dir);
+
+	return cnt;
+}
+
+/**
+ * @brief copy a file
+ */
+static void
+copy_file(const char *from, const char *to)
+{
+	char buf[8192];
+	ssize_t len;
+	int in = open(from, O_RDONLY);
+	int out = open("copy.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if ((in < 0) || (out < 0) || ((len = read(in, buf, sizeof(buf))) <= 0) ||
+			(write(out, buf, len) != len) || (close(out) != 0) ||
+			(rename("copy.tmp", to) != 0)) {
+		fprintf(stderr, "cannot copy %s to %s: %i\n", from, to, errno);
+		exit(1);
+	}
+	close(in);
+}
+
+/**
+ * @brief write the key file
+ * @param count number of keys
+ * @param first value of the bytes of the first key, the following keys use the next values
+ */
+static void
+write_keys(const unsigned int count, const unsigned char first)
+{
+	struct tls_ticket_key keys[TLSTICKET_MAXKEYS];
+	int fd;
+
+	for (unsigned int i = 0; i < count; i++)
+		memset(keys + i, first + i, sizeof(keys[i]));
+
+	fd = open("control/" TLSTICKET_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if ((fd < 0) || (write(fd, keys, count * sizeof(keys[0])) != (ssize_t)(count * sizeof(keys[0]))) ||
+			(close(fd) != 0) ||
+			(rename("control/" TLSTICKET_FILE ".tmp", "control/" TLSTICKET_FILE) != 0)) {
+		fprintf(stderr, "cannot write key file: %i\n", errno);
+		exit(1);
+	}
+}
+
+/**
+ * @brief CPU time used by a process in microseconds
+ */
+static unsigned long long
+cpu_usec(const int who)
+{
+	struct rusage ru;
+
+	getrusage(who, &ru);
+
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/**
+ * @brief measure the CPU time of full handshakes
+ * @param name description of the setup
+ * @param cctx the client context
+ * @param count number of handshakes
+ * @return number of errors
+ */
+static int
+bench_handshakes(const char *name, SSL_CTX *cctx, const unsigned int count)
+{
+	const unsigned long long server = cpu_usec(RUSAGE_CHILDREN);
+	const unsigned long long client = cpu_usec(RUSAGE_SELF);
+	int err = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		SSL_SESSION *sess = NULL;
+
+		err += connect_once(cctx, &sess, 0, -1);
+		SSL_SESSION_free(sess);
+	}
+
+	printf("%s: server %llu us, client %llu us per handshake\n", name,
+			(cpu_usec(RUSAGE_CHILDREN) - server) / count, (cpu_usec(RUSAGE_SELF) - client) / count);
+
+	return err;
+}
+
+/**
+ * @brief benchmark the CPU time of the STARTTLS handshake
+ * @param count number of handshakes per setup
+ *
+ * Every handshake is done by a new server process like with tcpserver. The
+ * key exchange parameters are first loaded by every server process, like
+ * before, then only once before forking, like in daemon mode. Both are done
+ * with the default key exchange, which is ECDHE, and with DHE forced by the
+ * client.
+ *
+ * The directory must contain control/servercert.pem and control/dh2048.pem,
+ * but no session ticket keys.
+ */
+static int
+benchmark(const unsigned int count)
+{
+	SSL_CTX *ecdhe = SSL_CTX_new(SSLv23_client_method());
+	SSL_CTX *dhe = SSL_CTX_new(SSLv23_client_method());
+	int err = 0;
+
+	if ((ecdhe == NULL) || (dhe == NULL)) {
+		fprintf(stderr, "cannot create client context\n");
+		return 1;
+	}
+
+	/* DHE is only available up to TLS 1.2 */
+#if (OPENSSL_VERSION_NUMBER >= 0x10100000L) && !defined(LIBRESSL_VERSION_NUMBER)
+	SSL_CTX_set_max_proto_version(dhe, TLS1_2_VERSION);
+#endif
+	if (SSL_CTX_set_cipher_list(dhe, "DHE") != 1) {
+		fprintf(stderr, "cannot restrict client to DHE\n");
+		return 1;
+	}
+
+	err += bench_handshakes("ECDHE, parameters loaded per process", ecdhe, count);
+	err += bench_handshakes("DHE, parameters loaded per process", dhe, count);
+
+	tls_load_params();
+
+	err += bench_handshakes("ECDHE, parameters loaded once", ecdhe, count);
+	err += bench_handshakes("DHE, parameters loaded once", dhe, count);
+
+	SSL_CTX_free(ecdhe);
+	SSL_CTX_free(dhe);
+
+	return err;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct tls_stats stats;
+	SSL_SESSION *sess = NULL;
+	SSL_CTX *cctx;
+	sigset_t mask;
+	int err = 0;
+	int fd;
+
+	controldir_fd = get_dirfd(AT_FDCWD, "control");
+	if (controldir_fd < 0) {
+		fprintf(stderr, "cannot open control dir: %i\n", errno);
+		return 1;
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	timeout = 20;
+
+	if ((argc == 3) && (strcmp(argv[1], "-b") == 0)) {
+		const int r = benchmark(strtoul(argv[2], NULL, 10));
+
+		close(controldir_fd);
+		return r;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	memcpy(stats.magic, TLSSTATS_MAGIC, sizeof(TLSSTATS_MAGIC));
+	fd = open(TLSSTATS_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if ((fd < 0) || (write(fd, &stats, sizeof(stats)) != sizeof(stats)) || (close(fd) != 0)) {
+		fprintf(stderr, "cannot write statistics file: %i\n", errno);
+		return 1;
+	}
+
+	cctx = SSL_CTX_new(SSLv23_client_method());
+	if (cctx == NULL) {
+		fprintf(stderr, "cannot create client context\n");
+		return 1;
+	}
+
+	write_keys(1, 'a');
+
+	puts("full handshake, then repeated resumptions");
+	err += connect_once(cctx, &sess, 0, 1);
+	err += connect_once(cctx, &sess, 1, 1);
+	err += connect_once(cctx, &sess, 1, 1);
+
+	puts("the ticket encrypted with the old key is still accepted after rotation");
+	write_keys(2, 'a' - 1);
+	err += connect_once(cctx, &sess, 1, 1);
+	/* this one now uses the ticket encrypted with the new key */
+	write_keys(1, 'a' - 1);
+	err += connect_once(cctx, &sess, 1, 1);
+
+	puts("the ticket is rejected once the key is gone");
+	write_keys(1, 'z');
+	err += connect_once(cctx, &sess, 0, 1);
+	err += connect_once(cctx, &sess, 1, 1);
+
+	puts("no tickets without key file");
+	unlink("control/" TLSTICKET_FILE);
+	err += connect_once(cctx, &sess, 0, 0);
+
+	SSL_SESSION_free(sess);
+	SSL_CTX_free(cctx);
+
+	fd = open(TLSSTATS_FILE, O_RDONLY);
+	if ((fd < 0) || (read(fd, &stats, sizeof(stats)) != sizeof(stats))) {
+		fprintf(stderr, "cannot read statistics file: %i\n", errno);
+		return 1;
+	}
+	close(fd);
+	unlink(TLSSTATS_FILE);
+
+	if ((stats.full != 3) || (stats.resumed != 5)) {
+		fprintf(stderr, "statistics: %lu full and %lu resumed handshakes, expected 3 and 5\n",
+				(unsigned long)stats.full, (unsigned long)stats.resumed);
+		err++;
+	}
+
+	puts("Qremote client: resumption using the session cache");
+	write_keys(1, 'k');
+	mkdir("tlssessions", 0700);
+	mkdir("control/tlshosts", 0755);
+	err += client_once(0, 0);
+	if (cache_entries() != 1) {
+		fprintf(stderr, "client: the session was not stored\n");
+		err++;
+	}
+	err += client_once(1, 0);
+
+	puts("Qremote client: the cached session is dropped when the verification policy changes");
+	copy_file("control/servercert.pem", "control/tlshosts/testcert.example.org.pem");
+	err += client_once(0, 0);
+	err += client_once(1, 0);
+
+	puts("Qremote client: the cached session is dropped when verification fails");
+	copy_file("othercert.pem", "control/tlshosts/testcert.example.org.pem");
+	err += client_once(0, EDONE);
+	if (cache_entries() != 0) {
+		fprintf(stderr, "client: the session was not removed from the cache\n");
+		err++;
+	}
+
+	unlink("control/tlshosts/testcert.example.org.pem");
+	rmdir("control/tlshosts");
+	unlink("control/" TLSTICKET_FILE);
+	rmdir("tlssessions");
+	close(controldir_fd);
+
+	return err;
+}
@@ -235,6 +235,154 @@ test_fork(unsigned int mxindex)
 	return r;
 }
 
+/**
+ * @brief test the bookkeeping of parallel connection attempts
+ *
+ * The first MX refuses the connection, the other two accept it. All attempts
+ * are started at once, the second MX must win and the third one must be left
+ * untouched so it is used on the next call.
+ */
+static int
+test_parallel(void)
+{
+	struct in_addr l4 = {
+		.s_addr = htonl(INADDR_LOOPBACK)
+	};
+	struct in_addr refused4 = {
+		.s_addr = htonl(INADDR_LOOPBACK + 1)
+	};
+	struct in6_addr loopback4 = in_addr_to_v4mapped(&l4);
+	struct in6_addr refused = in_addr_to_v4mapped(&refused4);
+	struct in6_addr accepted[2] = { loopback4, loopback4 };
+	struct ips mx[3] = {
+		{
+			.addr = &refused,
+			.next = mx + 1,
+			.priority = 10,
+			.count = 1
+		},
+		{
+			.addr = accepted,
+			.next = mx + 2,
+			.priority = 20,
+			.count = 1
+		},
+		{
+			.addr = accepted + 1,
+			.priority = 30,
+			.count = 1
+		}
+	};
+	struct sockaddr_in sa = {
+		.sin_family = AF_INET,
+		.sin_addr = l4
+	};
+	socklen_t salen = sizeof(sa);
+	int ret = 0;
+	int sd;
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+
+	if ((s < 0) || (bind(s, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+			(getsockname(s, (struct sockaddr *)&sa, &salen) != 0) || (listen(s, 4) != 0)) {
+		printf("%s: server setup error %i\n", __func__, errno);
+		if (s >= 0)
+			close(s);
+		return 1;
+	}
+	targetport = ntohs(sa.sin_port);
+	connect_delay = 0;
+
+	getrhost_permitted = 1;
+	sd = tryconn(mx, &loopback4, &in6addr_loopback);
+	if (sd < 0) {
+		printf("%s: first tryconn() failed: %i\n", __func__, sd);
+		ret++;
+	} else {
+		close(sd);
+	}
+
+	if ((mx[0].priority != MX_PRIORITY_USED) || (mx[1].priority != MX_PRIORITY_CURRENT) ||
+			(mx[2].priority != 30)) {
+		printf("%s: priorities after first call: %u %u %u\n", __func__,
+				mx[0].priority, mx[1].priority, mx[2].priority);
+		ret++;
+	}
+
+	getrhost_permitted = 1;
+	sd = tryconn(mx, &loopback4, &in6addr_loopback);
+	if (sd < 0) {
+		printf("%s: second tryconn() failed: %i\n", __func__, sd);
+		ret++;
+	} else {
+		close(sd);
+	}
+
+	if ((mx[1].priority != MX_PRIORITY_USED) || (mx[2].priority != MX_PRIORITY_CURRENT)) {
+		printf("%s: priorities after second call: %u %u %u\n", __func__,
+				mx[0].priority, mx[1].priority, mx[2].priority);
+		ret++;
+	}
+
+	sd = tryconn(mx, &loopback4, &in6addr_loopback);
+	if (sd != -ENOENT) {
+		printf("%s: third tryconn() returned %i instead of -ENOENT\n", __func__, sd);
+		if (sd >= 0)
+			close(sd);
+		ret++;
+	}
+
+	close(s);
+
+	return ret;
+}
+
+/**
+ * @brief no connection attempts are started after the deadline
+ */
+static int
+test_deadline(void)
+{
+	struct in_addr l4 = {
+		.s_addr = htonl(INADDR_LOOPBACK)
+	};
+	struct in6_addr loopback4 = in_addr_to_v4mapped(&l4);
+	struct in6_addr addrs[2] = { loopback4, loopback4 };
+	struct ips mx[2] = {
+		{
+			.addr = addrs,
+			.next = mx + 1,
+			.priority = 10,
+			.count = 1
+		},
+		{
+			.addr = addrs + 1,
+			.priority = 20,
+			.count = 1
+		}
+	};
+	const unsigned int oldtimeout = connect_timeout;
+	int ret = 0;
+	int sd;
+
+	connect_timeout = 0;
+	sd = tryconn(mx, &loopback4, &in6addr_loopback);
+	connect_timeout = oldtimeout;
+
+	if (sd != -ETIMEDOUT) {
+		printf("%s: tryconn() returned %i instead of -ETIMEDOUT\n", __func__, sd);
+		if (sd >= 0)
+			close(sd);
+		ret++;
+	}
+
+	if ((mx[0].priority != 10) || (mx[1].priority != 20)) {
+		printf("%s: priorities changed to %u %u\n", __func__, mx[0].priority, mx[1].priority);
+		ret++;
+	}
+
+	return ret;
+}
+
 int
 main(void)
 {
@@ -244,6 +392,8 @@ main(void)
 	r += test_exhausted();
 	for (i = 0; i < 2; i++)
 		r += test_fork(i);
+	r += test_parallel();
+	r += test_deadline();
 
 	return r;
 }
@@ -0,0 +1,298 @@
+#include <qsmtpd/addrparse.h>
+#include <qsmtpd/qsmtpd.h>
+#include <qsmtpd/rcptmap.h>
+#include <qsmtpd/userconf.h>
+#include <qsmtpd/userfilters.h>
+#include <cdb.h>
+#include <control.h>
+#include <diropen.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* to satisfy the linker */
+const char **globalconf;
+
+/* the same results as the vpopmail backend returns for this tree */
+static const struct {
+	const char *email;
+	int result;
+	unsigned int dirs; /* 1 = domainpath, 2 = userpath */
+} users[] = {
+	{
+		.email = "foo@bounce.example.org",
+		.result = 0
+	},
+	{
+		.email = "user@example.org",
+		.result = 1,
+		.dirs = 3
+	},
+	{
+		.email = "user.dot@example.org",
+		.result = 1,
+		.dirs = 3
+	},
+	{
+		.email = "foo.bar@example.org",
+		.result = 1,
+		.dirs = 1
+	},
+	{
+		.email = "baz@example.org",
+		.result = 1,
+		.dirs = 1
+	},
+	{
+		.email = "baz-bar@example.org",
+		.result = 4,
+		.dirs = 1
+	},
+	{
+		.email = "abc-def-ghi@example.org",
+		.result = 4,
+		.dirs = 1
+	},
+	{
+		.email = "bar@example.org",
+		.result = 0
+	},
+	{
+		.email = "bazz@example.org",
+		.result = 0
+	},
+	{
+		.email = "someoneelse@example.org",
+		.result = 0
+	},
+	{
+		.email = "someone@example.org",
+		.result = 1,
+		.dirs = 1
+	},
+	{
+		.email = "baz-bar/foo@example.org",
+		.result = 0
+	},
+	{
+		.email = "foo@default.example.org",
+		.result = 2,
+		.dirs = 1
+	},
+	{
+		.email = "bar@example.net",
+		.result = 5
+	},
+	{
+		.email = "user@bad.example.org",
+		.result = 0
+	},
+	{ }
+};
+
+int
+err_control(const char *fn)
+{
+	fprintf(stderr, "unexpected call to %s(%s)\n", __func__, fn);
+	exit(1);
+}
+
+int
+err_control2(const char *msg, const char *fn)
+{
+	fprintf(stderr, "unexpected call to %s(%s, %s)\n", __func__, msg, fn);
+	exit(1);
+}
+
+static int
+check_ue(const char *email, const unsigned int dirs, const int result)
+{
+	struct userconf ds;
+	const struct string localpart = {
+		.s = (char *)email,
+		.len = strchr(email, '@') - email
+	};
+	int ret = 0;
+
+	userconf_init(&ds);
+
+	const int r = user_exists(&localpart, strchr(email, '@') + 1, &ds);
+
+	if (r != result) {
+		fprintf(stderr, "email %s: got result %i, expected %i\n", email, r, result);
+		ret++;
+	}
+	if (!!(dirs & 1) != (ds.domaindirfd >= 0)) {
+		fprintf(stderr, "email %s: domain directory %s\n", email,
+				(dirs & 1) ? "not opened" : "opened but not expected");
+		ret++;
+	}
+	if (!!(dirs & 2) != (ds.userdirfd >= 0)) {
+		fprintf(stderr, "email %s: user directory %s\n", email,
+				(dirs & 2) ? "not opened" : "opened but not expected");
+		ret++;
+	}
+
+	userconf_free(&ds);
+
+	return ret;
+}
+
+/**
+ * @brief check that the settings are taken from the map
+ */
+static int
+test_configs(void)
+{
+	struct userconf ds;
+	const string localpart = { .s = (char *)"user", .len = strlen("user") };
+	enum config_domain type;
+	int ret = 0;
+	int fd;
+
+	userconf_init(&ds);
+
+	if (user_exists(&localpart, "example.org", &ds) != 1) {
+		fputs("user@example.org does not exist\n", stderr);
+		userconf_free(&ds);
+		return 1;
+	}
+
+	if (userconf_load_configs(&ds) != 0) {
+		fputs("cannot load the filter settings\n", stderr);
+		userconf_free(&ds);
+		return 1;
+	}
+
+	if ((ds.userconf == NULL) || (ds.userconf[0] == NULL) || (strcmp(ds.userconf[0], "whitelistauth") != 0) ||
+			(ds.userconf[1] == NULL) || (strcmp(ds.userconf[1], "fromdomain=3") != 0) ||
+			(ds.userconf[2] != NULL)) {
+		fputs("the user filterconf was not loaded correctly\n", stderr);
+		ret++;
+	}
+	if (ds.domainconf != NULL) {
+		fputs("a domain filterconf was loaded, but none exists\n", stderr);
+		ret++;
+	}
+
+	if (getsetting(&ds, SETTING_FROMDOMAIN, &type) != 3) {
+		fputs("getsetting(fromdomain) did not return the value from the map\n", stderr);
+		ret++;
+	}
+
+	fd = getfile(&ds, "filterconf", &type, 0);
+	if (fd < 0) {
+		fputs("getfile() did not find the filterconf of the user\n", stderr);
+		ret++;
+	} else {
+		close(fd);
+		if (type != CONFIG_USER) {
+			fprintf(stderr, "getfile() returned type %i instead of %i\n", type, CONFIG_USER);
+			ret++;
+		}
+	}
+
+	/* not in the file lists, so no file system access happens */
+	fd = getfile(&ds, "nomail", &type, 0);
+	if ((fd != -1) || (errno != ENOENT)) {
+		fprintf(stderr, "getfile() for a missing file returned %i/%i\n", fd, errno);
+		if (fd >= 0)
+			close(fd);
+		ret++;
+	}
+
+	userconf_free(&ds);
+
+	return ret;
+}
+
+/**
+ * @brief a replaced map is used for the next lookup
+ * @param vpopbounce contents of control/vpopbounce
+ */
+static int
+test_replaced(const char *vpopbounce)
+{
+	const char tmpname[] = RCPTMAP_FILE ".tmp";
+	struct cdb_make cm;
+	int ret = 0;
+	int fd;
+
+	/* an empty map: no domain is local anymore */
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if ((fd < 0) || (cdb_make_start(&cm, fd) != 0) || (cdb_make_finish(&cm) != 0) ||
+			(rename(tmpname, RCPTMAP_FILE) != 0)) {
+		fprintf(stderr, "cannot replace %s: %i\n", RCPTMAP_FILE, errno);
+		if (fd >= 0)
+			close(fd);
+		unlink(tmpname);
+		return 1;
+	}
+	close(fd);
+
+	ret += check_ue("user@example.org", 0, 5);
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if ((fd < 0) || (rcptmap_make(fd, vpopbounce) != 0) || (rename(tmpname, RCPTMAP_FILE) != 0)) {
+		fprintf(stderr, "cannot regenerate %s: %i\n", RCPTMAP_FILE, errno);
+		if (fd >= 0)
+			close(fd);
+		unlink(tmpname);
+		return ret + 1;
+	}
+	close(fd);
+
+	ret += check_ue("user@example.org", 3, 1);
+
+	return ret;
+}
+
+int
+main(void)
+{
+	int err = 0;
+	char *vpopbounce;
+	int fd;
+
+	if (lloadfilefd(open("control/vpopbounce", O_RDONLY | O_CLOEXEC), &vpopbounce, 0) == (size_t)-1) {
+		fprintf(stderr, "cannot read control/vpopbounce: %i\n", errno);
+		return 1;
+	}
+
+	fd = open(RCPTMAP_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "cannot create %s: %i\n", RCPTMAP_FILE, errno);
+		free(vpopbounce);
+		return 1;
+	}
+	if (rcptmap_make(fd, vpopbounce) != 0) {
+		fprintf(stderr, "cannot write the recipient map: %i\n", errno);
+		close(fd);
+		unlink(RCPTMAP_FILE);
+		return 1;
+	}
+	close(fd);
+
+	if (userbackend_init() != 0) {
+		fprintf(stderr, "error initializing rcptmap backend\n");
+		unlink(RCPTMAP_FILE);
+		free(vpopbounce);
+		return 1;
+	}
+
+	for (unsigned int i = 0; users[i].email != NULL; i++)
+		err += check_ue(users[i].email, users[i].dirs, users[i].result);
+
+	err += test_configs();
+	err += test_replaced(vpopbounce);
+	free(vpopbounce);
+
+	userbackend_free();
+	unlink(RCPTMAP_FILE);
+
+	return err;
+}
@@ -4,9 +4,11 @@
 #include <qsmtpd/vpop.h>
 #include <diropen.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 static int err;	/**< global error counter */
@@ -316,6 +318,99 @@ test_no_vpopbounce(void)
 	return ret;
 }
 
+/**
+ * @brief test that the directory index is not built for the first lookups
+ *
+ * This must run before any other lookup in domaindir.
+ */
+static int
+test_dirindex_lazy(void)
+{
+	const char *newfile = "domaindir/.qmail-newuser";
+	const struct timespec past[2] = { { .tv_sec = 1000000000 }, { .tv_sec = 1000000000 } };
+	int ret = 0;
+	int fd;
+
+	if (utimensat(AT_FDCWD, "domaindir", past, 0) != 0) {
+		fprintf(stderr, "%s: can't set the time of domaindir, error %i\n", __func__, errno);
+		return 1;
+	}
+
+	ret += check_ue("newuser@example.org", 0, 0, -1);
+
+	fd = open(newfile, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "%s: can't create %s, error %i\n", __func__, newfile, errno);
+		return ret + 1;
+	}
+	close(fd);
+
+	/* the directory seems unchanged, so the new file is only found if the
+	 * file system is still asked after a single miss */
+	if (utimensat(AT_FDCWD, "domaindir", past, 0) != 0) {
+		fprintf(stderr, "%s: can't set the time of domaindir, error %i\n", __func__, errno);
+		ret++;
+	} else {
+		ret += check_ue("newuser@example.org", 1, 1, -1);
+	}
+
+	unlink(newfile);
+
+	return ret;
+}
+
+/**
+ * @brief test that the directory index is used and updated
+ *
+ * The other lookups before have produced enough misses to build the index.
+ */
+static int
+test_dirindex(void)
+{
+	const char *newfile = "domaindir/.qmail-newuser";
+	const struct timespec past[2] = { { .tv_sec = 1000000000 }, { .tv_sec = 1000000000 } };
+	int ret = 0;
+	int fd;
+
+	/* an old directory allows to reuse the index */
+	if (utimensat(AT_FDCWD, "domaindir", past, 0) != 0) {
+		fprintf(stderr, "%s: can't set the time of domaindir, error %i\n", __func__, errno);
+		return 1;
+	}
+
+	ret += check_ue("newuser@example.org", 0, 0, -1);
+
+	fd = open(newfile, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "%s: can't create %s, error %i\n", __func__, newfile, errno);
+		return ret + 1;
+	}
+	close(fd);
+
+	/* the new file is not found if the directory seems unchanged, which
+	 * proves that the index was used */
+	if (utimensat(AT_FDCWD, "domaindir", past, 0) != 0) {
+		fprintf(stderr, "%s: can't set the time of domaindir, error %i\n", __func__, errno);
+		ret++;
+	} else {
+		ret += check_ue("newuser@example.org", 0, 0, -1);
+	}
+
+	/* a changed directory is read again */
+	if (utimensat(AT_FDCWD, "domaindir", NULL, 0) != 0) {
+		fprintf(stderr, "%s: can't set the time of domaindir, error %i\n", __func__, errno);
+		ret++;
+	} else {
+		ret += check_ue("newuser@example.org", 1, 1, -1);
+	}
+
+	unlink(newfile);
+
+	ret += check_ue("newuser@example.org", 0, 0, -1);
+
+	return ret;
+}
+
 int
 main(void)
 {
@@ -327,11 +422,14 @@ main(void)
 		return 1;
 	}
 
+	err += test_dirindex_lazy();
+
 	for (unsigned int i = 0; users[i].email != NULL; i++)
 		err += check_ue(users[i].email, users[i].dirs, users[i].result, i);
 
 	err += test_no_cdb();
 	err += test_cdbdir();
+	err += test_dirindex();
 
 	userbackend_free();
 	close(controldir_fd);
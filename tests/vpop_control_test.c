@@ -320,7 +320,7 @@ test_getsetting(void)
 	}
 
 	/* should be the user setting */
-	long r = getsetting(&ds, "helovalid", &t);
+	long r = getsetting(&ds, SETTING_HELOVALID, &t);
 	if ((r != 7) || (t != CONFIG_USER)) {
 		fprintf(stderr, "loading entry from user config returned %li type %i instead of 3/%i\n",
 				r, t, CONFIG_USER);
@@ -356,7 +356,7 @@ test_getsetting(void)
 	}
 
 	/* should be the user setting */
-	r = getsetting(&ds, "helovalid", &t);
+	r = getsetting(&ds, SETTING_HELOVALID, &t);
 	if ((r != 7) || (t != CONFIG_USER)) {
 		fprintf(stderr, "loading entry from user config returned %li type %i instead of 3/%i\n",
 				r, t, CONFIG_USER);
@@ -385,7 +385,7 @@ test_getsetting(void)
 	}
 
 	/* should be the user setting */
-	r = getsetting(&ds, "helovalid", &t);
+	r = getsetting(&ds, SETTING_HELOVALID, &t);
 	if ((r != 3) || (t != CONFIG_DOMAIN)) {
 		fprintf(stderr, "loading entry from user config returned %li type %i instead of 3/%i\n",
 				r, t, CONFIG_USER);
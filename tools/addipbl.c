@@ -1,7 +1,13 @@
 /** \file addipbl.c
  \brief helper program to an an IPv4 or IPv6 host or net address to a IP list for Qsmtp's filters
+
+ The file is always written in the sorted format described in ipbl.h. Files in
+ the old format are converted. Overlapping and adjacent ranges are merged. If no
+ addresses are given the file is only converted and compacted.
  */
 
+#include <ipbl.h>
+
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
@@ -14,8 +20,22 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+/**
+ * @brief one address range in a sorted file
+ */
+struct iprange {
+	unsigned char first[sizeof(struct in6_addr)];	/**< first address of the range */
+	unsigned char last[sizeof(struct in6_addr)];	/**< last address of the range */
+};
+
+static size_t iplen;		/**< length of the addresses in the current file */
+static struct iprange *ranges;
+static size_t rangecount;
+static size_t rangealloc;
+
 static void err_mixed(void) __attribute__ ((noreturn));
 static void err_syntax(const char *arg) __attribute__ ((noreturn));
+static void err_file(const char *fname, const char *msg) __attribute__ ((noreturn));
 
 void
 err_mixed(void)
@@ -33,24 +53,310 @@ err_syntax(const char *arg)
 	exit(EINVAL);
 }
 
+void
+err_file(const char *fname, const char *msg)
+{
+	fputs("error: file '", stderr);
+	fputs(fname, stderr);
+	fputs("' ", stderr);
+	fputs(msg, stderr);
+	fputs("\n", stderr);
+	exit(EINVAL);
+}
+
+/**
+ * @brief add the range covered by a network to the list
+ * @param ip the network address in network byte order
+ * @param mask the length of the netmask
+ */
+static void
+add_net(const unsigned char *ip, unsigned long mask)
+{
+	struct iprange *r;
+	size_t i;
+
+	if (rangecount == rangealloc) {
+		struct iprange *n;
+
+		rangealloc = rangealloc ? 2 * rangealloc : 64;
+		n = realloc(ranges, rangealloc * sizeof(*ranges));
+		if (n == NULL) {
+			fputs("error: out of memory\n", stderr);
+			exit(ENOMEM);
+		}
+		ranges = n;
+	}
+
+	r = ranges + rangecount++;
+	for (i = 0; i < iplen; i++) {
+		unsigned char m;
+
+		if (mask >= 8) {
+			m = 0xff;
+			mask -= 8;
+		} else {
+			m = (unsigned char)(0xff00 >> mask);
+			mask = 0;
+		}
+
+		r->first[i] = ip[i] & m;
+		r->last[i] = ip[i] | (unsigned char)~m;
+	}
+}
+
+static int
+cmp_range(const void *a, const void *b)
+{
+	const struct iprange *ra = a;
+	const struct iprange *rb = b;
+
+	return memcmp(ra->first, rb->first, iplen);
+}
+
+/**
+ * @brief check if a range starts directly after or inside another one
+ * @param prev the range with the lower start address
+ * @param next the range with the higher start address
+ * @return if both ranges can be merged
+ */
+static int
+ranges_touch(const struct iprange *prev, const struct iprange *next)
+{
+	unsigned char after[sizeof(struct in6_addr)];
+	size_t i = iplen;
+
+	memcpy(after, prev->last, iplen);
+	/* calculate the address following the previous range */
+	while (i > 0) {
+		i--;
+		if (++after[i] != 0)
+			break;
+		/* the previous range ends at the highest address */
+		if (i == 0)
+			return 1;
+	}
+
+	return memcmp(next->first, after, iplen) <= 0;
+}
+
+/**
+ * @brief sort the ranges and merge overlapping and adjacent ones
+ */
+static void
+compact_ranges(void)
+{
+	size_t i;
+	size_t out = 0;
+
+	if (rangecount == 0)
+		return;
+
+	qsort(ranges, rangecount, sizeof(*ranges), cmp_range);
+
+	for (i = 1; i < rangecount; i++) {
+		if (ranges_touch(ranges + out, ranges + i)) {
+			if (memcmp(ranges[i].last, ranges[out].last, iplen) > 0)
+				memcpy(ranges[out].last, ranges[i].last, iplen);
+		} else {
+			ranges[++out] = ranges[i];
+		}
+	}
+
+	rangecount = out + 1;
+}
+
+/**
+ * @brief read the existing contents of the file
+ * @param fname name of the file
+ * @param mode address family given on the command line, 0 if unknown
+ * @return the address family of the file (4 or 6), 0 if file is empty or does not exist
+ */
+static int
+read_file(const char *fname, int mode)
+{
+	struct stat st;
+	unsigned char *buf;
+	size_t pos = 0;
+	int fd = open(fname, O_RDONLY | O_CLOEXEC);
+
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return mode;
+		exit(errno);
+	}
+
+	if (fstat(fd, &st) != 0)
+		exit(errno);
+
+	if (st.st_size == 0) {
+		close(fd);
+		return mode;
+	}
+
+	buf = malloc(st.st_size);
+	if (buf == NULL) {
+		fputs("error: out of memory\n", stderr);
+		exit(ENOMEM);
+	}
+
+	while (pos < (size_t)st.st_size) {
+		ssize_t r = read(fd, buf + pos, st.st_size - pos);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			exit(errno);
+		} else if (r == 0) {
+			err_file(fname, "was truncated while reading");
+		}
+		pos += r;
+	}
+	close(fd);
+
+	if ((pos >= IPBL_HEADERLEN) && (memcmp(buf, IPBL_MAGIC, IPBL_MAGICLEN) == 0)) {
+		size_t recordlen;
+
+		if (buf[IPBL_MAGICLEN] != IPBL_VERSION)
+			err_file(fname, "has an unsupported format version");
+
+		switch (buf[IPBL_MAGICLEN + 1]) {
+		case sizeof(struct in_addr):
+			if (mode == 6)
+				err_mixed();
+			mode = 4;
+			break;
+		case sizeof(struct in6_addr):
+			if (mode == 4)
+				err_mixed();
+			mode = 6;
+			break;
+		default:
+			err_file(fname, "has an invalid address length");
+		}
+
+		iplen = buf[IPBL_MAGICLEN + 1];
+		recordlen = 2 * iplen;
+		if ((pos - IPBL_HEADERLEN) % recordlen)
+			err_file(fname, "has an invalid length");
+
+		for (size_t i = IPBL_HEADERLEN; i < pos; i += recordlen) {
+			add_net(buf + i, 8 * iplen);
+			memcpy(ranges[rangecount - 1].last, buf + i + iplen, iplen);
+		}
+	} else {
+		/* old format: address followed by the netmask length */
+		const unsigned int v4ok = ((pos % (sizeof(struct in_addr) + 1)) == 0);
+		const unsigned int v6ok = ((pos % (sizeof(struct in6_addr) + 1)) == 0);
+		size_t recordlen;
+
+		if (mode == 0) {
+			if (v4ok && !v6ok)
+				mode = 4;
+			else if (v6ok && !v4ok)
+				mode = 6;
+			else if (v4ok)
+				err_file(fname, "can not be identified as IPv4 or IPv6 file, give an address to add");
+		}
+		if (((mode == 4) && !v4ok) || ((mode == 6) && !v6ok) || (mode == 0))
+			err_file(fname, "has an invalid length");
+
+		iplen = (mode == 4) ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+		recordlen = iplen + 1;
+
+		for (size_t i = 0; i < pos; i += recordlen) {
+			const unsigned char m = buf[i + iplen];
+
+			if ((m < 8) || (m > 8 * iplen))
+				err_file(fname, "contains an invalid netmask");
+			add_net(buf + i, m);
+		}
+	}
+
+	free(buf);
+
+	return mode;
+}
+
+/**
+ * @brief write the ranges to the file
+ * @param fname name of the file
+ * @return 0 on success, error code otherwise
+ *
+ * The data is written to a temporary file that is then renamed to the final
+ * name, so readers will always see a complete file.
+ */
+static int
+write_file(const char *fname)
+{
+	const size_t fnlen = strlen(fname);
+	char *tmpname = malloc(fnlen + 5);
+	unsigned char header[IPBL_HEADERLEN];
+	int fd;
+
+	if (tmpname == NULL)
+		return ENOMEM;
+
+	memcpy(tmpname, fname, fnlen);
+	memcpy(tmpname + fnlen, ".tmp", 5);
+
+	fd = open(tmpname, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1) {
+		free(tmpname);
+		return errno;
+	}
+
+	memcpy(header, IPBL_MAGIC, IPBL_MAGICLEN);
+	header[IPBL_MAGICLEN] = IPBL_VERSION;
+	header[IPBL_MAGICLEN + 1] = (unsigned char)iplen;
+
+	if (write(fd, header, sizeof(header)) != sizeof(header))
+		goto err;
+
+	for (size_t i = 0; i < rangecount; i++) {
+		if ((write(fd, ranges[i].first, iplen) != (ssize_t)iplen) ||
+				(write(fd, ranges[i].last, iplen) != (ssize_t)iplen))
+			goto err;
+	}
+
+	if ((fsync(fd) != 0) || (close(fd) != 0)) {
+		fd = -1;
+		goto err;
+	}
+
+	if (rename(tmpname, fname) != 0) {
+		fd = -1;
+		goto err;
+	}
+
+	free(tmpname);
+	return 0;
+
+err:
+	{
+		const int e = errno ? errno : EIO;
+
+		if (fd >= 0)
+			close(fd);
+		unlink(tmpname);
+		free(tmpname);
+		return e;
+	}
+}
+
 int
 main(int argc, char *argv[])
 {
-	int fd, j;
-	int mode = 0;	/* IPv4 addresses */
-	int af;
+	int j;
+	int mode = 0;	/* unknown */
 	unsigned long minmask;
 	unsigned long maxmask;
 
 	if (argc == 1) {
 		fputs("Usage: ", stdout);
 		fputs(argv[0], stdout);
-		fputs(" file ip [ip ...]\n", stdout);
+		fputs(" file [ip ...]\n", stdout);
 		return 1;
 	}
-	fd = open(argv[1], O_CREAT | O_APPEND | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-	if (fd == -1)
-		return errno;
 
 	/* Find out if these are IPv6 or IPv4 addresses. */
 	for (j = 2; j < argc; j++) {
@@ -82,19 +388,26 @@ main(int argc, char *argv[])
 		}
 	}
 
+	mode = read_file(argv[1], mode);
+	if (mode == 0)
+		/* no addresses given and nothing in the file */
+		return 0;
+
 	if (mode == 4) {
-		af = AF_INET;
+		iplen = sizeof(struct in_addr);
 		minmask = 8;
 		maxmask = 32;
 	} else {
-		af = AF_INET6;
+		iplen = sizeof(struct in6_addr);
 		minmask = 32;
 		maxmask = 128;
 	}
 
 	for (j = 2; j < argc; j++) {
-		char *s, *t, c;
+		char *s, *t;
 		unsigned long m;
+		struct in6_addr ip;
+		int r;
 
 		s = strchr(argv[j], '/');
 		if (!s) {
@@ -115,19 +428,15 @@ main(int argc, char *argv[])
 				continue;
 			}
 		}
-		if (af == AF_INET) {
-			struct in_addr ip;
-			mode = inet_pton(AF_INET, argv[j], &ip.s_addr);
-			write(fd, &ip.s_addr, sizeof(ip.s_addr));
-		} else {
-			struct in6_addr ip;
-			mode = inet_pton(AF_INET6, argv[j], &ip.s6_addr);
-			write(fd, &ip.s6_addr, sizeof(ip.s6_addr));
-		}
-		assert(mode == 1);
 
-		c = m & 0xff;
-		write(fd, &c, 1);
+		r = inet_pton((mode == 4) ? AF_INET : AF_INET6, argv[j], ip.s6_addr);
+		assert(r == 1);
+		(void) r;
+
+		add_net(ip.s6_addr, m);
 	}
-	return close(fd) ? errno : 0;
+
+	compact_ranges();
+
+	return write_file(argv[1]);
 }
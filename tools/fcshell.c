@@ -3,6 +3,8 @@
  */
 
 #define _POSIX_C_SOURCE 200809L /* for O_CLOEXEC */
+#include <ipbl.h>
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -396,7 +398,26 @@ editread(const int type)
 			return 0;
 		}
 
-		if (st.st_size % (type == 3) ? 5 : 17) {
+		if (st.st_size >= IPBL_HEADERLEN) {
+			char magic[IPBL_MAGICLEN];
+
+			if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic)) {
+				commstat = errno ? errno : EIO;
+				close(fd);
+				err2("error reading from file ", editbuffer.name);
+				return 1;
+			}
+			/* sorted files can only be modified by addipbl, appending
+			 * records here would corrupt them */
+			if (memcmp(magic, IPBL_MAGIC, IPBL_MAGICLEN) == 0) {
+				commstat = EINVAL;
+				close(fd);
+				err2("file is in sorted format, use addipbl to modify it: ", editbuffer.name);
+				return 1;
+			}
+		}
+
+		if (st.st_size % ((type == 3) ? 5 : 17)) {
 			err2("file has wrong length for this type of file: ", editbuffer.name);
 			close(fd);
 			return 1;
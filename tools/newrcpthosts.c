@@ -0,0 +1,86 @@
+/** \file newrcpthosts.c
+ \brief compile control/rcpthosts into an index for faster lookups
+
+ The index is written to rcpthosts.cdb next to the domain list. Qsmtpd uses
+ it instead of searching the list as long as it is newer than the list, so
+ this has to be run again after every change of the list.
+ */
+
+#include <control.h>
+#include <qmaildir.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void __attribute__ ((noreturn))
+err_file(const char *fname, const char *msg)
+{
+	const int e = errno;
+
+	fprintf(stderr, "error: %s %s: %s\n", msg, fname, strerror(e));
+	exit(e ? e : EINVAL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *fname = AUTOQMAIL "/control/rcpthosts";
+	const char *map = "";
+	struct stat st;
+	int fd;
+
+	if (argc > 2) {
+		fputs("usage: newrcpthosts [file]\n", stderr);
+		return EINVAL;
+	} else if (argc == 2) {
+		fname = argv[1];
+	}
+
+	const size_t fnlen = strlen(fname);
+	char idxname[fnlen + sizeof(".cdb")];
+	char tmpname[fnlen + sizeof(".cdb.tmp")];
+
+	memcpy(idxname, fname, fnlen);
+	memcpy(idxname + fnlen, ".cdb", sizeof(".cdb"));
+	memcpy(tmpname, fname, fnlen);
+	memcpy(tmpname + fnlen, ".cdb.tmp", sizeof(".cdb.tmp"));
+
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if ((fd < 0) || (fstat(fd, &st) != 0))
+		err_file(fname, "cannot open");
+
+	if (st.st_size != 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED)
+			err_file(fname, "cannot map");
+	}
+	close(fd);
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		err_file(tmpname, "cannot create");
+
+	if ((makedomainidx(map, st.st_size, fd) != 0) || (fsync(fd) != 0)) {
+		unlink(tmpname);
+		err_file(tmpname, "cannot write");
+	}
+
+	if (close(fd) != 0) {
+		unlink(tmpname);
+		err_file(tmpname, "cannot write");
+	}
+
+	/* readers always see either the old or the new index */
+	if (rename(tmpname, idxname) != 0) {
+		unlink(tmpname);
+		err_file(idxname, "cannot create");
+	}
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+/** \file newrcptmap.c
+ \brief compile the vpopmail tree into the recipient map
+
+ The map is written to users/rcptmap.cdb in the qmail directory. It is only
+ used if Qsmtpd was built with the rcptmap user backend, and it has to be
+ generated again after every change of the domains, users, .qmail files or
+ filter settings.
+ */
+
+#include <control.h>
+#include <qmaildir.h>
+#include <qsmtpd/rcptmap.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void __attribute__ ((noreturn))
+err_file(const char *fname, const char *msg)
+{
+	const int e = errno;
+
+	fprintf(stderr, "error: %s %s: %s\n", msg, fname, strerror(e));
+	exit(e ? e : EINVAL);
+}
+
+int
+main(int argc, char *argv[] __attribute__ ((unused)))
+{
+	const char *tmpname = RCPTMAP_FILE ".tmp";
+	char *vpopbounce;
+	int fd;
+
+	if (argc != 1) {
+		fputs("usage: newrcptmap\n", stderr);
+		return EINVAL;
+	}
+
+	if (chdir(AUTOQMAIL) != 0)
+		err_file(AUTOQMAIL, "cannot change to");
+
+	if (lloadfilefd(open("control/vpopbounce", O_RDONLY | O_CLOEXEC), &vpopbounce, 0) == (size_t)-1)
+		err_file("control/vpopbounce", "cannot read");
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		err_file(tmpname, "cannot create");
+
+	if ((rcptmap_make(fd, vpopbounce) != 0) || (fsync(fd) != 0)) {
+		unlink(tmpname);
+		err_file(tmpname, "cannot write");
+	}
+
+	if (close(fd) != 0) {
+		unlink(tmpname);
+		err_file(tmpname, "cannot write");
+	}
+
+	free(vpopbounce);
+
+	/* running Qsmtpd instances keep the old map */
+	if (rename(tmpname, RCPTMAP_FILE) != 0) {
+		unlink(tmpname);
+		err_file(RCPTMAP_FILE, "cannot create");
+	}
+
+	return 0;
+}
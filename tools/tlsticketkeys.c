@@ -0,0 +1,147 @@
+/** \file tlsticketkeys.c
+ \brief maintain the TLS session ticket keys and statistics of Qsmtpd
+
+ Without arguments a new key is added to the front of control/tlsticketkeys,
+ the oldest one is dropped if the file already contains TLSTICKET_MAXKEYS
+ keys. This should be run regularly, e.g. once a day, so a stolen key can't
+ be used to decrypt old sessions. Clients with a ticket encrypted with one of
+ the old keys can still resume their session and get a new ticket.
+
+ With -z the statistics file is created or reset, with -s the statistics are
+ printed.
+ */
+
+#include <qmaildir.h>
+#include <qsmtpd/tlstickets.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void __attribute__ ((noreturn))
+err_file(const char *fname, const char *msg)
+{
+	const int e = errno;
+
+	fprintf(stderr, "error: %s %s: %s\n", msg, fname, strerror(e));
+	exit(e ? e : EINVAL);
+}
+
+static int
+rotate_keys(void)
+{
+	const char *fname = "control/" TLSTICKET_FILE;
+	const char *tmpname = "control/" TLSTICKET_FILE ".tmp";
+	struct tls_ticket_key keys[TLSTICKET_MAXKEYS];
+	ssize_t oldlen = 0;
+	int fd;
+
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if ((fd < 0) || (read(fd, keys, sizeof(keys[0])) != sizeof(keys[0])))
+		err_file("/dev/urandom", "cannot read");
+	close(fd);
+
+	/* keep the newest of the old keys */
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		oldlen = read(fd, keys + 1, sizeof(keys) - sizeof(keys[0]));
+		close(fd);
+		if ((oldlen < 0) || (oldlen % sizeof(keys[0]) != 0)) {
+			fprintf(stderr, "warning: ignoring invalid %s\n", fname);
+			oldlen = 0;
+		}
+	} else if (errno != ENOENT) {
+		err_file(fname, "cannot read");
+	}
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (fd < 0)
+		err_file(tmpname, "cannot create");
+
+	if ((write(fd, keys, sizeof(keys[0]) + oldlen) != (ssize_t)(sizeof(keys[0]) + oldlen)) ||
+			(fsync(fd) != 0) || (close(fd) != 0)) {
+		unlink(tmpname);
+		err_file(tmpname, "cannot write");
+	}
+
+	if (rename(tmpname, fname) != 0) {
+		unlink(tmpname);
+		err_file(fname, "cannot create");
+	}
+
+	return 0;
+}
+
+static int
+reset_stats(void)
+{
+	const char *tmpname = TLSSTATS_FILE ".tmp";
+	struct tls_stats stats;
+	int fd;
+
+	memset(&stats, 0, sizeof(stats));
+	memcpy(stats.magic, TLSSTATS_MAGIC, sizeof(TLSSTATS_MAGIC));
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+	if (fd < 0)
+		err_file(tmpname, "cannot create");
+
+	if ((write(fd, &stats, sizeof(stats)) != sizeof(stats)) || (close(fd) != 0)) {
+		unlink(tmpname);
+		err_file(tmpname, "cannot write");
+	}
+
+	/* running Qsmtpd instances may still count in the old file */
+	if (rename(tmpname, TLSSTATS_FILE) != 0) {
+		unlink(tmpname);
+		err_file(TLSSTATS_FILE, "cannot create");
+	}
+
+	return 0;
+}
+
+static int
+print_stats(void)
+{
+	struct tls_stats stats;
+	int fd = open(TLSSTATS_FILE, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		err_file(TLSSTATS_FILE, "cannot open");
+
+	if (read(fd, &stats, sizeof(stats)) != sizeof(stats) ||
+			(memcmp(stats.magic, TLSSTATS_MAGIC, sizeof(TLSSTATS_MAGIC)) != 0)) {
+		errno = EINVAL;
+		err_file(TLSSTATS_FILE, "invalid");
+	}
+	close(fd);
+
+	printf("full handshakes: %" PRIu64 "\nresumed handshakes: %" PRIu64 "\n",
+			stats.full, stats.resumed);
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	if ((argc > 2) || ((argc == 2) && (strcmp(argv[1], "-s") != 0) && (strcmp(argv[1], "-z") != 0))) {
+		fputs("usage: tlsticketkeys [-s|-z]\n", stderr);
+		return EINVAL;
+	}
+
+	if (chdir(AUTOQMAIL) != 0)
+		err_file(AUTOQMAIL, "cannot change to");
+
+	if (argc == 1)
+		return rotate_keys();
+	else if (strcmp(argv[1], "-s") == 0)
+		return print_stats();
+	else
+		return reset_stats();
+}